@@ -91,7 +91,7 @@ extern "C" {
  * Return Value:
  * Function returns ERROREE (or -1) if Size is invalid
  */
-extern int ReadEE(int Page, int Offset, int* DataOut, int Size);
+extern int ReadEE(int Page, int Offset, short* DataOut, int Size);
 
 /*
  * EraseEErow prototype:
@@ -115,5 +115,5 @@ extern int EraseEE(int Page, int Offset, int Size);
  * Return Value:
  * Function returns ERROREE (or -1) if Size is invalid
  */
-extern int WriteEE(int* DataIn, int Page, int Offset, int Size);
+extern int WriteEE(short* DataIn, int Page, int Offset, int Size);
 
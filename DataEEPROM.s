@@ -128,10 +128,11 @@ L2:
         bset    NVMCON, #WR 
         nop
         nop
+        pop     SR              ; only the unlock needs intrs off, let the
+                                ; servo isr run while the cell is erased
 L3:     btsc    NVMCON, #WR 
         bra     L3
         clr     w0
-        pop     SR
 L4:     pop     TBLPAG
         pop.d   w4
         return
@@ -172,10 +173,10 @@ L6:     tblwtl  [W0++],[W2++]
         bset    NVMCON, #WR 
         nop
         nop
+        pop     SR              ; intrs back on while the row is written
 L7:     btsc    NVMCON, #WR 
         bra     L7
         clr     w0
-        pop     SR
         pop     TBLPAG
         pop     w4
         return
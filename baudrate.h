@@ -0,0 +1,35 @@
+//---------------------------------------------------------------------
+//	File:		baudrate.h
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: U1BRG math for the 30f uart, baud = FCY / (16 * (U1BRG + 1)).
+//          Usable in #if so a bad rate is caught at build time, and
+//          without <xc.h> so host/baudcalc uses the same macros.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#ifndef BAUDRATE_H
+#define BAUDRATE_H
+
+// nearest U1BRG for a baud rate and the rate it really gives
+#define UART_BRG(fcy, baud)		(((fcy) + 8L * (baud)) / (16L * (baud)) - 1)
+#define UART_BAUD(fcy, brg)		((fcy) / (16L * ((brg) + 1)))
+// error of the real rate in 1/1000
+#define UART_ERR_PM(fcy, baud)	\
+	((UART_BAUD(fcy, UART_BRG(fcy, baud)) - (baud)) * 1000L / (baud))
+
+// both ends together must stay well inside half a bit over 10 bits
+#define UART_ERR_MAX_PM		25		// refuse above 2.5%
+#define UART_ERR_WARN_PM	10		// warn above 1%
+
+#define BAUD_FALLBACK		9600L	// used when autobaud fails
+
+// rates autobaud snaps to
+#define BAUD_RATES	{ 9600L, 19200L, 38400L, 57600L, 115200L, 230400L, 460800L }
+
+#endif
@@ -0,0 +1,188 @@
+//---------------------------------------------------------------------
+//	File:		boot.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Serial bootloader for the servo card, so new firmware can be
+//          loaded over the console port (host/flasher) instead of icsp on
+//          PGC/PGD. The protocol and the install logic are in bootproto.c,
+//          this file has the flash, uart and timer access.
+//
+//          It is its own MPLAB project, linked with a copy of
+//          p30f4012.gld whose program region starts at BOOT_START
+//          (0x7480) and has no interrupt handlers of its own: the vector
+//          tables belong to the application. The application is linked
+//          with its program region ending at APP_END (0x3a00), see
+//          bootproto.h for the whole layout. Program the bootloader once
+//          with icsp, it owns the config words and the reset vector.
+//
+//          After a reset it
+//             - finishes an install a power cut interrupted
+//             - waits BOOT_WAIT_MS for a frame, then runs the application
+//             - stays (until BOOT_IDLE_MS without a byte) when the
+//               application asked for it (U1 command) or there is none
+//          The uart is polled, no interrupts are used.
+//
+//          The 30f4012 has no boot segment protection, the bootloader
+//          rows are protected by bootproto.c and boot_flash_xxx refusing
+//          them.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include <xc.h>
+#include "../dspicservo.h"
+#include "bootproto.h"
+
+// same oscillator as the application, see main.c
+_FOSC( XT_PLL16 );  // 6mhz * PLL16  / 4 = 24mips
+_FWDT(WDT_OFF);                   // wdt off
+_FBORPOR(PBOR_ON & BORV45 & MCLR_DIS & PWRT_64 );
+
+#define BOOT_BAUD		115200L		// same as THE_BAUD_RATE in serial.c
+#define BOOT_WAIT_MS	250			// for the flasher after a plain reset
+#define BOOT_IDLE_MS	10000		// quiet line, go back to the application
+#define BOOT_GAP_MS		50			// drop a frame with a gap this long
+#define TICK_MS			10			// timer 1 period
+
+#if UART_ERR_PM(FCY, BOOT_BAUD) > UART_ERR_MAX_PM || UART_ERR_PM(FCY, BOOT_BAUD) < -UART_ERR_MAX_PM
+#error "BOOT_BAUD can not be made from FCY, see host/baudcalc"
+#endif
+
+// set by the application just before its software reset
+unsigned short boot_request __attribute__((persistent, address(BOOT_MAILBOX)));
+
+/*********************************************************************
+  Function:        void boot_flash_read(unsigned short row, unsigned long *ins)
+
+  Overview:        reads the 32 instructions of a flash row
+********************************************************************/
+void boot_flash_read(unsigned short row, unsigned long *ins)
+{
+	unsigned short a = row * FLASH_ROW_PC;
+	short i;
+
+	TBLPAG = 0;
+	for ( i = 0; i < FLASH_ROW; i++, a += 2 )
+		ins[i] = __builtin_tblrdl(a) | ((unsigned long)(__builtin_tblrdh(a) & 0xff) << 16);
+}
+
+// unlock sequence and wait for the erase or write to finish
+static void flash_go(void)
+{
+	__builtin_write_NVM();
+	while ( NVMCONbits.WR )
+		;
+}
+
+void boot_flash_erase(unsigned short row)
+{
+	if ( row >= BOOT_ROW )
+		return;
+	NVMCON = 0x4041;			// erase one row of program flash
+	NVMADRU = 0;
+	NVMADR = row * FLASH_ROW_PC;
+	flash_go();
+}
+
+void boot_flash_program(unsigned short row, const unsigned long *ins)
+{
+	unsigned short a = row * FLASH_ROW_PC;
+	short i;
+
+	if ( row >= BOOT_ROW )
+		return;
+	NVMCON = 0x4001;			// program one row of program flash
+	TBLPAG = 0;
+	for ( i = 0; i < FLASH_ROW; i++, a += 2 )
+	{
+		__builtin_tblwtl(a, (unsigned short)ins[i]);
+		__builtin_tblwth(a, (unsigned short)(ins[i] >> 16));
+	}
+	flash_go();
+}
+
+void boot_putc(unsigned char ch)
+{
+	BUS_DE = 1;
+	while ( U1STAbits.UTXBF )
+		;
+	U1TXREG = ch;
+}
+
+// put back what we used and jump to the application's own reset code
+static void run(unsigned long entry)
+{
+	while ( !U1STAbits.TRMT )
+		;
+	BUS_DE = 0;
+	U1MODE = 0;
+	U1STA = 0;
+	T1CON = 0;
+	IFS0 = 0;
+	__asm__ volatile ("goto %0" : : "r"((unsigned short)entry));
+}
+
+int main(void)
+{
+	unsigned long entry;
+	unsigned short ticks = 0, gap = 0, limit;
+	short ok;
+
+	ok = RCONbits.SWR && boot_request == BOOT_REQUEST;
+	boot_request = 0;
+	RCONbits.SWR = 0;
+
+	_TRISC13 = 0;				// serial port aux tx data
+	_TRISC14 = 1;				// serial port aux rx data
+	BUS_DE = 0;
+	_TRISB2 = 0;				// rs-485 driver enable
+	U1BRG = UART_BRG(FCY, BOOT_BAUD);
+	U1MODE = 0x8400;			// on, alternate pins, 8n1
+	U1STA = 0x0400;				// tx on
+
+	T1CON = 0x0030;				// Tcy/256, polled
+	PR1 = FCY / 256 / (1000 / TICK_MS) - 1;
+	TMR1 = 0;
+	T1CONbits.TON = 1;
+
+	boot_init();
+	limit = ok ? BOOT_IDLE_MS / TICK_MS : BOOT_WAIT_MS / TICK_MS;
+	ok = boot_startup(&entry);
+	if ( !ok )
+		limit = BOOT_IDLE_MS / TICK_MS;
+
+	while ( 1 )
+	{
+		if ( IFS0bits.T1IF )
+		{
+			IFS0bits.T1IF = 0;
+			ticks++;
+			if ( ++gap == BOOT_GAP_MS / TICK_MS )
+				boot_idle();
+		}
+		if ( U1STAbits.OERR )
+			U1STAbits.OERR = 0;
+		if ( U1STAbits.URXDA )
+		{
+			ticks = gap = 0;
+			limit = BOOT_IDLE_MS / TICK_MS;
+			if ( boot_rx(U1RXREG, &entry) == BOOT_RUN )
+				run(entry);
+		}
+		if ( BUS_DE && U1STAbits.TRMT )
+			BUS_DE = 0;			// reply is out, free the rs-485 line
+		if ( ticks >= limit )
+		{
+			// nobody there, run the application if there is a good one
+			ticks = 0;
+			boot_init();
+			if ( boot_startup(&entry) )
+				run(entry);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,456 @@
+//---------------------------------------------------------------------
+//	File:		bootproto.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Bootloader protocol and install logic, no hardware access so
+//          host/flasher can run it against a simulated flash.
+//
+//          A new image is written row by row to the staging rows, each
+//          row checked by the frame crc and read back after programming.
+//          BC_VERIFY checks the crc of the whole staged image, writes an
+//          install record (BM_STAGED), copies staging to the application
+//          rows and writes a second record (BM_ACTIVE) once the copy
+//          checks out. The old application stays in place until the new
+//          image is verified in staging, so a broken transfer leaves it
+//          running. A power cut during the copy is finished from staging
+//          by boot_startup() on the next reset.
+//
+//          The install records go to two rows in turn with a sequence
+//          number, the newer valid one counts, so a cut while writing a
+//          record leaves the previous one.
+//
+//          Row 0 of the application always gets goto BOOT_START as its
+//          reset vector. The image's own reset goto is kept in the record
+//          and is where the application is entered.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include "bootproto.h"
+
+#define META_MAGIC		0xb0a7
+#define META_WORDS		10
+
+#define GOTO_OP			0x04			// upper byte of the first goto word
+
+#define GET16(p)		((p)[0] | ((unsigned short)(p)[1] << 8))
+
+// install record, kept in the low 16 bits of one instruction per word
+struct META{
+	unsigned short magic;
+	unsigned short seq;			// the higher of the two rows is the current
+	unsigned short state;		// BM_xxx
+	unsigned short rows;		// size of the image
+	unsigned short crc;			// crc of the image as loaded
+	unsigned long rv0, rv1;		// the image's reset goto
+};
+
+static unsigned long row[FLASH_ROW];	// row being written or copied
+static unsigned long cmp[FLASH_ROW];	// read back
+
+// frame being received
+static unsigned char rx_st, rx_cmd, rx_len, rx_n;
+static unsigned char rx_buf[BOOT_MAXDATA + 2];
+
+// image being loaded, 0 rows when no BC_BEGIN yet
+static unsigned short img_rows, img_crc, next_row;
+
+// crc16 with poly 0xa001 as used by modbus, start with 0xffff
+unsigned short boot_crc(unsigned short crc, const unsigned char *p, short len)
+{
+	short i;
+
+	while ( len-- > 0 )
+	{
+		crc ^= *p++;
+		for ( i = 0; i < 8; i++ )
+			crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+	}
+	return crc;
+}
+
+/*********************************************************************
+  Function:        static unsigned short crc_rows(unsigned short first,
+                                 unsigned short rows, const struct META *m)
+
+  Overview:        crc of flash rows, 3 bytes per instruction low byte
+                   first. With a record the first two instructions are
+                   taken from it, for the application rows whose reset
+                   vector was replaced.
+********************************************************************/
+static unsigned short crc_rows(unsigned short first, unsigned short rows,
+							   const struct META *m)
+{
+	unsigned short crc = 0xffff, r;
+	unsigned char b[3];
+	short i;
+
+	for ( r = 0; r < rows; r++ )
+	{
+		boot_flash_read(first + r, row);
+		if ( r == 0 && m )
+		{
+			row[0] = m->rv0;
+			row[1] = m->rv1;
+		}
+		for ( i = 0; i < FLASH_ROW; i++ )
+		{
+			b[0] = (unsigned char)row[i];
+			b[1] = (unsigned char)(row[i] >> 8);
+			b[2] = (unsigned char)(row[i] >> 16);
+			crc = boot_crc(crc, b, 3);
+		}
+	}
+	return crc;
+}
+
+// target of a goto, 0 if it is not one into the application rows
+static unsigned long goto_target(unsigned long w0, unsigned long w1)
+{
+	unsigned long a;
+
+	if ( (w0 >> 16) != GOTO_OP )
+		return 0;
+	a = (w0 & 0xfffe) | ((w1 & 0x7f) << 16);
+	return a < APP_END ? a : 0;
+}
+
+// erase, program and read back one row, the bootloader rows are refused
+static short flash_write(unsigned short r, const unsigned long *ins)
+{
+	short i;
+
+	if ( r >= BOOT_ROW )
+		return BS_RANGE;
+	boot_flash_erase(r);
+	boot_flash_program(r, ins);
+	boot_flash_read(r, cmp);
+	for ( i = 0; i < FLASH_ROW; i++ )
+		if ( cmp[i] != (ins[i] & 0xffffffL) )
+			return BS_FLASH;
+	return BS_OK;
+}
+
+/*
+ * install records
+ */
+static unsigned short meta_check(const unsigned short *w)
+{
+	unsigned char b[2 * (META_WORDS - 1)];
+	short i;
+
+	for ( i = 0; i < META_WORDS - 1; i++ )
+	{
+		b[2 * i] = (unsigned char)w[i];
+		b[2 * i + 1] = (unsigned char)(w[i] >> 8);
+	}
+	return boot_crc(0xffff, b, sizeof(b));
+}
+
+// read the record in one row, 0 if it is not a valid one
+static short meta_read(unsigned short r, struct META *m)
+{
+	unsigned short w[META_WORDS];
+	short i;
+
+	boot_flash_read(r, cmp);
+	for ( i = 0; i < META_WORDS; i++ )
+		w[i] = (unsigned short)cmp[i];
+	if ( w[0] != META_MAGIC || w[9] != meta_check(w) )
+		return 0;
+	m->magic = w[0];
+	m->seq = w[1];
+	m->state = w[2];
+	m->rows = w[3];
+	m->crc = w[4];
+	m->rv0 = w[5] | ((unsigned long)w[6] << 16);
+	m->rv1 = w[7] | ((unsigned long)w[8] << 16);
+	return (m->state == BM_STAGED || m->state == BM_ACTIVE) &&
+		m->rows > 0 && m->rows <= APP_ROWS;
+}
+
+// the current record, 0 if there is none (a new part)
+static short meta_current(struct META *m)
+{
+	struct META b;
+	short ok_a, ok_b;
+
+	ok_a = meta_read(META_ROW, m);
+	ok_b = meta_read(META_ROW + 1, &b);
+	if ( ok_b && (!ok_a || (short)(b.seq - m->seq) > 0) )
+		*m = b;
+	return ok_a || ok_b;
+}
+
+// write the record with the next sequence number to the other row
+static short meta_write(struct META *m, unsigned short state)
+{
+	unsigned short w[META_WORDS];
+	short i;
+
+	m->magic = META_MAGIC;
+	m->seq++;
+	m->state = state;
+	w[0] = m->magic;
+	w[1] = m->seq;
+	w[2] = m->state;
+	w[3] = m->rows;
+	w[4] = m->crc;
+	w[5] = (unsigned short)m->rv0;
+	w[6] = (unsigned short)(m->rv0 >> 16);
+	w[7] = (unsigned short)m->rv1;
+	w[8] = (unsigned short)(m->rv1 >> 16);
+	w[9] = meta_check(w);
+	for ( i = 0; i < FLASH_ROW; i++ )
+		row[i] = i < META_WORDS ? w[i] : 0xffffffL;
+	return flash_write(META_ROW + (m->seq & 1), row);
+}
+
+/*********************************************************************
+  Function:        static short install(struct META *m)
+
+  Overview:        copies the staged image to the application rows,
+                   skipping rows that already hold the same thing, and
+                   marks it active once the copy checks out
+********************************************************************/
+static short install(struct META *m)
+{
+	unsigned short r;
+	short i, res;
+
+	for ( r = 0; r < m->rows; r++ )
+	{
+		boot_flash_read(STAGE_ROW + r, row);
+		if ( r == 0 )
+		{
+			row[0] = ((unsigned long)GOTO_OP << 16) | (BOOT_START & 0xfffe);
+			row[1] = (BOOT_START >> 16) & 0x7f;
+		}
+		boot_flash_read(r, cmp);
+		for ( i = 0; i < FLASH_ROW && cmp[i] == row[i]; i++ )
+			;
+		if ( i < FLASH_ROW && (res = flash_write(r, row)) != BS_OK )
+			return res;
+	}
+	if ( crc_rows(0, m->rows, m) != m->crc )
+		return BS_FLASH;
+	return meta_write(m, BM_ACTIVE);
+}
+
+// application rows hold the active image
+static short app_ok(const struct META *m)
+{
+	return m->state == BM_ACTIVE && crc_rows(0, m->rows, m) == m->crc;
+}
+
+void boot_init(void)
+{
+	rx_st = 0;
+	img_rows = 0;
+	next_row = 0;
+}
+
+/*********************************************************************
+  Function:        short boot_startup(unsigned long *entry)
+
+  Overview:        called after boot_init() on every reset. Finishes an install that was
+                   cut short, or copies the image again from staging if
+                   the application rows do not match it.
+
+  Output:          1 and the entry address if the application can run
+********************************************************************/
+short boot_startup(unsigned long *entry)
+{
+	struct META m;
+
+	if ( !meta_current(&m) )
+		return 0;
+	if ( !app_ok(&m) )
+	{
+		if ( crc_rows(STAGE_ROW, m.rows, 0) != m.crc || install(&m) != BS_OK )
+			return 0;
+	}
+	*entry = goto_target(m.rv0, m.rv1);
+	return *entry != 0;
+}
+
+// drop a partly received frame, called after a gap on the line
+void boot_idle(void)
+{
+	rx_st = 0;
+}
+
+static void reply(unsigned char cmd, const unsigned char *d, short len)
+{
+	unsigned char h[2];
+	unsigned short crc;
+
+	h[0] = cmd | 0x80;
+	h[1] = (unsigned char)len;
+	crc = boot_crc(boot_crc(0xffff, h, 2), d, len);
+	boot_putc(BOOT_SYNC);
+	boot_putc(h[0]);
+	boot_putc(h[1]);
+	while ( len-- > 0 )
+		boot_putc(*d++);
+	boot_putc((unsigned char)crc);
+	boot_putc((unsigned char)(crc >> 8));
+}
+
+static short cmd_write(const unsigned char *d)
+{
+	unsigned short r = GET16(d);
+	short i;
+
+	if ( img_rows == 0 )
+		return BS_ORDER;
+	if ( r >= img_rows )
+		return BS_RANGE;
+	if ( r != next_row && r + 1 != next_row )
+		return BS_ORDER;		// a repeat of the last row is fine, its ack got lost
+	for ( i = 0, d += 2; i < FLASH_ROW; i++, d += 3 )
+		row[i] = d[0] | ((unsigned short)d[1] << 8) | ((unsigned long)d[2] << 16);
+	if ( r == 0 && goto_target(row[0], row[1]) == 0 )
+		return BS_IMAGE;
+	if ( (i = flash_write(STAGE_ROW + r, row)) != BS_OK )
+		return i;
+	next_row = r + 1;
+	return BS_OK;
+}
+
+static short cmd_verify(void)
+{
+	struct META m;
+	short res;
+
+	if ( img_rows == 0 || next_row != img_rows )
+		return BS_ORDER;
+	res = meta_current(&m);
+	// a repeat after the ack got lost
+	if ( res && m.rows == img_rows && m.crc == img_crc && app_ok(&m) )
+		return BS_OK;
+	if ( crc_rows(STAGE_ROW, img_rows, 0) != img_crc )
+		return BS_VERIFY;
+	if ( !res )
+		m.seq = 0xffff;			// first install, seq 0 goes to META_ROW
+	m.rows = img_rows;
+	m.crc = img_crc;
+	boot_flash_read(STAGE_ROW, row);
+	m.rv0 = row[0];
+	m.rv1 = row[1];
+	if ( (res = meta_write(&m, BM_STAGED)) != BS_OK )
+		return res;
+	return install(&m);
+}
+
+/*********************************************************************
+  Function:        short boot_rx(unsigned char ch, unsigned long *entry)
+
+  Overview:        feeds one received byte, answers a complete frame
+
+  Output:          BOOT_RUN with the entry address after BC_GO
+********************************************************************/
+short boot_rx(unsigned char ch, unsigned long *entry)
+{
+	unsigned char r[11];
+	struct META m;
+	unsigned short crc;
+	short run = BOOT_WAIT;
+
+	switch ( rx_st )
+	{
+	case 0:
+		if ( ch == BOOT_SYNC )
+			rx_st = 1;
+		return BOOT_WAIT;
+	case 1:
+		rx_cmd = ch;
+		rx_st = 2;
+		return BOOT_WAIT;
+	case 2:
+		if ( ch > BOOT_MAXDATA )
+		{
+			rx_st = 0;			// not a frame of ours, wait for the next sync
+			return BOOT_WAIT;
+		}
+		rx_len = ch;
+		rx_n = 0;
+		rx_st = 3;
+		return BOOT_WAIT;
+	default:
+		rx_buf[rx_n++] = ch;
+		if ( rx_n < rx_len + 2 )
+			return BOOT_WAIT;
+		break;
+	}
+	rx_st = 0;
+
+	r[0] = rx_cmd;
+	r[1] = rx_len;
+	crc = boot_crc(boot_crc(0xffff, r, 2), rx_buf, rx_len);
+	if ( crc != GET16(&rx_buf[rx_len]) )
+	{
+		r[0] = BS_FRAME;
+		reply(rx_cmd, r, 1);
+		return BOOT_WAIT;
+	}
+
+	switch ( rx_cmd )
+	{
+	case BC_INFO:
+		r[0] = BS_OK;
+		r[1] = BOOT_VERSION;
+		r[2] = FLASH_ROW;
+		r[3] = (unsigned char)APP_ROWS;
+		r[4] = APP_ROWS >> 8;
+		if ( !meta_current(&m) )
+			m.state = m.rows = m.crc = 0;
+		r[5] = (unsigned char)m.state;
+		r[6] = (unsigned char)m.rows;
+		r[7] = m.rows >> 8;
+		r[8] = (unsigned char)m.crc;
+		r[9] = m.crc >> 8;
+		r[10] = m.state && app_ok(&m);
+		reply(rx_cmd, r, 11);
+		return BOOT_WAIT;
+	case BC_BEGIN:
+		if ( rx_len != 4 )
+			r[0] = BS_FRAME;
+		else
+		{
+			img_rows = GET16(rx_buf);
+			img_crc = GET16(&rx_buf[2]);
+			next_row = 0;
+			r[0] = BS_OK;
+			if ( img_rows == 0 || img_rows > APP_ROWS )
+			{
+				img_rows = 0;
+				r[0] = BS_RANGE;
+			}
+		}
+		break;
+	case BC_WRITE:
+		r[0] = rx_len == BOOT_MAXDATA ? cmd_write(rx_buf) : BS_FRAME;
+		break;
+	case BC_VERIFY:
+		r[0] = cmd_verify();
+		break;
+	case BC_GO:
+		r[0] = BS_NOAPP;
+		if ( boot_startup(entry) )
+		{
+			r[0] = BS_OK;
+			run = BOOT_RUN;
+		}
+		break;
+	default:
+		r[0] = BS_CMD;
+		break;
+	}
+	reply(rx_cmd, r, 1);
+	return run;
+}
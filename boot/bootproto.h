@@ -0,0 +1,94 @@
+//---------------------------------------------------------------------
+//	File:		bootproto.h
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Flash layout and serial protocol of the bootloader, shared by
+//          boot.c, the application (entry request) and host/flasher.
+//          No <xc.h> here so the host tools can use it.
+//
+//          Flash of the 30f4012 is 512 rows of 32 instructions:
+//
+//          rows   0-231  application, row 0 holds the reset vector
+//                        (always goto BOOT_START) and the vector tables
+//          rows 232-463  staging copy of a new image
+//          rows 464-465  install records, written alternately
+//          rows 466-511  bootloader, never written by itself
+//
+//          The data eeprom and the config words are never touched.
+//
+//          Frames both ways:
+//             BOOT_SYNC cmd len data[len] crc_lo crc_hi
+//          the crc (modbus polynomial) covers cmd, len and data. A reply
+//          has cmd | 0x80 and a status byte as data[0].
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#ifndef BOOTPROTO_H
+#define BOOTPROTO_H
+
+#define BOOT_VERSION	1
+
+#define FLASH_ROW		32						// instructions per erase/program row
+#define FLASH_ROW_PC	(FLASH_ROW * 2)			// program counter units per row
+#define FLASH_ROWS		512
+#define ROW_BYTES		(FLASH_ROW * 3)			// a row on the wire, 3 bytes/instruction
+
+#define APP_ROWS		232
+#define STAGE_ROW		APP_ROWS				// first row of the staging copy
+#define META_ROW		(2 * APP_ROWS)			// two install record rows
+#define BOOT_ROW		(META_ROW + 2)			// first bootloader row
+#define APP_END			((long)APP_ROWS * FLASH_ROW_PC)		// 0x3a00
+#define BOOT_START		((long)BOOT_ROW * FLASH_ROW_PC)		// 0x7480
+#define FLASH_END		((long)FLASH_ROWS * FLASH_ROW_PC)	// 0x8000
+
+// application -> bootloader request, survives the software reset
+#define BOOT_MAILBOX	0x0ffe					// last word of ram
+#define BOOT_REQUEST	0xb007
+
+#define BOOT_SYNC		0xa5
+#define BOOT_MAXDATA	(2 + ROW_BYTES)
+
+// commands
+#define BC_INFO			'I'		// -> version, row size, app rows, state, rows, crc, app ok
+#define BC_BEGIN		'B'		// rows(2) crc(2): start loading an image of that size
+#define BC_WRITE		'W'		// row(2) 96 bytes: one row, in order (a repeat is ok)
+#define BC_VERIFY		'V'		// check the staged image and install it
+#define BC_GO			'G'		// run the application
+
+// status byte of a reply
+#define BS_OK			0
+#define BS_FRAME		1		// bad crc or length, send it again
+#define BS_CMD			2		// unknown command
+#define BS_RANGE		3		// row or size out of range
+#define BS_ORDER		4		// no image started or rows missing
+#define BS_FLASH		5		// flash did not read back as written
+#define BS_VERIFY		6		// staged image does not match its crc
+#define BS_IMAGE		7		// row 0 does not start with a goto
+#define BS_NOAPP		8		// no valid application to run
+
+// install record states
+#define BM_STAGED		1		// staging verified, copy to the app rows
+#define BM_ACTIVE		2		// app rows hold the image
+
+// boot_rx() results
+#define BOOT_WAIT		0
+#define BOOT_RUN		1
+
+unsigned short boot_crc(unsigned short crc, const unsigned char *p, short len);
+void boot_init(void);
+short boot_startup(unsigned long *entry);
+short boot_rx(unsigned char ch, unsigned long *entry);
+void boot_idle(void);
+
+// supplied by boot.c (or the host simulation)
+void boot_flash_read(unsigned short row, unsigned long *ins);
+void boot_flash_erase(unsigned short row);
+void boot_flash_program(unsigned short row, const unsigned long *ins);
+void boot_putc(unsigned char ch);
+
+#endif
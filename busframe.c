@@ -0,0 +1,67 @@
+//---------------------------------------------------------------------
+//	File:		busframe.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Address filter for the multi-drop serial bus, see busframe.h.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include "busframe.h"
+
+/*********************************************************************
+  Function:        char *bus_parse(char *line, short node, short *kind)
+
+  Input:           line - received line without the CR
+                   node - our node id, 0 if we are not on a bus
+
+  Output:          the command part of the line and *kind = BUS_REPLY or
+                   BUS_SILENT if we should act on it, 0 and BUS_IGNORE if
+                   not. Lines without an address are only taken when
+                   node is 0, a bus card never answers them.
+********************************************************************/
+char *bus_parse(char *line, short node, short *kind)
+{
+	short addr = 0, digits = 0;
+
+	*kind = BUS_IGNORE;
+	if ( *line != '@' )
+	{
+		if ( node )
+			return 0;
+		*kind = BUS_REPLY;
+		return line;
+	}
+
+	line++;
+	if ( *line == BUS_BROADCAST )
+		line++;
+	else
+	{
+		for ( ; *line >= '0' && *line <= '9'; line++, digits++ )
+			if ( addr <= BUS_NODE_MAX )
+				addr = addr * 10 + (*line - '0');
+		if ( digits == 0 || addr > BUS_NODE_MAX )
+			return 0;			// not a valid address, nobody takes it
+	}
+	while ( *line == ' ' )
+		line++;
+
+	if ( addr == 0 )
+		*kind = node ? BUS_SILENT : BUS_REPLY;
+	else if ( addr == node || node == 0 )
+		*kind = BUS_REPLY;		// a lone card answers to any address
+	else
+		return 0;
+	return line;
+}
+
+// start of a node's telemetry slot after a synchronising broadcast
+long bus_slot_us(short node)
+{
+	return node * BUS_SLOT_US;
+}
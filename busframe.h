@@ -0,0 +1,38 @@
+//---------------------------------------------------------------------
+//	File:		busframe.h
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Addressing for several cards on one rs-485 line. Like
+//          pwmtiming.h this does not include <xc.h> so host/bussim runs
+//          the same code.
+//
+//          A frame is a console line with an address in front:
+//              @3 p0.01     card 3 sets its p gain and answers
+//              @* c1        every card, nobody answers
+//          A card with node id 0 is on its own port and takes every line.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#ifndef BUSFRAME_H
+#define BUSFRAME_H
+
+#define BUS_NODE_MAX	31		// node ids 1..31, 0 = not on a bus
+#define BUS_BROADCAST	'*'		// "@*" or "@0" address every card
+
+#define BUS_TURN_US		500		// host must have released the line by then
+#define BUS_SLOT_US		10000L	// telemetry slot per node id
+
+// what bus_parse() decided about a line
+#define BUS_IGNORE		0		// for another card
+#define BUS_REPLY		1		// for us, answer after BUS_TURN_US
+#define BUS_SILENT		2		// broadcast, act on it without answering
+
+char *bus_parse(char *line, short node, short *kind);
+long bus_slot_us(short node);
+
+#endif
@@ -21,6 +21,7 @@
 //
 // Aug 7 2006 --    first version Lawrence Glaister
 // Aug 15 2006		added pc command pulse multiplier option
+// Oct 19 2026		IPL_EDGE above the servo isr, shadow registers, no psv
 //---------------------------------------------------------------------- 
 #include <xc.h>
 #include "dspicservo.h"
@@ -91,22 +92,28 @@ void (*funcArr[16])(void)={change_NO,change_UP,change_DN,change_ER,
 
   Overview:        handles changes on IC1 pin 
 
-  Note:            None.
+  Note:            no_auto_psv: funcArr[] and what it calls are all in
+                   ram. shadow: only the IPL_EDGE isr's use the shadow
+                   registers and they do not nest.
 ********************************************************************/
-void __attribute__((__interrupt__,auto_psv)) _IC1Interrupt(void)
+void __attribute__((__interrupt__,no_auto_psv,shadow)) _IC1Interrupt(void)
 {
+    PROF_ENTER(PROF_IC1);
     IFS0bits.IC1IF = 0;                    	// Clear IF bit
        cmd_bits = ((cmd_bits << 2) & 0x000c) + 	// old bits move left
        (PORTD & 0x03);				// bits 0 and 1 are valid new bits
        (*funcArr[cmd_bits])();			// process cmd from pc
+    PROF_EXIT(PROF_IC1);
 }
 /////////////////////////////////////////////////////////////////////////////////////////
-void __attribute__((__interrupt__,auto_psv)) _IC2Interrupt(void)
+void __attribute__((__interrupt__,no_auto_psv,shadow)) _IC2Interrupt(void)
 {
+    PROF_ENTER(PROF_IC2);
     IFS0bits.IC2IF = 0;                                 // Clear IF bit
         cmd_bits = ((cmd_bits << 2) & 0x000c) + 	// old bits move left
         (PORTD & 0x03);                         	// bits 0 and 1 are valid new bits
         (*funcArr[cmd_bits])();				// process cmd from pc
+    PROF_EXIT(PROF_IC2);
 }
 
 
@@ -140,9 +147,9 @@ void setup_capture(void)
     IFS0bits.IC1IF = 0;             
 	IFS0bits.IC2IF = 0;
 
-	/* assign Interrupt Priority to IPC Register  (4 is default)*/
-    IPC0bits.IC1IP = 0x0004;     
-    IPC1bits.IC2IP = 0x0004;
+	/* above the servo isr, see IPL_EDGE in dspicservo.h */
+    IPC0bits.IC1IP = IPL_EDGE;
+    IPC1bits.IC2IP = IPL_EDGE;
 
     /* Config contains Clock source (0=timer 3, we dont care), 
        number of Captures per interuppt (0 = every event (not used))
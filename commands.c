@@ -13,15 +13,25 @@
 // Aug 11 2006 --    first version Lawrence Glaister
 // Sept 22 2006      added deadband programming
 // Sept 25 2006      added programmable servo loop interval
+// Oct 19 2026       added pwm frequency and pwm intr postscale settings
+// Oct 19 2026       parameters set and printed from the table in params.c
+// Oct 19 2026       numbers parsed and printed by fixnum.c instead of atof/%f
+// Oct 19 2026       the line to process is passed in from the serial line queue
+// Oct 19 2026       U1 restarts into the serial bootloader
+// Oct 19 2026       I starts the prbs excitation for plant identification
+// Oct 19 2026       B runs the frequency response analyzer
+// Oct 19 2026       R records the servo inputs for a replay
+// Oct 19 2026       numbers that end up as integers are limited first
+// Oct 19 2026       servo data masked at IPL_SERVO, edges still come in
+// Oct 19 2026       c1 starts telemetry on a card of its own too
+// Oct 19 2026       flash past APP_END reserved so an oversize link fails
 // 
 //---------------------------------------------------------------------- 
 #include <xc.h>
 #include "dspicservo.h"
 #include <stdio.h>
-#include <stdlib.h>
 #include <math.h>
-
-extern volatile unsigned short int timer_test;
+#include "boot/bootproto.h"
 
 extern unsigned short int cmd_posn;			// current posn cmd from PC
 extern unsigned short int cmd_err;			// number of bogus encoder positions detected
@@ -29,42 +39,88 @@ extern unsigned short int cmd_bits;			// a 4 bit number with old and new port va
 
 extern struct PID pid;
 //extern struct COF cof;
-extern char rxbuff[];		// global rx buffer for serial data
-extern char *rxbuffptr;		// local input ptr for storing data
-extern short int rxrdy;		// flag to indicate a line of data is available in buffer
 
-extern int save_setup( void );
+extern void print_profile(short clear);
+extern void print_load(void);
+extern void print_tasks(void);
+extern void print_serial(void);
+extern void print_faults(void);
+extern void print_flight(short freeze);
+extern void fault_clear(void);
+extern short load_telemetry;
+extern void load_sync(unsigned long delay);
+extern void fault_outputs_off(void);
 
 float jerk;					// global used for loop tuning
 
+// read by the bootloader after the software reset, see boot/boot.c
+unsigned short boot_request __attribute__((persistent, address(BOOT_MAILBOX)));
+
+#ifndef SIM_FIRMWARE
+// the staging copy, install records and bootloader, see boot/bootproto.h.
+// Nothing is loaded, it only takes the addresses so the link fails when
+// the application grows past APP_END instead of the flasher refusing it
+const unsigned char __attribute__((space(prog), address(APP_END), noload))
+	app_end_guard[FLASH_END - APP_END];
+#endif
+
+#ifndef SOFT_RESET
+#define SOFT_RESET()	__asm__ volatile ("reset")	// the host simulation has its own
+#endif
+
+// reset the loop so the current posn is the target and release a
+// latched fault (it trips again if the cause is still there)
+void servo_reset(void)
+{
+	int ipl;
+
+	SET_AND_SAVE_CPU_IPL(ipl, IPL_SERVO);
+	pid.command = 0.0;
+	pid.feedback = 0.0;
+	pid.error = 0.0;
+	fault_clear();
+	RESTORE_CPU_IPL(ipl);
+}
+
+// U1: drive off and restart into the bootloader, which then waits for
+// host/flasher instead of running the application again
+static void enter_bootloader(void)
+{
+	printf("\rrestarting into the bootloader\r\n");
+	while ( !U1STAbits.TRMT )
+		;
+	SET_CPU_IPL(7);
+	fault_outputs_off();
+	boot_request = BOOT_REQUEST;
+	SOFT_RESET();
+}
+
 void print_tuning(void)
 {
+	const struct PARAM *p;
 
-        
     printf("\rCurrent Settings(cksum=0x%04X):\r\n",pid.cksum);
 	printf("servo enabled = %d\r\n",	pid.enable);
-	printf("(p) = %f\r\n",		(double)pid.pgain);
-	printf("(i) = %f\r\n",		(double)pid.igain);
-	printf("(d) = %f\r\n",		(double)pid.dgain);
-	printf("FF(0) = %f\r\n",	(double)pid.ff0gain);
-	printf("FF(1) = %f\r\n",	(double)pid.ff1gain);
-    printf("dead(b)and = %f\r\n",(double)pid.deadband);
-	printf("(m)ax Output = %famps\r\n",(double)pid.maxoutput);
-	printf("(f)ault error = %f\r\n", (double)pid.maxerror);
-	printf("(x)pc cmd multiplier = %hu\r\n", pid.multiplier);
-    printf("(t)icks per servo cycle= %hu => %fms\r\n",
-    pid.ticksperservo, pid.ticksperservo * 0.250);
+	for ( p = params; p < &params[param_count]; p++ )
+		param_print(p);
+    printf("=> ");
+	fx_print(pid.pwmpost * 1000000.0 / pid.fpwm, FX_DIGITS);
+	printf("us/pwm intr, ");
+	fx_print(pid.ticksperservo * pid.pwmpost * 1000.0 / pid.fpwm, FX_DIGITS);
+	printf("ms/servo cycle\r\n");
 }
 
-void process_serial_buffer()
+void process_serial_buffer(char *line)
 {
-	int i;
+	const struct PARAM *p;
+	long cmd;
+	int i, ipl;
 
 	printf("processing serial buffer\r\n");
 	for ( i=0; i < 15; i++ )
 	{
-		if ( rxbuff[i] )
-			printf("%02X ",rxbuff[i] & 0xff);
+		if ( line[i] )
+			printf("%02X ",line[i] & 0xff);
 		else
 		{
 			printf("\r\n");
@@ -72,107 +128,31 @@ void process_serial_buffer()
 		}
 	}
 
-	switch( rxbuff[0] )
+	// parameters come from the table in params.c
+	if ( (p = param_find(line[0])) != 0 )
 	{
-	case 'k':
-		 pid.command = atof(&rxbuff[1]);
-		 printf("\rencoder = 0x%04X = %d\r\n",POSCNT, POSCNT & 0xffff);
-		break;
-
-	case 'b':
-		if (rxbuff[1])
-		{
-			pid.deadband = atof(&rxbuff[1]);
-			save_setup();
-		}
-		print_tuning();
-		break;		
-
-	case 'p':
-		if (rxbuff[1])
-		{
-			pid.pgain = atof(&rxbuff[1]);
-			save_setup();
-		}
-		print_tuning();
-		break;		
-	case 'i':
-		if (rxbuff[1])
-		{
-			pid.igain = atof(&rxbuff[1]);
-			pid.error_i = 0.0;	//reset integrator
-			save_setup();
-		}
-		print_tuning();
-		break;		
-	case 'd':
-		if (rxbuff[1])
-		{
-			pid.dgain = atof(&rxbuff[1]);
-			save_setup();
-		}
-		print_tuning();
-		break;		
-	case '0':
-		if (rxbuff[1])
-		{
-			pid.ff0gain = atof(&rxbuff[1]);
-			save_setup();
-		}
-		print_tuning();
-		break;		
-	case '1':
-		if (rxbuff[1])
-		{
-			pid.ff1gain = atof(&rxbuff[1]);
-			save_setup();
-		}
-		print_tuning();
-		break;		
-	case 'm':
-		if (rxbuff[1])
-		{
-			pid.maxoutput = atof(&rxbuff[1]);
-		   save_setup();
-		}
-		print_tuning();
-		break;		
-
-	case 'f':
-		if (rxbuff[1])
-		{
-			pid.maxerror = atof(&rxbuff[1]);
-			save_setup();
-		}
-		print_tuning();
-		break;		
-
-	case 'x':
-		if (rxbuff[1])
-		{
-			pid.multiplier = (short)atof(&rxbuff[1]);
-			if ( pid.multiplier < 1 ) pid.multiplier = 1;
-			if ( pid.multiplier > 22 ) pid.multiplier = 22;
-			save_setup();
-		}
-		print_tuning();
-		break;		
-
-    case 't':
-		if (rxbuff[1])
+		if (line[1])
 		{
-			pid.ticksperservo = (short)atof(&rxbuff[1]);
-			if ( pid.ticksperservo < 1 ) pid.ticksperservo = 1;		// 250us/servo calc =>4000hz
-			if ( pid.ticksperservo > 100 ) pid.ticksperservo = 100; // .025sec =>40hz rate
-			save_setup();
+			i = param_set(p, fx_atof(&line[1]));
+			if ( i != PARAM_OK )
+				param_error(p, i);
 		}
 		print_tuning();
-		break;		
+	}
+	else switch( line[0] )
+	{
+	case 'k':
+		 cmd = fx_ftol(fx_atof(&line[1]), -0x7fffffffL, 0x7fffffffL);
+		 SET_AND_SAVE_CPU_IPL(ipl, IPL_SERVO);	// the pwm isr also updates it
+		 pid.command = cmd;
+		 RESTORE_CPU_IPL(ipl);
+		 printf("\rencoder = 0x%04X = %d\r\n",POSCNT, POSCNT & 0xffff);
+		break;
 
 	case 'j':
-		if (rxbuff[1])
+		if (line[1])
 		{
-			jerk = atof(&rxbuff[1]);	
+			jerk = fx_ftol(fx_atof(&line[1]), 0, 32767);
 		}
 		break;
 
@@ -184,49 +164,112 @@ void process_serial_buffer()
 		print_tuning();
 		break;
 
+	case 'z':
+		print_profile(line[1] == '0');
+		break;
+
+	case 'c':
+		if (line[1])
+		{
+			load_telemetry = (short)fx_ftol(fx_atof(&line[1]), -32768, 32767);
+			load_sync(TB_US(bus_slot_us(pid.nodeid)));
+		}
+		print_load();
+		print_tasks();
+		print_serial();
+		break;
+
 	case 's':
 		printf("\rServo Loop Internal Calcs:\r\n");
 		printf("command: %ld\r\n",pid.command);
 		printf("feedback: %ld\r\n",pid.feedback);
-		printf("error: %f\r\n",(double)pid.error);
-		printf("max error: %f\r\n",(double)pid.maxposerror);
+		printf("error: ");		fx_print(pid.error, FX_DIGITS);
+		printf("\r\nmax error: ");	fx_print(pid.maxposerror, FX_DIGITS);
 		pid.maxposerror = 0.0;
-		printf("error_i: %famps\r\n",(double)(pid.error_i * pid.igain));
-		printf("error_d: %famps\r\n",(double)(pid.error_d * pid.dgain));
-		printf("output: %famps\r\n",(double)pid.output);
+		printf("\r\nerror_i: ");	fx_print(pid.error_i * pid.igain, FX_DIGITS);
+		printf("amps\r\nerror_d: ");	fx_print(pid.error_d * pid.dgain, FX_DIGITS);
+		printf("amps\r\noutput: ");	fx_print(pid.output, FX_DIGITS);
+		printf("amps\r\n");
 		printf("limit_state: %d\r\n",(int)pid.limit_state);
 		break;
  
  case 'r':
-          pid.command = 0.0;
-    		pid.feedback = 0.0;
-    		pid.error = 0.0;
-//			cof.emergncy=0; // 'e' also can reset emergency
+		servo_reset();
  break;
-	
+
+	case 'F':
+		print_faults();
+		break;
+
+	case 'h':
+		print_flight(line[1] == '1');
+		break;
+
+	case 'I':
+		{
+			// I amp [n]: prbs of amp % duty, a sample every n servo cycles
+			float amp, every;
+			const char *s = fx_strtof(&line[1], &amp);
+
+			if ( s == 0 || fx_strtof(s, &every) == 0 )
+				every = ID_EVERY;
+			ident_start(amp, (short)fx_ftol(every, 1, 32767));
+		}
+		break;
+
+	case 'B':
+		{
+			// B amp f1 f2 [n [c]]: n points f1..f2Hz, c 1 = into the command
+			float v[5] = { 0.0, 0.0, 0.0, FRA_POINTS, FRA_OUTPUT }, x;
+			const char *s = &line[1];
+
+			for ( i = 0; i < 5 && (s = fx_strtof(s, &x)) != 0; i++ )
+				v[i] = x;
+			if ( v[0] != 0.0 && i < 3 )
+				printf("\r\nB needs amp, f1 and f2\r\n");
+			else
+				fra_begin(v[4] != 0.0 ? FRA_COMMAND : FRA_OUTPUT, v[0], v[1], v[2],
+						  (short)fx_ftol(v[3], 0, FRA_POINTS_MAX));
+		}
+		break;
+
+	case 'R':
+		if ( line[1] >= '0' && line[1] <= '2' )
+			rec_command(line[1] - '0');
+		else
+			rec_command(-1);
+		break;
+
+	case 'U':
+		if ( line[1] == '1' )
+			enter_bootloader();
+		printf("\rU1 restarts into the bootloader for a firmware update\r\n");
+		break;
+
 default:
 		printf("\r\nUSAGE:\r\n");
-		printf("p x.x set proportional gain\r\n");
-        printf("i x.x set integral gain\r\n"); 
-		printf("d x.x set differential gain\r\n"); 
-        printf("0 x.x set FF0 gain\r\n"); 
-		printf("1 x.x set FF1 gain\r\n"); 
-		printf("b x.x set deadband\r\n");
-		printf("m x.x set max output current(amps)\r\n"); 
-		printf("f x.x set max error before drive faults(counts)\r\n");
-		printf("x n   set pc command multiplier (1-16)\r\n");
-        printf("t n   set # of 250us ticks/per servo calc(1-100)\r\n");
+		param_help();
+		printf("F     print fault status\r\n");
+		printf("@n cmd  send cmd to node n only, @* cmd to every node without answers\r\n");
+		printf("h     print the flight record saved at the last fault (h1 saves one now)\r\n");
+		printf("I a [n] plant identification: prbs of a%% duty, sample every n servo cycles, I0 stops\r\n");
+		printf("B a f1 f2 [n [c]]  frequency response, n points f1 to f2Hz of a%% duty at the\r\n"
+			   "                   pid output, or a counts into the command if c is 1, B0 stops\r\n");
+#ifdef INPUT_RECORDER
+		printf("R1/R2 record the servo inputs from now/the first pc command edge for host/replay,\r\n"
+			   "      R0 stops, R prints the record\r\n");
+#endif
+		printf("r     reset servo posn and clear a latched fault\r\n");
+		printf("U1    restart into the bootloader (host/flasher)\r\n");
 		printf("e print current encoder count\r\n"); 
 		printf("l print current loop tuning values\r\n"); 
         printf("s print internal loop components\r\n");
         printf("j x.x alternately posn for loop tuning\r\n");
+        printf("z     print isr timing profile (z0 also clears it)\r\n");
+        printf("c [n] print cpu load and tasks, c1/c0 turns 1 sec load telemetry on/off\r\n");
 		printf("? print this help\r\n");
 	
 	}
 
-	// reset input buffer state
-	rxrdy = 0;
-	rxbuff[0] = 0;
-	rxbuffptr = &rxbuff[0];
 	putchar('>');
 }
\ No newline at end of file
@@ -89,6 +89,14 @@ extern "C" {
 // Revision History
 // March 11 2006 --   formatted into multi file project
 // Sept 25 2006 -  6x pwm rate
+// Oct 19 2026 -   pwm rate, intr postscale and servo decimation are runtime params
+// Oct 19 2026 -   interrupt priorities in one place
+// Oct 19 2026 -   sample lead param, the adc isr runs the servo when it is set
+// Oct 19 2026 -   ram cut to fit the 30f4012: FR_DEPTH 32, task table in flash,
+//                  the input recorder is a build option
+// Oct 19 2026 -   flight record 160 cycles of 3 byte entries, the isr profiler
+//                  is a build option
+// Oct 19 2026 -   the build options the card leaves out listed in one place
 //---------------------------------------------------------------------- 
 // define which chip we are using (peripherals change)
 #include <xc.h>
@@ -96,12 +104,29 @@ extern "C" {
 #define CPWRT  "\rAlkhaldi Automation\r\n"
 #define VERSION "1.0"
 
-// this number was tweaked by hand until serial port baud was correct
+// build options. The 30f4012 has 2k of ram and the card build leaves out
+// the bench tools that do not fit next to the servo and its stack:
+//   INPUT_RECORDER  input recorder for host/replay (rec.c), 256 bytes
+//   ISR_PROFILE     isr execution time profiler (profile.c), 280 bytes
+// host/Makefile defines both for the simulation, which also defines
+// SIM_FIRMWARE and so drops the APP_END guard in commands.c. The card's
+// memory is only checked by make fit in host/ with XC16 (host/fitcheck).
+
+// must match _FOSC() in main.c, serial.c checks the baud rate error for it
+// at build time (host/baudcalc prints the table for every setting)
 #define FCY  (6000000 * 16 / 4)       // 24 MIPS ==> 6mhz osc * 16pll  / 4
 //#define FCY  (14318000 * 8 / 4)       // 28.636 MIPS ==> 14.318mhz osc * 8pll  / 4
+//#define FCY  (7372800 * 16 / 4)       // 29.49 MIPS ==> 7.3728mhz xtal * 16pll / 4, exact up to 460800 baud
 
-/* define required pwm rate... dont make it too high as we loose resolution */
+/* default pwm rate... dont make it too high as we loose resolution */
+/* the rate actually used is pid.fpwm, see pwmtiming.h for the limits */
 #define FPWM 16000		// 48000 gives approx +- 10 bit current control
+#define PWM_POST 4		// default pwm periods per pwm intr (16khz/4 => 250us)
+
+#include "pwmtiming.h"
+#include "fixnum.h"
+#include "baudrate.h"
+#include "busframe.h"
 
 // define some i/o bits for the various modules
 //#define STATUS_LED 	_LATE1		
@@ -109,7 +134,56 @@ extern "C" {
 //#define SVO_NDIR    _LATE3	//inverted 
 
 #define SVO_ENABLE   1
-//#define PWM_INTR    _LATB1
+#define PWM_INTR    _LATB1		// high while the pwm isr runs (scope trigger)
+#define BUS_DE      _LATB2		// rs-485 driver enable, high while we transmit
+
+// interrupt priorities. Nesting is on (INTCON1 NSTDIS = 0, the reset
+// value): an isr is only held up by one above it, by one of its own level
+// that is already running and by a background section at a higher IPL.
+//  - the pc command edges come first, a late one is a lost count. Their
+//    isr's are short and the only ones at their level, so they save W0-W3
+//    in the shadow registers (one set, nothing below may use them). The
+//    qei wrap check is short too and wants POSCNT near the wrap.
+//  - the servo loop next, its entry jitter is the edges only
+//  - the uart rx isr can wait one servo isr, the 4 byte fifo lasts 3
+//    characters (260us at 115200)
+//  - the timebase wrap can wait 175ms, the modbus frame end 3.5 chars
+// Background code that shares data with the servo isr only masks up to
+// IPL_SERVO so edges still get through, 7 is for what the edge isr's write.
+// host/isrlat models the latencies this gives.
+#define IPL_EDGE	6			// IC1, IC2, QEI
+#define IPL_SERVO	5			// PWM
+#define IPL_U1RX	3
+#define IPL_TICK	2			// T1, T3
+
+// isr execution time profiler (profile.c), a bench tool: define ISR_PROFILE
+// to build it in. Its 280 bytes of stats went to the flight recorder in
+// the 2k of the 30f4012, host/Makefile builds the simulation with it.
+// The sample to output delay and the servo overruns are kept either way.
+// timer 2 free runs at Tcy and is read on entry and exit of each isr.
+// note: a nested higher priority isr is counted in the time of the one
+// it interrupted.
+//#define ISR_PROFILE
+
+#define PROF_PWM	0
+#define PROF_IC1	1
+#define PROF_IC2	2
+#define PROF_QEI	3
+#define PROF_U1RX	4
+#define PROF_T1		5
+#define PROF_T3		6
+#define PROF_NUM	7
+#define PROF_BINS	8			// histogram bins, 128 Tcy doubling per bin
+
+#ifdef ISR_PROFILE
+#define PROF_ENTER(id)	unsigned short prof_t0 = TMR2; prof_nest++
+#define PROF_EXIT(id)	prof_record((id), prof_t0)
+void prof_record(short id, unsigned short t0);
+extern volatile short prof_nest;
+#else
+#define PROF_ENTER(id)
+#define PROF_EXIT(id)
+#endif
 
 // for some reason PI may not be defined in math.h on some systems
 #ifndef M_PI
@@ -119,6 +193,49 @@ extern "C" {
 #define	TRUE	(1)
 #define	FALSE	(0)	
 
+// free running 32 bit timebase (timer1.c), Tcy/64 => 2.67us at 24 MIPS
+// wraps every 3.2 hours so deadlines must be within half of that
+#define TB_HZ			(FCY / 64)
+#define TB_MS(ms)		((unsigned long)(ms) * (TB_HZ / 1000))
+#define TB_US(us)		((unsigned long)(us) * (TB_HZ / 1000) / 1000)
+// true once 'now' has reached 'deadline', correct across the 32 bit wrap.
+// Looks at bit 31 of the difference rather than its sign so it is also
+// right where long is wider than 32 bits (the host simulation)
+#define TB_REACHED(now, deadline)	((((now) - (deadline)) & 0x80000000UL) == 0)
+// counts from 'then' to 'now', across the wrap
+#define TB_ELAPSED(now, then)		(((now) - (then)) & 0xffffffffUL)
+
+unsigned long tb_now(void);
+void tb_delay(unsigned long ticks);
+
+struct SWTIMER{
+	unsigned long deadline;		// tb_now() value of the next call
+	unsigned long period;		// TB_HZ counts between calls, 0 = one shot
+	void (*func)(void);			// called from swt_poll()
+	short active;
+};
+
+void swt_start(struct SWTIMER *t, unsigned long delay, unsigned long period,
+			   void (*func)(void));
+void swt_stop(struct SWTIMER *t);
+short swt_poll(void);
+
+// background task table entry for the cooperative scheduler (sched.c),
+// const so the table stays in flash; what changes is in a TASKSTAT
+struct TASK{
+	const char *name;
+	short (*func)(void);		// returns non zero if it did any work
+	unsigned long period;		// TB_HZ counts between calls, 0 = every pass
+	unsigned long budget;		// expected worst run time, TB_HZ counts
+};
+
+struct TASKSTAT{
+	unsigned long deadline;		// tb_now() value of the next call
+	unsigned long worst;		// longest run time seen, TB_HZ counts
+	unsigned long runs;			// calls that did some work
+	unsigned short overruns;	// calls that took longer than budget
+};
+
 struct PID{
 	// the first block of params must survive powerfails and cksums
     // keep params together followed by cksum so that calc_cksum() works
@@ -134,7 +251,14 @@ struct PID{
     float maxerror_d;	 /* param: limit for differentiated error    */
     float maxcmd_d;		 /* param: limit for differentiated cmd      */
 	short multiplier;	 /* param: pc command multiplier             */
-	short ticksperservo; /* param: number of 100us ticks/servo cycle */
+	short ticksperservo; /* param: number of pwm intrs/servo cycle   */
+	unsigned short fpwm; /* param: pwm frequency in Hz               */
+	short pwmpost;		 /* param: pwm periods per pwm intr          */
+	short maxcmderr;	 /* param: bogus pc cmd edges/window, 0=off  */
+	unsigned short faultmask; /* param: FLT_xxx checks enabled       */
+	short nodeid;		 /* param: rs-485 node id, 0 = own port      */
+	short protocol;		 /* param: serial port 0=console 1=modbus    */
+	unsigned short samplelead; /* param: us feedback is sampled before a pwm edge, 0=at the pwm intr */
     short cksum;		 /* data block cksum used to verify eeprom   */
 	// the following block of temp vars is related to axis servo calcs
     // but should not be cksumed
@@ -154,6 +278,162 @@ struct PID{
 };
 
 
+// fault supervisor (fault.c) bits, also used in pid.faultmask
+#define FLT_FOLLOW		0x0001	// |error| > maxerror while enabled
+#define FLT_ENCODER		0x0002	// qei count error (CNTERR away from wrap)
+#define FLT_CMDSPEED	0x0004	// too many bogus pc cmd edges (cmd_err)
+#define FLT_AMP			0x0008	// amp fault input RE8 low
+#define FLT_TRAP		0x0010	// cpu trap (stack/address/math error)
+#define FLT_ALL			(FLT_FOLLOW | FLT_ENCODER | FLT_CMDSPEED | FLT_AMP)
+#define FLT_CMD_WINDOW	64		// servo cycles per cmd_err rate window
+
 struct COF{
-unsigned char emergncy; //TESTTEST
+	unsigned short fault;		// latched fault bits, outputs are off while set
+	unsigned short first;		// bits that caused the latch
+	unsigned short trips;		// times the supervisor has tripped
+	float trip_error;			// following error when it tripped
+	// state used by fault_check() in the pwm isr
+	unsigned short last_cmd_err;
+	unsigned short cmderr_win;	// bogus cmd edges in this window
+	short win_cycles;			// servo cycles left in this window
+	short amp_low;				// consecutive cycles with RE8 low
+	unsigned short seen;		// fault_eval() bits this cycle, before the mask
+};
+
+unsigned short fault_eval(float error, short enabled, float maxerror,
+						  short qei_err, short cmderrs, short maxcmderr,
+						  short amp_low);
+
+// flight recorder (flight.c): per servo cycle the change of command and
+// feedback since the cycle before and a state byte, each in its own byte
+// array. The header has the 32 bit positions of the newest cycle, the h
+// command works back from them. A change outside a byte is saved as
+// FR_CLIP and ends what can be worked back. FR_DEPTH * 3 + 32 bytes must
+// be a multiple of the 32 byte eeprom row. 512 bytes of ram.
+#define FR_DEPTH		160
+
+#if (FR_DEPTH * 3 + 32) % 32 != 0
+#error "FR_DEPTH must fill whole eeprom rows"
+#endif
+
+#define FR_CLIP			(-128)
+#define FRS_DUTY		0x0f	// drive in 1/7 of full duty, -7..7
+#define FRS_FAULT		0xf0	// FLT_ALL bits fault_eval() saw, << 4
+
+void fr_record(short duty);
+void fr_freeze(unsigned short fault);
+
+// plant identification (ident.c): prbs added to the pid output, samples
+// streamed on the console for host/plantfit
+#define ID_EVERY		8		// servo cycles per sample if none given
+
+float ident_excite(void);
+void ident_record(short duty);
+void ident_start(float amp, short every);
+
+// frequency response analyzer (fra.c): a stepped sine injected at the
+// pid output or into the command, demodulated on the card for host/bode
+#define FRA_OUTPUT		0		// H1 plant, H2 open loop
+#define FRA_COMMAND		1		// H1 closed loop, H2 sensitivity
+#define FRA_POINTS		20		// points if none given
+#define FRA_POINTS_MAX	200
+
+#define FRA_POINT		1		// fra_result()
+#define FRA_END			2
+
+struct FRAPOINT{
+	float f;				// Hz
+	float re1, im1;			// H1
+	float re2, im2;			// H2
 };
+
+short fra_command(void);
+float fra_output(void);
+void fra_record(void);
+short fra_start(short where, float amp, float f1, float f2, short points);
+void fra_stop(void);
+short fra_result(struct FRAPOINT *p);
+void fra_begin(short where, float amp, float f1, float f2, short points);
+
+// input recorder (rec.c): the pwm isr's inputs per servo cycle after a
+// snapshot of the state it starts from, for host/replay. A bench tool,
+// define INPUT_RECORDER to build it in: its buffer does not fit in the
+// 2k of ram next to everything else with room left for the stack.
+// host/Makefile builds the simulation with it.
+//#define INPUT_RECORDER
+
+#define RF_SHORT		0		// rec_fields[].type
+#define RF_LONG			1
+#define RF_FLOAT		2
+
+struct RECFIELD{
+	volatile void *p;
+	unsigned char type;
+};
+
+extern const struct RECFIELD rec_fields[];
+extern const short rec_nfields;
+
+#define REC_RUN			0x80	// | n - 1: n cycles with nothing new
+#define REC_SMALL		0x40	// | (ddc + 3) << 3 | (ddf + 3)
+#define RECF_ENABLE		0x01	// else flags of a full token
+#define RECF_AMP		0x02	// RE8 high
+#define RECF_QEI		0x04	// qei count error
+#define RECF_CMD		0x08	// varints follow: err, fb, cmd
+#define RECF_FB			0x10
+#define RECF_ERR		0x20
+
+#ifdef INPUT_RECORDER
+void rec_input(unsigned short cmd, unsigned short fb);
+void rec_faults(unsigned short errs, short amp, short qei);
+void rec_output(short duty);
+void rec_fold(unsigned short *sum, short duty, float output);
+void rec_command(short how);
+#else
+#define rec_input(cmd, fb)
+#define rec_faults(errs, amp, qei)
+#define rec_output(duty)
+#define rec_command(how)	printf("\r\nno input recorder in this build\r\n")
+#endif
+
+// console parameter table (params.c)
+#define PT_FLOAT		0
+#define PT_SHORT		1
+#define PT_USHORT		2
+
+#define PF_SAVE			0x01	// kept in eeprom, set starts a save
+#define PF_HEX			0x02	// printed in hex
+
+#define PARAM_OK		0		// same as PWMT_OK
+#define PARAM_RANGE		(-1)	// value outside min..max
+
+struct PARAM{
+	char code;					// command letter
+	const char *label;			// name printed by the l command
+	const char *unit;
+	const char *help;
+	unsigned char offset;		// offsetof the field in struct PID
+	unsigned char type;			// PT_xxx
+	unsigned char flags;		// PF_xxx
+	float min, max;
+	int (*apply)(float v);		// optional, called before the value is stored
+};
+
+extern const struct PARAM params[];
+extern const short param_count;
+
+const struct PARAM *param_find(char code);
+float param_get(const struct PARAM *p);
+int param_put(const struct PARAM *p, float value);
+int param_check(const struct PARAM *p, float value);
+void param_store(const struct PARAM *p, float value);
+int param_set(const struct PARAM *p, float value);
+const struct PARAM *param_validate(void);
+void param_error(const struct PARAM *p, int res);
+void param_print(const struct PARAM *p);
+void param_help(void);
+
+// multi-drop bus output control (serial.c). A card with a node id only
+// drives the line between bus_open() and bus_close().
+void bus_open(unsigned long at);
+void bus_close(void);
@@ -11,6 +11,7 @@
 // Revision History
 //
 // Nov 5 2005 -- first version 
+// Oct 19 2026 -- qei isr at IPL_EDGE with the pc command edges, no psv
 //---------------------------------------------------------------------- 
 #include <xc.h>
 #include "dspicservo.h"
@@ -18,6 +19,10 @@
 //#define ENC_MAX ((4*2000)-1)
 //int global_enc_h;
 
+#define QEI_WRAP_BAND 16		// counts either side of 0 treated as a rollover
+
+volatile unsigned short qei_cnterr;	// real count error seen, cleared by fault_check()
+
 /*********************************************************************
   Function:        void __attribute__((__interrupt__)) _QEIInterrupt(void)
 
@@ -31,13 +36,20 @@
 
   Overview:        handles encoder interrupts 
 
-  Note:            We can get intrs via index pulses, counting errors
+  Note:            We can get intrs via index pulses, counting errors.
+                   At IPL_EDGE so POSCNT is still near the wrap when it
+                   is looked at, sharing the shadow registers with the
+                   IC isr's of that level.
 ********************************************************************/
-void __attribute__((__interrupt__,auto_psv)) _QEIInterrupt(void)
+void __attribute__((__interrupt__,no_auto_psv,shadow)) _QEIInterrupt(void)
 {
+    PROF_ENTER(PROF_QEI);
     if (QEICONbits.CNTERR)
     {
-        /* encoder rolled over */
+        /* encoder rolled over, or a real count error if we are */
+        /* nowhere near the wrap point */
+        if ( POSCNT > QEI_WRAP_BAND && POSCNT < 0xffff - QEI_WRAP_BAND )
+            qei_cnterr = 1;
 //        if ( QEICONbits.UPDN )
 //            global_enc_h++;
 //        else
@@ -46,6 +58,7 @@ void __attribute__((__interrupt__,auto_psv)) _QEIInterrupt(void)
     }
 
     IFS2bits.QEIIF = 0;         // reset the if flag
+    PROF_EXIT(PROF_QEI);
 
 //    if ( STATUS_LED ) STATUS_LED = 0; else STATUS_LED = 1; // toggle led
 }
@@ -100,6 +113,6 @@ void setup_encoder(void)
 
     /* set up interrupts for encoder */
     IFS2bits.QEIIF = 0;         // clear Interrupt flag 
-    IPC10bits.QEIIP = 1;        // bits <2:0> are the priority
+    IPC10bits.QEIIP = IPL_EDGE; // bits <2:0> are the priority
     IEC2bits.QEIIE = 1;         // go live
 }
\ No newline at end of file
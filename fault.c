@@ -0,0 +1,211 @@
+//---------------------------------------------------------------------
+//	File:		fault.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Fault supervisor. fault_check() runs in the pwm isr right
+//          after calc_pid() and latches a fault on
+//             - following error larger than pid.maxerror (f command)
+//             - qei count error
+//             - too many bogus pc command edges in a window (cmd_err)
+//             - amp fault input RE8 low
+//          Once latched the pwm outputs are overridden off in the same
+//          isr and stay off until the r command or a disable/enable of
+//          the servo clears the latch. A condition that is still there
+//          trips it again on the next servo cycle.
+//
+//          fault_eval() holds the decisions and touches no hardware.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version, replaces the commented out drive fault
+//                check in main.c and the emergncy flag in calc_pid()
+// Oct 19 2026 -- inputs handed to the input recorder
+// Oct 19 2026 -- the bits fault_eval() saw each cycle kept for the flight record
+//----------------------------------------------------------------------
+#include <xc.h>
+#include "dspicservo.h"
+#include <stdio.h>
+#include <math.h>
+
+#define AMP_LOW_CYCLES	2		// RE8 must be low this many cycles in a row
+
+extern struct PID pid;
+extern struct COF cof;
+extern volatile unsigned short int cmd_err;
+extern volatile unsigned short qei_cnterr;	// set by the qei isr
+
+static const char * const fault_names[] = {
+	"following error", "encoder count", "pc cmd overspeed", "amp fault", "trap"
+};
+
+/*********************************************************************
+  Function:        unsigned short fault_eval(...)
+
+  Input:           error     - current following error (counts)
+                   enabled   - servo loop enabled
+                   maxerror  - following error limit, 0 = no limit
+                   qei_err   - non zero if the qei saw a count error
+                   cmderrs   - bogus pc cmd edges in the current window
+                   maxcmderr - limit for cmderrs, 0 = no limit
+                   amp_low   - consecutive servo cycles with RE8 low
+
+  Output:          FLT_xxx bits of the conditions present now
+********************************************************************/
+unsigned short fault_eval(float error, short enabled, float maxerror,
+						  short qei_err, short cmderrs, short maxcmderr,
+						  short amp_low)
+{
+	unsigned short f = 0;
+
+	if ( enabled && maxerror > 0.0 && fabs(error) > maxerror )
+		f |= FLT_FOLLOW;
+	if ( qei_err )
+		f |= FLT_ENCODER;
+	if ( maxcmderr > 0 && cmderrs > maxcmderr )
+		f |= FLT_CMDSPEED;
+	if ( amp_low >= AMP_LOW_CYCLES )
+		f |= FLT_AMP;
+	return f;
+}
+
+/*********************************************************************
+  Function:        void fault_outputs_off(void)
+
+  Overview:        drive the pwm pins inactive through the override
+                   register and zero the duty cycles
+********************************************************************/
+void fault_outputs_off(void)
+{
+	OVDCON = 0x0000;		// all pwm pins overridden to inactive
+	PDC1 = 0;
+	PDC3 = 0;
+}
+
+/*********************************************************************
+  Function:        unsigned short fault_check(void)
+
+  PreCondition:    called from the pwm isr after calc_pid()
+
+  Output:          latched fault bits, non zero means outputs are off
+********************************************************************/
+unsigned short fault_check(void)
+{
+	unsigned short now, errs;
+	short qei, amp;
+
+	errs = cmd_err;
+	cof.cmderr_win += errs - cof.last_cmd_err;
+	cof.last_cmd_err = errs;
+
+	amp = PORTEbits.RE8;
+	if ( amp == 0 )
+	{
+		if ( cof.amp_low < AMP_LOW_CYCLES )
+			cof.amp_low++;
+	}
+	else
+		cof.amp_low = 0;
+
+	qei = qei_cnterr;
+	qei_cnterr = 0;
+	rec_faults(errs, amp, qei);		// 0 unless recording for a replay
+
+	now = fault_eval(pid.error, pid.enable, pid.maxerror, qei,
+					 cof.cmderr_win, pid.maxcmderr, cof.amp_low);
+	cof.seen = now;			// for the flight record, masked or not
+	now &= pid.faultmask;
+
+	if ( --cof.win_cycles <= 0 )
+	{
+		cof.win_cycles = FLT_CMD_WINDOW;
+		cof.cmderr_win = 0;
+	}
+
+	if ( now && !cof.fault )
+	{
+		fault_outputs_off();
+		cof.first = now;
+		cof.trip_error = pid.error;
+		cof.trips++;
+	}
+	cof.fault |= now;
+	return cof.fault;
+}
+
+/*********************************************************************
+  Function:        void fault_clear(void)
+
+  Overview:        releases the latch and gives the outputs back to the
+                   pwm generators. Called with the pwm isr masked or
+                   from inside it.
+********************************************************************/
+void fault_clear(void)
+{
+	cof.fault = 0;
+	cof.amp_low = 0;
+	cof.cmderr_win = 0;
+	cof.win_cycles = FLT_CMD_WINDOW;
+	OVDCON = 0x3f00;		// pins back under pwm control
+}
+
+void init_fault(void)
+{
+	cof.trips = 0;
+	cof.first = 0;
+	cof.last_cmd_err = cmd_err;
+	qei_cnterr = 0;
+	fault_clear();
+}
+
+static void print_fault_bits(unsigned short f)
+{
+	short i;
+
+	if ( f == 0 )
+		printf(" none");
+	for ( i = 0; i < 5; i++ )
+		if ( f & (1 << i) )
+			printf(" [%s]", fault_names[i]);
+	printf("\r\n");
+}
+
+/*********************************************************************
+  Function:        short fault_task(void)
+
+  Overview:        background task, reports each new trip once
+********************************************************************/
+short fault_task(void)
+{
+	static unsigned short reported = 0;
+
+	if ( cof.trips == reported )
+		return 0;
+	reported = cof.trips;
+	printf("\r\nFAULT:");
+	print_fault_bits(cof.first);
+	printf(">");
+	return 1;
+}
+
+/*********************************************************************
+  Function:        void print_faults(void)
+
+  Overview:        F command
+********************************************************************/
+void print_faults(void)
+{
+	printf("\rfault latched(0x%02X):", cof.fault);
+	print_fault_bits(cof.fault);
+	printf("tripped by:");
+	print_fault_bits(cof.first);
+	printf("trips: %u  error at trip: ", cof.trips);
+	fx_print(cof.trip_error, FX_DIGITS);
+	printf("\r\n");
+	printf("amp input RE8: %s  pc cmd errors: %u\r\n",
+		PORTEbits.RE8 ? "ok" : "FAULT", cmd_err);
+	printf("checks enabled(0x%02X):", pid.faultmask);
+	print_fault_bits(pid.faultmask);
+}
@@ -0,0 +1,451 @@
+//---------------------------------------------------------------------
+//	File:		fixnum.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Decimal number parsing and formatting for the console.
+//          atof() and the floating point printf pull the full soft
+//          float conversion library into flash and are slow on a 24 MIPS
+//          part. Here a number is parsed into an integer of digits and a
+//          power of ten and rounded once with 64 bit integer arithmetic,
+//          and printed from its integer part and a binary fraction.
+//
+//          Once nothing uses %f the xc16 linker picks the integer only
+//          printf.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- fx_ftol() for console values that end up as integers,
+//                fx_ftoa() prints an infinity as inf
+// Oct 19 2026 -- fx_strtof() rounds once from exact integers, it took 9
+//                digits and rounded twice (off by one ulp now and then),
+//                fx_ftoa() takes the e+nn digits exactly, not by /10
+// Oct 19 2026 -- fx_strtof() on a 64 bit mantissa scaled in one step
+//                instead of the 208 bit integers, 1 ulp off at most
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include "fixnum.h"
+
+// exact arithmetic for fx_etoa(): little endian 16 bit words, so every
+// product fits in an unsigned long on XC16 and on a PC. 128 bits hold
+// the largest float as an integer.
+#define BN_WORDS	8
+
+// number of significant bits, 0 for 0
+static short bn_bits(const unsigned short *a)
+{
+	short i, n;
+	unsigned short w;
+
+	for ( i = BN_WORDS - 1; i >= 0 && a[i] == 0; i-- )
+		;
+	if ( i < 0 )
+		return 0;
+	for ( n = 0, w = a[i]; w; w >>= 1 )
+		n++;
+	return i * 16 + n;
+}
+
+static void bn_shl(unsigned short *a, short n)
+{
+	short i, w = n >> 4, b = n & 15;
+
+	for ( i = BN_WORDS - 1; i >= 0; i-- )
+	{
+		a[i] = i - w >= 0 ? a[i - w] << b : 0;
+		if ( b && i - w - 1 >= 0 )
+			a[i] |= a[i - w - 1] >> (16 - b);
+	}
+}
+
+// a /= d, returns the remainder
+static unsigned short bn_div_small(unsigned short *a, unsigned short d)
+{
+	unsigned long r = 0;
+	short i;
+
+	for ( i = BN_WORDS - 1; i >= 0; i-- )
+	{
+		r = (r << 16) | a[i];
+		a[i] = (unsigned short)(r / d);
+		r %= d;
+	}
+	return (unsigned short)r;
+}
+
+// 10^(16k) for k = -4..2 as m * 2^b, m rounded to nearest in 64 bits
+// with its top bit set. 10^0 and 10^16 are exact.
+static const struct { unsigned long long m; short b; } fx_pow16[7] = {
+	{ 0xa87fea27a539e9a5ULL, -276 },
+	{ 0xbb127c53b17ec159ULL, -223 },
+	{ 0xcfb11ead453994baULL, -170 },
+	{ 0xe69594bec44de15bULL, -117 },
+	{ 0x8000000000000000ULL, -63 },
+	{ 0x8e1bc9bf04000000ULL, -10 },
+	{ 0x9dc5ada82b70b59eULL, 43 },
+};
+
+// a shifted up until its top bit is set, a != 0. *e2 goes down by the shift
+static unsigned long long fx_norm(unsigned long long a, short *e2)
+{
+	for ( ; !(a >> 48); a <<= 16 )
+		*e2 -= 16;
+	for ( ; !(a >> 63); a <<= 1 )
+		(*e2)--;
+	return a;
+}
+
+// the top 64 bits of a * b, a and b with their top bits set. *e2 goes
+// up by the bits dropped and *sticky is set if any of them is 1
+static unsigned long long fx_mul64(unsigned long long a, unsigned long long b,
+								   short *e2, short *sticky)
+{
+	const unsigned long long lo32 = 0xffffffffULL;
+	unsigned long long ll = (a & lo32) * (b & lo32);
+	unsigned long long lh = (a & lo32) * (b >> 32);
+	unsigned long long hl = (a >> 32) * (b & lo32);
+	unsigned long long mid = (ll >> 32) + (lh & lo32) + (hl & lo32);
+	unsigned long long hi = (a >> 32) * (b >> 32) + (lh >> 32) + (hl >> 32) + (mid >> 32);
+	unsigned long long lo = (mid << 32) | (ll & lo32);
+
+	*e2 += 64;
+	if ( !(hi >> 63) )
+	{
+		hi = (hi << 1) | (lo >> 63);
+		lo <<= 1;
+		(*e2)--;
+	}
+	if ( lo )
+		*sticky = 1;
+	return hi;
+}
+
+/*********************************************************************
+  Function:        const char *fx_strtof(const char *s, float *v)
+
+  Input:           s - "[spaces][+-]digits[.digits][e[+-]digits]",
+                       either side of the point may be empty but not both
+
+  Output:          *v and a pointer to the first character after the
+                   number, or 0 (and *v = 0) if there is no number.
+
+  Overview:        up to FX_SIGDIGITS significant digits are taken into
+                   a 64 bit integer, the ones after that only count as
+                   being non zero. It is scaled by 10^exp in one step,
+                   an exact 10^r (r < 16) times 10^16k from fx_pow16[],
+                   keeping the top 64 bits and whether the rest is zero,
+                   and rounded to a float once, to nearest with ties to
+                   even as strtof() does.
+
+  Note:            where 10^exp is exact (0 <= exp < 32) the result is
+                   strtof()'s. Otherwise the 64 bit power and products
+                   are within 2^-62 of the exact value, so a number on a
+                   tie between two floats, or closer than that to one,
+                   can round to the other float: 1 ulp off at most. A tie
+                   needs 8 or more significant digits, a console value
+                   such as 0.04 or 1000 does not get there.
+********************************************************************/
+const char *fx_strtof(const char *s, float *v)
+{
+	union { float f; unsigned short w[2]; } u;
+	unsigned long long m = 0, t, keep, rest, half;
+	unsigned long bits;
+	short exp = 0, digits = 0, sig = 0, neg = 0, eneg = 0, e = 0;
+	short sticky = 0, e2 = 0, k, d, sh;
+	const char *p;
+
+	*v = 0.0;
+	while ( *s == ' ' || *s == '\t' )
+		s++;
+	if ( *s == '-' || *s == '+' )
+		neg = (*s++ == '-');
+
+	for ( ; *s >= '0' && *s <= '9'; s++, digits++ )
+	{
+		if ( sig < FX_SIGDIGITS )
+		{
+			m = m * 10 + (*s - '0');
+			if ( sig || *s != '0' )
+				sig++;
+		}
+		else
+		{
+			exp++;			// dropped digit left of the point
+			sticky |= *s != '0';
+		}
+	}
+	if ( *s == '.' )
+	{
+		for ( s++; *s >= '0' && *s <= '9'; s++, digits++ )
+		{
+			if ( sig < FX_SIGDIGITS )
+			{
+				m = m * 10 + (*s - '0');
+				if ( sig || *s != '0' )
+					sig++;
+				exp--;
+			}
+			else
+				sticky |= *s != '0';
+		}
+	}
+	if ( digits == 0 )
+		return 0;
+
+	// the exponent is only taken if it has digits, as strtod does
+	if ( *s == 'e' || *s == 'E' )
+	{
+		p = s + 1;
+		if ( *p == '-' || *p == '+' )
+			eneg = (*p++ == '-');
+		if ( *p >= '0' && *p <= '9' )
+		{
+			for ( ; *p >= '0' && *p <= '9'; p++ )
+				if ( e < 1000 )
+					e = e * 10 + (*p - '0');
+			exp += eneg ? -e : e;
+			s = p;
+		}
+	}
+
+	// value is m * 10^exp with m sig digits long, -64 <= exp < 39 below
+	if ( sig == 0 || sig + exp <= -46 )
+		bits = 0;					// under half the smallest float
+	else if ( sig - 1 + exp >= 39 )
+		bits = 0x7f800000UL;		// inf
+	else
+	{
+		k = exp >= 0 ? exp / 16 : -((15 - exp) / 16);
+		for ( t = 1, d = exp - 16 * k; d > 0; d-- )
+			t *= 10;
+		m = fx_mul64(fx_norm(m, &e2), fx_norm(t, &e2), &e2, &sticky);
+		m = fx_mul64(m, fx_pow16[k + 4].m, &e2, &sticky);
+		e2 += fx_pow16[k + 4].b;
+
+		// m * 2^e2, its top bit is 2^(e2 + 63). Below 2^-126 the float
+		// has fewer bits, round the extra ones off too
+		e2 += 63;
+		d = e2 < -126 ? -126 - e2 : 0;
+		if ( d > 24 )
+			bits = 0;
+		else
+		{
+			sh = 40 + d;
+			keep = sh < 64 ? m >> sh : 0;
+			rest = sh < 64 ? m & ((1ULL << sh) - 1) : m;
+			half = 1ULL << (sh - 1);
+			if ( rest > half || (rest == half && (sticky || (keep & 1))) )
+				keep++;
+			// the hidden bit of keep adds one to the exponent, and a
+			// carry out of the mantissa moves it up by one more
+			bits = ((unsigned long)(e2 + d + 126) << 23) + (unsigned long)keep;
+			if ( bits > 0x7f800000UL )
+				bits = 0x7f800000UL;
+		}
+	}
+	u.w[0] = (unsigned short)bits;
+	u.w[1] = (unsigned short)(bits >> 16);
+	*v = neg ? -u.f : u.f;
+	return s;
+}
+
+// drop in for atof(): 0.0 if there is no number
+float fx_atof(const char *s)
+{
+	float v;
+
+	fx_strtof(s, &v);
+	return v;
+}
+
+/*********************************************************************
+  Function:        long fx_ftol(float v, long min, long max)
+
+  Overview:        a parsed number as an integer, limited to min..max.
+                   A float outside the range of the integer it is cast
+                   to gives any value at all, and "1e99" parses as inf.
+
+  Output:          v truncated, min or max if it is outside, min if NaN
+********************************************************************/
+long fx_ftol(float v, long min, long max)
+{
+	if ( !(v >= (float)min) )
+		return min;
+	if ( v >= (float)max )
+		return max;
+	return (long)v;
+}
+
+// fx_ftoa() of 2e9 <= v < inf: all of its up to 39 decimal digits from
+// the integer mantissa * 2^e, then rounded to digits + 1 of them
+static void fx_etoa(char *p, float v, short digits)
+{
+	union { float f; unsigned short w[2]; } u;
+	unsigned short a[BN_WORDS];
+	char dec[40];
+	short n = 0, i, exp, up, rest = 0;
+
+	u.f = v;
+	for ( i = 0; i < BN_WORDS; i++ )
+		a[i] = 0;
+	a[0] = u.w[0];
+	a[1] = (u.w[1] & 0x7f) | 0x80;
+	bn_shl(a, (short)((u.w[1] >> 7) & 0xff) - 150);
+	while ( bn_bits(a) )
+		dec[n++] = (char)bn_div_small(a, 10);	// least significant first
+	exp = n - 1;
+
+	// round at dec[n - 2 - digits], ties to even
+	i = n - 1 - digits;
+	if ( i > 0 )
+	{
+		up = dec[i - 1] > 5 || (dec[i - 1] == 5 && (dec[i] & 1));
+		while ( --i > 0 && !rest )
+			rest = dec[i - 1] != 0;
+		i = n - 1 - digits;
+		if ( dec[i - 1] == 5 && rest )
+			up = 1;
+		for ( ; up && i < n; i++ )
+		{
+			if ( dec[i] == 9 )
+				dec[i] = 0;
+			else
+			{
+				dec[i]++;
+				up = 0;
+			}
+		}
+		if ( up )
+		{
+			dec[n - 1] = 1;		// 9.99e+09 -> 1.00e+10, the rest are 0
+			exp++;
+		}
+	}
+	for ( i = n - 1; i >= n - 1 - digits; i-- )
+	{
+		*p++ = i >= 0 ? '0' + dec[i] : '0';
+		if ( i == n - 1 && digits )
+			*p++ = '.';
+	}
+	*p++ = 'e';
+	*p++ = '+';
+	*p++ = '0' + exp / 10;
+	*p++ = '0' + exp % 10;
+	*p = 0;
+}
+
+/*********************************************************************
+  Function:        char *fx_ftoa(char *buf, float v, short digits)
+
+  Input:           buf    - FX_BUFLEN chars
+                   digits - decimals after the point, 0 to FX_MAXDIGITS
+
+  Output:          buf, holding v rounded to digits decimals the way
+                   printf("%.*f") does (exact ties to even). Values too
+                   big for a long are printed as d.ddd...e+nn the way
+                   printf("%.*e") does, an infinity as inf.
+
+  Note:            the fraction is taken as a 28 bit binary fraction and
+                   its decimals are produced by multiplying by ten, no
+                   float rounding happens after the split. Below 1/32
+                   the float has more fraction bits than that, so a
+                   value that is within 2^-28 of a rounding tie can come
+                   out one off in the last decimal. From 2e9 up a float
+                   is an integer, its decimal digits are taken exactly.
+********************************************************************/
+#define FX_FRACBITS	28
+#define FX_ONE		(1UL << FX_FRACBITS)
+
+char *fx_ftoa(char *buf, float v, short digits)
+{
+	char tmp[12];
+	char *p = buf, *d;
+	unsigned long ip, fbits;
+	short i, up;
+
+	if ( digits < 0 )
+		digits = 0;
+	if ( digits > FX_MAXDIGITS )
+		digits = FX_MAXDIGITS;
+	if ( v != v )
+	{
+		buf[0] = 'n'; buf[1] = 'a'; buf[2] = 'n'; buf[3] = 0;
+		return buf;
+	}
+	if ( v < 0.0 )
+	{
+		*p++ = '-';
+		v = -v;
+	}
+	if ( v > 3.4028235e38 )
+	{
+		p[0] = 'i'; p[1] = 'n'; p[2] = 'f'; p[3] = 0;
+		return buf;
+	}
+	if ( v >= 2.0e9 )
+	{
+		fx_etoa(p, v, digits);
+		return buf;
+	}
+
+	// v - ip is exact for a float, scaling by 2^28 is exact too
+	ip = (unsigned long)v;
+	fbits = (unsigned long)((v - (float)ip) * (float)FX_ONE);
+
+	i = 0;
+	do
+	{
+		tmp[i++] = '0' + ip % 10;
+		ip /= 10;
+	} while ( ip );
+	while ( i )
+		*p++ = tmp[--i];
+	*p++ = '.';
+	d = p;
+	for ( i = 0; i < digits; i++ )
+	{
+		fbits *= 10;
+		*p++ = '0' + (fbits >> FX_FRACBITS);
+		fbits &= FX_ONE - 1;
+	}
+
+	// round what is left, ties go to the even digit
+	up = fbits > FX_ONE / 2
+		|| ( fbits == FX_ONE / 2 && ((p[-1] == '.' ? p[-2] : p[-1]) & 1) );
+	for ( d = p - 1; up && d >= buf && *d != '-'; d-- )
+	{
+		if ( *d == '.' )
+			continue;
+		if ( *d == '9' )
+			*d = '0';
+		else
+		{
+			(*d)++;
+			up = 0;
+		}
+	}
+	if ( up )
+	{
+		// carried out of the first digit: 9.99 -> 10.00
+		d++;
+		for ( i = p - d; i > 0; i-- )
+			d[i] = d[i - 1];
+		*d = '1';
+		p++;
+	}
+	if ( digits == 0 )
+		p--;				// no point without decimals
+	*p = 0;
+	return buf;
+}
+
+// print a float with the given number of decimals
+void fx_print(float v, short digits)
+{
+	char buf[FX_BUFLEN];
+
+	fputs(fx_ftoa(buf, v, digits), stdout);
+}
@@ -0,0 +1,32 @@
+//---------------------------------------------------------------------
+//	File:		fixnum.h
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Decimal number parsing and formatting for the console
+//          without atof() or printf("%f"). Like pwmtiming.h this does
+//          not include <xc.h> so it also builds on a PC.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- fx_ftol() for console values that end up as integers
+// Oct 19 2026 -- fx_strtof() takes 19 digits into 64 bits
+//----------------------------------------------------------------------
+#ifndef FIXNUM_H
+#define FIXNUM_H
+
+#define FX_DIGITS		6	// decimals printed, same as %f
+#define FX_MAXDIGITS	9	// 10^9 still fits in a long
+#define FX_SIGDIGITS	19	// digits fx_strtof() takes, the most in 64 bits
+#define FX_BUFLEN		24	// "-2147483647.123456789" + exponent + nul
+
+const char *fx_strtof(const char *s, float *v);
+float fx_atof(const char *s);
+long fx_ftol(float v, long min, long max);
+char *fx_ftoa(char *buf, float v, short digits);
+void fx_print(float v, short digits);
+
+#endif
@@ -0,0 +1,319 @@
+//---------------------------------------------------------------------
+//	File:		flight.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Fault flight recorder. The pwm isr adds one entry per servo
+//          cycle to a circular buffer: how far command and feedback
+//          moved since the cycle before, the drive duty and the fault
+//          bits the supervisor saw. When the fault supervisor latches,
+//          or a cpu trap happens, the buffer freezes and is copied to a
+//          reserved area of eeprom together with the fault bits and the
+//          32 bit positions of the newest entry. The h command prints
+//          the saved copy after a reset, working the positions back
+//          from the header (error = command - feedback).
+//
+//          The 30f4012 only has 2k of ram, so an entry is 3 bytes: a
+//          byte for each change and the state byte. A change of more
+//          than 127 counts in one servo cycle is saved as FR_CLIP and
+//          the cycles before it are not printed. The duty is in 1/7
+//          steps of full duty. FR_DEPTH entries plus a 16 word header
+//          fill whole eeprom rows.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- freezing masks only the servo isr
+// Oct 19 2026 -- header positions in words, the same layout on the host
+// Oct 19 2026 -- 3 byte entries of position changes, duty and fault bits,
+//                160 cycles instead of 32
+//----------------------------------------------------------------------
+#include <xc.h>
+#include "dspicservo.h"
+#include <stdio.h>
+#include <stddef.h>
+#include "DataEEPROM.h"		// for eeprom read and write routines
+
+#define FR_MAGIC	0x4652	// 'FR'
+#define FR_ROWS		(sizeof(struct FRBUF) / (ROW*2))
+
+// states of the recorder
+#define FR_RECORDING	0
+#define FR_FROZEN		1	// waiting for fr_task() to save it
+#define FR_SAVING		2
+#define FR_SAVED		3
+
+struct FRHDR{					// 16 words, one eeprom row
+	unsigned short magic;
+	unsigned short fault;		// FLT_xxx bits that froze the buffer
+	unsigned short trips;		// cof.trips at the freeze
+	unsigned short oldest;		// index of the oldest entry
+	unsigned short count;		// valid entries
+	unsigned short ticks;		// servo cycle = ticks * pwmpost / fpwm
+	unsigned short fpwm;
+	unsigned short pwmpost;
+	unsigned short command[2];	// pid.command of the newest entry, low word first
+	unsigned short feedback[2];	// pid.feedback of it, in words so the
+								// header is one row on any compiler
+	unsigned short spare[3];
+	short cksum;
+};
+
+struct FRBUF{
+	struct FRHDR hdr;
+	signed char dcmd[FR_DEPTH];		// pid.command - the one of the entry before
+	signed char dfb[FR_DEPTH];
+	unsigned char state[FR_DEPTH];	// FRS_xxx
+};
+
+extern struct PID pid;
+extern struct COF cof;
+extern struct PWMTIMING pwm_timing;
+extern short calc_cksum(short sizew, short *adr);
+
+struct FRBUF fr;
+volatile short fr_state = FR_RECORDING;
+static short fr_row;				// next row to save
+short _EEDATA(32) frEE[sizeof(struct FRBUF) / 2] = {0};
+
+// a change of position as a byte, FR_CLIP if it does not fit
+static signed char fr_byte(short d)
+{
+	if ( d < -127 || d > 127 )
+		return FR_CLIP;
+	return (signed char)d;
+}
+
+/*********************************************************************
+  Function:        void fr_record(short duty)
+
+  PreCondition:    called from the pwm isr once per servo cycle after
+                   fault_check()
+
+  Input:           duty - drive applied this cycle, +PDC1 or -PDC3
+********************************************************************/
+void fr_record(short duty)
+{
+	short i, d;
+	long full;
+
+	if ( fr_state != FR_RECORDING )
+	{
+		// start over once the fault that froze us has been cleared
+		if ( fr_state == FR_SAVED && cof.fault == 0 )
+		{
+			fr.hdr.count = 0;
+			fr.hdr.oldest = 0;
+			fr_state = FR_RECORDING;
+		}
+		return;
+	}
+
+	i = fr.hdr.oldest + fr.hdr.count;
+	if ( i >= FR_DEPTH )
+		i -= FR_DEPTH;
+	d = (short)((unsigned short)pid.command - fr.hdr.command[0]);
+	fr.dcmd[i] = fr_byte(d);
+	d = (short)((unsigned short)pid.feedback - fr.hdr.feedback[0]);
+	fr.dfb[i] = fr_byte(d);
+	fr.hdr.command[0] = (unsigned short)pid.command;
+	fr.hdr.command[1] = (unsigned short)(pid.command >> 16);
+	fr.hdr.feedback[0] = (unsigned short)pid.feedback;
+	fr.hdr.feedback[1] = (unsigned short)(pid.feedback >> 16);
+
+	// duty to the nearest 1/7 of full
+	full = pwm_timing.pdcmax;
+	d = (short)(((long)duty * 7 + (duty < 0 ? -full : full) / 2) / full);
+	fr.state[i] = (unsigned char)((d & FRS_DUTY) | ((cof.seen & FLT_ALL) << 4));
+	if ( fr.hdr.count < FR_DEPTH )
+		fr.hdr.count++;
+	else if ( ++fr.hdr.oldest >= FR_DEPTH )
+		fr.hdr.oldest = 0;
+
+	if ( cof.fault )
+		fr_freeze(cof.first);
+}
+
+/*********************************************************************
+  Function:        void fr_freeze(unsigned short fault)
+
+  Overview:        stops recording and fills in the header, safe from
+                   the isr and from trap handlers
+********************************************************************/
+void fr_freeze(unsigned short fault)
+{
+	if ( fr_state != FR_RECORDING )
+		return;
+	fr_state = FR_FROZEN;
+	fr.hdr.magic = FR_MAGIC;
+	fr.hdr.fault = fault;
+	fr.hdr.trips = cof.trips;
+	fr.hdr.ticks = pid.ticksperservo;
+	fr.hdr.fpwm = pid.fpwm;
+	fr.hdr.pwmpost = pid.pwmpost;
+	fr.hdr.cksum = 0;
+	fr.hdr.cksum = -calc_cksum(sizeof(fr) / 2, (short *)&fr);
+}
+
+// write one row of the frozen buffer to eeprom
+static void fr_write_row(short row)
+{
+	int offset = row * ROW*2;
+
+	EraseEE(__builtin_tblpage(frEE), __builtin_tbloffset(frEE) + offset, ROW);
+	WriteEE((short *)&fr + row * ROW, __builtin_tblpage(frEE),
+			__builtin_tbloffset(frEE) + offset, ROW);
+}
+
+/*********************************************************************
+  Function:        short fr_task(void)
+
+  Overview:        background task, saves a frozen buffer one row per
+                   call so the other tasks keep running
+********************************************************************/
+short fr_task(void)
+{
+	if ( fr_state == FR_FROZEN )
+	{
+		fr_row = 0;
+		fr_state = FR_SAVING;
+	}
+	if ( fr_state != FR_SAVING )
+		return 0;
+	fr_write_row(fr_row);
+	if ( ++fr_row >= FR_ROWS )
+		fr_state = FR_SAVED;
+	return 1;
+}
+
+/*********************************************************************
+  Function:        void fr_trap(void)
+
+  Overview:        called from the trap handlers: freeze and save the
+                   whole buffer right now, nothing else will run again
+********************************************************************/
+void fr_trap(void)
+{
+	short row;
+
+	if ( fr_state == FR_RECORDING )
+		fr_freeze(FLT_TRAP | cof.fault);
+	if ( fr_state == FR_SAVED )
+		return;
+	for ( row = 0; row < FR_ROWS; row++ )
+		fr_write_row(row);
+	fr_state = FR_SAVED;
+}
+
+// a 32 bit position from its two header words
+static long fr_long(const unsigned short *w)
+{
+	return (long)(short)w[1] * 65536L + w[0];
+}
+
+// read one word of the saved copy
+static short fr_ee_word(short word)
+{
+	short w;
+
+	ReadEE(__builtin_tblpage(frEE), __builtin_tbloffset(frEE) + word * 2, &w, WORD);
+	return w;
+}
+
+// one byte of the saved copy, low byte of a word first
+static unsigned char fr_ee_byte(short ofs)
+{
+	unsigned short w = fr_ee_word(ofs >> 1);
+
+	return (ofs & 1) ? w >> 8 : w & 0xff;
+}
+
+// the saved entry n cycles after the oldest one
+static void fr_ee_entry(const struct FRHDR *h, short n, short *dcmd, short *dfb,
+						unsigned char *state)
+{
+	short i = (h->oldest + n) % FR_DEPTH;
+
+	*dcmd = (signed char)fr_ee_byte(offsetof(struct FRBUF, dcmd) + i);
+	*dfb = (signed char)fr_ee_byte(offsetof(struct FRBUF, dfb) + i);
+	*state = fr_ee_byte(offsetof(struct FRBUF, state) + i);
+}
+
+/*********************************************************************
+  Function:        void print_flight(short freeze)
+
+  Overview:        h command, prints the copy saved in eeprom, oldest
+                   entry first, as comma separated lines. The positions
+                   are worked back from the ones in the header to the
+                   newest FR_CLIP, the entries before it are left out.
+                   h1 first freezes the current history so it gets
+                   saved.
+********************************************************************/
+void print_flight(short freeze)
+{
+	struct FRHDR h;
+	short *hp = (short *)&h;
+	short i, n, dcmd, dfb, q, cs = 0;
+	short hdrw = sizeof(h) / 2;
+	unsigned char state;
+	long cmd, fb;
+	int ipl;
+
+	if ( freeze )
+	{
+		SET_AND_SAVE_CPU_IPL(ipl, IPL_SERVO);
+		fr_freeze(cof.fault);
+		RESTORE_CPU_IPL(ipl);
+		printf("\rflight record frozen, h prints it once saved\r\n");
+		return;
+	}
+
+	for ( i = 0; i < hdrw; i++ )
+		hp[i] = fr_ee_word(i);
+	for ( i = 0; i < (short)(sizeof(fr) / 2); i++ )
+		cs += fr_ee_word(i);
+	if ( h.magic != FR_MAGIC || cs != 0 || h.count > FR_DEPTH || h.oldest >= FR_DEPTH )
+	{
+		printf("\rno flight record saved\r\n");
+		return;
+	}
+	if ( fr_state == FR_FROZEN || fr_state == FR_SAVING )
+		printf("\r# save in progress, this may be the previous record\r\n");
+
+	// back from the newest entry to the oldest or the newest clipped one
+	cmd = fr_long(h.command);
+	fb = fr_long(h.feedback);
+	for ( n = (short)h.count - 1; n > 0; n-- )
+	{
+		fr_ee_entry(&h, n, &dcmd, &dfb, &state);
+		if ( dcmd == FR_CLIP || dfb == FR_CLIP )
+			break;
+		cmd -= dcmd;
+		fb -= dfb;
+	}
+	if ( n < 0 )
+		n = 0;
+
+	printf("\r# flight record, fault 0x%02X trip %u, %u cycles of %u ticks at %uHz/%u\r\n",
+		h.fault, h.trips, h.count - n, h.ticks, h.fpwm, h.pwmpost);
+	if ( n > 0 )
+		printf("# %d older cycles left out, a position changed by more than 127\r\n", n);
+	printf("# at freeze command %ld feedback %ld\r\n", fr_long(h.command), fr_long(h.feedback));
+	printf("# n,command,feedback,error,duty/7,faults\r\n");
+	for ( i = n; i < (short)h.count; i++ )
+	{
+		fr_ee_entry(&h, i, &dcmd, &dfb, &state);
+		if ( i > n )
+		{
+			cmd += dcmd;
+			fb += dfb;
+		}
+		q = state & FRS_DUTY;
+		if ( q & 0x08 )
+			q -= 16;
+		printf("%d,%ld,%ld,%ld,%d,0x%X\r\n", i - (short)h.count + 1, cmd, fb, cmd - fb, q,
+			(state & FRS_FAULT) >> 4);
+	}
+}
@@ -0,0 +1,430 @@
+//---------------------------------------------------------------------
+//	File:		fra.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Frequency response analyzer (host/bode). A sine is injected
+//          into the loop at a list of frequencies, stepped log spaced,
+//          and the response is demodulated on the card, so only a gain
+//          and phase per frequency go out on the console:
+//
+//             # fra <where> <amp>, <n> points <f1> to <f2>Hz
+//             # Hz <H1> dB deg <H2> dB deg
+//             <f> <gain1> <phase1> <gain2> <phase2>   one line per point
+//             ...
+//             # fra end[, stopped]
+//
+//          injected at the pid output (amp in % duty), with u the drive
+//          and x the part of it the pid made:
+//             H1 = feedback / u      the plant, counts per output unit
+//             H2 = -x / u            the open loop gain
+//          injected into the command (amp in counts), r the sine:
+//             H1 = feedback / r      the closed loop
+//             H2 = error / r         the sensitivity
+//
+//          The sine comes from the recurrence y[n+1] = 2cos(w) y[n] -
+//          y[n-1], one multiply per servo cycle. Its frequency is the
+//          one the float coefficient really gives, which is what is
+//          printed. The signals are averaged over a few servo cycles
+//          (so about FRA_SPP per period are left) and each goes through
+//          a Goertzel filter at the sine's frequency. The ratio of two
+//          of them is the response: the averaging and the phase the
+//          filters end on are the same for all and divide out.
+//
+//          A point settles for FRA_SETTLE periods, FRA_SETTLE_S at least,
+//          and is measured over FRA_PERIODS. Keep amp small enough not to saturate the drive.
+//          A fault or disabling the servo stops the run.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- amp limited, a command step has to fit a short
+//----------------------------------------------------------------------
+#include <xc.h>
+#include "dspicservo.h"
+#include <stdio.h>
+#include <math.h>
+
+#define FRA_SPP			32		// averaged samples per period of the sine
+#define FRA_PERIODS		4		// periods measured per point
+#define FRA_SETTLE		2		// periods let go by first
+#define FRA_SETTLE_S	0.2		// and at least this long, s
+#define FRA_MIN_SAMPLES	16		// averaged samples per point at least
+#define FRA_FMAX		0.4		// highest frequency, of the servo rate
+#define FRA_AMP_MAX		16000.0	// counts into the command, 2x per cycle fits a short
+
+// fra_state
+#define FRA_IDLE		0
+#define FRA_SETTLING	1		// isr excites
+#define FRA_MEASURING	2		// isr excites and demodulates
+#define FRA_DONE		3		// point measured, background takes it
+#define FRA_STOPPED		4		// fault or servo disabled
+
+extern struct PID pid;
+extern struct COF cof;
+extern struct PWMTIMING pwm_timing;
+
+static volatile short fra_state;
+static short fra_where;				// FRA_OUTPUT or FRA_COMMAND
+static short fra_points, fra_next_point;
+static float fra_amp, fra_f1, fra_f2;
+
+// the point being measured, set up by the background while the isr
+// leaves it alone
+static float fra_coef;				// 2cos(w), w per servo cycle
+static float fra_y1, fra_y2;		// the sine this and last cycle
+static long fra_ofs;				// counts added to pid.command
+static long fra_fb0;				// feedback when measuring started
+static long fra_settle;				// servo cycles left to settle
+static short fra_every, fra_n;		// servo cycles per averaged sample
+static short fra_count;				// averaged samples left
+static short fra_samples;			// averaged samples in the point
+static float fra_sum[3];			// u or r, feedback, x or error
+static float fra_tot[3];			// sum of the averaged samples
+static float fra_gcoef;				// 2cos(w every)
+static float fra_g1[3], fra_g2[3];	// goertzel states
+
+/*********************************************************************
+  Function:        short fra_command(void)
+
+  PreCondition:    called from the pwm isr once per servo cycle before
+                   calc_pid()
+
+  Output:          counts to add to pid.command this cycle, takes the
+                   offset back out when the sine stops
+********************************************************************/
+short fra_command(void)
+{
+	long ofs = 0;
+	short d;
+
+	if ( fra_where == FRA_COMMAND &&
+		 (fra_state == FRA_SETTLING || fra_state == FRA_MEASURING) )
+		ofs = (long)(fra_y1 < 0.0 ? fra_y1 - 0.5 : fra_y1 + 0.5);
+	d = (short)(ofs - fra_ofs);
+	fra_ofs = ofs;
+	return d;
+}
+
+/*********************************************************************
+  Function:        float fra_output(void)
+
+  PreCondition:    called from the pwm isr once per servo cycle after
+                   calc_pid()
+
+  Output:          what to add to pid.output this cycle
+********************************************************************/
+float fra_output(void)
+{
+	if ( fra_where == FRA_OUTPUT &&
+		 (fra_state == FRA_SETTLING || fra_state == FRA_MEASURING) )
+		return fra_y1;
+	return 0.0;
+}
+
+/*********************************************************************
+  Function:        void fra_record(void)
+
+  PreCondition:    called from the pwm isr once per servo cycle after
+                   the output was set
+
+  Overview:        averages and demodulates the signals, steps the sine
+********************************************************************/
+void fra_record(void)
+{
+	float y;
+	short i;
+
+	if ( fra_state != FRA_SETTLING && fra_state != FRA_MEASURING )
+		return;
+	if ( cof.fault || !pid.enable )
+	{
+		// the command is zeroed again when the servo is restarted
+		fra_ofs = 0;
+		fra_state = FRA_STOPPED;
+		return;
+	}
+	if ( fra_state == FRA_SETTLING )
+	{
+		if ( --fra_settle <= 0 )
+		{
+			fra_fb0 = pid.feedback;
+			fra_state = FRA_MEASURING;
+		}
+	}
+	else
+	{
+		if ( fra_where == FRA_OUTPUT )
+		{
+			fra_sum[0] += pid.output;
+			fra_sum[2] += pid.output - fra_y1;
+		}
+		else
+		{
+			fra_sum[0] += (float)fra_ofs;
+			fra_sum[2] += pid.error;
+		}
+		fra_sum[1] += (float)(pid.feedback - fra_fb0);
+		if ( ++fra_n >= fra_every )
+		{
+			for ( i = 0; i < 3; i++ )
+			{
+				y = fra_sum[i] + fra_gcoef * fra_g1[i] - fra_g2[i];
+				fra_g2[i] = fra_g1[i];
+				fra_g1[i] = y;
+				fra_tot[i] += fra_sum[i];
+				fra_sum[i] = 0.0;
+			}
+			fra_n = 0;
+			if ( --fra_count <= 0 )
+				fra_state = FRA_DONE;
+		}
+	}
+	y = fra_coef * fra_y1 - fra_y2;
+	fra_y2 = fra_y1;
+	fra_y1 = y;
+}
+
+// w of a 2cos(w) coefficient, right for the small ones too
+static float coef_w(float coef)
+{
+	return 2.0 * asin(sqrt((1.0 - coef / 2.0) / 2.0));
+}
+
+/*********************************************************************
+  Function:        static void fra_setup(short k)
+
+  PreCondition:    the isr is not exciting (fra_state not SETTLING or
+                   MEASURING)
+
+  Overview:        loads point k and starts it
+********************************************************************/
+static void fra_setup(short k)
+{
+	float f, w, c, periods;
+	short i;
+
+	f = fra_f1;
+	if ( fra_points > 1 )
+		f *= pow(fra_f2 / fra_f1, (float)k / (fra_points - 1));
+	fra_coef = 2.0 * cos(2.0 * M_PI * f * pwm_timing.periodfp);
+	w = coef_w(fra_coef);
+	periods = 2.0 * M_PI / w;			// servo cycles per period
+	fra_every = (short)(periods / FRA_SPP);
+	if ( fra_every < 1 )
+		fra_every = 1;
+	fra_gcoef = 2.0 * cos(w * fra_every);
+	fra_count = (short)(FRA_PERIODS * periods / fra_every + 0.5);
+	if ( fra_count < FRA_MIN_SAMPLES )
+		fra_count = FRA_MIN_SAMPLES;
+	fra_samples = fra_count;
+	fra_settle = (long)(FRA_SETTLE * periods + 0.5);
+	if ( fra_settle < (long)(FRA_SETTLE_S * pwm_timing.periodrecip) )
+		fra_settle = (long)(FRA_SETTLE_S * pwm_timing.periodrecip);
+	// starts at 0 going up
+	c = fra_coef / 2.0;
+	fra_y1 = 0.0;
+	fra_y2 = -fra_amp * sqrt((1.0 - c) * (1.0 + c));
+	fra_n = 0;
+	for ( i = 0; i < 3; i++ )
+		fra_sum[i] = fra_tot[i] = fra_g1[i] = fra_g2[i] = 0.0;
+	fra_next_point = k + 1;
+	fra_state = FRA_SETTLING;
+}
+
+/*********************************************************************
+  Function:        short fra_result(struct FRAPOINT *p)
+
+  Overview:        background side of the run: takes a measured point
+                   and starts the next one
+
+  Output:          FRA_POINT with *p filled in, FRA_END when the run is
+                   over (p->f is 0 if it was stopped), 0 otherwise
+********************************************************************/
+short fra_result(struct FRAPOINT *p)
+{
+	float t, n, c, s, cp, sp, k0, a0, b0, yr, yi, zr, zi, re[3], im[3], d;
+	short i;
+
+	if ( fra_state == FRA_STOPPED )
+	{
+		fra_state = FRA_IDLE;
+		p->f = 0.0;
+		return FRA_END;
+	}
+	if ( fra_state != FRA_DONE )
+		return 0;
+
+	// the goertzel filter gives Y = X e^(jt(N-1)), X the dft at t of the
+	// N samples. A sine with an offset, x = o + Re(a e^(jtn)), has
+	//    X = o K + (a N + a* L) / 2,   sum x = o N + Re(a K*)
+	// K and L the sums of e^(-jtn) and e^(-2jtn). Solving for a takes
+	// out the leakage of the offset and of the negative frequency, so
+	// the point need not be whole periods long. What the three have in
+	// common is left out, it divides out of the ratios.
+	t = coef_w(fra_gcoef);
+	n = fra_samples;
+	c = fra_gcoef / 2.0;
+	s = sqrt((1.0 - c) * (1.0 + c));
+	cp = cos(t * (n - 1) / 2.0);
+	sp = -sin(t * (n - 1) / 2.0);
+	k0 = sin(n * t / 2.0) / sin(t / 2.0);
+	a0 = (n - k0 * k0 / n) / 2.0;
+	b0 = (sin(n * t) / s - k0 * k0 / n) / 2.0;
+	for ( i = 0; i < 3; i++ )
+	{
+		yr = fra_g1[i] - c * fra_g2[i];
+		yi = s * fra_g2[i];
+		zr = cp * yr - sp * yi - k0 * fra_tot[i] / n;
+		zi = sp * yr + cp * yi;
+		re[i] = (a0 - b0) * zr;
+		im[i] = (a0 + b0) * zi;
+	}
+	d = re[0] * re[0] + im[0] * im[0];
+	if ( d == 0.0 )
+		d = 1.0e-30;
+	p->f = coef_w(fra_coef) / (2.0 * M_PI * pwm_timing.periodfp);
+	p->re1 = (re[1] * re[0] + im[1] * im[0]) / d;
+	p->im1 = (im[1] * re[0] - re[1] * im[0]) / d;
+	p->re2 = (re[2] * re[0] + im[2] * im[0]) / d;
+	p->im2 = (im[2] * re[0] - re[2] * im[0]) / d;
+	if ( fra_where == FRA_OUTPUT )
+	{
+		p->re2 = -p->re2;
+		p->im2 = -p->im2;
+	}
+
+	if ( fra_next_point < fra_points )
+		fra_setup(fra_next_point);
+	else
+		fra_state = FRA_IDLE;
+	return FRA_POINT;
+}
+
+// the amplitude a run uses: % duty up to 100, counts up to FRA_AMP_MAX
+static float fra_limit(short where, float amp)
+{
+	if ( amp < 0.0 )
+		amp = -amp;
+	if ( where == FRA_OUTPUT && amp > 100.0 )
+		amp = 100.0;
+	if ( where == FRA_COMMAND && amp > FRA_AMP_MAX )
+		amp = FRA_AMP_MAX;
+	return amp;
+}
+
+/*********************************************************************
+  Function:        short fra_start(short where, float amp, float f1,
+                                   float f2, short points)
+
+  Input:           where  - FRA_OUTPUT or FRA_COMMAND
+                   amp    - sine amplitude, % duty or counts
+                   f1, f2 - first and last frequency, Hz
+                   points - log spaced from f1 to f2
+
+  Output:          1, or 0 if the frequencies are out of range (0 <
+                   f <= FRA_FMAX of the servo rate, at half of it the
+                   phase can not be seen)
+********************************************************************/
+short fra_start(short where, float amp, float f1, float f2, short points)
+{
+	const float fmax = FRA_FMAX * pwm_timing.periodrecip;
+
+	fra_state = FRA_IDLE;				// the isr leaves everything alone now
+	if ( f1 <= 0.0 || f2 <= 0.0 || f1 > fmax || f2 > fmax )
+		return 0;
+	if ( points < 1 )
+		points = 1;
+	if ( points > FRA_POINTS_MAX )
+		points = FRA_POINTS_MAX;
+	amp = fra_limit(where, amp);
+	fra_where = where;
+	fra_f1 = f1;
+	fra_f2 = f2;
+	fra_points = points;
+	fra_amp = where == FRA_OUTPUT ? amp * pid.maxerror / 100.0 : amp;
+	fra_setup(0);
+	return 1;
+}
+
+/*********************************************************************
+  Function:        void fra_stop(void)
+
+  Overview:        ends a run, the isr takes the command offset back out
+********************************************************************/
+void fra_stop(void)
+{
+	if ( fra_state != FRA_IDLE )
+		fra_state = FRA_STOPPED;
+}
+
+// gain in dB and phase in degrees of re + j im
+static void print_response(float re, float im)
+{
+	float m = sqrt(re * re + im * im);
+
+	printf(" ");
+	fx_print(m > 1.0e-20 ? 20.0 * log10(m) : -400.0, 2);
+	printf(" ");
+	fx_print(atan2(im, re) * 180.0 / M_PI, 1);
+}
+
+/*********************************************************************
+  Function:        void fra_begin(short where, float amp, float f1,
+                                   float f2, short points)
+
+  Overview:        the B command: starts a run and prints its header
+********************************************************************/
+void fra_begin(short where, float amp, float f1, float f2, short points)
+{
+	if ( amp == 0.0 )
+	{
+		fra_stop();
+		return;
+	}
+	if ( !fra_start(where, amp, f1, f2, points) )
+	{
+		printf("\r\nfrequencies must be over 0 and up to ");
+		fx_print(FRA_FMAX * pwm_timing.periodrecip, 1);
+		printf("Hz\r\n");
+		return;
+	}
+	printf("\r\n# fra %s ", where == FRA_OUTPUT ? "output" : "command");
+	fx_print(fra_limit(where, amp), 1);
+	printf("%s, %d points ", where == FRA_OUTPUT ? "%" : " counts", fra_points);
+	fx_print(f1, 2);
+	printf(" to ");
+	fx_print(f2, 2);
+	printf("Hz\r\n# Hz %s\r\n", where == FRA_OUTPUT ?
+		"plant dB deg loop dB deg" : "closed loop dB deg error dB deg");
+}
+
+/*********************************************************************
+  Function:        short fra_task(void)
+
+  Overview:        background task, prints the measured points
+********************************************************************/
+short fra_task(void)
+{
+	struct FRAPOINT p;
+	short r = fra_result(&p);
+
+	if ( r == 0 )
+		return 0;
+	bus_open(tb_now());
+	if ( r == FRA_POINT )
+	{
+		fx_print(p.f, 3);
+		print_response(p.re1, p.im1);
+		print_response(p.re2, p.im2);
+		printf("\r\n");
+		if ( fra_state == FRA_IDLE )
+			r = FRA_END;
+	}
+	if ( r == FRA_END )
+		printf("# fra end%s\r\n", p.f == 0.0 ? ", stopped" : "");
+	bus_close();
+	return 1;
+}
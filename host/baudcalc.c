@@ -0,0 +1,112 @@
+//---------------------------------------------------------------------
+//	File:		baudcalc.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: PC side table of the uart baud rates each oscillator setting
+//          can make, using the same U1BRG macros as serial.c.
+//
+//          baudcalc                  table for every oscillator setting
+//          baudcalc fcy [baud]       one oscillator / one rate
+//          baudcalc -c               check the macros pick the best U1BRG
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../baudrate.h"
+
+// oscillator settings listed in dspicservo.h
+static const long fcy_list[] = {
+	6000000L * 16 / 4,		// 6mhz xtal * pll16
+	14318000L * 8 / 4,		// 14.318mhz osc * pll8
+	7372800L * 16 / 4,		// 7.3728mhz xtal * pll16
+};
+
+static const long rates[] = BAUD_RATES;
+
+#define NUM(a)	(int)(sizeof(a) / sizeof(a[0]))
+
+static void print_rate(long fcy, long baud)
+{
+	long brg = UART_BRG(fcy, baud);
+	long err = UART_ERR_PM(fcy, baud);
+
+	printf("  %7ld  U1BRG=%4ld  actual %8ld  error %+5.1f%%  %s\n", baud, brg,
+		UART_BAUD(fcy, brg), err / 10.0,
+		brg < 0 || err > UART_ERR_MAX_PM || err < -UART_ERR_MAX_PM ? "NO" :
+		err > UART_ERR_WARN_PM || err < -UART_ERR_WARN_PM ? "marginal" : "ok");
+}
+
+static void print_table(long fcy)
+{
+	int i;
+
+	printf("fcy=%ld\n", fcy);
+	for ( i = 0; i < NUM(rates); i++ )
+		print_rate(fcy, rates[i]);
+}
+
+// the macro must give the U1BRG with the smallest error
+static int check(void)
+{
+	int i, f, bad = 0;
+	long fcy, brg, b;
+	double e, best;
+
+	for ( f = 0; f < NUM(fcy_list); f++ )
+	{
+		fcy = fcy_list[f];
+		for ( i = 0; i < NUM(rates); i++ )
+		{
+			brg = UART_BRG(fcy, rates[i]);
+			best = 1e9;
+			for ( b = 0; b < 65536; b++ )
+			{
+				e = fabs((double)fcy / (16.0 * (b + 1)) - rates[i]);
+				if ( e < best )
+					best = e;
+			}
+			e = fabs((double)fcy / (16.0 * (brg + 1)) - rates[i]);
+			if ( e > best )
+			{
+				printf("FAIL fcy=%ld baud=%ld U1BRG=%ld is not the closest\n",
+					fcy, rates[i], brg);
+				bad++;
+			}
+		}
+	}
+	printf("%s\n", bad ? "FAILED" : "all U1BRG values are the closest");
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	if ( argc > 1 && argv[1][0] == '-' )
+	{
+		if ( argv[1][1] == 'c' )
+			return check();
+		fprintf(stderr, "usage: baudcalc [-c] [fcy [baud]]\n");
+		return 2;
+	}
+	if ( argc > 2 )
+	{
+		print_rate(atol(argv[1]), atol(argv[2]));
+		return 0;
+	}
+	if ( argc > 1 )
+	{
+		print_table(atol(argv[1]));
+		return 0;
+	}
+	for ( i = 0; i < NUM(fcy_list); i++ )
+		print_table(fcy_list[i]);
+	return 0;
+}
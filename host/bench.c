@@ -0,0 +1,579 @@
+//---------------------------------------------------------------------
+//	File:		bench.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Cost of the hot kernels of the firmware: calc_pid(),
+//          set_pwm_error(), the pc command edge isr of capture.c and
+//          calc_cksum(). Each one runs on its own, built for the pc as
+//          in servosim, over fixed input sets.
+//
+//          bench [-j out.json] [-b base.json] [listing.s ...]
+//              times every kernel and input set in BATCHES batches of
+//              a few ms and prints ns per call: mean with its 95%
+//              confidence interval, median and fastest batch. The
+//              edge isr is called the way the simulation takes an
+//              interrupt, the isr row gives that overhead alone.
+//              XC16 listings (make listings, xc16-gcc -S) of the
+//              firmware add a dsPIC estimate per function: instructions
+//              in it, cycles of one pass without taken branches or
+//              loops, and the support routines it calls, which is
+//              where the float math goes.
+//              -j writes it all as json, -b compares with an earlier
+//              json and gives exit status 1 if a kernel is slower by
+//              more than the noise of both runs and 10%.
+//          bench -c
+//              self check: the kernels give the right answers on their
+//              sets and a small listing is counted right
+//
+//          The pc numbers are for comparing one build with another on
+//          the same pc, the card's are the listing's.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include "../dspicservo.h"
+#include "sim.h"
+
+#define SET_LEN		1024			// inputs per set, used round robin
+#define BATCHES		31
+#define BATCH_NS	2.0e6			// at least this long
+#define T95			2.042			// student t, 30 degrees of freedom
+#define MAX_KERNELS	16
+#define MAX_FUNCS	64
+#define MAX_CALLED	12
+
+// the firmware's
+extern struct PID pid;
+extern struct PWMTIMING pwm_timing;
+extern volatile unsigned short cmd_posn, cmd_err;
+extern short calc_cksum(short sizew, short *adr);
+void set_pwm_error(float posn_error);
+void calc_pid(void);
+void init_pid(void);
+void _IC1Interrupt(void);
+
+struct RESULT{
+	const char *name;				// the function
+	const char *set;
+	long calls;						// per batch
+	double ns, ci95, median, min;	// per call
+};
+
+struct FUNC{
+	char name[48];
+	int instructions;
+	int cycles;						// one pass, no taken branches
+	int ncalled;
+	char called[MAX_CALLED][32];
+	int times[MAX_CALLED];
+};
+
+/*
+ * the input sets, the same every run
+ */
+static long cmd_in[SET_LEN], fb_in[SET_LEN];
+static float err_in[SET_LEN];
+static unsigned short portd_in[SET_LEN];
+static short words[512];
+static unsigned long lcg = 12345;
+static volatile short sink;
+
+static long rnd(long n)
+{
+	lcg = lcg * 1103515245 + 12345;
+	return (long)((lcg >> 8) % (unsigned long)n);
+}
+
+static const char *pid_set(int k)
+{
+	static const char *const name[] = { "hold", "move", "limit" };
+	long c = 0;
+	int i;
+
+	lcg = 12345 + k;
+	for ( i = 0; i < SET_LEN; i++ )
+	{
+		if ( k == 1 )
+			c += 10;
+		cmd_in[i] = c;
+		fb_in[i] = c - (k == 0 ? rnd(5) - 2 : k == 1 ? 20 + rnd(9) : 5000 + rnd(1000));
+	}
+	return name[k];
+}
+
+static const char *err_set(int k)
+{
+	static const char *const name[] = { "small", "limit" };
+	int i;
+
+	lcg = 23456 + k;
+	for ( i = 0; i < SET_LEN; i++ )
+		err_in[i] = k == 0 ? rnd(101) - 50 : rnd(10001) - 5000;
+	return name[k];
+}
+
+// RD1:RD0 of a pc command going forward, dithering back and forth, and
+// too fast for the edge isr (both bits change)
+static const char *edge_set(int k)
+{
+	static const char *const name[] = { "forward", "dither", "overspeed" };
+	static const unsigned char gray[4] = { 0, 1, 3, 2 };
+	int i;
+
+	for ( i = 0; i < SET_LEN; i++ )
+		portd_in[i] = gray[(k == 0 ? i : k == 1 ? i & 1 : 2 * i) & 3];
+	return name[k];
+}
+
+/*
+ * the kernels, n calls over their set
+ */
+static void run_pid(long n)
+{
+	long i;
+
+	for ( i = 0; i < n; i++ )
+	{
+		pid.command = cmd_in[i & (SET_LEN - 1)];
+		pid.feedback = fb_in[i & (SET_LEN - 1)];
+		calc_pid();
+	}
+}
+
+static void run_pwm(long n)
+{
+	long i;
+
+	for ( i = 0; i < n; i++ )
+		set_pwm_error(err_in[i & (SET_LEN - 1)]);
+}
+
+static void run_edge(long n)
+{
+	long i;
+
+	for ( i = 0; i < n; i++ )
+	{
+		PORTD = portd_in[i & (SET_LEN - 1)];
+		sim_isr(_IC1Interrupt);
+	}
+}
+
+static void empty_isr(void)
+{
+}
+
+static void run_isr(long n)
+{
+	long i;
+
+	for ( i = 0; i < n; i++ )
+	{
+		PORTD = portd_in[i & (SET_LEN - 1)];
+		sim_isr(empty_isr);
+	}
+}
+
+static short cksum_words;
+
+static void run_cksum(long n)
+{
+	long i;
+
+	for ( i = 0; i < n; i++ )
+		sink = calc_cksum(cksum_words, words);
+}
+
+static double now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1.0e9 + t.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double d = *(const double *)a - *(const double *)b;
+
+	return d < 0.0 ? -1 : d > 0.0;
+}
+
+/*********************************************************************
+  Function:        void measure(struct RESULT *r, void (*run)(long))
+
+  Overview:        sizes a batch to BATCH_NS, then times BATCHES of them
+********************************************************************/
+static void measure(struct RESULT *r, void (*run)(long))
+{
+	double t, ns[BATCHES], sum = 0.0, ss = 0.0;
+	long n = 64;
+	int k;
+
+	run(n);							// warm up
+	for ( ;; )
+	{
+		t = now_ns();
+		run(n);
+		t = now_ns() - t;
+		if ( t >= BATCH_NS || n > (1L << 30) )
+			break;
+		n = t > BATCH_NS / 64 ? (long)(n * BATCH_NS / t) + 1 : n * 64;
+	}
+	for ( k = 0; k < BATCHES; k++ )
+	{
+		t = now_ns();
+		run(n);
+		ns[k] = (now_ns() - t) / n;
+		sum += ns[k];
+	}
+	r->calls = n;
+	r->ns = sum / BATCHES;
+	for ( k = 0; k < BATCHES; k++ )
+		ss += (ns[k] - r->ns) * (ns[k] - r->ns);
+	r->ci95 = T95 * sqrt(ss / (BATCHES - 1)) / sqrt(BATCHES);
+	qsort(ns, BATCHES, sizeof(ns[0]), cmp_double);
+	r->median = ns[BATCHES / 2];
+	r->min = ns[0];
+}
+
+static void setup(void)
+{
+	int k;
+
+	init_pid();
+	pid.pgain = 25.0;
+	pid.igain = 0.5;
+	pid.dgain = 0.04;
+	pid.ff1gain = 0.001;
+	pid.maxerror = 1000.0;
+	calc_pwm_timing(FCY, FPWM, PWM_POST, TICKS_MIN, &pwm_timing);
+	for ( k = 0; k < (int)(sizeof(words) / sizeof(words[0])); k++ )
+		words[k] = (short)(k * 40503);
+}
+
+// every kernel on every set
+static int bench_all(struct RESULT *r)
+{
+	int n = 0, k;
+
+	setup();
+	for ( k = 0; k < 3; k++ )
+	{
+		r[n].name = "calc_pid";
+		r[n].set = pid_set(k);
+		measure(&r[n++], run_pid);
+	}
+	for ( k = 0; k < 2; k++ )
+	{
+		r[n].name = "set_pwm_error";
+		r[n].set = err_set(k);
+		measure(&r[n++], run_pwm);
+	}
+	for ( k = 0; k < 3; k++ )
+	{
+		r[n].name = "_IC1Interrupt";
+		r[n].set = edge_set(k);
+		measure(&r[n++], run_edge);
+	}
+	r[n].name = "isr";
+	r[n].set = "empty";
+	measure(&r[n++], run_isr);
+	r[n].name = "calc_cksum";
+	r[n].set = "params";
+	cksum_words = offsetof(struct PID, cksum) / sizeof(short);
+	measure(&r[n++], run_cksum);
+	r[n].name = "calc_cksum";
+	r[n].set = "512words";
+	cksum_words = 512;
+	measure(&r[n++], run_cksum);
+	return n;
+}
+
+/*
+ * dsPIC estimate from an XC16 listing
+ */
+// cycles of one pass through an instruction, branches not taken
+static int cycles(const char *op, const char *args, int *repeat)
+{
+	static const char *const two[] = { "goto", "call", "rcall", "do", "tblrdl", "tblrdh",
+		"tblwtl", "tblwth", "mov.d", "push.d", "pop.d", 0 };
+	int k, n = 1;
+
+	if ( strcmp(op, "return") == 0 || strcmp(op, "retfie") == 0 || strcmp(op, "retlw") == 0 )
+		n = 3;
+	else if ( strcmp(op, "bra") == 0 )
+		n = strchr(args, ',') ? 1 : 2;			// conditional or not
+	else
+		for ( k = 0; two[k]; k++ )
+			if ( strcmp(op, two[k]) == 0 )
+				n = 2;
+	if ( *repeat )
+	{
+		n *= *repeat;
+		*repeat = 0;
+	}
+	if ( strcmp(op, "repeat") == 0 && args[0] == '#' )
+		*repeat = atoi(args + 1) + 1;
+	return n;
+}
+
+static int read_listing(FILE *f, struct FUNC *fn, int nfn)
+{
+	char line[256], op[32], args[128], *p;
+	struct FUNC *cur = 0;
+	int repeat = 0, k;
+
+	while ( fgets(line, sizeof(line), f) )
+	{
+		if ( (p = strchr(line, ';')) != 0 )
+			*p = 0;
+		if ( line[0] == '_' && (p = strchr(line, ':')) != 0 )
+		{
+			// a function, its C name without the leading _
+			cur = 0;
+			*p = 0;
+			if ( nfn < MAX_FUNCS )
+			{
+				cur = &fn[nfn++];
+				memset(cur, 0, sizeof(*cur));
+				snprintf(cur->name, sizeof(cur->name), "%.47s", line + 1);
+			}
+			repeat = 0;
+			continue;
+		}
+		args[0] = 0;
+		if ( cur == 0 || (line[0] != '\t' && line[0] != ' ') ||
+			 sscanf(line, " %31s %127[^\n]", op, args) < 1 || op[0] == '.' )
+		{
+			if ( cur && strstr(line, ".size") )
+				cur = 0;
+			continue;
+		}
+		cur->instructions++;
+		cur->cycles += cycles(op, args, &repeat);
+		if ( (strcmp(op, "call") == 0 || strcmp(op, "rcall") == 0) && args[0] == '_' )
+		{
+			for ( p = args; *p && *p != ' ' && *p != '\t'; p++ )
+				;
+			*p = 0;
+			for ( k = 0; k < cur->ncalled && strcmp(cur->called[k], args + 1); k++ )
+				;
+			if ( k == cur->ncalled && k < MAX_CALLED )
+				snprintf(cur->called[cur->ncalled++], sizeof(cur->called[0]), "%.31s", args + 1);
+			if ( k < MAX_CALLED )
+				cur->times[k]++;
+		}
+	}
+	return nfn;
+}
+
+static void print_funcs(FILE *f, const struct FUNC *fn, int nfn, int json)
+{
+	int k, j;
+
+	for ( k = 0; k < nfn; k++ )
+	{
+		if ( json )
+			fprintf(f, "    {\"function\": \"%s\", \"instructions\": %d, \"cycles\": %d, \"calls\": {",
+				fn[k].name, fn[k].instructions, fn[k].cycles);
+		else
+			fprintf(f, "%-24s %5d %6d  ", fn[k].name, fn[k].instructions, fn[k].cycles);
+		for ( j = 0; j < fn[k].ncalled; j++ )
+			fprintf(f, json ? "%s\"%s\": %d" : "%s%s x%d", j ? (json ? ", " : " ") : "",
+				fn[k].called[j], fn[k].times[j]);
+		fprintf(f, json ? "}}%s\n" : "\n", k < nfn - 1 ? "," : "");
+	}
+}
+
+/*
+ * results
+ */
+static void write_json(FILE *f, const struct RESULT *r, int n, const struct FUNC *fn, int nfn)
+{
+	struct utsname u;
+	time_t t = time(0);
+	char date[32];
+	int k;
+
+	uname(&u);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+	fprintf(f, "{\n  \"bench\": 1,\n  \"date\": \"%s\",\n  \"host\": \"%s %s\",\n"
+		"  \"compiler\": \"%s\",\n  \"batches\": %d,\n  \"kernels\": [\n",
+		date, u.sysname, u.machine, __VERSION__, BATCHES);
+	for ( k = 0; k < n; k++ )
+		fprintf(f, "    {\"name\": \"%s\", \"set\": \"%s\", \"calls\": %ld, \"ns\": %.3f, "
+			"\"ci95\": %.3f, \"median\": %.3f, \"min\": %.3f}%s\n", r[k].name, r[k].set,
+			r[k].calls, r[k].ns, r[k].ci95, r[k].median, r[k].min, k < n - 1 ? "," : "");
+	fprintf(f, "  ],\n  \"dspic\": [\n");
+	print_funcs(f, fn, nfn, 1);
+	fprintf(f, "  ]\n}\n");
+}
+
+// compares with an earlier json, the number of kernels slower now
+static int compare(const char *path, const struct RESULT *r, int n)
+{
+	char line[512], name[48], set[48];
+	double ns, ci;
+	FILE *f = fopen(path, "r");
+	int k, slower = 0;
+
+	if ( f == 0 )
+	{
+		perror(path);
+		return 1;
+	}
+	printf("\nagainst %s:\n", path);
+	while ( fgets(line, sizeof(line), f) )
+	{
+		if ( sscanf(line, " {\"name\": \"%47[^\"]\", \"set\": \"%47[^\"]\", \"calls\": %*d, "
+					"\"ns\": %lf, \"ci95\": %lf", name, set, &ns, &ci) != 4 )
+			continue;
+		for ( k = 0; k < n && (strcmp(r[k].name, name) || strcmp(r[k].set, set)); k++ )
+			;
+		if ( k == n )
+			continue;
+		printf("%-14s %-9s %9.1f %9.1f  %+6.1f%%", name, set, ns, r[k].ns, 100.0 * (r[k].ns - ns) / ns);
+		if ( r[k].ns - ns > r[k].ci95 + ci && r[k].ns > 1.10 * ns )
+		{
+			printf("  SLOWER");
+			slower++;
+		}
+		printf("\n");
+	}
+	fclose(f);
+	return slower;
+}
+
+static int check(void)
+{
+	static const char listing[] =
+		"\t.section\t.text,code\n"
+		"\t.align\t2\n"
+		"\t.global\t_calc_cksum\t; export\n"
+		"\t.type\t_calc_cksum,@function\n"
+		"_calc_cksum:\n"
+		"\t.set ___PA___,1\n"
+		"\tclr\tw2\n"
+		"\tcp0\tw0\n"
+		"\tbra\tle,.L2\n"
+		"\trepeat\t#17\n"
+		"\tdiv.sw\tw4,w5\n"
+		"\trcall\t___addsf3\n"
+		".L3:\n"
+		"\tadd\tw2,[w1++],w2\n"
+		"\tdec\tw0,w0\n"
+		"\tbra\tnz,.L3\n"
+		".L2:\n"
+		"\tmov\tw2,w0\t; result\n"
+		"\treturn\n"
+		"\t.size\t_calc_cksum, .-_calc_cksum\n";
+	struct FUNC fn[MAX_FUNCS];
+	FILE *f = fmemopen((void *)listing, sizeof(listing) - 1, "r");
+	short w[4] = { 1, -2, 300, 4000 };
+	int bad = 0, k;
+
+	setup();
+	if ( f == 0 || read_listing(f, fn, 0) != 1 || strcmp(fn[0].name, "calc_cksum") ||
+		 fn[0].instructions != 11 || fn[0].cycles != 31 || fn[0].ncalled != 1 ||
+		 strcmp(fn[0].called[0], "__addsf3") || fn[0].times[0] != 1 )
+	{
+		printf("FAIL listing counted as %d instructions, %d cycles\n", fn[0].instructions, fn[0].cycles);
+		bad++;
+	}
+	if ( f )
+		fclose(f);
+
+	if ( calc_cksum(4, w) != 4299 )
+		bad += printf("FAIL calc_cksum\n") > 0;
+	pid_set(2);
+	run_pid(1);
+	if ( pid.output < 25.0 * 5000.0 )
+		bad += printf("FAIL calc_pid output %g for %.0f counts\n", pid.output, pid.error) > 0;
+	set_pwm_error(500.0);
+	if ( abs(PDC1 - pwm_timing.pdcmax / 2) > 1 || PDC3 != 0 )
+		bad += printf("FAIL set_pwm_error duty %u %u\n", PDC1, PDC3) > 0;
+	set_pwm_error(-5000.0);
+	if ( PDC1 != 0 || PDC3 != pwm_timing.pdcmax )
+		bad += printf("FAIL set_pwm_error limit %u %u\n", PDC1, PDC3) > 0;
+	for ( k = 0; k < 3; k++ )
+	{
+		edge_set(k);
+		PORTD = portd_in[SET_LEN - 1];
+		sim_isr(_IC1Interrupt);
+		cmd_posn = cmd_err = 0;
+		run_edge(100);
+		if ( k == 0 ? cmd_posn != 100 || cmd_err : k == 1 ? cmd_posn != 0 || cmd_err : cmd_err != 100 )
+			bad += printf("FAIL edge isr set %d: cmd_posn %u cmd_err %u\n", k, cmd_posn, cmd_err) > 0;
+	}
+	printf("%d failures\n", bad);
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	static struct RESULT r[MAX_KERNELS];
+	static struct FUNC fn[MAX_FUNCS];
+	const char *json = 0, *base = 0;
+	FILE *f;
+	int c, k, n, nfn = 0, res = 0;
+
+	while ( (c = getopt(argc, argv, "b:cj:")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'b': base = optarg; break;
+		case 'c': return check();
+		case 'j': json = optarg; break;
+		default:
+			fprintf(stderr, "usage: bench [-j out.json] [-b base.json] [listing.s ...]\n"
+				"       bench -c\n");
+			return 2;
+		}
+	}
+	for ( ; optind < argc; optind++ )
+	{
+		if ( (f = fopen(argv[optind], "r")) == 0 )
+		{
+			perror(argv[optind]);
+			return 1;
+		}
+		nfn = read_listing(f, fn, nfn);
+		fclose(f);
+	}
+
+	n = bench_all(r);
+	printf("%-14s %-9s %9s %7s %9s %9s\n", "kernel", "set", "ns/call", "+-95%", "median", "min");
+	for ( k = 0; k < n; k++ )
+		printf("%-14s %-9s %9.2f %7.2f %9.2f %9.2f\n", r[k].name, r[k].set, r[k].ns,
+			r[k].ci95, r[k].median, r[k].min);
+	if ( nfn )
+	{
+		printf("\n%-24s %5s %6s  %s\n", "dspic function", "instr", "cycles", "calls");
+		print_funcs(stdout, fn, nfn, 0);
+	}
+	if ( json )
+	{
+		if ( (f = fopen(json, "w")) == 0 )
+		{
+			perror(json);
+			return 1;
+		}
+		write_json(f, r, n, fn, nfn);
+		fclose(f);
+	}
+	if ( base )
+		res = compare(base, r, n) != 0;
+	return res;
+}
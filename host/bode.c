@@ -0,0 +1,412 @@
+//---------------------------------------------------------------------
+//	File:		bode.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Reads what the B command of the firmware (fra.c) prints
+//          and gives the margins of the loop, so notch filters can be
+//          placed and the phase margin checked without an analyzer on
+//          the pwm3l error output.
+//
+//          bode [log]
+//              reads a console log (stdin without one), the last B run
+//              in it if there are several, and prints its points with
+//              the phase unwrapped, then
+//                 output run:  gain crossover and phase margin, phase
+//                              crossover and gain margin of the loop
+//                 command run: closed loop -3dB bandwidth and peak,
+//                              peak of the sensitivity
+//              e.g. on the console
+//                 B5 2 1000 30      open loop, 5% duty at the pid output
+//                 B50 2 1000 30 1   closed loop, 50 counts of command
+//          bode -c
+//              self check: the firmware's demodulator driven by known
+//              discrete transfer functions, then the firmware measuring
+//              the simulated servo both ways, where the closed loop has
+//              to match the one the open loop gives
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <unistd.h>
+#include "../dspicservo.h"
+#include "sim.h"
+
+#define MAX_POINTS	FRA_POINTS_MAX
+
+struct POINT{
+	double f;					// Hz
+	double g1, p1;				// H1 dB and degrees
+	double g2, p2;				// H2
+};
+
+struct RUN{
+	int where;					// FRA_OUTPUT or FRA_COMMAND
+	int n;
+	struct POINT pt[MAX_POINTS];
+};
+
+// the firmware's, for the check
+extern struct PID pid;
+extern struct COF cof;
+extern struct PWMTIMING pwm_timing;
+
+static int read_log(FILE *f, struct RUN *r)
+{
+	char line[256], *p;
+	struct POINT pt;
+	int on = 0;
+
+	r->n = 0;
+	while ( fgets(line, sizeof(line), f) )
+	{
+		if ( (p = strstr(line, "# fra ")) != 0 )
+		{
+			if ( strncmp(p, "# fra output", 12) == 0 || strncmp(p, "# fra command", 13) == 0 )
+			{
+				r->where = p[6] == 'o' ? FRA_OUTPUT : FRA_COMMAND;
+				r->n = 0;
+				on = 1;
+			}
+			else if ( strncmp(p, "# fra end", 9) == 0 )
+				on = 0;
+			continue;
+		}
+		// the first point can come right after the prompt
+		for ( p = line; *p == '>'; p++ )
+			;
+		if ( on && r->n < MAX_POINTS &&
+			 sscanf(p, "%lf %lf %lf %lf %lf", &pt.f, &pt.g1, &pt.p1, &pt.g2, &pt.p2) == 5 )
+			r->pt[r->n++] = pt;
+	}
+	return r->n;
+}
+
+// keeps the phase within 180 degrees of the point before
+static void unwrap(struct RUN *r)
+{
+	int k;
+
+	for ( k = 1; k < r->n; k++ )
+	{
+		while ( r->pt[k].p1 - r->pt[k - 1].p1 > 180.0 )
+			r->pt[k].p1 -= 360.0;
+		while ( r->pt[k].p1 - r->pt[k - 1].p1 < -180.0 )
+			r->pt[k].p1 += 360.0;
+		while ( r->pt[k].p2 - r->pt[k - 1].p2 > 180.0 )
+			r->pt[k].p2 -= 360.0;
+		while ( r->pt[k].p2 - r->pt[k - 1].p2 < -180.0 )
+			r->pt[k].p2 += 360.0;
+	}
+}
+
+// where y (of H2 gain if gain, else its phase) first falls through
+// level, on a log frequency axis. 0 if it does not.
+static double crossing(const struct RUN *r, int gain, double level, int *at)
+{
+	double a, b, t;
+	int k;
+
+	for ( k = 1; k < r->n; k++ )
+	{
+		a = gain ? r->pt[k - 1].g2 : r->pt[k - 1].p2;
+		b = gain ? r->pt[k].g2 : r->pt[k].p2;
+		if ( a >= level && b < level )
+		{
+			t = (a - level) / (a - b);
+			*at = k;
+			return r->pt[k - 1].f * pow(r->pt[k].f / r->pt[k - 1].f, t);
+		}
+	}
+	return 0.0;
+}
+
+// value of H2 phase (or gain) at frequency f, log interpolated
+static double at_f(const struct RUN *r, int gain, double f, int k)
+{
+	double t = log(f / r->pt[k - 1].f) / log(r->pt[k].f / r->pt[k - 1].f);
+
+	if ( gain )
+		return r->pt[k - 1].g2 + t * (r->pt[k].g2 - r->pt[k - 1].g2);
+	return r->pt[k - 1].p2 + t * (r->pt[k].p2 - r->pt[k - 1].p2);
+}
+
+struct MARGINS{
+	double fc, pm;				// gain crossover, phase margin
+	double f180, gm;			// phase crossover, gain margin
+	double fbw, peak;			// closed loop -3dB, its peak dB
+	double speak;				// sensitivity peak dB
+};
+
+static void margins(struct RUN *r, struct MARGINS *m)
+{
+	int k;
+
+	memset(m, 0, sizeof(*m));
+	unwrap(r);
+	if ( r->where == FRA_OUTPUT )
+	{
+		if ( (m->fc = crossing(r, 1, 0.0, &k)) != 0.0 )
+			m->pm = 180.0 + at_f(r, 0, m->fc, k);
+		if ( (m->f180 = crossing(r, 0, -180.0, &k)) != 0.0 )
+			m->gm = -at_f(r, 1, m->f180, k);
+		return;
+	}
+	m->peak = m->speak = -1.0e9;
+	for ( k = 0; k < r->n; k++ )
+	{
+		if ( r->pt[k].g1 > m->peak )
+			m->peak = r->pt[k].g1;
+		if ( r->pt[k].g2 > m->speak )
+			m->speak = r->pt[k].g2;
+		if ( m->fbw == 0.0 && k > 0 && r->pt[k].g1 < -3.0 && r->pt[k - 1].g1 >= -3.0 )
+			m->fbw = r->pt[k - 1].f * pow(r->pt[k].f / r->pt[k - 1].f,
+				(r->pt[k - 1].g1 + 3.0) / (r->pt[k - 1].g1 - r->pt[k].g1));
+	}
+}
+
+static void print_run(FILE *o, struct RUN *r)
+{
+	struct MARGINS m;
+	int k;
+
+	margins(r, &m);
+	fprintf(o, "# %s\n", r->where == FRA_OUTPUT ?
+		"Hz  plant dB deg  open loop dB deg" : "Hz  closed loop dB deg  sensitivity dB deg");
+	for ( k = 0; k < r->n; k++ )
+		fprintf(o, "%9.3f %8.2f %7.1f %8.2f %7.1f\n", r->pt[k].f, r->pt[k].g1, r->pt[k].p1,
+			r->pt[k].g2, r->pt[k].p2);
+	if ( r->where == FRA_OUTPUT )
+	{
+		if ( m.fc != 0.0 )
+			fprintf(o, "# gain crossover %.1fHz, phase margin %.1f deg\n", m.fc, m.pm);
+		else
+			fprintf(o, "# no gain crossover in the sweep\n");
+		if ( m.f180 != 0.0 )
+			fprintf(o, "# phase crossover %.1fHz, gain margin %.1fdB\n", m.f180, m.gm);
+		else
+			fprintf(o, "# no phase crossover in the sweep\n");
+	}
+	else
+	{
+		if ( m.fbw != 0.0 )
+			fprintf(o, "# bandwidth %.1fHz", m.fbw);
+		else
+			fprintf(o, "# bandwidth over the sweep");
+		fprintf(o, ", closed loop peak %.2fdB, sensitivity peak %.2fdB\n", m.peak, m.speak);
+	}
+}
+
+/*********************************************************************
+  Check 1: the demodulator. fra.c's isr side runs against a discrete
+  plant here instead of the pwm isr, so what it measures can be held
+  against the plant's H(e^jwT).
+********************************************************************/
+
+// y[n] = a y[n-1] + b x[n-d], d up to 7
+struct LAG{
+	double a, b;
+	int d;
+	double y, x[8];
+};
+
+static double lag_step(struct LAG *l, double x)
+{
+	memmove(&l->x[1], &l->x[0], 7 * sizeof(double));
+	l->x[0] = x;
+	l->y = l->a * l->y + l->b * l->x[l->d];
+	return l->y;
+}
+
+static double complex lag_h(const struct LAG *l, double w)
+{
+	double complex z = cexp(-I * w);
+
+	return l->b * cpow(z, l->d) / (1.0 - l->a * z);
+}
+
+static int close_to(const char *what, double f, double complex got, double complex want)
+{
+	double dg = 20.0 * log10(cabs(got) / cabs(want));
+	double dp = carg(got / want) * 180.0 / M_PI;
+
+	if ( fabs(dg) <= 0.05 && fabs(dp) <= 0.5 )
+		return 0;
+	printf("FAIL %s at %.3fHz: %.3fdB %.2fdeg off\n", what, f, dg, dp);
+	return 1;
+}
+
+// runs fra over f1..f2 with the lag between the injection and the
+// feedback, a proportional loop of gain k around it
+static int check_demod(const char *what, short where, double amp, struct LAG *l, double k)
+{
+	struct FRAPOINT p;
+	double complex h, got1, got2;
+	double u = 0.0, w;
+	long cycles = 0;
+	int bad = 0, points = 0;
+	short r;
+
+	memset(l->x, 0, sizeof(l->x));
+	l->y = 0.0;
+	pid.command = pid.feedback = 0;
+	if ( !fra_start(where, amp, 1.0, 1500.0, 25) )
+		return 1;
+	for ( ;; )
+	{
+		// as the pwm isr does it
+		pid.command += fra_command();
+		pid.feedback = lround(lag_step(l, where == FRA_OUTPUT ? u : (double)pid.command));
+		pid.error = pid.command - pid.feedback;
+		pid.output = -k * pid.feedback;
+		pid.output += fra_output();
+		u = pid.output;
+		fra_record();
+		cycles++;
+		if ( (r = fra_result(&p)) == FRA_POINT )
+		{
+			w = 2.0 * M_PI * p.f * pwm_timing.periodfp;
+			h = lag_h(l, w);
+			got1 = p.re1 + I * p.im1;
+			got2 = p.re2 + I * p.im2;
+			if ( where == FRA_OUTPUT )
+			{
+				h *= cexp(-I * w);		// the plant gets last cycle's output
+				bad += close_to(what, p.f, got1, h);
+				bad += close_to(what, p.f, got2, k * h);
+			}
+			else
+			{
+				bad += close_to(what, p.f, got1, h);
+				bad += close_to(what, p.f, got2, 1.0 - h);
+			}
+			points++;
+		}
+		if ( r == FRA_END || (r == FRA_POINT && points == 25) || cycles > 10000000 )
+			break;
+	}
+	if ( points != 25 )
+	{
+		printf("FAIL %s: %d points measured\n", what, points);
+		bad++;
+	}
+	return bad;
+}
+
+/*********************************************************************
+  Check 2: the firmware in the simulation, open loop then closed loop
+  of the same tuning. T = L / (1 + L) has to hold between them.
+********************************************************************/
+static int sim_sweep(const char *cmd, struct RUN *r)
+{
+	double t = sim_time() + 30.0;
+	FILE *log;
+
+	sim_clear();
+	sim_send(cmd);
+	while ( sim_time() < t && !strstr(sim_output(), "# fra end") )
+		sim_run(sim_time() + 0.1);
+	if ( (log = fmemopen((void *)sim_output(), strlen(sim_output()), "r")) == 0 )
+		return 0;
+	read_log(log, r);
+	fclose(log);
+	return strstr(sim_output(), "# fra end") != 0 ? r->n : 0;
+}
+
+static int check_sim(void)
+{
+	static struct RUN ol, cl;
+	struct MARGINS m;
+	double complex l, t;
+	int bad = 0, k;
+
+	// a fine encoder, a coarse one does not see the motor move at the
+	// higher frequencies
+	sim_start();
+	motor_parse(&sim_motor, "cpr=20000");
+	sim_run(1.0);
+	sim_send("\rp2.5\rd0.004\rf10000\r");
+	sim_run(sim_time() + 0.5);
+	if ( sim_sweep("B20 5 100 12\r", &ol) != 12 || sim_sweep("B200 5 100 12 1\r", &cl) != 12 )
+	{
+		printf("FAIL simulation: sweeps did not finish, %d and %d points\n", ol.n, cl.n);
+		return 1;
+	}
+	for ( k = 0; k < ol.n; k++ )
+	{
+		l = pow(10.0, ol.pt[k].g2 / 20.0) * cexp(I * ol.pt[k].p2 * M_PI / 180.0);
+		t = pow(10.0, cl.pt[k].g1 / 20.0) * cexp(I * cl.pt[k].p1 * M_PI / 180.0);
+		if ( fabs(ol.pt[k].f - cl.pt[k].f) > 1.0e-3 * ol.pt[k].f ||
+			 cabs(t - l / (1.0 + l)) > 0.1 * cabs(l / (1.0 + l)) + 0.02 )
+		{
+			printf("FAIL simulation at %.3fHz: closed loop %.2fdB %.1fdeg, open loop gives %.2fdB %.1fdeg\n",
+				cl.pt[k].f, cl.pt[k].g1, cl.pt[k].p1, 20.0 * log10(cabs(l / (1.0 + l))),
+				carg(l / (1.0 + l)) * 180.0 / M_PI);
+			bad++;
+		}
+	}
+	margins(&ol, &m);
+	printf("simulated servo: gain crossover %.1fHz, phase margin %.1f deg\n", m.fc, m.pm);
+	return bad;
+}
+
+static int check(void)
+{
+	struct LAG lag = { 0.95, 0.05, 1 }, slow = { 0.99, 0.01, 3 }, fast = { 0.5, 0.5, 1 };
+	int bad = 0;
+
+	calc_pwm_timing(FCY, FPWM, PWM_POST, TICKS_MIN, &pwm_timing);
+	pid.enable = 1;
+	pid.maxerror = 1000.0;
+	cof.fault = 0;
+	bad += check_demod("closed loop of a lag", FRA_COMMAND, 10000.0, &lag, 0.0);
+	bad += check_demod("closed loop of a lag and delay", FRA_COMMAND, 10000.0, &slow, 0.0);
+	bad += check_demod("plant in a loop", FRA_OUTPUT, 100.0, &fast, 0.5);
+	bad += check_sim();
+	printf("4 sweeps checked, %d failures\n", bad);
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	static struct RUN r;
+	FILE *in = stdin;
+	int c;
+
+	while ( (c = getopt(argc, argv, "c")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'c': return check();
+		default:
+			goto usage;
+		}
+	}
+	if ( argc - optind > 1 )
+		goto usage;
+	if ( optind < argc && (in = fopen(argv[optind], "r")) == 0 )
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	if ( read_log(in, &r) == 0 )
+	{
+		fprintf(stderr, "no B run in the log\n");
+		return 1;
+	}
+	print_run(stdout, &r);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: bode [log]\n"
+		"       bode -c\n");
+	return 2;
+}
@@ -0,0 +1,280 @@
+//---------------------------------------------------------------------
+//	File:		bussim.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: PC side simulation of several servo cards on one rs-485
+//          line. Every node runs the card's bus_parse() on each frame
+//          the host sends, the simulation works out when each answer
+//          or telemetry line is on the wire and looks for collisions.
+//          Each card's crystal is off by up to SKEW_PPM, every other
+//          one fast and slow, and the host sends a sync broadcast once
+//          a telemetry period.
+//
+//          bussim [-n] [nodes [baud]]  print the timeline of a session,
+//                                      -n without the sync broadcasts
+//          bussim -c                   check addressing and timing for
+//                                      1..31 nodes at every baud rate
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- crystal skew, a minute of telemetry with a sync
+//                broadcast each period
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../busframe.h"
+#include "../baudrate.h"
+
+#define REPLY_CHARS		80		// longest single line answer we model
+#define TELEM_CHARS		50		// "load 12.3% isr 4.5% main 7.8% peak 13.0%"
+#define HOST_RELEASE_BITS 2		// host adapter drops its driver this late
+#define TELEM_PERIOD_US	1000000L
+#define TELEM_PERIODS	60		// telemetry simulated, the skew adds up
+#define SKEW_PPM		100		// crystal tolerance of a card
+#define SYNC_FRAME		"@* c"	// any broadcast syncs the slots
+#define SYNC_GUARD_US	2000.0	// after the last slot of a period
+
+// one transmission on the line
+struct TX{
+	double start, end;			// us
+	int who;					// 0 = host, else node id
+};
+
+#define MAXTX	4096
+static struct TX txs[MAXTX];
+static int ntx;
+
+static double char_us(long baud)
+{
+	return 10.0 * 1e6 / baud;
+}
+
+static void add_tx(double start, int chars, long baud, int who)
+{
+	if ( ntx < MAXTX )
+	{
+		txs[ntx].start = start;
+		txs[ntx].end = start + chars * char_us(baud);
+		txs[ntx].who = who;
+		ntx++;
+	}
+}
+
+// host sends one frame at t, returns the time its driver is off
+static double host_frame(double t, const char *frame, int nodes, long baud,
+						 int *answers, int *takers, int verbose)
+{
+	char line[64];
+	double end = t + (strlen(frame) + 1) * char_us(baud);
+	int n;
+	short kind;
+
+	add_tx(t, strlen(frame) + 1, baud, 0);
+	*answers = *takers = 0;
+	for ( n = 1; n <= nodes; n++ )
+	{
+		strcpy(line, frame);
+		if ( bus_parse(line, n, &kind) == 0 )
+			continue;
+		(*takers)++;
+		if ( kind == BUS_REPLY )
+		{
+			(*answers)++;
+			add_tx(end + BUS_TURN_US, REPLY_CHARS, baud, n);
+			if ( verbose )
+				printf("%10.0fus  node %2d answers \"%s\"\n", end + BUS_TURN_US, n, frame);
+		}
+	}
+	return end + HOST_RELEASE_BITS * char_us(baud) / 10.0;
+}
+
+// a node's crystal, fast and slow in turn so neighbouring slots drift
+// towards each other
+static double node_clock(int n, int skew_ppm)
+{
+	return 1.0 + (n & 1 ? skew_ppm : -skew_ppm) * 1e-6;
+}
+
+/*********************************************************************
+  Function:        static int telemetry(double t, int nodes, long baud,
+                                        int skew_ppm, int sync, int verbose)
+
+  Overview:        telemetry started by a broadcast ending at t. Each
+                   node times its line from the last broadcast it saw
+                   with its own crystal. With sync the host sends
+                   SYNC_FRAME after the last slot of every period, by
+                   its own clock.
+
+  Output:          number of sync frames not taken by every node
+********************************************************************/
+static int telemetry(double t, int nodes, long baud, int skew_ppm, int sync, int verbose)
+{
+	double from = t, at;
+	int k, n, answers, takers, bad = 0;
+
+	for ( k = 1; k <= TELEM_PERIODS; k++ )
+	{
+		for ( n = 1; n <= nodes; n++ )
+		{
+			at = from + ((sync ? 1 : k) * TELEM_PERIOD_US + bus_slot_us(n)) * node_clock(n, skew_ppm);
+			add_tx(at, TELEM_CHARS, baud, n);
+			if ( verbose )
+				printf("%10.0fus  node %2d telemetry\n", at, n);
+		}
+		if ( !sync )
+			continue;
+		t = from + TELEM_PERIOD_US + bus_slot_us(nodes) + TELEM_CHARS * char_us(baud) + SYNC_GUARD_US;
+		from = host_frame(t, SYNC_FRAME, nodes, baud, &answers, &takers, verbose);
+		from -= HOST_RELEASE_BITS * char_us(baud) / 10.0;		// the cards see the CR end
+		if ( answers != 0 || takers != nodes )
+			bad++;
+	}
+	return bad;
+}
+
+static int tx_cmp(const void *a, const void *b)
+{
+	const struct TX *x = a, *y = b;
+
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// returns the number of overlapping transmissions, host driver release included
+static int collisions(long baud, int verbose)
+{
+	int i, j, bad = 0;
+	double tail = HOST_RELEASE_BITS * char_us(baud) / 10.0;
+
+	qsort(txs, ntx, sizeof(txs[0]), tx_cmp);
+	for ( i = 0; i < ntx; i++ )
+		for ( j = i + 1; j < ntx && txs[j].start < txs[i].end + tail; j++ )
+		{
+			if ( txs[j].start < txs[i].end + (txs[i].who == 0 || txs[j].who == 0 ? tail : 0.0) )
+			{
+				if ( verbose )
+					printf("COLLISION %s %d and %s %d at %.0fus\n",
+						txs[i].who ? "node" : "host", txs[i].who,
+						txs[j].who ? "node" : "host", txs[j].who, txs[j].start);
+				bad++;
+			}
+		}
+	return bad;
+}
+
+// a tuning session: poll each node, broadcast a param, a minute of telemetry
+static int session(int nodes, long baud, int skew_ppm, int sync, int verbose)
+{
+	char frame[32];
+	double t = 0.0;
+	int n, answers, takers, bad = 0;
+
+	ntx = 0;
+	for ( n = 1; n <= nodes; n++ )
+	{
+		sprintf(frame, "@%d e", n);
+		t = host_frame(t, frame, nodes, baud, &answers, &takers, verbose);
+		if ( answers != 1 || takers != 1 )
+		{
+			printf("FAIL %s taken by %d nodes, %d answers\n", frame, takers, answers);
+			bad++;
+		}
+		t += BUS_TURN_US + REPLY_CHARS * char_us(baud) + 1000.0;	// host waits for it
+	}
+	t = host_frame(t, "@* p0.01", nodes, baud, &answers, &takers, verbose);
+	if ( answers != 0 || takers != nodes )
+	{
+		printf("FAIL broadcast taken by %d of %d nodes, %d answers\n", takers, nodes, answers);
+		bad++;
+	}
+	t = host_frame(t + 1000.0, "p0.01", nodes, baud, &answers, &takers, verbose);
+	if ( takers != 0 )
+	{
+		printf("FAIL unaddressed line taken by %d nodes\n", takers);
+		bad++;
+	}
+	t = host_frame(t + 1000.0, "@* c1", nodes, baud, &answers, &takers, verbose);
+	t -= HOST_RELEASE_BITS * char_us(baud) / 10.0;
+	if ( telemetry(t, nodes, baud, skew_ppm, sync, verbose) )
+	{
+		printf("FAIL sync broadcast not taken by all %d nodes\n", nodes);
+		bad++;
+	}
+	if ( bus_slot_us(nodes) + TELEM_CHARS * char_us(baud) > TELEM_PERIOD_US )
+	{
+		printf("FAIL %d nodes do not fit in the telemetry period at %ld baud\n", nodes, baud);
+		bad++;
+	}
+	bad += collisions(baud, verbose || bad);
+	return bad;
+}
+
+static int check(void)
+{
+	static const long rates[] = BAUD_RATES;
+	int i, nodes, bad = 0, runs = 0, slow = 0;
+	char line[16];
+	short kind;
+
+	// malformed addresses are taken by nobody
+	strcpy(line, "@ p1");
+	bad += bus_parse(line, 1, &kind) != 0;
+	strcpy(line, "@99 p1");
+	bad += bus_parse(line, 1, &kind) != 0;
+
+	for ( i = 0; i < (int)(sizeof(rates) / sizeof(rates[0])); i++ )
+	{
+		// an answer slot must hold a telemetry line
+		if ( TELEM_CHARS * char_us(rates[i]) > BUS_SLOT_US )
+		{
+			slow++;
+			continue;
+		}
+		for ( nodes = 1; nodes <= BUS_NODE_MAX; nodes++, runs++ )
+			bad += session(nodes, rates[i], SKEW_PPM, 1, 0);
+	}
+
+	// and the skew is enough to collide in a minute without the syncs
+	if ( session(2, 115200, SKEW_PPM, 0, 0) == 0 )
+	{
+		printf("FAIL 2 nodes %dppm apart do not collide without syncs\n", 2 * SKEW_PPM);
+		bad++;
+	}
+	printf("%d bus sessions checked (%d baud rates too slow for %ldus slots), %d failures\n",
+		runs, slow, BUS_SLOT_US, bad);
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	int nodes = 6, sync = 1;
+	long baud = 115200;
+
+	if ( argc > 1 && strcmp(argv[1], "-n") == 0 )
+	{
+		sync = 0;
+		argc--;
+		argv++;
+	}
+	if ( argc > 1 && argv[1][0] == '-' )
+	{
+		if ( argv[1][1] == 'c' )
+			return check();
+		fprintf(stderr, "usage: bussim [-c] [-n] [nodes [baud]]\n");
+		return 2;
+	}
+	if ( argc > 1 )
+		nodes = atoi(argv[1]);
+	if ( argc > 2 )
+		baud = atol(argv[2]);
+	if ( nodes < 1 || nodes > BUS_NODE_MAX )
+	{
+		fprintf(stderr, "nodes must be 1-%d\n", BUS_NODE_MAX);
+		return 2;
+	}
+	return session(nodes, baud, SKEW_PPM, sync, 1) != 0;
+}
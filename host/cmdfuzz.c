@@ -0,0 +1,386 @@
+//---------------------------------------------------------------------
+//	File:		cmdfuzz.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Fuzzing harness for the console: arbitrary bytes go in
+//          through the uart rx isr, rx_assemble(), bus_parse() and
+//          process_serial_buffer() of the firmware, built for the pc
+//          against the register model in sim/ with the address and
+//          undefined behaviour sanitizers. After each input, with the
+//          eeprom writes done, it has to hold that
+//             every parameter is within its range in params.c
+//             the pwm settings give a valid timing
+//             the eeprom holds the parameters in ram with a good cksum
+//          and the sanitizers see no bad access or float to integer
+//          cast out of range. A broken one aborts.
+//
+//          cmdfuzz [file ...]
+//              runs each file, or stdin, as one input (for afl:
+//              make cmdfuzz FUZZCC=afl-clang-fast, then
+//              afl-fuzz -i corpus -o findings ./cmdfuzz @@)
+//          cmdfuzz -c dir [-n runs]
+//              runs the seed corpus in dir, then runs mutations of it
+//              (4000 if not given)
+//          make cmdfuzz LIBFUZZER=1 FUZZCC=clang
+//              a libFuzzer build instead: ./cmdfuzz corpus
+//
+//          With -c each input is written to cmdfuzz.crash before it
+//          runs, so after an abort it holds the one that broke
+//          something, to run again with cmdfuzz cmdfuzz.crash. The
+//          file is removed when every input held.
+//
+//          Every input starts from the same setup. U1 would restart
+//          the card, the rest of an input after it is not run.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "../dspicservo.h"
+#include "../busframe.h"
+#include "sim.h"
+
+#define INPUT_MAX	1024
+#define MAX_SEEDS	256
+#define CRASH_FILE	"cmdfuzz.crash"
+
+// the firmware's
+extern struct PID pid;
+extern struct PID pidEE;
+extern struct PWMTIMING pwm_timing;
+extern volatile float jerk;
+extern short load_telemetry;
+extern short calc_cksum(short sizew, short *adr);
+extern int save_setup(void);
+extern void flush_setup(void);
+extern void init_pid(void);
+extern void setup_uart(void);
+extern short rx_assemble(void);
+extern char *rx_getline(void);
+extern void rx_release(void);
+extern void process_serial_buffer(char *line);
+extern void modbus_mode(short on);
+void _U1RXInterrupt(void);
+extern char __start_sim_eedata[], __stop_sim_eedata[];
+
+static struct PID pid0;
+static char *ee0;
+static const unsigned char *in_data;
+static size_t in_len;
+static int restarted;
+
+static void setup(void)
+{
+	init_pid();
+	pid.pgain = 25.0;
+	pid.dgain = 0.04;
+	calc_pwm_timing(FCY, pid.fpwm, pid.pwmpost, pid.ticksperservo, &pwm_timing);
+	save_setup();
+	flush_setup();
+	pid0 = pid;
+	ee0 = malloc(__stop_sim_eedata - __start_sim_eedata);
+	if ( ee0 == 0 )
+		exit(2);
+	memcpy(ee0, __start_sim_eedata, __stop_sim_eedata - __start_sim_eedata);
+}
+
+// the same start for every input
+static void reset(void)
+{
+	pid = pid0;
+	memcpy(__start_sim_eedata, ee0, __stop_sim_eedata - __start_sim_eedata);
+	calc_pwm_timing(FCY, pid.fpwm, pid.pwmpost, pid.ticksperservo, &pwm_timing);
+	modbus_mode(0);
+	setup_uart();
+	jerk = 0.0;
+	load_telemetry = 0;
+	fra_stop();
+	ident_start(0.0, 1);
+	sim_clear();
+	restarted = 0;
+}
+
+// serial_task() of main.c
+static void console(void)
+{
+	char *line, *cmd;
+	short kind;
+
+	rx_assemble();
+	if ( (line = rx_getline()) == 0 )
+		return;
+	cmd = bus_parse(line, pid.nodeid, &kind);
+	if ( cmd && cmd[0] == 'U' && cmd[1] == '1' )
+		restarted = 1;
+	else if ( cmd )
+	{
+		// no turnaround wait, the time does not run in here
+		if ( kind == BUS_REPLY )
+			bus_open(tb_now());
+		jerk = 0.0;
+		process_serial_buffer(cmd);
+		bus_close();
+	}
+	rx_release();
+}
+
+static void broken(const char *what)
+{
+	fprintf(stderr, "cmdfuzz: %s\n", what);
+	abort();
+}
+
+static void check(void)
+{
+	const short words = offsetof(struct PID, cksum) / sizeof(short);
+	struct PWMTIMING t;
+	const struct PARAM *p;
+
+	if ( (p = param_validate()) != 0 )
+	{
+		fprintf(stderr, "cmdfuzz: parameter %c = %g out of range\n", p->code, param_get(p));
+		abort();
+	}
+	if ( calc_pwm_timing(FCY, pid.fpwm, pid.pwmpost, pid.ticksperservo, &t) != PWMT_OK )
+		broken("pwm settings give no timing");
+	if ( memcmp(&pid, &pidEE, offsetof(struct PID, cksum)) != 0 )
+		broken("eeprom does not hold the parameters in ram");
+	if ( -calc_cksum(words, (short *)&pidEE) != pidEE.cksum )
+		broken("eeprom cksum bad");
+}
+
+// one input, as an isr so the firmware's timer reads do not wait
+static void run_input(void)
+{
+	size_t i;
+	int k;
+
+	reset();
+	for ( i = 0; i < in_len && !restarted; i++ )
+	{
+		if ( !sim_rx_put(in_data[i]) )
+		{
+			_U1RXInterrupt();
+			console();
+			sim_rx_put(in_data[i]);
+		}
+		if ( in_data[i] == '\r' )
+		{
+			_U1RXInterrupt();
+			console();
+		}
+	}
+	_U1RXInterrupt();
+	for ( k = 0; k < 8 && !restarted; k++ )
+		console();
+	flush_setup();
+	check();
+}
+
+static void one(const unsigned char *data, size_t len)
+{
+	in_data = data;
+	in_len = len;
+	sim_isr(run_input);
+}
+
+#ifdef LIBFUZZER
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	(void)argc;
+	(void)argv;
+	sim_isr(setup);
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t len)
+{
+	one(data, len);
+	return 0;
+}
+#else
+
+struct SEED{
+	unsigned char *p;
+	size_t len;
+};
+
+static unsigned long lcg = 1;
+
+static unsigned rnd(unsigned n)
+{
+	lcg = lcg * 1103515245 + 12345;
+	return (unsigned)((lcg >> 8) % n);
+}
+
+static size_t read_all(FILE *f, unsigned char *buf)
+{
+	return fread(buf, 1, INPUT_MAX, f);
+}
+
+// a seed changed a few times: bytes flipped, replaced with ones the
+// parser looks at, inserted, deleted, repeated or spliced from another
+static size_t mutate(const struct SEED *s, int n, unsigned char *buf)
+{
+	static const char likely[] = "0123456789.-+eE \r\n@*?pidm0fxwutoanyklcszrhFIBRU";
+	const struct SEED *a = &s[rnd(n)], *b;
+	size_t len = a->len, at, k, m;
+	int ops = 1 + rnd(4);
+
+	memcpy(buf, a->p, len);
+	while ( ops-- > 0 )
+	{
+		at = len ? rnd(len) : 0;
+		switch ( rnd(6) )
+		{
+		case 0:
+			if ( len )
+				buf[at] ^= 1 << rnd(8);
+			break;
+		case 1:
+			if ( len )
+				buf[at] = rnd(4) ? likely[rnd(sizeof(likely) - 1)] : rnd(256);
+			break;
+		case 2:
+			if ( len < INPUT_MAX )
+			{
+				memmove(buf + at + 1, buf + at, len - at);
+				buf[at] = likely[rnd(sizeof(likely) - 1)];
+				len++;
+			}
+			break;
+		case 3:
+			if ( len )
+			{
+				memmove(buf + at, buf + at + 1, len - at - 1);
+				len--;
+			}
+			break;
+		case 4:
+			m = len - at < 16 ? len - at : 16;
+			for ( k = 0; k < 4 && len + m <= INPUT_MAX; k++ )
+			{
+				memmove(buf + at + m, buf + at, len - at);
+				len += m;
+			}
+			break;
+		default:
+			b = &s[rnd(n)];
+			m = b->len < INPUT_MAX - at ? b->len : INPUT_MAX - at;
+			memcpy(buf + at, b->p, m);
+			len = at + m > len ? at + m : len;
+			break;
+		}
+	}
+	return len;
+}
+
+// the input about to run, in case it does not come back
+static void keep(const unsigned char *p, size_t len)
+{
+	FILE *f = fopen(CRASH_FILE, "wb");
+
+	if ( f == 0 )
+		return;
+	fwrite(p, 1, len, f);
+	fclose(f);
+}
+
+static int run_corpus(const char *dir, long runs)
+{
+	static struct SEED seeds[MAX_SEEDS];
+	static unsigned char buf[INPUT_MAX];
+	struct dirent *e;
+	char path[512];
+	DIR *d = opendir(dir);
+	FILE *f;
+	size_t len;
+	int n = 0;
+	long k;
+
+	if ( d == 0 )
+	{
+		perror(dir);
+		return 1;
+	}
+	while ( (e = readdir(d)) != 0 && n < MAX_SEEDS )
+	{
+		if ( e->d_name[0] == '.' )
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		if ( (f = fopen(path, "rb")) == 0 )
+			continue;
+		seeds[n].len = read_all(f, buf);
+		fclose(f);
+		seeds[n].p = malloc(seeds[n].len + 1);
+		if ( seeds[n].p == 0 )
+			exit(2);
+		memcpy(seeds[n].p, buf, seeds[n].len);
+		keep(seeds[n].p, seeds[n].len);
+		one(seeds[n].p, seeds[n].len);
+		n++;
+	}
+	closedir(d);
+	if ( n == 0 )
+	{
+		fprintf(stderr, "%s: no seeds\n", dir);
+		return 1;
+	}
+	for ( k = 0; k < runs; k++ )
+	{
+		memset(buf, 0, sizeof(buf));
+		len = mutate(seeds, n, buf);
+		keep(buf, len);
+		one(buf, len);
+	}
+	remove(CRASH_FILE);
+	printf("%d seeds and %ld mutations run, every check held\n", n, runs);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned char buf[INPUT_MAX];
+	const char *corpus = 0;
+	long runs = 4000;
+	FILE *f;
+	int c;
+
+	while ( (c = getopt(argc, argv, "c:n:")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'c': corpus = optarg; break;
+		case 'n': runs = atol(optarg); break;
+		default:
+			fprintf(stderr, "usage: cmdfuzz [file ...]\n"
+				"       cmdfuzz -c dir [-n runs]\n");
+			return 2;
+		}
+	}
+	sim_isr(setup);
+	if ( corpus )
+		return run_corpus(corpus, runs);
+	if ( optind == argc )
+		one(buf, read_all(stdin, buf));
+	for ( ; optind < argc; optind++ )
+	{
+		if ( (f = fopen(argv[optind], "rb")) == 0 )
+		{
+			perror(argv[optind]);
+			return 1;
+		}
+		one(buf, read_all(f, buf));
+		fclose(f);
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,260 @@
+//---------------------------------------------------------------------
+//	File:		fitcheck.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: PC side check that the card build fits the 30f4012, from the
+//          memory report the XC16 linker prints with --report-mem
+//          (make fit writes it to fit/servo.mem).
+//
+//          fitcheck [-s stack] report  the end of the code against
+//                                      APP_END and the static ram plus
+//                                      the stack against the 2k of ram,
+//                                      exits with status 1 if either is
+//                                      over
+//          fitcheck -c                 check the report parser on the
+//                                      samples below
+//
+//          The host simulation is built with SIM_FIRMWARE, which leaves
+//          out the APP_END guard in commands.c, so this is the only check
+//          of the card's memory that make check can run without XC16.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../boot/bootproto.h"
+
+#define RAM_START	0x0800		// data memory of the 30f4012
+#define RAM_SIZE	2048
+#define STACK_MIN	448			// same as host/Makefile
+
+struct FIT{
+	long text_end;				// pc units, highest end below APP_END
+	long ram;					// bytes of sections and alignment gaps
+	long stack;					// bytes the linker left for the stack
+	int sections;
+};
+
+#define IN_NONE		0
+#define IN_PROG		1
+#define IN_DATA		2
+#define IN_DYN		3
+
+/*********************************************************************
+  Function:        static int read_report(FILE *f, struct FIT *fit)
+
+  Overview:        the section lines of the "Program Memory" and "Data
+                   Memory" blocks and the stack line of the "Dynamic
+                   Memory" block. Program sections from APP_END up are
+                   the reserved rows and the config words, not the
+                   application's.
+
+  Output:          0, or -1 if there were no sections
+********************************************************************/
+static int read_report(FILE *f, struct FIT *fit)
+{
+	char buf[256], name[64];
+	unsigned long addr, len, bytes;
+	long gaps;
+	int in = IN_NONE;
+
+	memset(fit, 0, sizeof(*fit));
+	while ( fgets(buf, sizeof(buf), f) )
+	{
+		if ( strstr(buf, "Program Memory") )
+			in = IN_PROG;
+		else if ( strstr(buf, "Data Memory") )
+			in = IN_DATA;
+		else if ( strstr(buf, "Dynamic Memory") )
+			in = IN_DYN;
+		// section lines start in the first column, the totals do not
+		else if ( buf[0] == ' ' || buf[0] == '\t' || buf[0] == '-' ||
+				  sscanf(buf, "%63s", name) != 1 ||
+				  strcmp(name, "section") == 0 || strcmp(name, "region") == 0 )
+			continue;
+		// address, length in pc units, length in bytes
+		else if ( in == IN_PROG &&
+				  sscanf(buf, "%*s %lx %lx %lx", &addr, &len, &bytes) == 3 )
+		{
+			if ( (long)addr < APP_END && (long)(addr + len) > fit->text_end )
+				fit->text_end = (long)(addr + len);
+			fit->sections++;
+		}
+		// address, alignment gaps in decimal, total length
+		else if ( in == IN_DATA &&
+				  sscanf(buf, "%*s %lx %ld %lx", &addr, &gaps, &len) == 3 )
+		{
+			fit->ram += gaps + (long)len;
+			fit->sections++;
+		}
+		// address, maximum length
+		else if ( in == IN_DYN && strcmp(name, "stack") == 0 &&
+				  sscanf(buf, "%*s %lx %lx", &addr, &len) == 2 )
+			fit->stack = (long)len;
+	}
+	return fit->sections ? 0 : -1;
+}
+
+// prints the fit, 0 if it fits
+static int report(const struct FIT *fit, long stack_min)
+{
+	int bad = 0;
+
+	printf("flash: code ends at 0x%04lx, APP_END 0x%04lx, ", fit->text_end,
+		(long)APP_END);
+	if ( fit->text_end > APP_END )
+	{
+		printf("%ld instructions over\n", (fit->text_end - APP_END) / 2);
+		bad = 1;
+	}
+	else
+		printf("%ld instructions spare\n", (APP_END - fit->text_end) / 2);
+
+	printf("ram: data+bss %ld + stack %ld = %ld of %d, ", fit->ram, stack_min,
+		fit->ram + stack_min, RAM_SIZE);
+	if ( fit->ram + stack_min > RAM_SIZE )
+	{
+		printf("%ld bytes over\n", fit->ram + stack_min - RAM_SIZE);
+		bad = 1;
+	}
+	else
+		printf("%ld bytes spare\n", RAM_SIZE - fit->ram - stack_min);
+	if ( fit->stack )
+		printf("ram: the linker leaves %ld bytes for the stack\n", fit->stack);
+	return bad;
+}
+
+// reports in the layout of xc16-ld --report-mem
+static const char sample_ok[] =
+	"\"Program Memory\"  [Origin = 0x100, Length = 0x7f00]\n"
+	"\n"
+	"section                    address   length (PC units)   length (bytes) (dec)\n"
+	"-------                    -------   -----------------   --------------------\n"
+	".text                        0x100              0x2f00          0x4680  (18048)\n"
+	".const                      0x3000               0x600           0x900  (2304)\n"
+	".dinit                      0x3600                0x80            0xc0  (192)\n"
+	"app_end_guard               0x3a00              0x4600          0x6900  (26880)\n"
+	"__FOSC                    0xf80000                 0x2             0x3  (3)\n"
+	"\n"
+	"                     Total program memory used (bytes):         0xdbc3  (56259) 100%\n"
+	"\n"
+	"\"Data Memory\"  [Origin = 0x800, Length = 0x800]\n"
+	"\n"
+	"section                    address      alignment gaps    total length  (dec)\n"
+	"-------                    -------      --------------    -------------------\n"
+	".nbss                        0x800                   0             0x1a0  (416)\n"
+	".ndata                       0x9a0                   0              0x42  (66)\n"
+	".bss                         0x9e2                   2             0x3ba  (954)\n"
+	"boot_request                 0xffe                   0               0x2  (2)\n"
+	"\n"
+	"                        Total data memory used (bytes):           0x5a0  (1440) 70%\n"
+	"\n"
+	"\n"
+	"Dynamic Memory Usage\n"
+	"region                     address                      maximum length  (dec)\n"
+	"------                     -------                      ---------------------\n"
+	"heap                             0                                   0  (0)\n"
+	"stack                        0xda0                               0x25e  (606)\n"
+	"\n"
+	"                        Maximum dynamic memory (bytes):          0x25e  (606)\n";
+
+static int check_one(const char *what, const char *text, long text_end,
+					 long ram, long stack, int bad)
+{
+	struct FIT fit;
+	FILE *f = fmemopen((void *)text, strlen(text), "r");
+	int r, fail;
+
+	if ( !f )
+		return 1;
+	r = read_report(f, &fit);
+	fclose(f);
+	printf("%s:\n", what);
+	fail = report(&fit, STACK_MIN) != bad || r != 0 ||
+		fit.text_end != text_end || fit.ram != ram || fit.stack != stack;
+	if ( fail )
+		printf("FAIL %s: code end 0x%lx ram %ld stack %ld, want 0x%lx %ld %ld%s\n",
+			what, fit.text_end, fit.ram, fit.stack, text_end, ram, stack,
+			bad ? " over" : "");
+	return fail;
+}
+
+static int check(void)
+{
+	char over[sizeof(sample_ok) + 64];
+	char *p;
+	int failed = 0;
+
+	failed += check_one("fits", sample_ok, 0x3680, 1440, 606, 0);
+
+	// the code past APP_END (the guard would fail the link first)
+	strcpy(over, sample_ok);
+	p = strstr(over, "0x2f00");
+	memcpy(p, "0x3a00", 6);
+	failed += check_one("code over", over, 0x3a00 + 0x100, 1440, 606, 1);
+
+	// 166 bytes more of .bss leaves 442 for the stack
+	strcpy(over, sample_ok);
+	p = strstr(over, "0x3ba  (954)");
+	memcpy(p, "0x460", 5);
+	failed += check_one("ram over", over, 0x3680, 1606, 606, 1);
+
+	{
+		struct FIT fit;
+		FILE *f = fmemopen((void *)"no report here\n", 15, "r");
+
+		failed += read_report(f, &fit) != -1;
+		fclose(f);
+	}
+	printf("%d failures\n", failed);
+	return failed != 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct FIT fit;
+	long stack_min = STACK_MIN;
+	FILE *f;
+	int c, r;
+
+	while ( (c = getopt(argc, argv, "cs:")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'c':
+			return check();
+		case 's':
+			stack_min = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: fitcheck [-s stack] report | -c\n");
+			return 2;
+		}
+	}
+	if ( optind != argc - 1 )
+	{
+		fprintf(stderr, "usage: fitcheck [-s stack] report | -c\n");
+		return 2;
+	}
+	if ( (f = fopen(argv[optind], "r")) == 0 )
+	{
+		perror(argv[optind]);
+		return 2;
+	}
+	r = read_report(f, &fit);
+	fclose(f);
+	if ( r != 0 )
+	{
+		fprintf(stderr, "%s: no memory report (link with --report-mem)\n",
+			argv[optind]);
+		return 2;
+	}
+	return report(&fit, stack_min);
+}
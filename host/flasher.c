@@ -0,0 +1,808 @@
+//---------------------------------------------------------------------
+//	File:		flasher.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: PC side of the serial bootloader in ../boot. Loads the hex
+//          file MPLAB builds into the card over the console port.
+//
+//          flasher [-d dev] [-b baud] [-r] file.hex
+//              sends U1 to the running application and loads the image.
+//              With -r nothing is sent to the application: reset the
+//              card by hand within 30s. On an rs-485 line send @n U1
+//              yourself first and use -r, so only that card listens.
+//          flasher [-d dev] [-b baud] [-r] -i
+//              prints what the bootloader reports
+//          flasher -c
+//              runs boot/bootproto.c against a simulated flash and line:
+//              complete loads, the cable pulled after every byte, power
+//              cut at every flash operation of a load and install and of
+//              the recovery after it, a noisy line, bad images
+//
+//          Only program memory below APP_END is sent. Data eeprom and
+//          config word records in the hex file are skipped, so the saved
+//          parameters survive an update.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/select.h>
+#include "../boot/bootproto.h"
+
+#define IMG_SIZE	(APP_ROWS * FLASH_ROW)
+#define EEPROM_PC	0x7ffc00L		// program counter address of the data eeprom
+#define RETRIES		5
+#define REPLY_MS	500				// for a row to be written
+#define VERIFY_MS	10000			// for the whole install
+
+static unsigned long image[IMG_SIZE];
+static int verbose = 1;
+
+// the bootloader at the other end, a serial port or the simulation
+static void (*link_send)(const unsigned char *p, int len);
+static int (*link_recv)(unsigned char *ch, int ms);		// 0 on timeout
+
+/*********************************************************************
+  Function:        static int read_hex(FILE *f, unsigned long *img)
+
+  Overview:        reads an intel hex file as written by xc16: byte
+                   address = 2 * program counter, 4 bytes per
+                   instruction of which the last is always 0
+
+  Output:          rows of the image, -1 on an error
+********************************************************************/
+static int read_hex(FILE *f, unsigned long *img)
+{
+	char line[600];
+	unsigned char b[256];
+	unsigned long base = 0, ba, pc, k;
+	int i, n, len, sum, rows = 0, ln = 0;
+	long skipped = 0;
+
+	for ( k = 0; k < IMG_SIZE; k++ )
+		img[k] = 0xffffff;
+	while ( fgets(line, sizeof(line), f) )
+	{
+		ln++;
+		if ( line[0] != ':' )
+			continue;
+		for ( n = 0, sum = 0; n < 256 && sscanf(&line[1 + 2 * n], "%2hhx", &b[n]) == 1; n++ )
+			sum += b[n];
+		len = b[0];
+		if ( n < 5 || n < len + 5 || (sum & 0xff) != 0 )
+		{
+			fprintf(stderr, "line %d: bad hex record\n", ln);
+			return -1;
+		}
+		switch ( b[3] )
+		{
+		case 0:
+			for ( i = 0; i < len; i++ )
+			{
+				ba = base + ((b[1] << 8) | b[2]) + i;
+				pc = ba / 2;
+				if ( pc >= EEPROM_PC )
+				{
+					skipped++;		// eeprom and config words stay as they are
+					continue;
+				}
+				if ( pc >= APP_END )
+				{
+					fprintf(stderr, "line %d: code at 0x%06lx, the application must end "
+						"below 0x%06lx (bootloader)\n", ln, pc, APP_END);
+					return -1;
+				}
+				if ( (ba & 3) == 3 )
+					continue;		// phantom byte
+				k = ba / 4;
+				img[k] &= ~(0xffUL << (8 * (ba & 3)));
+				img[k] |= (unsigned long)b[4 + i] << (8 * (ba & 3));
+				if ( (int)(k / FLASH_ROW) + 1 > rows )
+					rows = k / FLASH_ROW + 1;
+			}
+			break;
+		case 1:
+			if ( verbose && skipped )
+				printf("%ld eeprom/config bytes in the file not loaded\n", skipped);
+			return rows;
+		case 2:
+			base = (unsigned long)((b[4] << 8) | b[5]) << 4;
+			break;
+		case 4:
+			base = (unsigned long)((b[4] << 8) | b[5]) << 16;
+			break;
+		}
+	}
+	fprintf(stderr, "no end record\n");
+	return -1;
+}
+
+static unsigned short image_crc(const unsigned long *img, int rows)
+{
+	unsigned short crc = 0xffff;
+	unsigned char b[3];
+	int k;
+
+	for ( k = 0; k < rows * FLASH_ROW; k++ )
+	{
+		b[0] = (unsigned char)img[k];
+		b[1] = (unsigned char)(img[k] >> 8);
+		b[2] = (unsigned char)(img[k] >> 16);
+		crc = boot_crc(crc, b, 3);
+	}
+	return crc;
+}
+
+// one reply to cmd: sync, cmd | 0x80, len, data, crc. Length or -1.
+static int get_reply(int cmd, unsigned char *h, int ms)
+{
+	unsigned short crc;
+	unsigned char ch;
+	int n;
+
+	do
+		if ( !link_recv(&ch, ms) )
+			return -1;
+	while ( ch != BOOT_SYNC );
+	if ( !link_recv(&h[0], 100) || h[0] != (cmd | 0x80) ||
+		!link_recv(&h[1], 100) || h[1] < 1 || h[1] > BOOT_MAXDATA )
+		return -1;
+	for ( n = 0; n < h[1] + 2; n++ )
+		if ( !link_recv(&h[2 + n], 100) )
+			return -1;
+	crc = boot_crc(0xffff, h, h[1] + 2);
+	if ( h[h[1] + 2] != (unsigned char)crc || h[h[1] + 3] != (crc >> 8) )
+		return -1;
+	return h[1];
+}
+
+/*********************************************************************
+  Function:        static int request(int cmd, const unsigned char *d,
+                                      int len, unsigned char *r, int ms)
+
+  Overview:        sends a frame and waits for its reply, sends it again
+                   on a timeout or a damaged frame either way
+
+  Output:          reply data length (r[0] is the status), -1 if none
+********************************************************************/
+static int request(int cmd, const unsigned char *d, int len, unsigned char *r, int ms)
+{
+	unsigned char f[BOOT_MAXDATA + 5], h[BOOT_MAXDATA + 4], ch;
+	unsigned short crc;
+	int try, rlen;
+
+	f[0] = BOOT_SYNC;
+	f[1] = (unsigned char)cmd;
+	f[2] = (unsigned char)len;
+	memcpy(&f[3], d, len);
+	crc = boot_crc(0xffff, &f[1], len + 2);
+	f[len + 3] = (unsigned char)crc;
+	f[len + 4] = (unsigned char)(crc >> 8);
+
+	for ( try = 0; try < RETRIES; try++ )
+	{
+		while ( link_recv(&ch, 0) )
+			;					// a late reply to an earlier try
+		link_send(f, len + 5);
+		rlen = get_reply(cmd, h, ms);
+		if ( rlen < 0 || h[2] == BS_FRAME )
+			continue;
+		memcpy(r, &h[2], rlen);
+		return rlen;
+	}
+	return -1;
+}
+
+static const char *status_name(int s)
+{
+	static const char *names[] = { "ok", "damaged frame", "unknown command",
+		"out of range", "rows missing", "flash write failed", "crc mismatch",
+		"row 0 is not a goto", "no application" };
+
+	return s >= 0 && s <= BS_NOAPP ? names[s] : "?";
+}
+
+// info reply: 0 ok, 1 version, 2 row size, 3-4 app rows, 5 state,
+// 6-7 rows, 8-9 crc, 10 app ok
+static int info(unsigned char *r, int tries, int ms)
+{
+	while ( tries-- > 0 )
+		if ( request(BC_INFO, 0, 0, r, ms) == 11 )
+			return 1;
+	return 0;
+}
+
+/*********************************************************************
+  Function:        static int load(const unsigned long *img, int rows,
+                                   int install)
+
+  Overview:        BC_BEGIN and every row, then with install set
+                   BC_VERIFY and BC_GO
+
+  Output:          BS_OK or the status that stopped it, -1 for no answer
+********************************************************************/
+static int load(const unsigned long *img, int rows, int install)
+{
+	unsigned char d[BOOT_MAXDATA], r[16];
+	const unsigned long *p;
+	unsigned short crc = image_crc(img, rows);
+	int row, i;
+
+	d[0] = (unsigned char)rows;
+	d[1] = (unsigned char)(rows >> 8);
+	d[2] = (unsigned char)crc;
+	d[3] = (unsigned char)(crc >> 8);
+	if ( request(BC_BEGIN, d, 4, r, REPLY_MS) < 1 )
+		return -1;
+	if ( r[0] != BS_OK )
+		return r[0];
+	for ( row = 0; row < rows; row++ )
+	{
+		d[0] = (unsigned char)row;
+		d[1] = (unsigned char)(row >> 8);
+		p = &img[row * FLASH_ROW];
+		for ( i = 0; i < FLASH_ROW; i++ )
+		{
+			d[2 + 3 * i] = (unsigned char)p[i];
+			d[3 + 3 * i] = (unsigned char)(p[i] >> 8);
+			d[4 + 3 * i] = (unsigned char)(p[i] >> 16);
+		}
+		if ( request(BC_WRITE, d, BOOT_MAXDATA, r, REPLY_MS) < 1 )
+			return -1;
+		if ( r[0] != BS_OK )
+			return r[0];
+		if ( verbose )
+		{
+			printf("\rrow %d/%d", row + 1, rows);
+			fflush(stdout);
+		}
+	}
+	if ( verbose )
+		printf("\n");
+	if ( !install )
+		return BS_OK;
+	if ( request(BC_VERIFY, 0, 0, r, VERIFY_MS) < 1 )
+		return -1;
+	if ( r[0] != BS_OK )
+		return r[0];
+	if ( request(BC_GO, 0, 0, r, REPLY_MS) < 1 )
+		return -1;
+	return r[0];
+}
+
+/*
+ * serial port
+ */
+static int port;
+
+static void port_send(const unsigned char *p, int len)
+{
+	if ( write(port, p, len) != len )
+		perror("write");
+}
+
+static int port_recv(unsigned char *ch, int ms)
+{
+	struct timeval tv;
+	fd_set rd;
+
+	FD_ZERO(&rd);
+	FD_SET(port, &rd);
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000L;
+	return select(port + 1, &rd, 0, 0, &tv) > 0 && read(port, ch, 1) == 1;
+}
+
+static int port_open(const char *dev, long baud)
+{
+	static const struct { long baud; speed_t speed; } speeds[] = {
+		{ 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+		{ 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 },
+	};
+	struct termios tio;
+	int i;
+
+	for ( i = 0; i < (int)(sizeof(speeds) / sizeof(speeds[0])); i++ )
+		if ( speeds[i].baud == baud )
+			break;
+	if ( i == (int)(sizeof(speeds) / sizeof(speeds[0])) )
+	{
+		fprintf(stderr, "baud %ld not supported\n", baud);
+		return -1;
+	}
+	if ( (port = open(dev, O_RDWR | O_NOCTTY)) < 0 || tcgetattr(port, &tio) )
+	{
+		perror(dev);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speeds[i].speed);
+	cfsetospeed(&tio, speeds[i].speed);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tcsetattr(port, TCSANOW, &tio);
+	link_send = port_send;
+	link_recv = port_recv;
+	return 0;
+}
+
+/*
+ * simulated card for -c: flash array, bootproto.c, a line that can be cut
+ * or noisy, and a power supply that can fail at a given flash operation
+ */
+static unsigned long flash[FLASH_ROWS][FLASH_ROW];
+static long power_left = -1;		// flash operations until the power fails
+static jmp_buf power_fail;
+static long link_left = -1;			// bytes to the card until the cable is pulled
+static unsigned noise;				// 1 in noise bytes gets a bit flipped, 0 = clean
+static unsigned long rnd = 1;
+static unsigned char to_host[1024];
+static int th_rd, th_wr;
+static int boot_writes;				// writes to the bootloader rows, must stay 0
+static int ran;						// BC_GO answered BOOT_RUN
+static unsigned long ran_entry;
+static long sent;					// bytes to the card so far
+
+static int rand_bit(void)
+{
+	rnd = rnd * 1103515245UL + 12345;
+	return noise && (rnd >> 16) % noise == 0 ? 1 << ((rnd >> 8) & 7) : 0;
+}
+
+static void power_tick(unsigned short row, int partial)
+{
+	short i;
+
+	if ( power_left < 0 )
+		return;
+	if ( power_left-- == 0 )
+	{
+		// cut in the middle of the operation
+		for ( i = 0; i < FLASH_ROW / 2; i++ )
+			flash[row][i] = partial ? flash[row][i] & 0x5a5a5a : 0xffffff;
+		longjmp(power_fail, 1);
+	}
+}
+
+void boot_flash_read(unsigned short row, unsigned long *ins)
+{
+	memcpy(ins, flash[row], sizeof(flash[row]));
+}
+
+void boot_flash_erase(unsigned short row)
+{
+	short i;
+
+	if ( row >= BOOT_ROW )
+	{
+		boot_writes++;
+		return;
+	}
+	power_tick(row, 0);
+	for ( i = 0; i < FLASH_ROW; i++ )
+		flash[row][i] = 0xffffff;
+}
+
+void boot_flash_program(unsigned short row, const unsigned long *ins)
+{
+	short i;
+
+	if ( row >= BOOT_ROW )
+	{
+		boot_writes++;
+		return;
+	}
+	power_tick(row, 1);
+	for ( i = 0; i < FLASH_ROW; i++ )
+		flash[row][i] &= ins[i] & 0xffffff;		// programming only clears bits
+}
+
+void boot_putc(unsigned char ch)
+{
+	if ( th_wr < (int)sizeof(to_host) )
+		to_host[th_wr++] = ch ^ rand_bit();
+}
+
+static void sim_send(const unsigned char *p, int len)
+{
+	unsigned long entry;
+
+	for ( ; len > 0; len--, p++ )
+	{
+		if ( link_left == 0 )
+			return;
+		if ( link_left > 0 )
+			link_left--;
+		sent++;
+		if ( boot_rx(*p ^ rand_bit(), &entry) == BOOT_RUN )
+		{
+			ran = 1;
+			ran_entry = entry;
+		}
+	}
+}
+
+static int sim_recv(unsigned char *ch, int ms)
+{
+	(void)ms;					// no time passes in the simulation
+	if ( th_rd < th_wr )
+	{
+		*ch = to_host[th_rd++];
+		return 1;
+	}
+	th_rd = th_wr = 0;
+	boot_idle();				// the card sees a quiet line too
+	return 0;
+}
+
+// power up the card: 1 and the entry if it runs an application
+static int sim_reset(unsigned long *entry)
+{
+	power_left = -1;
+	link_left = -1;
+	th_rd = th_wr = 0;
+	ran = 0;
+	boot_init();
+	return boot_startup(entry);
+}
+
+// a random image of rows whose reset goto jumps to entry
+static void make_image(unsigned long *img, int rows, unsigned long entry, unsigned seed)
+{
+	int k;
+
+	srand(seed);
+	for ( k = 0; k < IMG_SIZE; k++ )
+		img[k] = k < rows * FLASH_ROW ? ((unsigned long)rand() << 4 ^ rand()) & 0xffffff : 0xffffff;
+	img[0] = 0x040000 | (entry & 0xfffe);
+	img[1] = (entry >> 16) & 0x7f;
+}
+
+// application rows hold img with the bootloader's reset goto
+static int app_is(const unsigned long *img, int rows)
+{
+	int k;
+
+	if ( flash[0][0] != (0x040000 | (BOOT_START & 0xfffe)) || flash[0][1] != 0 )
+		return 0;
+	for ( k = 2; k < rows * FLASH_ROW; k++ )
+		if ( flash[k / FLASH_ROW][k % FLASH_ROW] != img[k] )
+			return 0;
+	return 1;
+}
+
+// card runs exactly one of the two images after a reset
+static int runs(const unsigned long *a, int arows, unsigned long aentry,
+				const unsigned long *b, int brows, unsigned long bentry)
+{
+	unsigned long entry;
+
+	if ( !sim_reset(&entry) )
+		return 0;
+	if ( entry == aentry && app_is(a, arows) )
+		return 1;
+	if ( b && entry == bentry && app_is(b, brows) )
+		return 2;
+	return 0;
+}
+
+static void hex_record(FILE *f, int type, unsigned addr, const unsigned char *d, int len)
+{
+	int i, sum = len + (addr >> 8) + (addr & 0xff) + type;
+
+	fprintf(f, ":%02X%04X%02X", len, addr & 0xffff, type);
+	for ( i = 0; i < len; i++ )
+	{
+		fprintf(f, "%02X", d[i]);
+		sum += d[i];
+	}
+	fprintf(f, "%02X\n", (0x100 - sum) & 0xff);
+}
+
+// write the image as xc16 would, with eeprom and config records
+static void write_hex(FILE *f, const unsigned long *img, int rows)
+{
+	static const unsigned char ee[8] = { 0x34, 0x12, 0, 0, 0x78, 0x56, 0, 0 };
+	static const unsigned char cfg[2] = { 0xc7, 0x2f };
+	unsigned char b[16], up[2];
+	unsigned long ba, upper = ~0UL;
+	int k, i;
+
+	for ( k = 0; k < rows * FLASH_ROW; k += 4 )
+	{
+		ba = (unsigned long)k * 4;
+		if ( (ba >> 16) != upper )
+		{
+			upper = ba >> 16;
+			up[0] = (unsigned char)(upper >> 8);
+			up[1] = (unsigned char)upper;
+			hex_record(f, 4, 0, up, 2);
+		}
+		for ( i = 0; i < 16; i++ )
+			b[i] = i % 4 == 3 ? 0 : (unsigned char)(img[k + i / 4] >> (8 * (i % 4)));
+		hex_record(f, 0, ba, b, 16);
+	}
+	// pidEE defaults at 0x7ffc00 and a config word at 0xf80000
+	up[0] = 0x00;
+	up[1] = 0xff;
+	hex_record(f, 4, 0, up, 2);
+	hex_record(f, 0, 0xf800, ee, 8);
+	up[0] = 0x01;
+	up[1] = 0xf0;
+	hex_record(f, 4, 0, up, 2);
+	hex_record(f, 0, 0, cfg, 2);
+	hex_record(f, 1, 0, 0, 0);
+}
+
+static int check(void)
+{
+	static unsigned long a[IMG_SIZE], b[IMG_SIZE], c[IMG_SIZE];
+	static unsigned long saved[FLASH_ROWS][FLASH_ROW], cut_at[FLASH_ROWS][FLASH_ROW];
+	static unsigned long boot_rows[FLASH_ROWS - BOOT_ROW][FLASH_ROW];
+	const int arows = 150, brows = 20;
+	const unsigned long aentry = 0x0200, bentry = 0x0312;
+	unsigned char r[16];
+	unsigned long entry;
+	long cut, vstart, total;
+	int k, res, who, n;
+	volatile long cuts = 0;					// kept across the longjmp of a power cut
+	volatile int bad = 0, m, powers = 0;
+	FILE *f;
+
+	verbose = 0;
+	link_send = sim_send;
+	link_recv = sim_recv;
+
+	// a part fresh from icsp: bootloader only
+	for ( k = 0; k < FLASH_ROWS * FLASH_ROW; k++ )
+		flash[k / FLASH_ROW][k % FLASH_ROW] = k / FLASH_ROW >= BOOT_ROW ? (k * 7919UL) & 0xffffff : 0xffffff;
+	flash[0][0] = 0x040000 | (BOOT_START & 0xfffe);
+	flash[0][1] = 0;
+	memcpy(boot_rows, flash[BOOT_ROW], sizeof(boot_rows));
+	if ( sim_reset(&entry) )
+	{
+		printf("FAIL blank part runs an application\n");
+		bad++;
+	}
+
+	// image a through a hex file, eeprom and config records left out
+	make_image(a, arows, aentry, 1);
+	f = tmpfile();
+	write_hex(f, a, arows);
+	rewind(f);
+	res = read_hex(f, c);
+	fclose(f);
+	if ( res != arows || memcmp(a, c, sizeof(a)) )
+	{
+		printf("FAIL hex file read back as %d rows, %s\n", res, memcmp(a, c, sizeof(a)) ? "different" : "same");
+		bad++;
+	}
+	if ( (res = load(a, arows, 1)) != BS_OK || !ran || ran_entry != aentry || runs(a, arows, aentry, 0, 0, 0) != 1 )
+	{
+		printf("FAIL first load: %s\n", res < 0 ? "no answer" : status_name(res));
+		bad++;
+	}
+	if ( !info(r, 1, REPLY_MS) || r[5] != BM_ACTIVE || (r[6] | r[7] << 8) != arows ||
+		(r[8] | r[9] << 8) != image_crc(a, arows) || !r[10] )
+	{
+		printf("FAIL info after the first load\n");
+		bad++;
+	}
+	memcpy(saved, flash, sizeof(flash));
+
+	// pull the cable after every byte of loading b: a must run until the
+	// verify frame got through, b after it
+	make_image(b, brows, bentry, 2);
+	sent = 0;
+	load(b, brows, 0);
+	vstart = sent;
+	memcpy(flash, saved, sizeof(flash));
+	sim_reset(&entry);
+	sent = 0;
+	load(b, brows, 1);
+	total = sent;
+	memcpy(flash, saved, sizeof(flash));
+	for ( cut = 0; cut <= total + 1; cut++, cuts++ )
+	{
+		sim_reset(&entry);
+		link_left = cut;
+		res = load(b, brows, 1);
+		who = runs(a, arows, aentry, b, brows, bentry);
+		if ( who != (cut < vstart + 5 ? 1 : 2) || (res == BS_OK) != (cut >= total) )
+		{
+			printf("FAIL cable pulled after %ld of %ld bytes: load %d, runs %c\n",
+				cut, total, res, who ? 'a' + who - 1 : '-');
+			bad++;
+		}
+		memcpy(flash, saved, sizeof(flash));
+	}
+
+	// power cut at every flash operation of loading and installing b,
+	// and again at every operation of the recovery after that cut
+	for ( n = 0; ; n++ )
+	{
+		memcpy(flash, saved, sizeof(flash));
+		sim_reset(&entry);
+		load(b, brows, 0);
+		power_left = n;
+		if ( !setjmp(power_fail) )
+		{
+			res = load(b, brows, 1);
+			power_left = -1;
+			if ( res != BS_OK || runs(a, arows, aentry, b, brows, bentry) != 2 )
+			{
+				printf("FAIL install of b without a power cut\n");
+				bad++;
+			}
+			break;
+		}
+		memcpy(cut_at, flash, sizeof(flash));
+		if ( !runs(a, arows, aentry, b, brows, bentry) )
+		{
+			printf("FAIL power cut at install op %d: nothing runs\n", n);
+			bad++;
+		}
+		for ( m = 0; ; m++ )
+		{
+			powers++;
+			memcpy(flash, cut_at, sizeof(flash));
+			sim_reset(&entry);
+			power_left = m;
+			if ( !setjmp(power_fail) )
+			{
+				boot_init();
+				boot_startup(&entry);
+				power_left = -1;
+				if ( !runs(a, arows, aentry, b, brows, bentry) )
+				{
+					printf("FAIL power cut at install op %d, recovery op %d: nothing runs\n", n, m);
+					bad++;
+				}
+				break;
+			}
+			if ( !runs(a, arows, aentry, b, brows, bentry) )
+			{
+				printf("FAIL power cut at install op %d and recovery op %d: nothing runs\n", n, m);
+				bad++;
+			}
+		}
+	}
+
+	// noisy line both ways, frames get damaged and are sent again
+	memcpy(flash, saved, sizeof(flash));
+	sim_reset(&entry);
+	make_image(c, arows, 0x0456, 3);
+	noise = 2000;
+	res = load(c, arows, 1);
+	noise = 0;
+	if ( res != BS_OK || runs(c, arows, 0x0456, 0, 0, 0) != 1 )
+	{
+		printf("FAIL load over a noisy line: %s\n", res < 0 ? "no answer" : status_name(res));
+		bad++;
+	}
+
+	// bad images are refused and the old one keeps running
+	memcpy(flash, saved, sizeof(flash));
+	sim_reset(&entry);
+	memcpy(c, b, sizeof(c));
+	c[0] = 0x123456;
+	if ( load(c, brows, 1) != BS_IMAGE || runs(a, arows, aentry, 0, 0, 0) != 1 )
+	{
+		printf("FAIL image without a reset goto\n");
+		bad++;
+	}
+	sim_reset(&entry);
+	r[0] = (APP_ROWS + 1) & 0xff;
+	r[1] = (APP_ROWS + 1) >> 8;
+	r[2] = r[3] = 0;
+	if ( request(BC_BEGIN, r, 4, r, REPLY_MS) < 1 || r[0] != BS_RANGE ||
+		runs(a, arows, aentry, 0, 0, 0) != 1 )
+	{
+		printf("FAIL image larger than the application rows\n");
+		bad++;
+	}
+	sim_reset(&entry);
+	if ( load(b, brows, 0) != BS_OK )
+		bad++;
+	flash[STAGE_ROW + 3][5] ^= 0x10;		// staging row changes after it was written
+	if ( request(BC_VERIFY, 0, 0, r, VERIFY_MS) < 1 || r[0] != BS_VERIFY ||
+		runs(a, arows, aentry, 0, 0, 0) != 1 )
+	{
+		printf("FAIL damaged staging copy was installed\n");
+		bad++;
+	}
+
+	if ( boot_writes || memcmp(boot_rows, flash[BOOT_ROW], sizeof(boot_rows)) )
+	{
+		printf("FAIL bootloader rows written\n");
+		bad++;
+	}
+	printf("%ld cable pulls, %d power cuts, noisy line and bad images checked, %d failures\n",
+		cuts, powers, bad);
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = "/dev/ttyUSB0";
+	long baud = 115200;
+	int c, rows, res, reset = 0, show = 0;
+	unsigned char r[16];
+	FILE *f;
+
+	while ( (c = getopt(argc, argv, "cb:d:ir")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'c': return check();
+		case 'b': baud = atol(optarg); break;
+		case 'd': dev = optarg; break;
+		case 'i': show = 1; break;
+		case 'r': reset = 1; break;
+		default:
+			goto usage;
+		}
+	}
+	if ( show == (optind < argc) )
+		goto usage;
+	rows = 0;
+	if ( !show )
+	{
+		if ( !(f = fopen(argv[optind], "r")) )
+		{
+			perror(argv[optind]);
+			return 1;
+		}
+		rows = read_hex(f, image);
+		fclose(f);
+		if ( rows <= 0 )
+			return 1;
+		printf("%d rows, crc 0x%04x\n", rows, image_crc(image, rows));
+	}
+	if ( port_open(dev, baud) )
+		return 1;
+
+	if ( reset )
+		printf("reset the card now\n");
+	else
+		port_send((const unsigned char *)"\rU1\r", 4);
+	if ( !info(r, reset ? 30000 / (100 * RETRIES) : 4, 100) )
+	{
+		fprintf(stderr, "no bootloader\n");
+		return 1;
+	}
+	printf("bootloader v%d, %d application rows, image %s %u rows crc 0x%04x\n",
+		r[1], r[3] | r[4] << 8, r[10] ? "ok" : r[5] ? "bad" : "none",
+		r[6] | r[7] << 8, r[8] | r[9] << 8);
+	if ( r[2] != FLASH_ROW || (r[3] | r[4] << 8) != APP_ROWS )
+	{
+		fprintf(stderr, "bootloader has a different flash layout\n");
+		return 1;
+	}
+	if ( show )
+		return 0;
+	res = load(image, rows, 1);
+	if ( res != BS_OK )
+	{
+		fprintf(stderr, "load failed: %s\n", res < 0 ? "no answer" : status_name(res));
+		return 1;
+	}
+	printf("installed, application started\n");
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: flasher [-d dev] [-b baud] [-r] file.hex\n"
+		"       flasher [-d dev] [-b baud] [-r] -i\n"
+		"       flasher -c\n");
+	return 2;
+}
@@ -0,0 +1,1054 @@
+//---------------------------------------------------------------------
+//	File:		fwtest.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Checks of the firmware's modules one at a time, run on the
+//          firmware in the simulation. Each group starts from the same
+//          booted card, forked from one simulation as in scenarios.c,
+//          so a group can do what it likes to the card.
+//
+//          fwtest [-v] [group ...]
+//              runs the groups (all without a name) and prints ok or
+//              the checks that failed, -v every check. Exit status 1
+//              on a failure.
+//
+//          timebase   TB_REACHED and TB_ELAPSED across the 32 bit wrap,
+//                     one shot and periodic software timers, stopping,
+//                     skipping missed calls, a full timer table
+//          sched      sched_due() around the wrap, the enable task of
+//                     main.c's table after a long idle and across the
+//                     wrap, a disable is never held off
+//          profile    isr periods from the z command, 16 bit (pwm) and
+//                     longer (timer 1)
+//          fault      amp fault input, qei count errors and pc command
+//                     spikes trip the supervisor, turn the outputs off,
+//                     are reported and cleared by r; the fault mask and
+//                     the qei wrap band. servosim covers following error
+//          flight     the flight record freezes on a trip, h1 and a trap,
+//                     is saved to eeprom and printed by h with the last
+//                     FR_DEPTH servo cycles up to the freeze, positions
+//                     worked back from the header, duty and fault bits;
+//                     a change too big for a byte ends it
+//          params     every entry of the parameter table: found by its
+//                     letter, limits, NaN and inf, printed and read back,
+//                     the apply hooks
+//          serial     the rx ring and its overflow, the line queue and
+//                     lines too long, a uart overrun, commands back to
+//                     back at the line rate
+//          bus        telemetry in its node's slot, timed again from
+//                     every broadcast so slots follow the master
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../dspicservo.h"
+#include "sim.h"
+#include "xc.h"
+
+#define BOOT_SECS	1.0
+#define WARP_STEP	(1UL << 24)		// 45s, well under 2^31 counts
+#define SWT_FREE	5				// timer slots load.c leaves
+#define SETTLE_SECS	0.25			// enable_task() holds off a new enable
+
+// the firmware's
+extern struct PID pid;
+extern short sw_enable;
+extern struct COF cof;
+extern volatile short fr_state;
+extern struct PWMTIMING pwm_timing;
+extern void set_pwm_error(float posn_error);
+void fr_trap(void);
+void modbus_mode(short on);
+short sched_due(const struct TASK *t, struct TASKSTAT *s, unsigned long now);
+
+struct GROUP{
+	const char *name;
+	int (*run)(void);
+};
+
+static int verbose;
+static int checks;
+
+// counts a check, prints it if it failed or with -v. Returns 1 if it failed
+static int check(int ok, const char *fmt, ...)
+{
+	va_list ap;
+
+	checks++;
+	if ( ok && !verbose )
+		return 0;
+	printf("    %s ", ok ? "ok  " : "FAIL");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+	return !ok;
+}
+
+static void line(const char *cmd)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "%s\r", cmd);
+	sim_send(buf);
+}
+
+static void run_for(double secs)
+{
+	sim_run(sim_time() + secs);
+}
+
+/*
+ * the timebase from the tool's side. Firmware calls that read a timer
+ * go through sim_isr() so they do not let the simulation run.
+ */
+static unsigned long tb_value;
+
+static void tb_read(void)
+{
+	tb_value = tb_now();
+}
+
+static unsigned long tb(void)
+{
+	sim_isr(tb_read);
+	return tb_value;
+}
+
+// moves the timebase on to at, letting the background run for a while
+// after each step as it would have done in that time
+static void warp_to(unsigned long at)
+{
+	unsigned long d;
+
+	while ( (d = TB_ELAPSED(at, tb())) > WARP_STEP + TB_HZ )
+	{
+		sim_tb_warp(WARP_STEP);
+		run_for(0.02);
+	}
+	sim_tb_warp(d);
+}
+
+/*
+ * timebase: TB_REACHED, TB_ELAPSED and the software timers
+ */
+static struct SWTIMER swt[SWT_FREE + 1];
+static int swt_calls[SWT_FREE + 1];
+static struct SWTIMER *swt_new;
+static unsigned long swt_delay, swt_period;
+
+static void swt_call0(void) { swt_calls[0]++; }
+static void swt_call1(void) { swt_calls[1]++; }
+static void swt_call2(void) { swt_calls[2]++; }
+static void swt_call3(void) { swt_calls[3]++; }
+static void swt_call4(void) { swt_calls[4]++; }
+static void swt_call5(void) { swt_calls[5]++; }
+static void (*const swt_func[SWT_FREE + 1])(void) = {
+	swt_call0, swt_call1, swt_call2, swt_call3, swt_call4, swt_call5
+};
+
+static void swt_start_isr(void)
+{
+	swt_start(swt_new, swt_delay, swt_period, swt_func[swt_new - swt]);
+}
+
+static void start(int k, unsigned long delay, unsigned long period)
+{
+	swt_new = &swt[k];
+	swt_delay = delay;
+	swt_period = period;
+	swt_calls[k] = 0;
+	sim_isr(swt_start_isr);
+}
+
+static int timebase(void)
+{
+	static const struct{
+		unsigned long now, deadline;
+		int reached;
+	} reach[] = {
+		{ 0, 0, 1 },
+		{ 1, 0, 1 },
+		{ 0, 1, 0 },
+		{ 5, 0xfffffffbUL, 1 },			// deadline just before the wrap
+		{ 0xfffffffbUL, 5, 0 },
+		{ 0x7fffffffUL, 0, 1 },			// furthest back it can be
+		{ 0x80000000UL, 0, 0 },			// half way round looks ahead
+		{ 3, 0x100000002ULL, 1 },		// a host sum past 32 bits
+		{ 0xfffffff0UL, 0x10000000fULL, 0 },
+	};
+	unsigned long t;
+	int k, bad = 0;
+
+	for ( k = 0; k < (int)(sizeof(reach) / sizeof(reach[0])); k++ )
+		bad += check(TB_REACHED(reach[k].now, reach[k].deadline) == reach[k].reached,
+			"TB_REACHED(0x%lx, 0x%lx) is %d", reach[k].now, reach[k].deadline,
+			reach[k].reached);
+	bad += check(TB_ELAPSED(5UL, 0xfffffffbUL) == 10, "TB_ELAPSED across the wrap");
+	bad += check(TB_ELAPSED(0x100000002ULL, 0xfffffffeUL) == 4,
+		"TB_ELAPSED of a host sum past 32 bits");
+
+	// one shot
+	start(0, TB_MS(10), 0);
+	run_for(0.009);
+	bad += check(swt_calls[0] == 0, "one shot not called before its delay");
+	run_for(0.002);
+	bad += check(swt_calls[0] == 1, "one shot called after its delay");
+	run_for(0.05);
+	bad += check(swt_calls[0] == 1 && !swt[0].active, "one shot called once and stopped");
+
+	// periodic, then stopped
+	start(0, TB_MS(5), TB_MS(5));
+	run_for(0.1 + 0.001);
+	bad += check(swt_calls[0] == 20, "5ms periodic called %d times in 100ms", swt_calls[0]);
+	swt_stop(&swt[0]);
+	run_for(0.05);
+	bad += check(swt_calls[0] == 20 && !swt[0].active, "no calls once stopped");
+
+	// a second behind, one call and back on the period from now
+	start(0, TB_MS(5), TB_MS(5));
+	run_for(0.001);
+	sim_tb_warp(TB_HZ);
+	run_for(0.001);
+	bad += check(swt_calls[0] == 1, "missed calls skipped, %d calls", swt_calls[0]);
+	run_for(0.05);
+	bad += check(swt_calls[0] == 11, "back on the period after a skip, %d calls", swt_calls[0]);
+	swt_stop(&swt[0]);
+
+	// table full: the timers load.c does not use and one more
+	for ( k = 0; k <= SWT_FREE; k++ )
+		start(k, TB_MS(1), TB_MS(1));
+	for ( k = 0; k < SWT_FREE; k++ )
+		bad += check(swt[k].active, "timer %d of %d started", k + 1, SWT_FREE);
+	bad += check(!swt[SWT_FREE].active, "timer refused with the table full");
+	run_for(0.0105);
+	bad += check(swt_calls[SWT_FREE - 1] == 10 && swt_calls[SWT_FREE] == 0,
+		"only the started timers are called");
+	for ( k = 0; k < SWT_FREE; k++ )
+		swt_stop(&swt[k]);
+
+	// across the wrap, from 50ms before it
+	warp_to(0xffffffffUL - TB_MS(50));
+	t = tb();
+	bad += check(t >= 0xffffffffUL - TB_MS(51), "timebase 0x%lx before the wrap", t);
+	start(0, TB_MS(5), TB_MS(5));
+	start(1, TB_MS(75), 0);
+	run_for(0.1 + 0.001);
+	t = tb();
+	bad += check(t < TB_MS(60), "timebase 0x%lx after the wrap", t);
+	bad += check(swt_calls[0] == 20, "periodic across the wrap called %d times in 100ms",
+		swt_calls[0]);
+	bad += check(swt_calls[1] == 1, "one shot due after the wrap");
+	swt_stop(&swt[0]);
+	return bad;
+}
+
+/*
+ * sched: sched_due() and the task table of main.c
+ */
+static int due(unsigned long at, unsigned long period, unsigned long now,
+			   int expect, unsigned long next, const char *what)
+{
+	struct TASK t;
+	struct TASKSTAT s;
+	int d;
+
+	memset(&t, 0, sizeof(t));
+	memset(&s, 0, sizeof(s));
+	s.deadline = at;
+	t.period = period;
+	d = sched_due(&t, &s, now);
+	return check(d == expect && TB_ELAPSED(s.deadline, 0) == next,
+		"sched_due %s: due %d next 0x%lx", what, d, TB_ELAPSED(s.deadline, 0));
+}
+
+// sw_enable set to on, pid.enable after secs
+static int enable_after(short on, double secs)
+{
+	sw_enable = on;
+	run_for(secs);
+	return pid.enable;
+}
+
+static int sched(void)
+{
+	int bad = 0;
+
+	bad += due(100, 10, 99, 0, 100, "before the deadline");
+	bad += due(100, 10, 100, 1, 110, "at the deadline");
+	bad += due(100, 10, 125, 1, 135, "more than a period late");
+	bad += due(100, 0, 0, 1, 100, "period 0");
+	bad += due(0xfffffffcUL, 10, 0xfffffffbUL, 0, 0xfffffffcUL, "before a deadline at the wrap");
+	bad += due(0xfffffffcUL, 10, 2, 1, 6, "after the wrap");
+	bad += due(0xfffffffcUL, 10, 0x7ffffffcUL, 0, 0xfffffffcUL, "half way round");
+
+	bad += check(pid.enable == 1, "enabled after boot");
+	bad += check(enable_after(0, 0.02) == 0, "disabled by the enable coil");
+	bad += check(enable_after(1, 0.02) == 1, "enabled again");
+	bad += check(enable_after(0, 0.02) == 0, "disabled while settling");
+	bad += check(enable_after(1, 0.02) == 0, "no enable while settling");
+	bad += check(enable_after(1, SETTLE_SECS) == 1, "enabled after settling");
+
+	// the last enable over 2^31 counts (1.6 hours) ago
+	run_for(0.5);
+	warp_to(tb() + 0x80000000UL + TB_MS(100));
+	bad += check(enable_after(0, 0.02) == 0, "disabled 1.6 hours after an enable");
+	bad += check(enable_after(1, 0.02) == 1, "enabled again");
+
+	// the deadlines of the table go across the wrap
+	run_for(SETTLE_SECS + 0.05);
+	warp_to(0xffffffffUL - TB_MS(5));
+	bad += check(enable_after(0, 0.02) == 0 && tb() < TB_MS(50), "disabled across the wrap");
+	bad += check(enable_after(1, 0.02) == 1, "enabled after the wrap");
+	return bad;
+}
+
+/*
+ * profile: the period columns of the z command
+ */
+
+// min and max period of an isr in the z output, 0 if it is not there
+static int period(const char *out, const char *isr, double *min, double *max)
+{
+	char name[8];
+	const char *p;
+	unsigned count;
+
+	for ( p = out; p && *p; p = strchr(p, '\n'), p = p ? p + 1 : 0 )
+		if ( sscanf(p, "%7s %u %*f %*f %*f %lf/%lf", name, &count, min, max) == 4 &&
+			 strcmp(name, isr) == 0 )
+			return 1;
+	return 0;
+}
+
+static int profile(void)
+{
+	const double t1_us = 65536.0 * 64 / FCY * 1e6;	// its wrap
+	double min = 0.0, max = 0.0, pwm_us = 1e6 / pid.fpwm * pid.pwmpost;
+	int ok, bad = 0;
+
+	line("z");
+	run_for(1.0);
+	sim_clear();
+	line("z");
+	run_for(0.1);
+	ok = period(sim_output(), "pwm", &min, &max);
+	bad += check(ok && fabs(min - pwm_us) < 0.1 && fabs(max - pwm_us) < 0.1,
+		"pwm period %.1f/%.1fus, %.1fus", min, max, pwm_us);
+	// over 16 bits of Tcy, to a timebase count
+	ok = period(sim_output(), "t1", &min, &max);
+	bad += check(ok && fabs(min - t1_us) < 3.0 && fabs(max - t1_us) < 3.0,
+		"timer 1 period %.1f/%.1fus, %.1fus", min, max, t1_us);
+	return bad;
+}
+
+/*
+ * fault: injected faults
+ */
+
+// cof.fault is want, the outputs off and the trip printed if it is set
+static int tripped(unsigned short want, const char *what)
+{
+	int off = OVDCON == 0 && sim_volts == 0.0;
+	int printed = strstr(sim_output(), "FAULT:") != 0;
+	int bad;
+
+	if ( want )
+		bad = check(cof.fault == want && cof.first == want && off && printed,
+			"%s trips: fault 0x%x first 0x%x outputs %s%s", what, cof.fault, cof.first,
+			off ? "off" : "on", printed ? "" : ", not reported");
+	else
+		bad = check(cof.fault == 0 && OVDCON == 0x3f00,
+			"%s does not trip: fault 0x%x", what, cof.fault);
+	sim_clear();
+	return bad;
+}
+
+static int reset_fault(void)
+{
+	line("r");
+	run_for(0.02);
+	return check(cof.fault == 0 && OVDCON == 0x3f00, "cleared by r");
+}
+
+static int fault(void)
+{
+	int k, bad = 0;
+
+	// tuned as in scenarios.c so a move does not trip following error
+	line("p25");
+	line("d0.04");
+	run_for(0.2);
+	sim_clear();
+	bad += tripped(0, "nothing");
+
+	// amp fault input, RE8 low
+	sim_amp_fault(1);
+	run_for(0.02);
+	bad += tripped(FLT_AMP, "amp fault input");
+	line("r");
+	run_for(0.02);
+	bad += check(cof.fault == FLT_AMP, "trips again after r while still low");
+	sim_amp_fault(0);
+	bad += reset_fault();
+	line("a7");
+	run_for(0.02);
+	sim_amp_fault(1);
+	run_for(0.02);
+	bad += tripped(0, "amp fault masked off");
+	sim_amp_fault(0);
+	line("a15");
+	run_for(0.02);
+
+	// a count error near the wrap of POSCNT is the qei wrapping
+	sim_qei_error();
+	run_for(0.02);
+	bad += tripped(0, "qei count error at the wrap");
+	sim_cmd_move(-200, 0.02);
+	run_for(0.1);
+	bad += tripped(0, "wrap of POSCNT going down");
+	sim_cmd_move(5200, 0.5);
+	run_for(0.8);
+	bad += tripped(0, "move away from the wrap");
+	bad += check(POSCNT > 0x100 && POSCNT < 0xff00, "POSCNT 0x%x away from the wrap", POSCNT);
+	sim_qei_error();
+	run_for(0.02);
+	bad += tripped(FLT_ENCODER, "qei count error");
+	bad += reset_fault();
+
+	// pc command spikes, off by default
+	for ( k = 0; k < 20; k++ )
+	{
+		sim_cmd_spike();
+		run_for(20e-6);
+	}
+	run_for(0.02);
+	bad += tripped(0, "pc command spikes with o0");
+	line("o5");
+	run_for(0.1);
+	for ( k = 0; k < 3; k++ )
+	{
+		sim_cmd_spike();
+		run_for(20e-6);
+	}
+	run_for(0.02);
+	bad += tripped(0, "3 pc command spikes with o5");
+	for ( k = 0; k < 20; k++ )
+	{
+		sim_cmd_spike();
+		run_for(20e-6);
+	}
+	run_for(0.02);
+	bad += tripped(FLT_CMDSPEED, "20 pc command spikes with o5");
+	bad += reset_fault();
+	return bad;
+}
+
+/*
+ * flight: the fault flight recorder
+ */
+#define FR_SAVED	3				// flight.c's fr_state once in eeprom
+
+// what the h command printed
+struct FRDUMP{
+	unsigned fault, trips;
+	int lines, left_out;		// cycles printed, older ones left out
+	long cmd, fb;				// positions at the freeze in the header
+	long first_cmd, last_cmd, last_fb;
+	int maxduty;				// largest |duty| in 1/7 of full
+	unsigned faults, last_faults;	// fault bits of all cycles, of the newest
+};
+
+// the h command's output, 0 if there was no record or it does not add up
+static int flight_dump(struct FRDUMP *r)
+{
+	const char *p, *q;
+	unsigned count, flt;
+	int n, d;
+	long c, f, e;
+
+	memset(r, 0, sizeof(*r));
+	sim_clear();
+	line("h");
+	run_for(0.1);
+	p = strstr(sim_output(), "# flight record");
+	if ( p == 0 || sscanf(p, "# flight record, fault 0x%x trip %u, %u", &r->fault, &r->trips,
+						  &count) != 3 )
+		return 0;
+	if ( (q = strstr(p, "\n# ")) != 0 )
+		sscanf(q, "\n# %d older", &r->left_out);
+	if ( (p = strstr(p, "# at freeze")) == 0 ||
+		 sscanf(p, "# at freeze command %ld feedback %ld", &r->cmd, &r->fb) != 2 )
+		return 0;
+	while ( (p = strchr(p, '\n')) != 0 )
+	{
+		p++;
+		if ( sscanf(p, "%d,%ld,%ld,%ld,%d,0x%x", &n, &c, &f, &e, &d, &flt) != 6 )
+			continue;
+		if ( n != r->lines - (int)count + 1 || e != c - f || d < -7 || d > 7 )
+			return 0;
+		if ( r->lines == 0 )
+			r->first_cmd = c;
+		r->last_cmd = c;
+		r->last_fb = f;
+		if ( abs(d) > r->maxduty )
+			r->maxduty = abs(d);
+		r->faults |= flt;
+		r->last_faults = flt;
+		r->lines++;
+	}
+	return r->lines == (int)count;
+}
+
+// moves both positions by the same amount, more than a byte holds
+static void fr_jump_isr(void)
+{
+	pid.command += 1000;
+	pid.feedback += 1000;
+}
+
+static int flight(void)
+{
+	struct FRDUMP r;
+	int ok, bad = 0;
+	long at;
+	char first[16384];
+
+	line("p25");
+	line("d0.04");
+	run_for(0.2);
+	sim_clear();
+	line("h");
+	run_for(0.1);
+	bad += check(strstr(sim_output(), "no flight record") != 0, "no record in a new eeprom");
+
+	// a trip in the middle of a move
+	sim_cmd_move(3000, 0.3);
+	run_for(0.15);
+	sim_amp_fault(1);
+	run_for(0.2);
+	bad += check(fr_state == FR_SAVED, "saved after the trip");
+	ok = flight_dump(&r);
+	bad += check(ok &&
+		r.fault == FLT_AMP && r.trips == cof.trips && r.lines == FR_DEPTH && r.left_out == 0,
+		"record of the trip: fault 0x%x trip %u, %d cycles", r.fault, r.trips, r.lines);
+	bad += check(r.last_cmd == r.cmd && r.last_fb == r.fb && r.cmd != 0,
+		"last cycle %ld,%ld is the freeze at %ld,%ld", r.last_cmd, r.last_fb, r.cmd, r.fb);
+	// 10000 edges/s for FR_DEPTH cycles of 250us
+	bad += check(labs(r.last_cmd - r.first_cmd - FR_DEPTH * 10000L / 4000) <= 2,
+		"command worked back over %d cycles moved %ld", r.lines, r.last_cmd - r.first_cmd);
+	bad += check(r.maxduty > 0, "duty recorded while moving (up to %d/7)", r.maxduty);
+	bad += check(r.last_faults == FLT_AMP && r.faults == FLT_AMP,
+		"amp fault bit in the newest cycle only (0x%x, all 0x%x)", r.last_faults, r.faults);
+	snprintf(first, sizeof(first), "%s", sim_output());
+	run_for(0.3);
+	flight_dump(&r);
+	bad += check(fr_state == FR_SAVED && strcmp(first, sim_output()) == 0,
+		"frozen while the fault is latched");
+
+	// recording again after r, the saved copy stays until the next freeze
+	sim_amp_fault(0);
+	line("r");
+	run_for(0.1);
+	bad += check(fr_state != FR_SAVED, "recording again after r");
+	flight_dump(&r);
+	bad += check(strcmp(first, sim_output()) == 0, "saved copy kept after r");
+
+	// h1 freezes without a fault
+	sim_cmd_move(-1000, 0.1);
+	run_for(0.05);
+	line("h1");
+	run_for(0.2);
+	ok = flight_dump(&r);
+	bad += check(ok &&
+		r.fault == 0 && r.lines == FR_DEPTH && r.last_cmd == r.cmd && r.faults == 0,
+		"record frozen by h1: fault 0x%x, %d cycles", r.fault, r.lines);
+	bad += check(cof.fault == 0, "h1 does not trip: fault 0x%x", cof.fault);
+
+	// a change too big for a byte: printed from there on
+	run_for(0.1);
+	sim_isr(fr_jump_isr);
+	at = pid.command;
+	run_for(0.01);
+	line("h1");
+	run_for(0.2);
+	ok = flight_dump(&r);
+	bad += check(ok && r.left_out > 0 && r.lines + r.left_out == FR_DEPTH &&
+		r.lines >= 40 && r.lines <= 41 && r.first_cmd == at,
+		"a jump of 1000 ends the record: %d cycles from %ld, %d left out",
+		r.lines, r.first_cmd, r.left_out);
+
+	// a trap saves it at once, recording starts again with no fault latched
+	run_for(0.1);
+	bad += check(fr_state != FR_SAVED, "recording again after h1");
+	sim_isr(fr_trap);
+	bad += check(fr_state == FR_SAVED, "saved by the trap handler at once");
+	ok = flight_dump(&r);
+	bad += check(ok &&
+		r.fault == FLT_TRAP && r.lines == FR_DEPTH,
+		"record of a trap: fault 0x%x, %d cycles", r.fault, r.lines);
+	return bad;
+}
+
+/*
+ * params: the parameter table
+ */
+static const struct PARAM *put_p;
+static float put_v;
+static int put_res;
+
+static void put_isr(void)
+{
+	put_res = param_put(put_p, put_v);
+}
+
+static void print_isr(void)
+{
+	param_print(put_p);
+}
+
+static void pwm_error_isr(void)
+{
+	set_pwm_error(put_v);
+}
+
+// param_put() as the console does it, hooks included
+static int put(const struct PARAM *p, float v)
+{
+	put_p = p;
+	put_v = v;
+	sim_isr(put_isr);
+	return put_res;
+}
+
+// the value param_print() shows, read back the way it was printed
+static int printed(const struct PARAM *p, float *v)
+{
+	const char *s;
+
+	sim_clear();
+	put_p = p;
+	sim_isr(print_isr);
+	if ( (s = strstr(sim_output(), " = ")) == 0 )
+		return 0;
+	s += 3;
+	if ( p->flags & PF_HEX )
+	{
+		*v = (float)strtoul(s, 0, 16);
+		return 1;
+	}
+	return fx_strtof(s, v) != s;
+}
+
+static int same(const struct PARAM *p, float a, float b)
+{
+	if ( p->type != PT_FLOAT )
+		return a == b;
+	return fabsf(a - b) <= 0.5e-6f + fabsf(b) * 1.0e-7f;	// the 6 decimals printed
+}
+
+// one value that param_put() took or refused: stored, printed and read back
+static int param_value(const struct PARAM *p, float v)
+{
+	float was = param_get(p), now, back = 0.0f;
+	int res = put(p, v), bad = 0;
+
+	now = param_get(p);
+	if ( res == PARAM_RANGE || v != v || v < p->min || v > p->max )
+		return check(res == PARAM_RANGE && same(p, now, was),
+			"%c%g refused as out of range, res %d value %g", p->code, v, res, now);
+	if ( res != PARAM_OK )		// the hook turned it down
+		return check(same(p, now, was), "%c%g refused by its hook (%d), value kept",
+			p->code, v, res);
+	if ( p->type != PT_FLOAT )
+		v = (float)(long)v;
+	bad += check(now == v, "%c%g stored as %g", p->code, v, now);
+	if ( pid.nodeid != 0 )
+		return bad;		// the console only answers lines addressed to it
+	bad += check(printed(p, &back) && same(p, back, now) && put(p, back) == PARAM_OK &&
+		same(p, param_get(p), now), "%c%g printed and read back as %g", p->code, v, back);
+	return bad;
+}
+
+static int params_check(void)
+{
+	const struct PARAM *p, *q;
+	const float inf = 1.0f / 0.0f;
+	float mid, v;
+	int k, bad = 0;
+
+	bad += check(param_validate() == 0, "values after boot within their limits");
+	bad += check(param_find('q') == 0 && param_find(0) == 0 && param_find('\xff') == 0,
+		"letters that are not parameters");
+	for ( p = params; p < &params[param_count]; p++ )
+	{
+		for ( q = params; q < p && q->code != p->code; q++ )
+			;
+		bad += check(q == p, "%c is in the table once", p->code);
+		bad += check(param_find(p->code) == p, "%c is found", p->code);
+		bad += check(p->min <= p->max && p->label && p->help && p->unit,
+			"%c has limits, label, help and unit", p->code);
+		if ( p->code == 'y' )
+			continue;		// modbus mode would take the console, see below
+
+		mid = p->type == PT_FLOAT ? (p->min + p->max) / 2 : (float)(long)((p->min + p->max) / 2);
+		bad += param_value(p, param_get(p));
+		bad += param_value(p, p->min);
+		bad += param_value(p, p->max);
+		bad += param_value(p, mid);
+		bad += param_value(p, p->min - 1.0f - fabsf(p->min) * 0.01f);
+		bad += param_value(p, p->max + 1.0f + fabsf(p->max) * 0.01f);
+		bad += param_value(p, inf);
+		bad += param_value(p, -inf);
+		bad += param_value(p, 0.0f / 0.0f);
+		if ( p->type != PT_FLOAT && p->max > p->min )
+			bad += param_value(p, p->min + 0.75f);	// truncated
+	}
+
+	// the hooks
+	pid.error_i = 5.0f;
+	put(param_find('i'), 1.0f);
+	bad += check(pid.error_i == 0.0f, "i resets the integrator");
+	put(param_find('u'), PWM_POST);
+	put(param_find('t'), 1);
+	k = put(param_find('w'), 20000);
+	run_for(0.01);
+	bad += check(k == PARAM_OK && PTPER == FCY / 20000 / 2 - 1, "w20000 sets PTPER %u", PTPER);
+	k = put(param_find('u'), PWM_POST_MIN);
+	bad += check(k == PWMT_TOO_FAST && pid.pwmpost == PWM_POST,
+		"u%d too fast at 20kHz refused (%d)", PWM_POST_MIN, k);
+	put(param_find('w'), FPWM);
+	run_for(0.01);
+	bad += check(PTPER == FCY / FPWM / 2 - 1, "back to %dHz", FPWM);
+
+	// f0 would be a divide by zero in the servo isr (set_pwm_error())
+	v = pid.maxerror;
+	bad += check(put(param_find('f'), 0.0f) == PARAM_RANGE && pid.maxerror == v, "f0 refused");
+	sim_clear();
+	line("f0");
+	run_for(0.1);
+	bad += check(pid.maxerror == v, "f0 on the console refused");
+	// a 0 from an eeprom image saved before: no drive rather than garbage.
+	// x86 turns inf and nan into LONG_MIN, which happens to land on 0 in
+	// PDC3; the dsPIC saturates to LONG_MAX and would drive PDC1 flat out
+	pid.maxerror = 1000.0f;
+	put_v = 500.0f;
+	sim_isr(pwm_error_isr);
+	k = PDC1;
+	pid.maxerror = 0.0f;
+	sim_isr(pwm_error_isr);
+	bad += check(k == pwm_timing.pdcmax / 2, "f1000 drives 500 counts at half duty (PDC1 %d)", k);
+	bad += check(PDC1 == 0 && PDC3 == 0, "maxerror 0 drives nothing (PDC1 %u PDC3 %u)", PDC1, PDC3);
+	pid.maxerror = v;
+	bad += check(put(param_find('y'), 1) == PARAM_OK && pid.protocol == 1, "y1 stored");
+	bad += check(put(param_find('y'), 0) == PARAM_OK && pid.protocol == 0, "y0 stored");
+	run_for(0.05);
+	sim_clear();
+	line("l");
+	run_for(0.1);
+	bad += check(strstr(sim_output(), "protocol(y) = 0") != 0, "console back after y0");
+	return bad;
+}
+
+/*
+ * serial: the rx ring, the line assembler and its queue, the counters
+ */
+#define RX_RING		64			// serial.c's
+#define RX_LINES	4
+#define RX_LINE		30
+
+extern volatile unsigned short rx_oerr, rx_ferr, rx_full;
+extern unsigned short rx_long;
+short rx_assemble(void);
+char *rx_getline(void);
+void rx_release(void);
+void _U1RXInterrupt(void);
+
+static short assembled;
+
+static void assemble_isr(void)
+{
+	assembled = rx_assemble();
+}
+
+// bytes through the uart fifo and the rx interrupt with the background
+// stopped, as if it was busy all that time
+static void rx_bytes(const char *s, int n)
+{
+	while ( n > 0 )
+	{
+		if ( sim_rx_put((unsigned char)*s) )
+		{
+			s++;
+			n--;
+		}
+		else
+			sim_isr(_U1RXInterrupt);
+	}
+	sim_isr(_U1RXInterrupt);
+}
+
+// the oldest queued line is text, it is released
+static int next_line(const char *text)
+{
+	char *l;
+	int ok;
+
+	sim_isr(assemble_isr);
+	l = rx_getline();
+	ok = l != 0 && strcmp(l, text) == 0;
+	check(ok, "line \"%s\" queued in order, got \"%s\"", text, l ? l : "(none)");
+	rx_release();
+	return !ok;
+}
+
+static int serial(void)
+{
+	char burst[256], lots[RX_RING + 6];
+	unsigned short full = rx_full, lng = rx_long, oerr = rx_oerr;
+	char *l;
+	int k, n, bad = 0;
+
+	// the queue takes RX_LINES - 1 complete lines, the CR of the next
+	// one waits in the ring until a line is released
+	rx_bytes("b1\rb2\rb3\rb4\rb5\r", 15);
+	sim_isr(assemble_isr);
+	bad += check(assembled == 11, "%d lines and \"b4\" taken from the ring (%d bytes)",
+		RX_LINES - 1, assembled);
+	for ( k = 1; k <= 5; k++ )
+	{
+		snprintf(burst, sizeof(burst), "b%d", k);
+		bad += next_line(burst);
+	}
+	sim_isr(assemble_isr);
+	bad += check(rx_getline() == 0 && assembled == 0, "queue and ring empty");
+
+	// the ring keeps RX_RING - 1 bytes, the rest are counted
+	memset(lots, 'a', sizeof(lots));
+	rx_bytes(lots, sizeof(lots));
+	n = rx_full - full;
+	bad += check(n == (int)sizeof(lots) - (RX_RING - 1), "ring full, %d bytes counted lost", n);
+	// the line keeps RX_LINE - 1 chars, the rest are counted
+	sim_isr(assemble_isr);
+	rx_bytes("\r", 1);
+	sim_isr(assemble_isr);
+	l = rx_getline();
+	n = rx_long - lng;
+	bad += check(l && strlen(l) == RX_LINE - 1 && n == RX_RING - RX_LINE,
+		"long line cut to %d chars, %d counted", l ? (int)strlen(l) : -1, n);
+	rx_release();
+	full = rx_full;
+	lng = rx_long;
+
+	// the uart fifo overruns while the rx interrupt is held off; the
+	// receiver is started again and the console goes on
+	IEC0bits.U1RXIE = 0;
+	line("\r\r\r\r\r\r\r");
+	run_for(0.01);
+	IEC0bits.U1RXIE = 1;
+	run_for(0.05);
+	n = rx_oerr - oerr;
+	bad += check(n == 1, "uart overrun counted (%d)", n);
+	sim_clear();
+	line("b7");
+	run_for(0.1);
+	bad += check(pid.deadband == 7.0f, "console works after the overrun");
+
+	// commands back to back at the line rate. Each one answers with the
+	// settings (60ms at 115200), so the ring has to hold the rest
+	burst[0] = 0;
+	for ( k = 1; k <= 9; k++ )
+		snprintf(burst + strlen(burst), sizeof(burst) - strlen(burst), "b%d\r", k);
+	strcat(burst, "p11\ri0\rd0.5\r02\r13\rm5\rf600\r");
+	n = (int)strlen(burst);
+	sim_send(burst);
+	run_for(1.5);
+	bad += check(n < RX_RING && pid.deadband == 9.0f && pid.pgain == 11.0f && pid.igain == 0.0f
+		&& pid.dgain == 0.5f && pid.ff0gain == 2.0f && pid.ff1gain == 3.0f && pid.maxoutput == 5.0f
+		&& pid.maxerror == 600.0f, "%d bytes of commands back to back all taken", n);
+	bad += check(rx_full == full && rx_long == lng && rx_oerr == oerr + 1,
+		"nothing lost (ring full %u, long %u, overruns %u)", rx_full - full, rx_long - lng,
+		rx_oerr - oerr - 1);
+
+	// more than the ring and the queue hold while the first answers go
+	// out: the bytes that did not fit are counted, the rest are taken
+	for ( k = 10; k <= 30; k++ )
+		snprintf(burst + strlen(burst), sizeof(burst) - strlen(burst), "b%d\r", k);
+	sim_send(burst + n);
+	run_for(2.0);
+	n = rx_full - full;
+	bad += check(n > 0 && pid.deadband >= 10.0f, "%d bytes past the ring counted", n);
+	return bad;
+}
+
+/*
+ * bus: telemetry slots timed from the last broadcast
+ */
+#define BUS_NODE	3				// "n3" below
+
+static double tx_first;				// sim time of the first byte sent
+
+static void tx_seen(unsigned char ch)
+{
+	(void)ch;
+	if ( tx_first < 0.0 )
+		tx_first = sim_time();
+}
+
+// sends a broadcast, returns the time of its last byte and the time the
+// next telemetry line starts in *line
+static double broadcast(const char *cmd, double *at)
+{
+	double end = sim_time() + (strlen(cmd) + 1) * 10.0 / 115200;
+
+	tx_first = -1.0;
+	line(cmd);
+	while ( tx_first < 0.0 && sim_time() < end + 2.0 )
+		run_for(0.0005);
+	*at = tx_first;
+	return end;
+}
+
+static int bus(void)
+{
+	double slot = bus_slot_us(BUS_NODE) / 1e6, end, at, prev;
+	int bad = 0;
+
+	line("n3");
+	run_for(0.2);
+	sim_tx_hook = tx_seen;
+	end = broadcast("@* c1", &at);
+	bad += check(fabs(at - (end + 1.0 + slot)) < 0.002,
+		"telemetry 1s plus the slot after @* c1 (%.4fs)", at - end);
+	run_for(0.3);
+	end = broadcast("@* c", &at);
+	bad += check(fabs(at - (end + 1.0 + slot)) < 0.002,
+		"synced again by the next broadcast (%.4fs)", at - end);
+	prev = at;
+	run_for(0.5);
+	broadcast("@2 c", &at);
+	bad += check(fabs(at - (prev + 1.0)) < 0.002,
+		"a line for another node does not move the slot (%.4fs)", at - prev);
+	end = broadcast("@* c0", &at);
+	bad += check(at < 0.0, "@* c0 stops it");
+	sim_tx_hook = 0;
+	return bad;
+}
+
+static const struct GROUP groups[] = {
+	{ "timebase", timebase },
+	{ "sched", sched },
+	{ "profile", profile },
+	{ "fault", fault },
+	{ "flight", flight },
+	{ "params", params_check },
+	{ "serial", serial },
+	{ "bus", bus },
+};
+#define NGROUPS	(int)(sizeof(groups) / sizeof(groups[0]))
+
+/*********************************************************************
+  Function:        int run(const struct GROUP *g)
+
+  Overview:        runs a group in a child of the booted simulation
+
+  Output:          0 if it passed
+********************************************************************/
+static int run(const struct GROUP *g)
+{
+	int st, pipefd[2], n = 0;
+
+	fflush(NULL);
+	if ( pipe(pipefd) )
+		return 1;
+	if ( fork() == 0 )
+	{
+		close(pipefd[0]);
+		printf("%s\n", g->name);
+		st = g->run();
+		fflush(stdout);
+		if ( write(pipefd[1], &checks, sizeof(checks)) != sizeof(checks) )
+			_exit(2);
+		_exit(st != 0);
+	}
+	close(pipefd[1]);
+	if ( read(pipefd[0], &n, sizeof(n)) != sizeof(n) )
+		n = 0;
+	close(pipefd[0]);
+	wait(&st);
+	if ( !WIFEXITED(st) || WEXITSTATUS(st) > 1 )
+	{
+		printf("    FAIL did not finish\n");
+		return 1;
+	}
+	printf("    %s, %d checks\n", WEXITSTATUS(st) ? "FAIL" : "ok", n);
+	return WEXITSTATUS(st);
+}
+
+static void boot(void)
+{
+	sim_start();
+	sim_run(BOOT_SECS);
+	line("");
+	sim_run(sim_time() + 0.5);
+	sim_clear();
+}
+
+int main(int argc, char **argv)
+{
+	int c, k, j, bad = 0, n = 0;
+
+	while ( (c = getopt(argc, argv, "v")) != -1 )
+	{
+		if ( c == 'v' )
+			verbose = 1;
+		else
+			goto usage;
+	}
+	for ( k = optind; k < argc; k++ )
+	{
+		for ( j = 0; j < NGROUPS; j++ )
+			if ( strcmp(groups[j].name, argv[k]) == 0 )
+				break;
+		if ( j == NGROUPS )
+		{
+			fprintf(stderr, "no group %s\n", argv[k]);
+			goto usage;
+		}
+	}
+
+	boot();
+	for ( j = 0; j < NGROUPS; j++ )
+	{
+		if ( optind < argc )
+		{
+			for ( k = optind; k < argc; k++ )
+				if ( strcmp(groups[j].name, argv[k]) == 0 )
+					break;
+			if ( k == argc )
+				continue;
+		}
+		bad += run(&groups[j]);
+		n++;
+	}
+	printf("%d groups, %d failures\n", n, bad);
+	return bad != 0;
+
+usage:
+	fprintf(stderr, "usage: fwtest [-v] [group ...]\ngroups:");
+	for ( j = 0; j < NGROUPS; j++ )
+		fprintf(stderr, " %s", groups[j].name);
+	fprintf(stderr, "\n");
+	return 2;
+}
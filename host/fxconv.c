@@ -0,0 +1,309 @@
+//---------------------------------------------------------------------
+//	File:		fxconv.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: PC side check of the console's number conversions in
+//          fixnum.c against the C library.
+//
+//          fxconv number ...     parse each with fx_strtof() and
+//                                strtof(), print it back with fx_ftoa()
+//                                and printf("%.6f")
+//          fxconv -c [-s stride] check fx_strtof() against strtof() on
+//                                every stride'th float (default 4093)
+//                                and the ties and near ties around it,
+//                                fx_ftoa() against printf and print and
+//                                parse round trips; and both on every
+//                                float from 16 to 32, so on every
+//                                mantissa. -s 1 takes hours.
+//          fxconv -t             ns per call of fx_strtof() and strtof(),
+//                                fx_ftoa() and printf("%.6f") on numbers
+//                                the way they are typed on the console
+//
+//          A difference prints the input and exits with status 1.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- fx_strtof() may be 1 ulp off near a tie, -t times it
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "../fixnum.h"
+
+#define REPORT_MAX	10			// differences printed before giving up
+
+static long checked, failed, ulp_off;
+
+static unsigned long float_bits(float v)
+{
+	unsigned int u;
+
+	memcpy(&u, &v, sizeof(u));
+	return u;
+}
+
+static float bits_float(unsigned long b)
+{
+	unsigned int u = (unsigned int)b;
+	float v;
+
+	memcpy(&v, &u, sizeof(v));
+	return v;
+}
+
+static void fail(const char *what, const char *text, float got, float want)
+{
+	if ( ++failed <= REPORT_MAX )
+		printf("FAIL %s \"%s\": 0x%08lx %.9g, want 0x%08lx %.9g\n", what, text,
+			float_bits(got), got, float_bits(want), want);
+}
+
+// fx_strtof() of text is strtof() of it, or the float next to it where
+// text is that close to a tie (fixnum.c), counted in ulp_off
+static void parse(const char *text)
+{
+	float got, want = strtof(text, 0);
+	unsigned long g, w;
+
+	checked++;
+	if ( fx_strtof(text, &got) == 0 )
+	{
+		fail("parse", text, got, want);
+		return;
+	}
+	g = float_bits(got);
+	w = float_bits(want);
+	if ( g == w )
+		return;
+	if ( (g ^ w) < 0x80000000UL && (g + 1 == w || w + 1 == g) )
+		ulp_off++;
+	else
+		fail("parse", text, got, want);
+}
+
+// what the console prints for v is printf's %.6f (%.9e from 2e9 up), and
+// reads back as v where those decimals are enough to tell the floats apart
+static void print(float v)
+{
+	char fx[FX_BUFLEN], ref[64];
+	float back;
+
+	checked++;
+	if ( fabsf(v) < 2.0e9f )
+	{
+		fx_ftoa(fx, v, FX_DIGITS);
+		snprintf(ref, sizeof(ref), "%.6f", v);
+		// fx_ftoa() may be one off in the last decimal below 1/32
+		if ( fabsf(v) >= 0.03125f && strcmp(fx, ref) != 0 )
+		{
+			if ( ++failed <= REPORT_MAX )
+				printf("FAIL print 0x%08lx: \"%s\", printf \"%s\"\n", float_bits(v), fx, ref);
+			return;
+		}
+		if ( fabsf(v) < 16.0f )
+			return;
+	}
+	else
+	{
+		fx_ftoa(fx, v, FX_MAXDIGITS);
+		snprintf(ref, sizeof(ref), "%.*e", FX_MAXDIGITS, v);
+		if ( strcmp(fx, ref) != 0 )
+		{
+			if ( ++failed <= REPORT_MAX )
+				printf("FAIL print 0x%08lx: \"%s\", printf \"%s\"\n", float_bits(v), fx, ref);
+			return;
+		}
+	}
+	if ( fx_strtof(fx, &back) == 0 || float_bits(back) != float_bits(v) )
+		fail("print and parse", fx, back, v);
+}
+
+/*********************************************************************
+  Function:        static void one(float v)
+
+  Overview:        all the checks of one positive finite float: its
+                   shortest round trip text, the tie between it and the
+                   next float up to 9 to FX_SIGDIGITS significant digits
+                   (so just below, on and just above the tie), and the
+                   printing
+********************************************************************/
+static void one(float v)
+{
+	static const int sig[] = { 9, 12, 17, 20, 24, FX_SIGDIGITS };
+	char text[64];
+	double mid;
+	size_t k;
+
+	snprintf(text, sizeof(text), "%.9g", v);
+	parse(text);
+	snprintf(text, sizeof(text), "-%.9g", v);
+	parse(text);
+	if ( v < 3.4028234e38f )
+	{
+		mid = ((double)v + nextafterf(v, INFINITY)) / 2;	// exact in a double
+		for ( k = 0; k < sizeof(sig) / sizeof(sig[0]); k++ )
+		{
+			snprintf(text, sizeof(text), "%.*e", sig[k] - 1, mid);
+			parse(text);
+		}
+	}
+	print(v);
+	print(-v);
+}
+
+static int check(unsigned long stride)
+{
+	// every float of a binade the gains live in, so every mantissa
+	static const float whole[][2] = {
+		{ 16.0f, 32.0f },		// p25
+	};
+	static const char *const fixed[] = {
+		"0", "-0", "0.0", ".5", "5.", "1e0", "1E+2", "1e-2", "  7", "+3",
+		"910319.03163",			// rounded twice by the 9 digit parser
+		"1.4e-45", "7.006492321624085e-46", "7.006492321624086e-46", "1e-46",
+		"1.1754942e-38", "1.17549435e-38", "3.4028235e38", "3.40282357e38", "1e39",
+		"1e-999", "1e999", "0.000000000000000000000000000000000000000000001",
+		"1234567890123456789012345678", "12345678901234567890123456789012345",
+		"16777217", "16777217.0000000000000000001", "33554434", "33554433",
+	};
+	static const char *const refused[] = { "", ".", "-", "e5", "+.e1", "x" };
+	unsigned long b, n;
+	size_t k;
+	float v, lo;
+
+	for ( k = 0; k < sizeof(fixed) / sizeof(fixed[0]); k++ )
+		parse(fixed[k]);
+	for ( k = 0; k < sizeof(refused) / sizeof(refused[0]); k++ )
+	{
+		checked++;
+		if ( fx_strtof(refused[k], &v) != 0 || v != 0.0f )
+			fail("not a number", refused[k], v, 0.0f);
+	}
+
+	// every stride'th float and the two at each end of every binade
+	for ( b = 1; b < 0x7f800000UL; b += stride )
+		one(bits_float(b));
+	for ( b = 0; b < 0x7f800000UL; b += 0x00800000UL )
+		for ( n = b ? b - 2 : 1; n < b + 2; n++ )
+			one(bits_float(n));
+
+	for ( k = 0; k < sizeof(whole) / sizeof(whole[0]); k++ )
+	{
+		lo = whole[k][0];
+		for ( v = lo; v < whole[k][1]; v = nextafterf(v, INFINITY) )
+		{
+			char text[32];
+
+			snprintf(text, sizeof(text), "%.9g", v);
+			parse(text);
+			print(v);
+		}
+	}
+	printf("%ld conversions checked, %ld 1 ulp off, %ld failures\n", checked,
+		ulp_off, failed);
+	return failed != 0;
+}
+
+static double now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1.0e9 + t.tv_nsec;
+}
+
+#define TIME_BATCHES	20
+#define TIME_CALLS		20000
+
+// fastest batch in ns per call of one of the four conversions
+static double time_one(int which)
+{
+	static const char *const typed[] = {
+		"25", "0.04", "1000", "16000", "-3.14159", "1e-3", "123456.789", "0.5",
+	};
+	static volatile float sink;
+	static char buf[64];
+	const size_t n = sizeof(typed) / sizeof(typed[0]);
+	double best = 1.0e30, t0, t;
+	float v;
+	int b, k;
+
+	for ( b = 0; b < TIME_BATCHES; b++ )
+	{
+		t0 = now_ns();
+		for ( k = 0; k < TIME_CALLS; k++ )
+		{
+			const char *text = typed[k % n];
+
+			switch ( which )
+			{
+			case 0: fx_strtof(text, &v); sink = v; break;
+			case 1: sink = strtof(text, 0); break;
+			case 2: fx_ftoa(buf, sink + k, FX_DIGITS); break;
+			default: snprintf(buf, sizeof(buf), "%.6f", sink + k); break;
+			}
+		}
+		t = (now_ns() - t0) / TIME_CALLS;
+		if ( t < best )
+			best = t;
+	}
+	return best;
+}
+
+static int timing(void)
+{
+	static const char *const name[] = { "fx_strtof", "strtof", "fx_ftoa", "printf %.6f" };
+	int k;
+
+	for ( k = 0; k < 4; k++ )
+		printf("%-12s %7.1f ns\n", name[k], time_one(k));
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char fx[FX_BUFLEN];
+	unsigned long stride = 4093;
+	int c, k, do_check = 0, do_time = 0;
+	float v;
+
+	while ( (c = getopt(argc, argv, "cs:t")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'c': do_check = 1; break;
+		case 't': do_time = 1; break;
+		case 's': stride = strtoul(optarg, 0, 0); break;
+		default:
+			goto usage;
+		}
+	}
+	if ( do_check )
+		return check(stride ? stride : 1);
+	if ( do_time )
+		return timing();
+	if ( optind == argc )
+		goto usage;
+	for ( k = optind; k < argc; k++ )
+	{
+		if ( fx_strtof(argv[k], &v) == 0 )
+		{
+			printf("%s: not a number\n", argv[k]);
+			continue;
+		}
+		printf("%s: fx 0x%08lx strtof 0x%08lx  %s  %%.6f %.6f\n", argv[k], float_bits(v),
+			float_bits(strtof(argv[k], 0)), fx_ftoa(fx, v, FX_DIGITS), v);
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: fxconv number ...\n       fxconv -c [-s stride]\n       fxconv -t\n");
+	return 2;
+}
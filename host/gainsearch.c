@@ -0,0 +1,491 @@
+//---------------------------------------------------------------------
+//	File:		gainsearch.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Finds servo gains for an axis offline, with the firmware
+//          running closed loop against a motor model (sim/sim.c).
+//
+//          gainsearch [-e eeprom] [-M motor] [-G pid1] [-m edges] [-r secs]
+//                     [-w secs] [-b counts] [-n pop] [-g gens] [-j jobs] [-s seed]
+//              boots the firmware once (with the setup from the eeprom
+//              image if there is one), then scores candidate gain sets
+//              on a standard move: edges out over -r secs, -w secs to
+//              settle, and back the same way. The cost of a candidate is
+//                 settling time in ms, to within -b counts
+//               + overshoot in counts
+//               + FOLLOW_W * rms following error during the moves
+//              summed over both moves. A candidate that trips a fault or
+//              does not settle costs at least BIG.
+//
+//              The search is differential evolution over the -G gains,
+//              any of p i d 0 1 (log scale for p, i and d). FF0 is left
+//              out by default: it multiplies the absolute command, so
+//              it only fits the move it was scored on. -n candidates for
+//              -g generations, -s seeding the random numbers. Every
+//              candidate runs in a process forked from the booted
+//              firmware, -j at a time (default one per cpu), so the
+//              time goes down close to linearly with the cores and the
+//              result does not depend on -j.
+//
+//              The best gains go to stdout as console commands, ready
+//              to paste into the terminal (each one is saved to eeprom
+//              by the card). Progress and scores go to stderr.
+//
+//              -M sets the motor: name=value pairs of sim/motor.h, e.g.
+//              -M r=0.8,l=2e-3,kt=0.07,j=1.2e-4,cpr=4000,vbus=36, or
+//              -M @file with the model host/plantfit fitted
+//          gainsearch -c
+//              self check: a short search beats the firmware defaults,
+//              its gains settle without a fault, and one worker and
+//              several give the same result
+//
+//          The gains are rounded to the 4 digits printed before they
+//          are scored, so the pasted commands give the scored loop.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../dspicservo.h"
+#include "sim.h"
+
+#define BOOT_SECS	1.0			// past the 500ms startup delay and the powerup messages
+#define REST_SECS	0.1			// for the motor to stand still before the moves
+#define MAXDIM		5
+#define MAXPOP		256
+#define FOLLOW_W	0.1			// cost of a count of rms following error
+#define BIG			1.0e6		// cost of a fault or not settling
+#define DE_F		0.6			// differential weight
+#define DE_CR		0.9			// crossover probability
+
+// the firmware's
+extern struct PID pid;
+extern struct COF cof;
+
+struct GAIN{
+	char code;					// console command
+	double lo, hi;				// search range
+	short log;					// searched on a log scale
+};
+
+static const struct GAIN gains[] = {
+	{ 'p', 1.0,     2000.0, 1 },
+	{ 'i', 1.0,     1.0e5,  1 },
+	{ 'd', 1.0e-4,  1.0,    1 },
+	{ '0', -0.01,   0.01,   0 },
+	{ '1', -0.5,    0.5,    0 },
+};
+#define NGAINS	(sizeof(gains) / sizeof(gains[0]))
+
+struct SCORE{
+	double cost;
+	double settle;				// ms, both moves
+	double overshoot;			// counts, both moves
+	double follow;				// rms counts
+	unsigned short fault;
+	short done;					// the worker got to the end
+};
+
+// the search
+static const struct GAIN *dims[MAXDIM];
+static int ndim;
+static long edges = 2000;
+static double move_secs = 0.1, settle_secs = 0.2, band = 2.0;
+static int jobs;
+
+// the move being scored, kept by the pwm hook
+static short dir;
+static double last_out;			// last time |error| was outside the band
+static double over, sum2;
+static long nsum;
+
+static unsigned long long rnd_state;
+
+// wall clock seconds
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1.0e-9;
+}
+
+static double rnd(void)
+{
+	// xorshift64*, the same numbers on every host
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return (double)((rnd_state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+// gain from its 0..1 search coordinate, rounded to what is printed
+static float gain_value(const struct GAIN *g, double x, char *text)
+{
+	double v = g->log ? g->lo * pow(g->hi / g->lo, x) : g->lo + (g->hi - g->lo) * x;
+
+	sprintf(text, "%.4g", v);
+	return fx_atof(text);
+}
+
+static void sample(void)
+{
+	double e = (double)(pid.command - pid.feedback);
+
+	if ( sim_cmd_busy() )
+	{
+		sum2 += e * e;
+		nsum++;
+		return;
+	}
+	if ( fabs(e) > band )
+		last_out = sim_time();
+	if ( -dir * e > over )
+		over = -dir * e;
+}
+
+// one move of the profile, out or back
+static void leg(short d, struct SCORE *s)
+{
+	double stop;
+
+	dir = d;
+	over = 0.0;
+	sim_cmd_move(d * edges, move_secs);
+	stop = sim_time() + move_secs;
+	last_out = stop;
+	sim_run(stop + settle_secs);
+	if ( last_out > stop + 0.9 * settle_secs )
+		s->cost += BIG;				// still moving at the end
+	s->settle += (last_out - stop) * 1000.0;
+	s->overshoot += over;
+}
+
+// in a worker: scores gain set x on the booted firmware
+static void score(const double *x, struct SCORE *s)
+{
+	char text[32];
+	int k;
+
+	for ( k = 0; k < ndim; k++ )
+		param_put(param_find(dims[k]->code), gain_value(dims[k], x[k], text));
+	memset(s, 0, sizeof(*s));
+	sum2 = 0.0;
+	nsum = 0;
+	sim_pwm_hook = sample;
+	leg(1, s);
+	leg(-1, s);
+	s->follow = nsum ? sqrt(sum2 / nsum) : 0.0;
+	s->fault = cof.fault;
+	s->cost += s->settle + s->overshoot + FOLLOW_W * s->follow + (s->fault ? BIG : 0.0);
+	s->done = 1;
+}
+
+// scores n gain sets, jobs workers at a time
+static void score_all(double (*x)[MAXDIM], int n, struct SCORE *res)
+{
+	pid_t who[MAXPOP];
+	int next = 0, running = 0, k, st;
+	pid_t w;
+
+	memset(res, 0, n * sizeof(*res));
+	fflush(NULL);
+	while ( next < n || running )
+	{
+		if ( next < n && running < jobs )
+		{
+			w = fork();
+			if ( w == 0 )
+			{
+				score(x[next], &res[next]);
+				_exit(0);
+			}
+			if ( w < 0 )
+			{
+				perror("fork");
+				exit(1);
+			}
+			who[next++] = w;
+			running++;
+			continue;
+		}
+		w = wait(&st);
+		if ( w < 0 )
+			break;
+		running--;
+		for ( k = 0; k < next; k++ )
+			if ( who[k] == w && !res[k].done )
+				res[k].cost = 10 * BIG;		// the simulation gave up on it
+	}
+}
+
+static void print_gains(FILE *f, const double *x)
+{
+	char text[32];
+	int k;
+
+	for ( k = 0; k < ndim; k++ )
+	{
+		gain_value(dims[k], x[k], text);
+		fprintf(f, "%c %s\n", dims[k]->code, text);
+	}
+}
+
+static void print_score(const char *what, const struct SCORE *s)
+{
+	fprintf(stderr, "%s: cost %.1f, settle %.1fms, overshoot %.0f counts, following rms %.1f counts%s\n",
+		what, s->cost, s->settle, s->overshoot, s->follow, s->fault ? ", faulted" : "");
+}
+
+/*********************************************************************
+  Function:        double search(int np, int gens, double *best,
+                                 struct SCORE *bs, int verbose)
+
+  Overview:        differential evolution (rand/1/bin) over the search
+                   coordinates, each in 0..1. A generation's trial
+                   vectors are scored together, so the workers stay busy.
+                   verbose prints the best of each generation.
+
+  Output:          best cost, best holds its coordinates
+********************************************************************/
+static double search(int np, int gens, double *best, struct SCORE *bs, int verbose)
+{
+	static double pop[MAXPOP][MAXDIM], trial[MAXPOP][MAXDIM];
+	static struct SCORE *cost, *tc;
+	int g, i, k, a, b, c, j, ib = 0;
+
+	if ( cost == 0 )
+	{
+		cost = mmap(0, 2 * MAXPOP * sizeof(*cost), PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if ( cost == MAP_FAILED )
+		{
+			perror("mmap");
+			exit(1);
+		}
+		tc = cost + MAXPOP;
+	}
+	for ( i = 0; i < np; i++ )
+		for ( k = 0; k < ndim; k++ )
+			pop[i][k] = rnd();
+	score_all(pop, np, cost);
+
+	for ( g = 0; g < gens; g++ )
+	{
+		for ( i = 0; i < np; i++ )
+		{
+			do a = rnd() * np; while ( a == i );
+			do b = rnd() * np; while ( b == i || b == a );
+			do c = rnd() * np; while ( c == i || c == a || c == b );
+			j = rnd() * ndim;
+			for ( k = 0; k < ndim; k++ )
+			{
+				if ( k == j || rnd() < DE_CR )
+				{
+					trial[i][k] = pop[a][k] + DE_F * (pop[b][k] - pop[c][k]);
+					// bounce back into range
+					if ( trial[i][k] < 0.0 )
+						trial[i][k] = -trial[i][k] * rnd();
+					if ( trial[i][k] > 1.0 )
+						trial[i][k] = 1.0 - (trial[i][k] - 1.0) * rnd();
+				}
+				else
+					trial[i][k] = pop[i][k];
+			}
+		}
+		score_all(trial, np, tc);
+		for ( i = 0; i < np; i++ )
+		{
+			if ( tc[i].cost <= cost[i].cost )
+			{
+				memcpy(pop[i], trial[i], sizeof(pop[i]));
+				cost[i] = tc[i];
+			}
+		}
+		for ( i = 1, ib = 0; i < np; i++ )
+			if ( cost[i].cost < cost[ib].cost )
+				ib = i;
+		if ( verbose )
+		{
+			fprintf(stderr, "gen %d: best cost %.1f", g + 1, cost[ib].cost);
+			for ( k = 0; k < ndim; k++ )
+			{
+				char text[32];
+
+				gain_value(dims[k], pop[ib][k], text);
+				fprintf(stderr, " %c%s", dims[k]->code, text);
+			}
+			fprintf(stderr, "\n");
+		}
+	}
+	memcpy(best, pop[ib], sizeof(pop[ib]));
+	*bs = cost[ib];
+	return cost[ib].cost;
+}
+
+// boots the firmware, the workers start from here
+static int boot(const char *ee, const char *motor)
+{
+	if ( ee && sim_ee_load(ee) )
+		fprintf(stderr, "%s: no eeprom image, using the firmware defaults\n", ee);
+	sim_start();
+	if ( motor && motor_arg(&sim_motor, motor) )
+		return -1;
+	sim_run(BOOT_SECS);
+	sim_send("\r");				// gets it past an empty eeprom
+	if ( sim_run(BOOT_SECS + REST_SECS) != SIM_RUN || !pid.enable )
+	{
+		fprintf(stderr, "the firmware did not start:\n%s\n", sim_output());
+		return -1;
+	}
+	sim_clear();
+	return 0;
+}
+
+static int set_dims(const char *codes)
+{
+	size_t k;
+
+	for ( ndim = 0; *codes; codes++ )
+	{
+		for ( k = 0; k < NGAINS && gains[k].code != *codes; k++ )
+			;
+		if ( k == NGAINS || ndim == MAXDIM )
+			return -1;
+		dims[ndim++] = &gains[k];
+	}
+	return ndim ? 0 : -1;
+}
+
+// the setup the firmware booted with, scored like a candidate
+static void score_current(struct SCORE *s)
+{
+	struct SCORE *r = mmap(0, sizeof(*r), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	int st;
+
+	if ( r == MAP_FAILED )
+	{
+		perror("mmap");
+		exit(1);
+	}
+	memset(r, 0, sizeof(*r));
+	fflush(NULL);
+	if ( fork() == 0 )
+	{
+		ndim = 0;
+		score(0, r);
+		_exit(0);
+	}
+	wait(&st);
+	*s = *r;
+	if ( !s->done )
+		s->cost = 10 * BIG;
+	munmap(r, sizeof(*r));
+}
+
+static int check(void)
+{
+	double b1[MAXDIM], b4[MAXDIM];
+	struct SCORE s1, s4, def;
+	double start = now();
+	int bad = 0;
+
+	if ( boot(0, 0) )
+		return 1;
+	set_dims("pd1");
+	score_current(&def);
+	jobs = 1;
+	rnd_state = 1;
+	search(12, 8, b1, &s1, 0);
+	jobs = 4;
+	rnd_state = 1;
+	search(12, 8, b4, &s4, 0);
+
+	print_score("firmware defaults", &def);
+	print_score("found", &s1);
+	if ( s1.cost >= def.cost || s1.cost >= BIG || s1.fault )
+	{
+		printf("FAIL search did not find gains that settle without a fault\n");
+		bad++;
+	}
+	if ( memcmp(b1, b4, sizeof(b1)) || s1.cost != s4.cost )
+	{
+		printf("FAIL 1 and 4 workers found different gains\n");
+		bad++;
+	}
+	printf("%d candidates scored in %.2fs, %d failures\n", 2 * 12 * 9, now() - start, bad);
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *ee = 0, *motor = 0, *codes = "pid1";
+	double best[MAXDIM];
+	struct SCORE bs, cur;
+	int c, np = 0, gens = 40;
+	double t0;
+
+	rnd_state = 1;
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	while ( (c = getopt(argc, argv, "cb:e:g:j:m:n:r:s:w:G:M:")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'c': return check();
+		case 'b': band = atof(optarg); break;
+		case 'e': ee = optarg; break;
+		case 'g': gens = atoi(optarg); break;
+		case 'j': jobs = atoi(optarg); break;
+		case 'm': edges = atol(optarg); break;
+		case 'n': np = atoi(optarg); break;
+		case 'r': move_secs = atof(optarg); break;
+		case 's': rnd_state = strtoull(optarg, 0, 0) | 1; break;
+		case 'w': settle_secs = atof(optarg); break;
+		case 'G': codes = optarg; break;
+		case 'M': motor = optarg; break;
+		default:
+			goto usage;
+		}
+	}
+	if ( optind != argc || set_dims(codes) )
+		goto usage;
+	if ( np == 0 )
+		np = 10 * ndim;
+	if ( np < 4 || np > MAXPOP || gens < 0 || jobs < 1 || edges <= 0 ||
+		 move_secs <= 0.0 || settle_secs <= 0.0 || band < 0.0 )
+		goto usage;
+	if ( jobs > MAXPOP )
+		jobs = MAXPOP;
+	if ( boot(ee, motor) )
+		return 1;
+
+	t0 = now();
+	score_current(&cur);
+	print_score("current setup", &cur);
+	fprintf(stderr, "%d candidates, %d workers\n", np * (gens + 1), jobs);
+	search(np, gens, best, &bs, 1);
+	print_score("best", &bs);
+	fprintf(stderr, "%.1fs\n", now() - t0);
+	if ( bs.cost >= BIG )
+		fprintf(stderr, "nothing settled without a fault, try other ranges or a longer -w\n");
+	print_gains(stdout, best);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: gainsearch [-e eeprom] [-M motor] [-G pid1] [-m edges] [-r secs]\n"
+		"                  [-w secs] [-b counts] [-n pop] [-g gens] [-j jobs] [-s seed]\n"
+		"       gainsearch -c\n");
+	return 2;
+}
@@ -0,0 +1,429 @@
+//---------------------------------------------------------------------
+//	File:		isrlat.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Model of the card's interrupt latencies. The 30f interrupt
+//          controller (priorities, nesting, one isr at a time per
+//          level, IPL masking by the background) is run cycle exact
+//          over random phasings of the interrupt sources, once with the
+//          priorities and context saves the firmware had before the
+//          IPL_ values of dspicservo.h and once with those:
+//             servo entry delay   pwm period start to the servo isr's
+//                                 first instruction, min/max/jitter
+//             edge latency        a pc command edge to the IC isr
+//             edges lost          an edge while one was not taken yet,
+//                                 both pins have moved by the time the
+//                                 isr reads PORTD
+//             u1rx wait           byte in to the rx isr, the fifo
+//                                 overruns after 4
+//          The sim (sim/) runs isr's in no time so it can not show this.
+//
+//          isrlat [-e edges/s] [-b Tcy] [-s secs] [-w fpwm] [-u post] [zlog]
+//              isr run times from the max column of the card's z
+//              printout in zlog (they include any nested isr, so they
+//              are on the safe side), nominal ones without. -e is the
+//              pc command edge rate (50000), -b the longest background
+//              section that masks interrupts (150 Tcy), -s the time to
+//              run (2s).
+//          isrlat -c
+//              self check: the new priorities must give less servo
+//              jitter and edge latency than the old ones and lose
+//              nothing, and a too fast edge rate must lose edges
+//
+//          The card's own numbers come from the z command: servo jitter
+//          is the pwm row's max - min period, on a scope PWM_INTR.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../dspicservo.h"
+
+#define ENTRY_CY	5			// request to the first isr instruction, 2 cycle instruction in the way
+#define RETFIE_CY	3
+#define PSV_CY		4			// push/set/pop PSVPAG for auto_psv
+#define RX_FIFO		4
+#define MAX_NEST	10
+
+// the sources, in natural order (the lower one wins a tie), IC1 and IC2
+// first as s ^ 1 is the other pin
+enum { S_IC1, S_IC2, S_PWM, S_QEI, S_U1RX, S_T1, S_T3, S_BG, NSRC };
+
+struct SOURCE{
+	const char *name;			// as in the z printout
+	long body;					// Tcy between PROF_ENTER and PROF_EXIT
+	short regs;					// W registers the prologue saves
+	double per_us;				// between requests, 0 from the pwm/edge settings
+	double spread;				// +- fraction of per_us, random
+};
+
+static struct SOURCE src[NSRC] = {
+	{ "ic1 ", 110, 8, 0.0, 0.25 },			// calls through funcArr[]: W0-W7
+	{ "ic2 ", 110, 8, 0.0, 0.25 },
+	{ "pwm ", 2200, 8, 0.0, 0.0 },
+	{ "qei ", 90, 4, 10000.0, 0.5 },		// a wrap now and then
+	{ "u1rx", 120, 8, 0.0, 0.0 },			// back to back at the baud rate
+	{ "t1  ", 70, 4, 0.0, 0.0 },
+	{ "t3  ", 80, 4, 10000.0, 0.5 },		// a modbus frame end
+	{ "bg  ", 150, 0, 1000.0, 0.5 },		// the longest IPL masked background section
+};
+
+struct DESIGN{
+	const char *name;
+	short pri[NSRC];			// for S_BG the IPL it masks at
+	unsigned char psv[NSRC];	// auto_psv
+	unsigned char shadow[NSRC];
+};
+
+// before the IPL_ values: the pwm isr at 1 as setup_pwm() had it, the qei
+// at 1, the edges at 4 and the rest at the reset value 4, all auto_psv
+// and every background section at 7
+static const struct DESIGN before = {
+	"before",
+	{ 4, 4, 1, 1, 4, 4, 4, 7 },
+	{ 1, 1, 1, 1, 1, 1, 1, 0 },
+	{ 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+
+// dspicservo.h: the background sections that share servo data mask at
+// IPL_SERVO now, the longest one is the modbus snapshot
+static const struct DESIGN after = {
+	"after",
+	{ IPL_EDGE, IPL_EDGE, IPL_SERVO, IPL_EDGE, IPL_U1RX, IPL_TICK, IPL_TICK, IPL_SERVO },
+	{ 0, 0, 1, 0, 0, 0, 0, 0 },
+	{ 1, 1, 0, 1, 0, 0, 0, 0 },
+};
+
+struct RESULT{
+	double servo_min, servo_max;	// entry delay, us
+	double servo_busy;				// longest pwm request to return, us
+	double edge_max;				// us
+	long edges, edges_lost;
+	double rx_max;					// us
+	long rx_lost, servo_lost;
+};
+
+static long fcy = FCY;
+static unsigned long lcg;
+
+static double rnd(void)
+{
+	lcg = lcg * 1103515245 + 12345;
+	return ((lcg >> 8) & 0xffff) / 65536.0;
+}
+
+// Tcy from the request to the first body instruction, and after it
+static long pre_cy(const struct DESIGN *d, int s)
+{
+	long n = ENTRY_CY + (d->psv[s] ? PSV_CY - 1 : 0);
+	short regs = src[s].regs;
+
+	if ( s == S_BG )
+		return 0;
+	if ( d->shadow[s] )
+		n += 1 + (regs > 4 ? regs - 4 : 0);	// push.s does W0-W3 and SR
+	else
+		n += regs;
+	return n;
+}
+
+static long post_cy(const struct DESIGN *d, int s)
+{
+	if ( s == S_BG )
+		return 0;
+	return pre_cy(d, s) - ENTRY_CY + RETFIE_CY - (d->psv[s] ? PSV_CY - 2 : 0);
+}
+
+static double us(long long cy)
+{
+	return cy * 1.0e6 / fcy;
+}
+
+/*********************************************************************
+  Function:        void run(const struct DESIGN *d, double edges,
+                            double secs, long pwm_cy, long char_cy,
+                            unsigned long seed, struct RESULT *r)
+
+  Overview:        runs the interrupt controller over secs of requests:
+                   the pwm every pwm_cy, edges per second alternating
+                   IC1 and IC2, a byte every char_cy, the others at their own rates. An isr
+                   runs when its request is above the IPL of what runs
+                   now; the background section only starts when no isr
+                   runs or waits.
+********************************************************************/
+static void run(const struct DESIGN *d, double edges, double secs, long pwm_cy, long char_cy,
+				unsigned long seed, struct RESULT *r)
+{
+	long long t = 0, end = (long long)(secs * fcy), next[NSRC], at[NSRC], tn, wait;
+	struct { int s; long long left; long long at; } stack[MAX_NEST];
+	int sp = 0, s, best, fifo = 0, top;
+	short pending[NSRC] = { 0 };
+	double per[NSRC];
+
+	memset(r, 0, sizeof(*r));
+	r->servo_min = 1.0e9;
+	lcg = seed;
+	for ( s = 0; s < NSRC; s++ )
+	{
+		per[s] = src[s].per_us * fcy / 1.0e6;
+		if ( s == S_IC1 || s == S_IC2 )
+			per[s] = fcy / edges;
+		else if ( s == S_PWM )
+			per[s] = pwm_cy;
+		else if ( s == S_U1RX )
+			per[s] = char_cy;
+		else if ( s == S_T1 )
+			per[s] = 65536.0 * 64;
+		next[s] = (long long)(rnd() * per[s]);
+	}
+	// the edges come in turns on the two pins, IC1 first
+	next[S_IC2] = end + 1;
+
+	while ( t < end )
+	{
+		// take what is above the running level, highest first
+		for ( ;; )
+		{
+			top = sp ? d->pri[stack[sp - 1].s] : 0;
+			best = -1;
+			for ( s = 0; s < S_BG; s++ )
+				if ( pending[s] && d->pri[s] > top && (best < 0 || d->pri[s] > d->pri[best]) )
+					best = s;
+			if ( best < 0 && sp == 0 && pending[S_BG] )
+				best = S_BG;
+			if ( best < 0 || sp == MAX_NEST )
+				break;
+			pending[best] = 0;
+			wait = t - at[best] + pre_cy(d, best);
+			switch ( best )
+			{
+			case S_PWM:
+				if ( us(wait) < r->servo_min ) r->servo_min = us(wait);
+				if ( us(wait) > r->servo_max ) r->servo_max = us(wait);
+				break;
+			case S_IC1:
+			case S_IC2:
+				if ( us(wait) > r->edge_max ) r->edge_max = us(wait);
+				break;
+			case S_U1RX:
+				if ( us(wait) > r->rx_max ) r->rx_max = us(wait);
+				fifo = 0;
+				break;
+			}
+			stack[sp].s = best;
+			stack[sp].at = at[best];
+			stack[sp++].left = pre_cy(d, best) + src[best].body + post_cy(d, best);
+		}
+
+		tn = end;
+		for ( s = 0; s < NSRC; s++ )
+			if ( next[s] < tn )
+				tn = next[s];
+		if ( sp && t + stack[sp - 1].left < tn )
+			tn = t + stack[sp - 1].left;
+		if ( sp )
+			stack[sp - 1].left -= tn - t;
+		t = tn;
+		if ( sp && stack[sp - 1].left == 0 )
+		{
+			sp--;
+			if ( stack[sp].s == S_PWM && us(t - stack[sp].at) > r->servo_busy )
+				r->servo_busy = us(t - stack[sp].at);
+		}
+
+		for ( s = 0; s < NSRC; s++ )
+		{
+			if ( next[s] != t )
+				continue;
+			switch ( s )
+			{
+			case S_IC1:
+			case S_IC2:
+				r->edges++;
+				if ( pending[S_IC1] || pending[S_IC2] )
+					r->edges_lost++;
+				break;
+			case S_PWM:
+				if ( pending[s] )
+					r->servo_lost++;
+				break;
+			case S_U1RX:
+				if ( ++fifo > RX_FIFO )
+					r->rx_lost++;
+				break;
+			}
+			if ( !pending[s] )
+				at[s] = t;
+			pending[s] = 1;
+			next[s] = t + (long long)(per[s] * (1.0 + src[s].spread * (2.0 * rnd() - 1.0)));
+			if ( next[s] <= t )
+				next[s] = t + 1;
+			if ( s == S_IC1 || s == S_IC2 )
+			{
+				next[s ^ 1] = next[s];
+				next[s] = end + 1;
+			}
+		}
+	}
+	if ( r->servo_min > r->servo_max )
+		r->servo_min = 0.0;
+}
+
+static void print_design(const struct DESIGN *d)
+{
+	int s;
+
+	printf("%-7s", d->name);
+	for ( s = 0; s < NSRC; s++ )
+		printf(" %s %d%s%s", src[s].name, d->pri[s], d->psv[s] ? "p" : "", d->shadow[s] ? "s" : "");
+	printf("\n");
+}
+
+static void print_result(const char *name, const struct RESULT *r)
+{
+	printf("%-7s %7.1f %7.1f %7.1f %8.1f %8.1f %8ld/%-8ld %7.1f %5ld %5ld\n", name, r->servo_min,
+		r->servo_max, r->servo_max - r->servo_min, r->servo_busy, r->edge_max, r->edges_lost,
+		r->edges, r->rx_max, r->rx_lost, r->servo_lost);
+}
+
+// isr run times from the max column of a z printout
+static int read_zlog(const char *path)
+{
+	char line[160], *p;
+	double mn, mean, mx;
+	unsigned count;
+	int s, n = 0;
+	FILE *f = fopen(path, "r");
+
+	if ( f == 0 )
+	{
+		perror(path);
+		return -1;
+	}
+	while ( fgets(line, sizeof(line), f) )
+	{
+		for ( p = line; *p == '>' || *p == '\r'; p++ )
+			;
+		for ( s = 0; s < S_BG; s++ )
+			if ( strncmp(p, src[s].name, 4) == 0 &&
+				 sscanf(p + 4, "%u %lf %lf %lf", &count, &mn, &mean, &mx) == 4 && count )
+			{
+				src[s].body = (long)(mx * fcy / 1.0e6 + 0.5);
+				n++;
+			}
+	}
+	fclose(f);
+	if ( n == 0 )
+		fprintf(stderr, "%s: no z printout in it, nominal isr times\n", path);
+	return n;
+}
+
+static void compare(struct RESULT *rb, struct RESULT *ra, double edges, double secs, long pwm_cy,
+					long char_cy)
+{
+	run(&before, edges, secs, pwm_cy, char_cy, 1, rb);
+	run(&after, edges, secs, pwm_cy, char_cy, 1, ra);
+}
+
+static void header(void)
+{
+	printf("        -- servo entry delay us --  busy us  edge us  edges lost    u1rx us  rx    pwm\n"
+		   "            min     max  jitter                                             lost  lost\n");
+}
+
+static int check(void)
+{
+	struct PWMTIMING t;
+	struct RESULT rb, ra, rf;
+	long char_cy = 10L * fcy / 115200;
+	int bad = 0;
+
+	calc_pwm_timing(fcy, FPWM, PWM_POST, TICKS_MIN, &t);
+	compare(&rb, &ra, 50000.0, 2.0, t.tick_cy, char_cy);
+	header();
+	print_result("before", &rb);
+	print_result("after", &ra);
+	if ( !(ra.servo_max - ra.servo_min < rb.servo_max - rb.servo_min) )
+	{
+		printf("FAIL servo jitter not less\n");
+		bad++;
+	}
+	if ( !(ra.edge_max < rb.edge_max) )
+	{
+		printf("FAIL edge latency not less\n");
+		bad++;
+	}
+	if ( ra.edges_lost || ra.rx_lost || ra.servo_lost )
+	{
+		printf("FAIL something lost with the new priorities\n");
+		bad++;
+	}
+	// faster than an edge isr can go, the model has to see it
+	run(&after, 500000.0, 0.2, t.tick_cy, char_cy, 1, &rf);
+	print_result("500kHz", &rf);
+	if ( rf.edges_lost == 0 )
+	{
+		printf("FAIL 500k edges/s lost none\n");
+		bad++;
+	}
+	printf("%d failures\n", bad);
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct PWMTIMING t;
+	struct RESULT rb, ra;
+	double edges = 50000.0, secs = 2.0;
+	unsigned fpwm = FPWM, post = PWM_POST;
+	int c, s;
+
+	while ( (c = getopt(argc, argv, "b:ce:s:u:w:")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'b': src[S_BG].body = atol(optarg); break;
+		case 'c': return check();
+		case 'e': edges = atof(optarg); break;
+		case 's': secs = atof(optarg); break;
+		case 'u': post = atoi(optarg); break;
+		case 'w': fpwm = atoi(optarg); break;
+		default:
+			goto usage;
+		}
+	}
+	if ( argc - optind > 1 || edges <= 0.0 )
+		goto usage;
+	if ( optind < argc && read_zlog(argv[optind]) < 0 )
+		return 1;
+	if ( calc_pwm_timing(fcy, fpwm, post, TICKS_MIN, &t) != PWMT_OK )
+	{
+		fprintf(stderr, "no pwm timing for %uHz post %u\n", fpwm, post);
+		return 1;
+	}
+
+	printf("%.0fus pwm intr, %.0f edges/s, 115200 baud rx, isr run times (Tcy):", us(t.tick_cy),
+		edges);
+	for ( s = 0; s < NSRC; s++ )
+		printf(" %s %ld", src[s].name, src[s].body);
+	printf("\npriorities (p auto_psv, s shadow):\n");
+	print_design(&before);
+	print_design(&after);
+	compare(&rb, &ra, edges, secs, t.tick_cy, 10L * fcy / 115200);
+	header();
+	print_result("before", &rb);
+	print_result("after", &ra);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: isrlat [-e edges/s] [-b Tcy] [-s secs] [-w fpwm] [-u post] [zlog]\n"
+		"       isrlat -c\n");
+	return 2;
+}
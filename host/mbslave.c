@@ -0,0 +1,549 @@
+//---------------------------------------------------------------------
+//	File:		mbslave.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: The card's modbus rtu slave (modbus.c and mbrtu.c) in the
+//          simulation, on a Linux pseudo terminal so a standard modbus
+//          master (mbpoll, pymodbus, a plc simulator) can be tried
+//          against it without a card. The registers are the card's
+//          own, parameters go through the table in params.c. The bytes
+//          reach the simulated uart at the card's baud rate, so the
+//          frame timing is the card's too.
+//
+//          mbslave [-a addr] [-l link] [-q]
+//              prints the pty name (and makes link point to it), then
+//              serves requests until killed
+//          mbslave -c
+//              sends rtu frames through the simulated uart and checks
+//              the answers: every function code, the exceptions, crc
+//              errors, other addresses and broadcasts, the t1.5 and
+//              t3.5 character times (at 9600 and 19200 baud too),
+//              frames too long, a write refused part way, the pwm
+//              settings written together and c1 telemetry stopped by y1
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- runs modbus.c in the simulation, no copy of the
+//                register map to keep in step; -c frame checks
+// Oct 19 2026 -- gaps of 1.0 to 1.6 characters at 9600 and 19200 baud,
+//                telemetry must not reach the rtu line
+//----------------------------------------------------------------------
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include "../dspicservo.h"
+#include "../mbrtu.h"
+#include "sim.h"
+#include "xc.h"
+
+#define BOOT_SECS	1.0
+#define TXBUF		512
+
+// the firmware's
+extern struct PID pid;
+extern short sw_enable;
+extern long uart_baud;
+extern short load_telemetry;
+extern unsigned short mb_frames, mb_errors;
+
+// a byte on the simulated uart (8E1) and modbus.c's gaps, set by boot()
+static double char_secs, t15_secs, t35_secs;
+
+static unsigned char tx[TXBUF];			// what the card sent
+static int txn;
+static double tx_first;					// sim time of its first byte
+static int verbose = 1;
+static int failed, checks;
+
+static void tx_byte(unsigned char ch)
+{
+	if ( txn == 0 )
+		tx_first = sim_time();
+	if ( txn < TXBUF )
+		tx[txn++] = ch;
+}
+
+static void dump(const char *what, const unsigned char *f, int len)
+{
+	int i;
+
+	printf("%s", what);
+	for ( i = 0; i < len; i++ )
+		printf(" %02x", f[i]);
+	printf("\n");
+	fflush(stdout);
+}
+
+static void line(const char *cmd)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "%s\r", cmd);
+	sim_send(buf);
+	sim_run(sim_time() + 0.2);
+}
+
+// the character time and gaps of the rate the card is at now
+static void line_times(void)
+{
+	char_secs = 11.0 * 16 * (U1BRG + 1) / FCY;
+	if ( uart_baud > 19200 )
+	{
+		t15_secs = 750e-6;
+		t35_secs = 1750e-6;
+	}
+	else
+	{
+		t15_secs = 1.5 * 11 / uart_baud;
+		t35_secs = 3.5 * 11 / uart_baud;
+	}
+}
+
+// a booted card with node id addr in modbus mode, at baud or the
+// card's own rate if 0
+static void boot(int addr, long baud)
+{
+	char cmd[16];
+
+	sim_start();
+	sim_run(BOOT_SECS);
+	if ( baud )
+	{
+		U1BRG = UART_BRG(FCY, baud);
+		uart_baud = baud;
+	}
+	snprintf(cmd, sizeof(cmd), "n%d", addr);
+	line(cmd);
+	snprintf(cmd, sizeof(cmd), "@%d y1", addr);
+	line(cmd);
+	sim_tx_hook = tx_byte;
+	txn = 0;
+	line_times();
+}
+
+/*
+ * -c
+ */
+#define ADDR	7
+
+static int check(int ok, const char *what)
+{
+	checks++;
+	if ( !ok )
+	{
+		failed++;
+		printf("FAIL %s\n", what);
+	}
+	else if ( verbose > 1 )
+		printf("ok   %s\n", what);
+	return ok;
+}
+
+// frame of n bytes with its crc added, returns the length
+static int with_crc(unsigned char *f, int n)
+{
+	unsigned short crc = mb_crc(f, n);
+
+	f[n] = (unsigned char)crc;
+	f[n + 1] = (unsigned char)(crc >> 8);
+	return n + 2;
+}
+
+// the common 8 byte request: address, function, two 16 bit fields
+static int req(unsigned char *f, int addr, int fn, unsigned short a, unsigned short b)
+{
+	f[0] = addr;
+	f[1] = fn;
+	f[2] = a >> 8;
+	f[3] = a;
+	f[4] = b >> 8;
+	f[5] = b;
+	return with_crc(f, 6);
+}
+
+// write multiple registers
+static int req16(unsigned char *f, int addr, unsigned short start, int n,
+				 const unsigned short *v)
+{
+	int i;
+
+	req(f, addr, 0x10, start, n);
+	f[6] = n * 2;
+	for ( i = 0; i < n; i++ )
+	{
+		f[7 + i * 2] = v[i] >> 8;
+		f[8 + i * 2] = v[i];
+	}
+	return with_crc(f, 7 + n * 2);
+}
+
+/*********************************************************************
+  Function:        static int send(const unsigned char *f, int len,
+                                   int split, double gap)
+
+  Overview:        sends a frame into the simulated uart, with gap
+                   seconds of silence after the first split bytes if
+                   split is non zero, and waits for the answer
+
+  Output:          bytes of the answer in tx[], 0 for none
+********************************************************************/
+static int send(const unsigned char *f, int len, int split, double gap)
+{
+	double end;
+
+	txn = 0;
+	if ( split )
+	{
+		sim_send_bytes(f, split);
+		sim_run(sim_time() + split * char_secs + gap);
+		f += split;
+		len -= split;
+	}
+	sim_send_bytes(f, len);
+	end = sim_time() + len * char_secs;
+	sim_run(end + t35_secs + TXBUF * char_secs / 8);
+	// the answer must not start before the frame has ended
+	if ( txn && !check(tx_first >= end + t35_secs - char_secs, "answer after t3.5") )
+		printf("     %.0fus after the request\n", (tx_first - end) * 1e6);
+	return txn;
+}
+
+// the answer is the exception ex to function fn
+static int exception(int n, int fn, int ex)
+{
+	return n == 5 && tx[0] == ADDR && tx[1] == (fn | 0x80) && tx[2] == ex
+		&& mb_crc(tx, 3) == (tx[3] | tx[4] << 8);
+}
+
+static unsigned short reg16(int i)
+{
+	return (unsigned short)(tx[3 + i * 2] << 8 | tx[4 + i * 2]);
+}
+
+static unsigned short float_word(float v, int low)
+{
+	union { float f; unsigned int l; } u;
+
+	u.f = v;
+	return low ? (unsigned short)u.l : (unsigned short)(u.l >> 16);
+}
+
+static int param_reg(char code)
+{
+	return (int)(param_find(code) - params);
+}
+
+static int frame_checks(void)
+{
+	unsigned char f[MB_BUF + 16];
+	unsigned short v[MB_MAX_WRITE];
+	unsigned short frames, errors;
+	int n, len, k;
+
+	boot(ADDR, 0);
+	check(uart_baud > 19200, "fixed 750us and 1750us gaps at this baud rate");
+
+	// 03 read holding: the float pairs and the 16 bit view
+	n = send(f, req(f, ADDR, 0x03, 2 * param_reg('p'), 2), 0, 0);
+	check(n == 9 && tx[2] == 4 && reg16(0) == float_word(pid.pgain, 0) &&
+		reg16(1) == float_word(pid.pgain, 1) && mb_crc(tx, 7) == (tx[7] | tx[8] << 8),
+		"03 reads p as a float");
+	n = send(f, req(f, ADDR, 0x03, 100 + param_reg('x'), 1), 0, 0);
+	check(n == 7 && reg16(0) == (unsigned short)pid.multiplier, "03 reads x in the 16 bit view");
+	n = send(f, req(f, ADDR, 0x03, 2 * param_count, 2), 0, 0);
+	check(exception(n, 0x03, MB_EX_ADDRESS), "03 past the parameters: illegal address");
+	n = send(f, req(f, ADDR, 0x03, 0, MB_MAX_READ + 1), 0, 0);
+	check(exception(n, 0x03, MB_EX_VALUE), "03 too many registers: illegal value");
+
+	// 04 read input
+	n = send(f, req(f, ADDR, 0x04, 0, 15), 0, 0);
+	check(n == 35 && tx[2] == 30 && reg16(12) == (unsigned short)pid.enable, "04 reads the inputs");
+	n = send(f, req(f, ADDR, 0x04, 14, 2), 0, 0);
+	check(exception(n, 0x04, MB_EX_ADDRESS), "04 past the inputs: illegal address");
+
+	// 01 read coils, 05 write coil
+	n = send(f, req(f, ADDR, 0x01, 0, 4), 0, 0);
+	check(n == 6 && tx[2] == 1 && (tx[3] & 1) == (sw_enable != 0), "01 reads the coils");
+	len = req(f, ADDR, 0x05, 0, 0x0000);
+	n = send(f, len, 0, 0);
+	check(n == len && memcmp(tx, f, len) == 0 && sw_enable == 0, "05 clears coil 0, echoed");
+	n = send(f, req(f, ADDR, 0x05, 0, 0xff00), 0, 0);
+	check(n == 8 && sw_enable == 1, "05 sets coil 0");
+	n = send(f, req(f, ADDR, 0x05, 0, 0x1234), 0, 0);
+	check(exception(n, 0x05, MB_EX_VALUE), "05 with neither ff00 nor 0: illegal value");
+	n = send(f, req(f, ADDR, 0x05, 3, 0xff00), 0, 0);
+	check(exception(n, 0x05, MB_EX_ADDRESS), "05 to the read only coil: illegal address");
+
+	// 06 write single register
+	len = req(f, ADDR, 0x06, 100 + param_reg('x'), 5);
+	n = send(f, len, 0, 0);
+	check(n == len && memcmp(tx, f, len) == 0 && pid.multiplier == 5, "06 writes x, echoed");
+	n = send(f, req(f, ADDR, 0x06, 100 + param_reg('x'), 99), 0, 0);
+	check(exception(n, 0x06, MB_EX_VALUE) && pid.multiplier == 5, "06 out of range refused");
+
+	// 16 write multiple: a float pair, then a frame with a bad value
+	// last which must not store the ones before it
+	v[0] = float_word(0.02f, 0);
+	v[1] = float_word(0.02f, 1);
+	n = send(f, req16(f, ADDR, 2 * param_reg('p'), 2, v), 0, 0);
+	check(n == 8 && tx[1] == 0x10 && tx[4] == 0 && tx[5] == 2 && pid.pgain == 0.02f,
+		"16 writes p as a float");
+	k = param_reg('x');
+	for ( n = 0; n < k; n++ )
+		v[n] = 1;
+	v[k] = 99;
+	n = send(f, req16(f, ADDR, 100, k + 1, v), 0, 0);
+	check(exception(n, 0x10, MB_EX_VALUE) && pid.pgain == 0.02f && pid.deadband != 1.0f,
+		"16 with x out of range stores none of the values before it");
+	n = send(f, req16(f, ADDR, 1, 2, v), 0, 0);
+	check(exception(n, 0x10, MB_EX_ADDRESS), "16 half a float: illegal address");
+
+	// pwm rate and postscale written together: 8000Hz/1 to 40000Hz/4,
+	// both 100us or more per interrupt but 40000Hz/1 in between is not
+	send(f, req(f, ADDR, 0x06, 100 + param_reg('w'), 8000), 0, 0);
+	send(f, req(f, ADDR, 0x06, 100 + param_reg('u'), 1), 0, 0);
+	v[0] = 40000;
+	v[1] = 4;
+	n = send(f, req16(f, ADDR, 100 + param_reg('w'), 2, v), 0, 0);
+	sim_run(sim_time() + 0.01);
+	check(n == 8 && pid.fpwm == 40000 && pid.pwmpost == 4 && PTPER == FCY / 40000 / 2 - 1,
+		"16 takes w and u as a set, not in turn");
+	v[0] = 40000;
+	v[1] = 1;
+	n = send(f, req16(f, ADDR, 100 + param_reg('w'), 2, v), 0, 0);
+	check(exception(n, 0x10, MB_EX_VALUE) && pid.pwmpost == 4, "16 w and u too fast together refused");
+
+	// unknown function, other address, broadcast, crc
+	n = send(f, req(f, ADDR, 0x07, 0, 0), 0, 0);
+	check(exception(n, 0x07, MB_EX_FUNCTION), "07: illegal function");
+	n = send(f, req(f, ADDR + 1, 0x03, 0, 1), 0, 0);
+	check(n == 0, "another address gets no answer");
+	n = send(f, req(f, 0, 0x06, 100 + param_reg('x'), 3), 0, 0);
+	check(n == 0 && pid.multiplier == 3, "broadcast 06 acted on, no answer");
+	len = req(f, ADDR, 0x06, 100 + param_reg('x'), 4);
+	f[len - 1] ^= 0x40;
+	n = send(f, len, 0, 0);
+	check(n == 0 && pid.multiplier == 3, "crc error: no answer, nothing written");
+
+	// character times: a gap under t1.5 is part of the frame, one over
+	// t1.5 spoils it, one over t3.5 ends it
+	frames = mb_frames;
+	errors = mb_errors;
+	n = send(f, req(f, ADDR, 0x03, 0, 2), 4, t15_secs - 2 * char_secs);
+	check(n == 9 && mb_frames == frames + 1, "gap under t1.5 inside a frame");
+	n = send(f, req(f, ADDR, 0x03, 0, 2), 4, t15_secs - 50e-6);
+	check(n == 9 && mb_frames == frames + 2, "gap of 700us inside a frame");
+	n = send(f, req(f, ADDR, 0x03, 0, 2), 4, t15_secs + 50e-6);
+	check(n == 0 && mb_errors == errors + 1, "gap of 800us spoils the frame");
+	n = send(f, req(f, ADDR, 0x03, 0, 2), 4, (t15_secs + t35_secs) / 2);
+	check(n == 0 && mb_errors == errors + 2, "gap over t1.5 spoils the frame");
+	n = send(f, req(f, ADDR, 0x03, 0, 2), 4, t35_secs + 2 * char_secs);
+	check(n == 0 && mb_frames == frames + 4 && mb_errors == errors + 2,
+		"gap over t3.5 makes two frames, both bad");
+	memset(f, 0, sizeof(f));
+	req(f, ADDR, 0x03, 0, 2);
+	n = send(f, MB_BUF + 8, 0, 0);
+	check(n == 0 && mb_errors == errors + 3, "frame longer than MB_BUF dropped");
+	n = send(f, req(f, ADDR, 0x03, 0, 2), 0, 0);
+	check(n == 9, "next frame answered");
+
+	// back to the console through y
+	n = send(f, req(f, ADDR, 0x06, 100 + param_reg('y'), 0), 0, 0);
+	check(n == 8 && pid.protocol == 0, "06 y0 answered in modbus");
+	sim_tx_hook = 0;
+	sim_clear();
+	line("@7 l");
+	check(strstr(sim_output(), "protocol(y) = 0") != 0, "console back after y0");
+	return failed;
+}
+
+// silence between two bytes of a frame at the slow rates, where t1.5 is
+// 1.5 characters: counted from the end of one byte to the start of the
+// next, the next byte's own time is not part of it
+static int gap_checks(long baud)
+{
+	static const double ok[] = { 1.0, 1.4 };
+	unsigned char f[MB_BUF];
+	char what[64];
+	int n, k;
+
+	boot(ADDR, baud);
+	for ( k = 0; k < 2; k++ )
+	{
+		n = send(f, req(f, ADDR, 0x03, 0, 2), 3, ok[k] * char_secs);
+		snprintf(what, sizeof(what), "%ld baud: %.1f characters of silence inside a frame",
+			baud, ok[k]);
+		check(n == 9, what);
+	}
+	n = send(f, req(f, ADDR, 0x03, 0, 2), 3, 1.6 * char_secs);
+	snprintf(what, sizeof(what), "%ld baud: 1.6 characters of silence spoils the frame", baud);
+	check(n == 0, what);
+	return failed;
+}
+
+// telemetry started on the console must not go on once modbus has the
+// line: an ascii line in the middle of the frames of every slave
+static int telemetry_checks(void)
+{
+	unsigned char f[MB_BUF];
+	int n;
+
+	sim_start();
+	sim_run(BOOT_SECS);
+	line("n7");
+	line("@7 c1");
+	sim_clear();
+	sim_run(sim_time() + 2.5);
+	check(strstr(sim_output(), "load") != 0, "c1 telemetry on the console");
+	line("@7 y1");
+	sim_tx_hook = tx_byte;
+	txn = 0;
+	sim_run(sim_time() + 3.0);
+	check(txn == 0 && load_telemetry == 0, "y1 stops the telemetry, nothing on the rtu line");
+	line_times();
+	n = send(f, req(f, ADDR, 0x03, 0, 2), 0, 0);
+	check(n == 9, "frame answered after the switch");
+	return failed;
+}
+
+// each group on a card of its own, the counts come back through a pipe
+static int run_checks(void)
+{
+	int fd[2], k, st, res[2];
+	int total = 0, bad = 0;
+
+	for ( k = 0; k < 4; k++ )
+	{
+		if ( pipe(fd) )
+			return 2;
+		fflush(stdout);
+		if ( fork() == 0 )
+		{
+			close(fd[0]);
+			switch ( k )
+			{
+			case 0: frame_checks(); break;
+			case 1: gap_checks(9600); break;
+			case 2: gap_checks(19200); break;
+			case 3: telemetry_checks(); break;
+			}
+			res[0] = checks;
+			res[1] = failed;
+			if ( write(fd[1], res, sizeof(res)) != sizeof(res) )
+				_exit(2);
+			fflush(stdout);
+			_exit(0);
+		}
+		close(fd[1]);
+		if ( read(fd[0], res, sizeof(res)) == sizeof(res) )
+		{
+			total += res[0];
+			bad += res[1];
+		}
+		else
+		{
+			printf("FAIL check group %d did not finish\n", k);
+			bad++;
+		}
+		close(fd[0]);
+		wait(&st);
+	}
+	printf("%d modbus frame checks, %d failures\n", total, bad);
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char buf[MB_BUF];
+	const char *link = 0;
+	int addr = 1, fd, c, n, checking = 0;
+	struct termios tio;
+	struct timeval tv;
+	fd_set rd;
+
+	while ( (c = getopt(argc, argv, "a:l:qcv")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'a': addr = atoi(optarg); break;
+		case 'l': link = optarg; break;
+		case 'q': verbose = 0; break;
+		case 'v': verbose = 2; break;
+		case 'c': checking = 1; break;
+		default:
+			goto usage;
+		}
+	}
+	if ( checking )
+		return run_checks();
+	if ( addr < 1 || addr > BUS_NODE_MAX )
+		goto usage;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if ( fd < 0 || grantpt(fd) || unlockpt(fd) )
+	{
+		perror("pty");
+		return 1;
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(fd, TCSANOW, &tio);
+	boot(addr, 0);
+	printf("modbus slave %d on %s\n", addr, ptsname(fd));
+	if ( link )
+	{
+		unlink(link);
+		if ( symlink(ptsname(fd), link) )
+			perror(link);
+	}
+	fflush(stdout);
+
+	// the card runs 10ms for every 10ms of waiting, about real time
+	for ( ;; )
+	{
+		FD_ZERO(&rd);
+		FD_SET(fd, &rd);
+		tv.tv_sec = 0;
+		tv.tv_usec = 10000;
+		if ( select(fd + 1, &rd, 0, 0, &tv) > 0 )
+		{
+			n = read(fd, buf, sizeof(buf));
+			if ( n <= 0 )
+				usleep(100000);		// master closed the port
+			else
+			{
+				if ( verbose )
+					dump("rx", buf, n);
+				sim_send_bytes(buf, n);
+			}
+		}
+		if ( sim_run(sim_time() + 0.01) != SIM_RUN )
+		{
+			fprintf(stderr, "the card reset\n");
+			return 1;
+		}
+		if ( txn )
+		{
+			if ( verbose )
+				dump("tx", tx, txn);
+			if ( write(fd, tx, txn) != txn )
+				perror("write");
+			txn = 0;
+		}
+	}
+
+usage:
+	fprintf(stderr, "usage: mbslave [-a addr] [-l link] [-q]\n       mbslave -c [-v]\n");
+	return 2;
+}
@@ -0,0 +1,520 @@
+//---------------------------------------------------------------------
+//	File:		plantfit.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Fits a dc motor and load model to what the I command of the
+//          firmware (ident.c) streams, so the axis inertia, damping,
+//          friction and electrical time constant are known for tuning.
+//
+//          plantfit [-M motor] [log]
+//              reads a console log (stdin without one) holding an I run,
+//              the last one if there are several, and prints the fitted
+//              model in the form -M @file of servosim and gainsearch
+//              takes, e.g.
+//                 plantfit -M vbus=36,r=0.8,kt=0.07,cpr=4000 run.log > axis.mot
+//                 gainsearch -M @axis.mot
+//              Position and duty alone can not tell the winding from the
+//              mechanics, so vbus, r, kt and cpr have to be given with -M
+//              (motor data sheet, an ohm meter); the others are fitted.
+//          plantfit -c
+//              self check: fits data from known models, sampled ideally
+//              and streamed by the firmware running in the simulation
+//
+//          The fit is least squares, refined by instrumental variables
+//          against the bias the count quantization gives it, on
+//             v[k] = a1 v[k-1] + a2 v[k-2] + b0 u[k] + b1 u[k-1] + b2 u[k-2]
+//                    + c sign(v[k])
+//          v the counts moved in a sample, u the mean drive in volts.
+//          The two poles give the mechanical and electrical time
+//          constants, the gain the back emf plus damping and c the
+//          coulomb friction. An electrical time constant well under the
+//          sample time can not be seen, l is then left as given. The
+//          prbs keeps reversing the motor, so damping and friction are
+//          only good as a sum at the speeds of the run, and not at all
+//          where they are small next to the back emf. Samples of 1ms or
+//          more keep the count quantization down.
+//
+//          To record: connect with a terminal that logs, turn the
+//          following error check off (a14) and the gains down, then
+//             I30 4     +-30% duty, a sample every 4 servo cycles
+//             I0        after 10s or so
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "../dspicservo.h"
+#include "sim.h"
+
+#define NP			6			// a1 a2 b0 b1 b2 c
+#define MIN_SAMPLES	200
+#define IV_PASSES	5			// instrumental variable refinements
+
+struct RUN{
+	double t;					// sample time, s
+	double pdcmax;
+	long n, size;
+	double *y;					// position, counts
+	double *u;					// drive, fraction of full duty
+};
+
+struct FIT{
+	double p[NP];
+	double rms;					// one step prediction, counts
+	double tm, te;				// time constants, s (te 0 if not seen)
+	double gain;				// rad/s per volt
+	double vf;					// friction, volts
+};
+
+// the firmware's, for the check
+extern struct PID pid;
+
+static void run_add(struct RUN *r, double y, double u)
+{
+	if ( r->n == r->size )
+	{
+		r->size = r->size ? 2 * r->size : 4096;
+		r->y = realloc(r->y, r->size * sizeof(double));
+		r->u = realloc(r->u, r->size * sizeof(double));
+		if ( r->y == 0 || r->u == 0 )
+			exit(2);
+	}
+	r->y[r->n] = y;
+	r->u[r->n] = u;
+	r->n++;
+}
+
+/*********************************************************************
+  Function:        int read_log(FILE *f, struct RUN *r)
+
+  Overview:        picks the last I run out of a console log. Feedback
+                   is unwrapped from its 16 bits.
+
+  Output:          samples, 0 if there was no run
+********************************************************************/
+static int read_log(FILE *f, struct RUN *r)
+{
+	char line[256], *p;
+	unsigned int cmd, fb, duty;
+	double us, pdcmax, y = 0.0;
+	unsigned short last = 0;
+	int on = 0, every;
+
+	r->n = 0;
+	while ( fgets(line, sizeof(line), f) )
+	{
+		if ( (p = strstr(line, "# ident ")) != 0 && (p = strstr(p, "every ")) != 0 )
+		{
+			if ( sscanf(p, "every %d cycles of %lfus, pdcmax %lf", &every, &us, &pdcmax) == 3 &&
+				 every > 0 && us > 0 && pdcmax > 0 )
+			{
+				r->n = 0;
+				r->t = every * us * 1.0e-6;
+				r->pdcmax = pdcmax;
+				on = 1;
+			}
+			continue;
+		}
+		if ( strstr(line, "# ident end") )
+		{
+			on = 0;
+			continue;
+		}
+		if ( !on || strspn(line, "0123456789ABCDEF") != 12 ||
+			 sscanf(line, "%4x%4x%4x", &cmd, &fb, &duty) != 3 )
+			continue;
+		y = r->n ? y + (short)(fb - last) : 0.0;
+		last = fb;
+		run_add(r, y, (short)duty / r->pdcmax);
+	}
+	return r->n;
+}
+
+// solves a x = b in place, 0 if singular
+static int solve(double a[NP][NP], double *b, int n)
+{
+	int i, j, k, m;
+	double t;
+
+	for ( i = 0; i < n; i++ )
+	{
+		m = i;
+		for ( k = i + 1; k < n; k++ )
+			if ( fabs(a[k][i]) > fabs(a[m][i]) )
+				m = k;
+		if ( fabs(a[m][i]) < 1e-300 )
+			return 0;
+		for ( k = 0; k < n; k++ )
+		{
+			t = a[i][k]; a[i][k] = a[m][k]; a[m][k] = t;
+		}
+		t = b[i]; b[i] = b[m]; b[m] = t;
+		for ( k = i + 1; k < n; k++ )
+		{
+			t = a[k][i] / a[i][i];
+			for ( j = i; j < n; j++ )
+				a[k][j] -= t * a[i][j];
+			b[k] -= t * b[i];
+		}
+	}
+	for ( i = n - 1; i >= 0; i-- )
+	{
+		for ( k = i + 1; k < n; k++ )
+			b[i] -= a[i][k] * b[k];
+		b[i] /= a[i][i];
+	}
+	return 1;
+}
+
+static double sgn(double x)
+{
+	return x > 0.0 ? 1.0 : x < 0.0 ? -1.0 : 0.0;
+}
+
+// regressors of sample k from velocities v, order 1 keeps a2 and b2 out
+static void regressors(const struct RUN *r, const double *v, double vbus, long k, int order, double *x)
+{
+	x[0] = v[k - 1];
+	x[1] = order > 1 ? v[k - 2] : 0.0;
+	x[2] = vbus * r->u[k];
+	x[3] = vbus * r->u[k - 1];
+	x[4] = order > 1 ? vbus * r->u[k - 2] : 0.0;
+	x[5] = sgn(v[k]);
+}
+
+// solves sum z x' p = sum z v for p, z the regressors from vz
+static int estimate(const struct RUN *r, const double *v, const double *vz, double vbus,
+					int order, double *p)
+{
+	double a[NP][NP], x[NP], z[NP];
+	long k;
+	int i, j;
+
+	memset(a, 0, sizeof(a));
+	memset(p, 0, NP * sizeof(double));
+	for ( k = 3; k < r->n; k++ )
+	{
+		regressors(r, v, vbus, k, order, x);
+		regressors(r, vz, vbus, k, order, z);
+		for ( i = 0; i < NP; i++ )
+		{
+			for ( j = 0; j < NP; j++ )
+				a[i][j] += z[i] * x[j];
+			p[i] += z[i] * v[k];
+		}
+	}
+	if ( order < 2 )
+	{
+		// pin a2 and b2
+		a[1][1] = a[4][4] = 1.0;
+		p[1] = p[4] = 0.0;
+	}
+	return solve(a, p, NP);
+}
+
+/*********************************************************************
+  Function:        int fit(const struct RUN *r, double vbus, double cpr,
+                           int order, struct FIT *f)
+
+  Overview:        least squares fit of the model above (normal
+                   equations, the parameters left out by a first order
+                   fit are pinned to 0) and its time constants
+
+  Output:          1, or 0 if the data does not give a stable model
+********************************************************************/
+static int fit(const struct RUN *r, double vbus, double cpr, int order, struct FIT *f)
+{
+	double *v = calloc(r->n, sizeof(double)), *vs = calloc(r->n, sizeof(double));
+	double p[NP], x[NP], e, sum = 0.0, z1, z2, d, bs;
+	long k;
+	int i, it, ok;
+
+	if ( v == 0 || vs == 0 )
+		exit(2);
+	for ( k = 1; k < r->n; k++ )
+		v[k] = r->y[k] - r->y[k - 1];
+	ok = estimate(r, v, v, vbus, order, f->p);
+	for ( it = 0; ok && it < IV_PASSES; it++ )
+	{
+		// the model run on the drive alone, free of the count noise
+		memcpy(vs, v, 3 * sizeof(double));
+		for ( k = 3; k < r->n; k++ )
+		{
+			// friction takes the sign of the motion it opposes, it
+			// slows the motor down to a stop but does not reverse it
+			regressors(r, vs, vbus, k, order, x);
+			for ( d = 0.0, i = 0; i < NP - 1; i++ )
+				d += f->p[i] * x[i];
+			vs[k] = d + f->p[NP - 1] * sgn(d);
+			if ( vs[k] * d < 0.0 )
+				vs[k] = 0.0;
+			if ( fabs(vs[k]) > 1.0e9 )
+				break;
+		}
+		if ( k < r->n || !estimate(r, v, vs, vbus, order, p) )
+			break;
+		memcpy(f->p, p, sizeof(p));
+	}
+	for ( k = 3; ok && k < r->n; k++ )
+	{
+		regressors(r, v, vbus, k, order, x);
+		for ( e = v[k], i = 0; i < NP; i++ )
+			e -= f->p[i] * x[i];
+		sum += e * e;
+	}
+	free(v);
+	free(vs);
+	if ( !ok )
+		return 0;
+	f->rms = sqrt(sum / (r->n - 3));
+
+	// poles of z^2 - a1 z - a2
+	d = f->p[0] * f->p[0] + 4.0 * f->p[1];
+	if ( d < 0.0 )
+		return 0;
+	z1 = (f->p[0] + sqrt(d)) / 2.0;
+	z2 = (f->p[0] - sqrt(d)) / 2.0;
+	if ( z1 <= 0.0 || z1 >= 1.0 )
+		return 0;
+	f->tm = -r->t / log(z1);
+	f->te = z2 > 0.0 && z2 < z1 ? -r->t / log(z2) : 0.0;
+	bs = f->p[2] + f->p[3] + f->p[4];
+	if ( bs <= 0.0 )
+		return 0;
+	f->gain = bs / (1.0 - f->p[0] - f->p[1]) * 2.0 * M_PI / cpr / r->t;
+	f->vf = -f->p[5] / bs;
+	return 1;
+}
+
+/*********************************************************************
+  Function:        int model(const struct FIT *f, struct MOTOR *m)
+
+  Overview:        the motor parameters behind a fit, with vbus, r, kt
+                   and cpr of m as given:
+                      steady state   kt / (R B + kt^2) = gain
+                      poles          L J = te tm D, L B + R J = (te + tm) D
+                                     with D = R B + kt^2
+                      friction       Tf = kt vf / R
+
+  Output:          1, or 0 if they do not come out physical
+********************************************************************/
+static int model(const struct FIT *f, struct MOTOR *m)
+{
+	double d = m->kt / f->gain, s, p, q;
+
+	m->b = (d - m->kt * m->kt) / m->r;
+	if ( m->b < 0.0 )
+		m->b = 0.0;
+	d = m->r * m->b + m->kt * m->kt;
+	m->tf = f->vf > 0.0 ? m->kt * f->vf / m->r : 0.0;
+	if ( f->te <= 0.0 )
+	{
+		m->j = f->tm * d / m->r;	// l stays as it was
+		return m->j > 0.0;
+	}
+	s = (f->tm + f->te) * d;
+	p = f->tm * f->te * d;
+	q = s * s - 4.0 * m->r * p * m->b;
+	if ( q < 0.0 )
+		return 0;
+	m->j = (s + sqrt(q)) / (2.0 * m->r);
+	m->l = p / m->j;
+	return m->j > 0.0;
+}
+
+// fits a run, the second order model if it comes out, else the first
+static int fit_run(const struct RUN *r, struct MOTOR *m, struct FIT *f)
+{
+	struct MOTOR m2 = *m;
+
+	if ( r->n < MIN_SAMPLES )
+		return 0;
+	if ( fit(r, m->vbus, m->cpr, 2, f) && model(f, &m2) )
+	{
+		*m = m2;
+		return 1;
+	}
+	f->te = 0.0;
+	return fit(r, m->vbus, m->cpr, 1, f) && model(f, m);
+}
+
+static void print_model(FILE *o, const struct RUN *r, const struct FIT *f, const struct MOTOR *m)
+{
+	fprintf(o, "# plantfit: %ld samples of %.0fus, one step rms %.3g counts\n",
+		r->n, r->t * 1.0e6, f->rms);
+	fprintf(o, "# mechanical tau %.3gms, %.4g rad/s per volt\n", f->tm * 1.0e3, f->gain);
+	if ( f->te > 0.0 )
+		fprintf(o, "# electrical tau %.3gms\n", f->te * 1.0e3);
+	else
+		fprintf(o, "# electrical tau too short to see, l as given\n");
+	fprintf(o, "vbus=%.4g\nr=%.4g\nl=%.4g\nkt=%.4g\nj=%.4g\nb=%.4g\ntf=%.4g\ncpr=%.0f\n",
+		m->vbus, m->r, m->l, m->kt, m->j, m->b, m->tf, m->cpr);
+}
+
+/*
+ * self check
+ */
+static int close_to(const char *what, const char *name, double got, double want, double tol)
+{
+	if ( fabs(got - want) <= tol * fabs(want) )
+		return 0;
+	printf("FAIL %s: %s fitted %.4g, is %.4g\n", what, name, got, want);
+	return 1;
+}
+
+// b and tf trade off against each other on a prbs that keeps reversing
+// the motor, what they have to get right is the loss torque at the
+// speeds of the run
+static int compare(const char *what, const struct MOTOR *got, const struct MOTOR *want,
+				   double w, int lossy, int see_l)
+{
+	int bad = 0;
+
+	bad += close_to(what, "j", got->j, want->j, 0.1);
+	if ( lossy )
+		bad += close_to(what, "loss torque", got->b * w + got->tf, want->b * w + want->tf, 0.2);
+	if ( see_l )
+		bad += close_to(what, "l", got->l, want->l, 0.3);
+	return bad;
+}
+
+// ideal samples: prbs volts held over each sample, position at its end
+static void synth(struct MOTOR *m, double t, double amp, long n, struct RUN *r)
+{
+	unsigned short lfsr = 1;
+	double u;
+	long k;
+
+	r->n = 0;
+	r->t = t;
+	r->pdcmax = 1.0;
+	for ( k = 0; k < n; k++ )
+	{
+		u = (lfsr & 1) ? amp : -amp;
+		lfsr = (lfsr >> 1) ^ ((lfsr & 1) ? 0x6000 : 0);
+		motor_step(m, u * m->vbus, t);
+		run_add(r, (double)motor_counts(m), u);
+	}
+}
+
+// fits a run, vbus r kt and cpr taken from want
+static int check_fit(const char *what, const struct RUN *r, const struct MOTOR *want, int lossy)
+{
+	struct MOTOR got = *want;
+	struct FIT f;
+	double w = 0.0;
+	long k;
+
+	got.l = got.j = got.b = got.tf = 0.0;
+	if ( !fit_run(r, &got, &f) )
+	{
+		printf("FAIL %s: %ld samples, no model\n", what, r->n);
+		return 1;
+	}
+	for ( k = 1; k < r->n; k++ )
+		w += (r->y[k] - r->y[k - 1]) * (r->y[k] - r->y[k - 1]);
+	w = sqrt(w / (r->n - 1)) * 2.0 * M_PI / want->cpr / r->t;
+	return compare(what, &got, want, w, lossy, f.te > 0.0);
+}
+
+static int check(void)
+{
+	static const struct { const char *motor; int lossy; } motors[] = {
+		{ "", 0 },				// the simulation's, losses well under the back emf
+		{ "vbus=36,r=0.8,l=2.5e-3,kt=0.08,j=2e-4,b=3e-3,tf=0.05,cpr=4000", 1 },
+	};
+	struct MOTOR want;
+	struct RUN r = { 0 };
+	char what[64];
+	FILE *log;
+	int bad = 0, k, n = 0;
+
+	for ( k = 0; k < (int)(sizeof(motors) / sizeof(motors[0])); k++, n++ )
+	{
+		motor_init(&want);
+		motor_parse(&want, motors[k].motor);
+		synth(&want, getenv("T")?atof(getenv("T")):1.0e-3, getenv("A")?atof(getenv("A")):0.3, 10000, &r);
+		motor_init(&want);
+		motor_parse(&want, motors[k].motor);
+		snprintf(what, sizeof(what), "ideal samples, motor %d", k);
+		bad += check_fit(what, &r, &want, motors[k].lossy);
+	}
+
+	// the firmware streaming it in the simulation, 1ms samples
+	k = sizeof(motors) / sizeof(motors[0]) - 1;
+	sim_start();
+	motor_parse(&sim_motor, motors[k].motor);
+	sim_run(1.0);
+	sim_send("\ra14\rp0.0001\rI30 4\r");
+	sim_run(11.0);
+	sim_send("I0\r");
+	sim_run(11.2);
+	if ( (log = fmemopen((void *)sim_output(), strlen(sim_output()), "r")) == 0 )
+		return 1;
+	read_log(log, &r);
+	fclose(log);
+	motor_init(&want);
+	motor_parse(&want, motors[k].motor);
+	bad += check_fit("firmware stream", &r, &want, motors[k].lossy);
+	n++;
+	printf("%d models fitted, %d failures\n", n, bad);
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct MOTOR m;
+	struct RUN r = { 0 };
+	struct FIT f;
+	FILE *in = stdin;
+	int c;
+
+	motor_init(&m);
+	while ( (c = getopt(argc, argv, "cM:")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'c': return check();
+		case 'M':
+			if ( motor_arg(&m, optarg) )
+				return 2;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if ( argc - optind > 1 )
+		goto usage;
+	if ( optind < argc && (in = fopen(argv[optind], "r")) == 0 )
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	if ( read_log(in, &r) == 0 )
+	{
+		fprintf(stderr, "no I run in the log\n");
+		return 1;
+	}
+	if ( !fit_run(&r, &m, &f) )
+	{
+		fprintf(stderr, "%ld samples, no stable model fits them%s\n", r.n,
+			r.n < MIN_SAMPLES ? " (too few)" : ", more amplitude or a longer run may help");
+		return 1;
+	}
+	print_model(stdout, &r, &f, &m);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: plantfit [-M motor] [log]\n"
+		"       plantfit -c\n");
+	return 2;
+}
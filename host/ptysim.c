@@ -0,0 +1,533 @@
+//---------------------------------------------------------------------
+//	File:		ptysim.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: The simulated card (sim/, as servosim) with its console on a
+//          Linux pseudo terminal, so the firmware's serial layer and
+//          commands.c can be talked to end to end: by hand, by a host
+//          tool that opens a serial port, or by session scripts.
+//
+//          ptysim [-e eeprom] [-x speed] [-t secs]
+//              powers up and prints the name of the pty, then runs in
+//              real time (speed times it with -x) until interrupted or
+//              -t secs. Bytes from the pty arrive at the card's baud
+//              rate. Latencies as below are printed at the end.
+//          ptysim [-e eeprom] [-l us] session ...
+//              runs each session script on a card of its own, through
+//              the pty, in simulated time:
+//                 # comment
+//                 send TEXT      TEXT and a \r (\r \n \t \\ \xHH escapes)
+//                 raw TEXT       TEXT only
+//                 expect REGEX   waits until the output since the last
+//                                match matches (extended regex, the
+//                                escapes as above)
+//                 timeout SECS   for the expects after it, 1s at first
+//                 wait SECS      lets the card run
+//                 saved          waits until the eeprom holds the
+//                                parameters in ram with a good cksum
+//              At the end the card runs until every command sent got
+//              its prompt. A timeout there or in an expect or saved
+//              fails the session, so
+//              does a pwm interrupt lost or one that had to wait more
+//              than -l us (10) for the console side. Exit status 1 if a
+//              session failed.
+//
+//          For every console command the card time from its \r into
+//          the uart to the first byte of the answer and to the prompt
+//          is printed, with the longest wait of a pwm interrupt while
+//          it was being handled:
+//             command  reply ms  done ms  pwm wait us
+//          The session time is the card's, so the numbers are the same
+//          every run. The eeprom image of -e is not written back.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../dspicservo.h"
+#include "sim.h"
+
+#define SLICE_SECS		0.0001		// the card runs this long between pty reads
+#define MAX_CMDS		256			// timed per session
+#define CMD_TEXT		24			// of a command kept for the report
+#define MAX_OPEN		8			// commands sent ahead of their answers
+#define SCRIPT_LINE		256
+#define SEEN_MAX		65536		// session output not matched yet
+
+// the firmware's
+extern struct PID pid;
+extern struct PID pidEE;
+extern short calc_cksum(short sizew, short *adr);
+
+struct CMD{
+	char text[CMD_TEXT];
+	unsigned long long in;		// its \r went into the uart
+	unsigned long long reply;	// first byte of the answer, 0 none yet
+	unsigned long long done;	// the prompt, 0 not yet
+	unsigned long late;			// most Tcy a pwm interrupt waited meanwhile
+};
+
+static int master = -1, slave = -1;
+static struct CMD cmds[MAX_CMDS];
+static int ncmds;
+static short open_cmd[MAX_OPEN], nopen;
+static char typed[CMD_TEXT];		// the command coming in
+static short ntyped;
+static unsigned long nrx;			// bytes into the uart
+static unsigned long long prompt_at;	// a '>' went out, a prompt if nothing follows it at once
+static unsigned long pwm_late;		// the most of the whole run
+static size_t out_sent;				// of sim_output() into the pty
+static volatile sig_atomic_t stop;
+
+/*
+ * timing the commands, from the uart hooks
+ */
+static void rx_hook(unsigned char ch)
+{
+	struct CMD *c;
+
+	nrx++;
+	if ( ch != '\r' )
+	{
+		if ( ntyped < CMD_TEXT - 1 && isprint(ch) )
+			typed[ntyped++] = ch;
+		return;
+	}
+	typed[ntyped] = 0;
+	ntyped = 0;
+	if ( ncmds == MAX_CMDS || nopen == MAX_OPEN )
+		return;
+	c = &cmds[ncmds];
+	strcpy(c->text, typed[0] ? typed : "(empty)");
+	c->in = sim_cy;
+	c->reply = c->done = 0;
+	c->late = 0;
+	open_cmd[nopen++] = ncmds++;
+}
+
+// the oldest open command got its prompt
+static void prompt(void)
+{
+	struct CMD *c;
+
+	prompt_at = 0;
+	if ( nopen == 0 )
+		return;
+	c = &cmds[open_cmd[0]];
+	if ( c->reply == 0 )
+		c->reply = sim_cy;
+	c->done = sim_cy;
+	memmove(open_cmd, open_cmd + 1, --nopen * sizeof(open_cmd[0]));
+}
+
+// print_tuning() has a '>' in "=> " too, but more text goes out with it
+static void tx_hook(unsigned char ch)
+{
+	if ( prompt_at && prompt_at != sim_cy )
+		prompt();
+	if ( nopen && cmds[open_cmd[0]].reply == 0 )
+		cmds[open_cmd[0]].reply = sim_cy;
+	if ( ch == '>' )
+		prompt_at = sim_cy;
+}
+
+// after a slice, time the waits of the pwm interrupt
+static void slice_done(void)
+{
+	short k;
+
+	if ( prompt_at && prompt_at != sim_cy )
+		prompt();
+	for ( k = 0; k < nopen; k++ )
+		if ( sim_pwm_late > cmds[open_cmd[k]].late )
+			cmds[open_cmd[k]].late = sim_pwm_late;
+	if ( sim_pwm_late > pwm_late )
+		pwm_late = sim_pwm_late;
+	sim_pwm_late = 0;
+}
+
+static double ms(unsigned long long cy)
+{
+	return cy * 1000.0 / FCY;
+}
+
+static void report(void)
+{
+	const struct CMD *c;
+
+	printf("command                  reply ms  done ms  pwm wait us\n");
+	for ( c = cmds; c < &cmds[ncmds]; c++ )
+	{
+		printf("%-24s ", c->text);
+		if ( c->reply )
+			printf("%8.3f ", ms(c->reply - c->in));
+		else
+			printf("       - ");
+		if ( c->done )
+			printf("%8.3f ", ms(c->done - c->in));
+		else
+			printf("       - ");
+		printf("%12.1f\n", ms(c->late) * 1000.0);
+	}
+	printf("pwm interrupt waited %.1fus at most, %lu lost\n", ms(pwm_late) * 1000.0, sim_pwm_lost);
+}
+
+/*
+ * the card and the pty
+ */
+static int open_pty(void)
+{
+	struct termios t;
+	char *name;
+
+	if ( (master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(master) || unlockpt(master) ||
+		 (name = ptsname(master)) == 0 )
+	{
+		perror("pty");
+		return -1;
+	}
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+	// held open here too, a reader going away is no hangup then
+	if ( (slave = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0 || tcgetattr(slave, &t) )
+	{
+		perror(name);
+		return -1;
+	}
+	cfmakeraw(&t);
+	tcsetattr(slave, TCSANOW, &t);
+	return 0;
+}
+
+// the pty to the uart and the console output back, then a slice of the card
+static short run_slice(void)
+{
+	char buf[256];
+	const char *out;
+	ssize_t n;
+	size_t len;
+	short res;
+
+	while ( (n = read(master, buf, sizeof(buf) - 1)) > 0 )
+	{
+		buf[n] = 0;
+		sim_send(buf);				// a NUL does not get through
+	}
+	res = sim_run(sim_time() + SLICE_SECS);
+	slice_done();
+	out = sim_output();
+	len = strlen(out);
+	n = 0;
+	while ( out_sent < len && (n = write(master, out + out_sent, len - out_sent)) > 0 )
+		out_sent += n;
+	if ( out_sent == len || n < 0 )
+	{
+		sim_clear();				// nobody reading drops it
+		out_sent = 0;
+	}
+	return res;
+}
+
+static int boot(const char *ee)
+{
+	sim_pwm_lost = 0;
+	sim_rx_hook = rx_hook;
+	sim_tx_hook = tx_hook;
+	if ( ee && sim_ee_load(ee) )
+		fprintf(stderr, "%s: not loaded, starting without a saved setup\n", ee);
+	if ( open_pty() )
+		return -1;
+	sim_start();
+	return 0;
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static int interactive(const char *ee, double speed, double secs)
+{
+	struct timespec t0, now, nap = { 0, 200000 };
+	double wall;
+
+	if ( boot(ee) )
+		return 1;
+	printf("console on %s, ^C to stop\n", ptsname(master));
+	fflush(stdout);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while ( !stop && (secs <= 0.0 || sim_time() < secs) )
+	{
+		if ( run_slice() != SIM_RUN )
+		{
+			printf("the card restarted (U1), it can not go on\n");
+			break;
+		}
+		for ( ;; )
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			wall = (now.tv_sec - t0.tv_sec) + (now.tv_nsec - t0.tv_nsec) * 1.0e-9;
+			if ( stop || wall * speed >= sim_time() )
+				break;
+			nanosleep(&nap, 0);
+		}
+	}
+	report();
+	return 0;
+}
+
+/*
+ * session scripts
+ */
+static char seen[SEEN_MAX + 1];
+static size_t nseen;
+
+// the card runs until t or until done() says so, with what it sent in seen
+static int run_until(double t, int (*done)(void *), void *arg)
+{
+	ssize_t n;
+
+	for ( ;; )
+	{
+		if ( done && done(arg) )
+			return 1;
+		if ( sim_time() >= t )
+			return 0;
+		if ( run_slice() != SIM_RUN )
+			return 0;
+		while ( (n = read(slave, seen + nseen, SEEN_MAX - nseen)) > 0 )
+			nseen += n;
+		seen[nseen] = 0;
+		if ( nseen == SEEN_MAX )
+		{
+			memmove(seen, seen + SEEN_MAX / 2, SEEN_MAX / 2);
+			nseen = SEEN_MAX / 2;
+		}
+	}
+}
+
+static int matched(void *arg)
+{
+	regmatch_t m;
+
+	if ( regexec(arg, seen, 1, &m, 0) != 0 )
+		return 0;
+	nseen -= m.rm_eo;
+	memmove(seen, seen + m.rm_eo, nseen + 1);
+	return 1;
+}
+
+static int is_saved(void *arg)
+{
+	const short words = offsetof(struct PID, cksum) / sizeof(short);
+
+	(void)arg;
+	return memcmp(&pid, &pidEE, offsetof(struct PID, cksum)) == 0 &&
+		-calc_cksum(words, (short *)&pidEE) == pidEE.cksum;
+}
+
+// everything the script sent got to the card and was answered
+static int answered(void *arg)
+{
+	return nrx == *(unsigned long *)arg && nopen == 0;
+}
+
+// C escapes in place, a regex keeps the backslash of any other
+static void unescape(char *s, int regex)
+{
+	char *d = s;
+	unsigned v;
+
+	for ( ; *s; s++ )
+	{
+		if ( *s != '\\' || !s[1] )
+		{
+			*d++ = *s;
+			continue;
+		}
+		switch ( *++s )
+		{
+		case 'r': *d++ = '\r'; break;
+		case 'n': *d++ = '\n'; break;
+		case 't': *d++ = '\t'; break;
+		case 'x':
+			if ( sscanf(s + 1, "%2x", &v) == 1 )
+			{
+				*d++ = (char)v;
+				s += isxdigit((unsigned char)s[2]) ? 2 : 1;
+			}
+			break;
+		default:
+			if ( regex )
+				*d++ = '\\';
+			*d++ = *s;
+			break;
+		}
+	}
+	*d = 0;
+}
+
+// the script in f against the card booted in this process
+static int one_session(FILE *f, const char *path, double late_us)
+{
+	char line[SCRIPT_LINE], *arg;
+	double timeout = 1.0;
+	unsigned long sent = 0;
+	regex_t re;
+	int n = 0, bad = 0, res;
+
+	while ( !bad && fgets(line, sizeof(line), f) )
+	{
+		n++;
+		line[strcspn(line, "\r\n")] = 0;
+		for ( arg = line; *arg && !isspace((unsigned char)*arg); arg++ )
+			;
+		if ( *arg )
+			*arg++ = 0;
+		if ( line[0] == 0 || line[0] == '#' )
+			continue;
+		if ( strcmp(line, "send") == 0 || strcmp(line, "raw") == 0 )
+		{
+			unescape(arg, 0);
+			if ( line[0] == 's' )
+				strcat(arg, "\r");
+			if ( write(slave, arg, strlen(arg)) < 0 )
+				bad = 1;
+			sent += strlen(arg);
+		}
+		else if ( strcmp(line, "expect") == 0 )
+		{
+			unescape(arg, 1);
+			if ( regcomp(&re, arg, REG_EXTENDED) != 0 )
+			{
+				printf("%s:%d: bad regex %s\n", path, n, arg);
+				return 1;
+			}
+			res = run_until(sim_time() + timeout, matched, &re);
+			regfree(&re);
+			if ( !res )
+			{
+				printf("%s:%d: FAIL expect %s timed out at %.3fs, got:\n%s\n", path, n, arg,
+					sim_time(), seen);
+				bad = 1;
+			}
+		}
+		else if ( strcmp(line, "saved") == 0 )
+		{
+			if ( !run_until(sim_time() + timeout, is_saved, 0) )
+			{
+				printf("%s:%d: FAIL the eeprom does not hold the parameters at %.3fs\n", path, n,
+					sim_time());
+				bad = 1;
+			}
+		}
+		else if ( strcmp(line, "timeout") == 0 )
+			timeout = atof(arg);
+		else if ( strcmp(line, "wait") == 0 )
+			run_until(sim_time() + atof(arg), 0, 0);
+		else
+		{
+			printf("%s:%d: no command %s\n", path, n, line);
+			return 1;
+		}
+	}
+	if ( !bad && !run_until(sim_time() + timeout, answered, &sent) )
+	{
+		printf("%s: FAIL not every command was answered\n", path);
+		bad = 1;
+	}
+	report();
+	if ( sim_pwm_lost )
+	{
+		printf("%s: FAIL %lu pwm interrupts lost\n", path, sim_pwm_lost);
+		bad = 1;
+	}
+	if ( ms(pwm_late) * 1000.0 > late_us )
+	{
+		printf("%s: FAIL a pwm interrupt waited %.1fus, more than %gus\n", path,
+			ms(pwm_late) * 1000.0, late_us);
+		bad = 1;
+	}
+	printf("%s: %s at %.3fs\n", path, bad ? "FAILED" : "ok", sim_time());
+	return bad;
+}
+
+/*********************************************************************
+  Function:        int session(const char *path, const char *ee,
+                               double late_us)
+
+  Overview:        runs a session script on a new card, which is forked
+                   so every session starts from power up
+
+  Output:          0 if it passed
+********************************************************************/
+static int session(const char *path, const char *ee, double late_us)
+{
+	FILE *f = fopen(path, "r");
+	int st;
+
+	if ( f == 0 )
+	{
+		perror(path);
+		return 1;
+	}
+	fflush(NULL);
+	if ( fork() == 0 )
+	{
+		if ( boot(ee) )
+			_exit(1);
+		st = one_session(f, path, late_us);
+		fflush(stdout);
+		_exit(st);
+	}
+	wait(&st);
+	fclose(f);
+	return !WIFEXITED(st) || WEXITSTATUS(st) != 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *ee = 0;
+	double speed = 1.0, secs = 0.0, late_us = 10.0;
+	int c, bad = 0;
+
+	while ( (c = getopt(argc, argv, "e:l:t:x:")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'e': ee = optarg; break;
+		case 'l': late_us = atof(optarg); break;
+		case 't': secs = atof(optarg); break;
+		case 'x': speed = atof(optarg); break;
+		default:
+			fprintf(stderr, "usage: ptysim [-e eeprom] [-x speed] [-t secs]\n"
+				"       ptysim [-e eeprom] [-l us] session ...\n");
+			return 2;
+		}
+	}
+	if ( optind == argc )
+		return interactive(ee, speed > 0.0 ? speed : 1.0, secs);
+	for ( ; optind < argc; optind++ )
+		bad += session(argv[optind], ee, late_us);
+	return bad != 0;
+}
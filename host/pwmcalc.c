@@ -0,0 +1,248 @@
+//---------------------------------------------------------------------
+//	File:		pwmcalc.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: PC side calculator for the runtime pwm settings. It runs the
+//          same calc_pwm_timing() the card uses.
+//
+//          pwmcalc fpwm [post [ticks [fcy]]]   print one setting
+//          pwmcalc -g lead [-k calc] fpwm [post [ticks [fcy]]]
+//                                              and the sample to output
+//                                              delay with a sample lead
+//                                              of lead us (the g param)
+//                                              and a calc of calc us, as
+//                                              the z command shows it
+//          pwmcalc -c                          check the period math and
+//                                              the sample lead for every
+//                                              supported setting
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- sample lead and sample to output delay
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include "../pwmtiming.h"
+
+// oscillator settings listed in dspicservo.h
+static const long fcy_list[] = {
+	6000000L * 16 / 4,		// 6mhz xtal * pll16
+	14318000L * 8 / 4,		// 14.318mhz osc * pll8
+	7372800L * 16 / 4,		// 7.3728mhz xtal * pll16
+};
+
+static void print_timing(long fcy, const struct PWMTIMING *t)
+{
+	printf("fcy=%ld fpwm=%u (actual %.1fHz) post=%u ticks=%u\n",
+		fcy, t->fpwm, (double)fcy / (2.0 * (t->ptper + 1)), t->post, t->ticks);
+	printf("  PTPER=%u PDCmax=%u tick=%.2fus servo=%.2fus (%lu Tcy)\n",
+		t->ptper, t->pdcmax, t->tick_cy * 1e6 / fcy, t->servo_cy * 1e6 / fcy,
+		t->servo_cy);
+	printf("  periodfp=%.9g periodrecip=%.9g\n",
+		(double)t->periodfp, (double)t->periodrecip);
+}
+
+// the g param: where the trigger is and what the delay comes to, next
+// to the servo at the pwm intr as without it
+static void print_lead(long fcy, const struct PWMTIMING *t, unsigned lead_us, double calc_us)
+{
+	unsigned long period = 2UL * (t->ptper + 1), lead_cy;
+	unsigned long busy = (unsigned long)(calc_us * fcy / 1e6 + 0.5);
+	unsigned short sevtcmp = calc_sample_lead(fcy, t, lead_us, &lead_cy);
+
+	printf("  sample lead %uus: SEVTCMP=0x%04X (%s count), trigger %lu Tcy before the edge\n",
+		lead_us, sevtcmp, (sevtcmp & 0x8000) ? "down" : "up", lead_cy);
+	printf("  with a %.1fus calc, sample to output %.2fus, %.2fus at the pwm intr\n", calc_us,
+		calc_s2o(t, lead_cy, busy) * 1e6 / fcy, calc_s2o(t, period, busy) * 1e6 / fcy);
+}
+
+// PTMR with PTDIR in bit 15 c Tcy into a period, counted out
+static unsigned short ptmr_at(const struct PWMTIMING *t, unsigned long c)
+{
+	unsigned long v = 0, k;
+	int down = 0;
+
+	for ( k = 0; k < c; k++ )
+	{
+		if ( !down && v == t->ptper )
+			down = 1;
+		else if ( down )
+			v--;
+		else
+			v++;
+	}
+	return (unsigned short)(v | (down ? 0x8000 : 0));
+}
+
+// the sample lead of every g for one setting, 0 if it holds
+static int check_lead(long fcy, const struct PWMTIMING *t)
+{
+	static const unsigned long busy[] = { 0, 1, 100, 1499, 1500, 1501, 6000, 20000 };
+	unsigned long period = 2UL * (t->ptper + 1), lead_cy, want, s;
+	unsigned short sevtcmp;
+	unsigned lead;
+	int k, bad = 0;
+
+	for ( lead = 0; lead <= LEAD_MAX_US; lead += lead < 50 ? 1 : 37 )
+	{
+		sevtcmp = calc_sample_lead(fcy, t, lead, &lead_cy);
+		want = (unsigned long)floor(lead * (double)(fcy / 1000L) / 1000.0 + 0.5) % period;
+		if ( lead_cy != (want ? want : period) )
+			bad++, printf("FAIL %uus lead is %lu Tcy\n", lead, lead_cy);
+		// the trigger is where PTMR counts to SEVTCMP
+		if ( lead_cy > period || ptmr_at(t, period - lead_cy) != sevtcmp )
+			bad++, printf("FAIL %uus lead SEVTCMP 0x%04X, PTMR is 0x%04X there\n", lead,
+				sevtcmp, lead_cy > period ? 0 : ptmr_at(t, period - lead_cy));
+		for ( k = 0; k < (int)(sizeof(busy) / sizeof(busy[0])); k++ )
+		{
+			s = calc_s2o(t, lead_cy, busy[k]);
+			if ( s <= busy[k] || s - busy[k] > period || (s - lead_cy) % period )
+				bad++, printf("FAIL %uus lead %lu Tcy calc gives %lu\n", lead, busy[k], s);
+		}
+		if ( bad )
+			return bad;
+	}
+	return 0;
+}
+
+// returns the number of problems found with one setting
+static int check_one(long fcy, unsigned fpwm, int post, int ticks)
+{
+	struct PWMTIMING t;
+	int res = calc_pwm_timing(fcy, fpwm, post, ticks, &t);
+	double tick_s = (double)post / fpwm;
+	double servo_s;
+	int bad = 0;
+
+	// a setting must be rejected exactly when it is outside the documented range
+	if ( fpwm < FPWM_MIN || fpwm > FPWM_MAX || post < PWM_POST_MIN ||
+		 post > PWM_POST_MAX || ticks < TICKS_MIN || ticks > TICKS_MAX )
+	{
+		if ( res == PWMT_OK )
+		{
+			printf("FAIL accepted out of range setting\n");
+			bad++;
+		}
+		return bad;
+	}
+	if ( res == PWMT_TOO_FAST )
+	{
+		if ( tick_s * 1e6 > PWM_MIN_TICK_US * 1.01 )
+		{
+			printf("FAIL rejected %.2fus tick\n", tick_s * 1e6);
+			bad++;
+		}
+		return bad;
+	}
+	if ( res != PWMT_OK )
+	{
+		printf("FAIL error %d on a valid setting\n", res);
+		return 1;
+	}
+
+	servo_s = (double)t.servo_cy / fcy;
+	if ( t.ptper > 0x7fff )
+		bad++, printf("FAIL PTPER out of range\n");
+	if ( t.pdcmax != 2 * (t.ptper + 1) - 1 )
+		bad++, printf("FAIL PDCmax does not match PTPER\n");
+	if ( t.tick_cy != 2UL * (t.ptper + 1) * post || t.servo_cy != t.tick_cy * ticks )
+		bad++, printf("FAIL cycle counts\n");
+	if ( fabs((double)fcy / (2.0 * (t.ptper + 1)) - fpwm) / fpwm > 0.005 )
+		bad++, printf("FAIL pwm frequency off by more than 0.5%%\n");
+	if ( t.tick_cy * 1e6 / fcy < PWM_MIN_TICK_US * 0.99 )
+		bad++, printf("FAIL tick faster than %dus accepted\n", PWM_MIN_TICK_US);
+	if ( fabs(servo_s - tick_s * ticks) / servo_s > 0.005 )
+		bad++, printf("FAIL servo period %.9g expected %.9g\n", servo_s, tick_s * ticks);
+	if ( fabs(t.periodfp - servo_s) / servo_s > 1e-6 ||
+		 fabs(t.periodrecip * servo_s - 1.0) > 1e-6 )
+		bad++, printf("FAIL float period constants\n");
+	if ( ticks == 1 && fpwm % 1000 == 0 )
+		bad += check_lead(fcy, &t);
+	if ( bad )
+		print_timing(fcy, &t);
+	return bad;
+}
+
+static int check_all(void)
+{
+	unsigned i, fpwm;
+	int post, ticks;
+	long n = 0;
+	int bad = 0;
+	struct PWMTIMING t;
+
+	// the defaults must reproduce the original compile time constants
+	if ( calc_pwm_timing(fcy_list[0], 16000, 4, 1, &t) != PWMT_OK ||
+		 t.ptper != 749 || t.pdcmax != 1499 || t.servo_cy != 6000 )
+	{
+		printf("FAIL default 16khz timing changed\n");
+		bad++;
+	}
+
+	for ( i = 0; i < sizeof(fcy_list) / sizeof(fcy_list[0]); i++ )
+		for ( fpwm = FPWM_MIN - 100; fpwm <= FPWM_MAX + 100; fpwm += 50 )
+			for ( post = 0; post <= PWM_POST_MAX + 1; post++ )
+				for ( ticks = 0; ticks <= TICKS_MAX + 1; ticks++ )
+				{
+					n++;
+					if ( check_one(fcy_list[i], fpwm, post, ticks) )
+					{
+						printf("  at fcy=%ld fpwm=%u post=%d ticks=%d\n",
+							fcy_list[i], fpwm, post, ticks);
+						if ( ++bad > 20 )
+							return bad;
+					}
+				}
+	printf("%ld settings checked, %d failures\n", n, bad);
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	struct PWMTIMING t;
+	long fcy = fcy_list[0];
+	int post = 4, ticks = 1, lead = -1;
+	double calc_us = 0.0;
+	int res, c;
+
+	while ( (c = getopt(argc, argv, "cg:k:")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'c': return check_all() ? 1 : 0;
+		case 'g': lead = atoi(optarg); break;
+		case 'k': calc_us = atof(optarg); break;
+		default:
+			goto usage;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+	if ( argc < 2 || lead > LEAD_MAX_US )
+		goto usage;
+	if ( argc > 2 ) post = atoi(argv[2]);
+	if ( argc > 3 ) ticks = atoi(argv[3]);
+	if ( argc > 4 ) fcy = atol(argv[4]);
+	res = calc_pwm_timing(fcy, (unsigned short)atoi(argv[1]), post, ticks, &t);
+	if ( res != PWMT_OK )
+	{
+		printf("rejected, error %d\n", res);
+		return 1;
+	}
+	print_timing(fcy, &t);
+	if ( lead >= 0 )
+		print_lead(fcy, &t, lead, calc_us);
+	return 0;
+
+usage:
+	printf("usage: pwmcalc fpwm [post [ticks [fcy]]]\n"
+		"       pwmcalc -g lead [-k calc] fpwm [post [ticks [fcy]]]\n"
+		"       pwmcalc -c\n");
+	return 2;
+}
@@ -0,0 +1,382 @@
+//---------------------------------------------------------------------
+//	File:		replay.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Replays what the R command of the firmware (rec.c) recorded
+//          through the firmware's own pwm isr, built for the pc as in
+//          servosim, so a misbehaving servo cycle can be stepped in a
+//          debugger with the card's exact inputs.
+//
+//          replay [-q] [log]
+//              reads a console log (stdin without one), the last record
+//              in it, puts the servo state back as it was when it began
+//              and runs the isr over the recorded cycles. A line per
+//              servo cycle goes to stdout (not with -q):
+//                 cycle command feedback error output duty
+//              and at the end whether the outputs summed up the same as
+//              on the card, bit for bit. Exit status 1 if they did not.
+//          replay -c
+//              self check: records in the simulation, a move from the
+//              first pc command edge and a jam until its fault, and
+//              replays both. A corrupted record must not match.
+//
+//          The replay only gives the card's numbers if the pc rounds
+//          single floats the way the card does (IEEE, no wider
+//          intermediates), as gcc on x86-64 and arm64 does.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- the jam recorded from close to its trip, the buffer is smaller
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../dspicservo.h"
+#include "sim.h"
+
+#define MAX_BYTES	4096		// more than a card can hold
+
+struct RECORD{
+	unsigned cycles;
+	double us;					// servo period on the card
+	int len;					// bytes in buf
+	unsigned long sum;
+	int fault;					// stopped by a fault
+	int done;					// got to # rec end
+	unsigned char buf[MAX_BYTES];
+};
+
+// the firmware's
+extern struct PID pid;
+extern struct COF cof;
+extern struct PWMTIMING pwm_timing;
+extern volatile unsigned short cmd_posn, cmd_err, qei_cnterr;
+extern unsigned short pwm_last_cmd, pwm_last_fb;
+void _PWMInterrupt(void);
+
+static int read_log(FILE *f, struct RECORD *r)
+{
+	char line[256], *p;
+	int on = 0, b;
+
+	r->done = 0;
+	r->len = 0;
+	while ( fgets(line, sizeof(line), f) )
+	{
+		// the record can come right after the prompt
+		for ( p = line; *p == '>' || *p == '\r'; p++ )
+			;
+		if ( strncmp(p, "# rec end", 9) == 0 )
+		{
+			r->done = on;
+			on = 0;
+		}
+		else if ( sscanf(p, "# rec %u cycles of %lfus, %d bytes, sum %lx", &r->cycles, &r->us,
+						 &b, &r->sum) == 4 )
+		{
+			r->len = 0;
+			r->done = 0;
+			r->fault = strstr(p, ", fault") != 0;
+			on = 1;
+		}
+		else if ( on )
+		{
+			while ( r->len < MAX_BYTES && sscanf(p, "%2x", &b) == 1 )
+			{
+				r->buf[r->len++] = (unsigned char)b;
+				p += 2;
+			}
+		}
+	}
+	return r->done ? r->len : 0;
+}
+
+// the servo state as it was when the record began, 0 if the record is short
+static int restore(const struct RECORD *r)
+{
+	union { float f; unsigned long l; } u;
+	int k, pos = 0, n;
+
+	for ( k = 0; k < rec_nfields; k++ )
+	{
+		n = rec_fields[k].type == RF_SHORT ? 2 : 4;
+		if ( pos + n > r->len )
+			return 0;
+		u.l = r->buf[pos] | r->buf[pos + 1] << 8;
+		if ( n == 4 )
+			u.l |= (unsigned long)(r->buf[pos + 2] | r->buf[pos + 3] << 8) << 16;
+		pos += n;
+		switch ( rec_fields[k].type )
+		{
+		case RF_SHORT:
+			*(volatile unsigned short *)rec_fields[k].p = (unsigned short)u.l;
+			break;
+		case RF_LONG:
+			*(long *)rec_fields[k].p = (long)(int)u.l;
+			break;
+		default:
+			*(float *)rec_fields[k].p = u.f;
+			break;
+		}
+	}
+	return pos;
+}
+
+static int get_varint(const struct RECORD *r, int *pos, short *v)
+{
+	unsigned short z = 0;
+	int shift = 0;
+
+	do
+	{
+		if ( *pos >= r->len || shift > 14 )
+			return 0;
+		z |= (unsigned short)(r->buf[*pos] & 0x7f) << shift;
+		shift += 7;
+	} while ( r->buf[(*pos)++] & 0x80 );
+	*v = (short)((z >> 1) ^ -(z & 1));
+	return 1;
+}
+
+/*********************************************************************
+  Function:        int replay(const struct RECORD *r, FILE *trace,
+                              unsigned short *sum)
+
+  Overview:        runs the pwm isr over the recorded cycles, with the
+                   inputs it got on the card
+
+  Output:          cycles replayed, -1 if the record does not decode
+********************************************************************/
+static int replay(const struct RECORD *r, FILE *trace, unsigned short *sum)
+{
+	unsigned short cmd, fb, errs;
+	short dc = 0, df = 0, ddc, ddf, de, duty;
+	int pos, run, flags = -1, k;
+	unsigned n = 0;
+
+	sum[0] = sum[1] = 0;
+	if ( (pos = restore(r)) == 0 ||
+		 calc_pwm_timing(FCY, pid.fpwm, pid.pwmpost, pid.ticksperservo, &pwm_timing) != PWMT_OK )
+		return -1;
+	cmd = pwm_last_cmd;
+	fb = pwm_last_fb;
+	errs = cof.last_cmd_err;
+	while ( n < r->cycles )
+	{
+		if ( pos >= r->len )
+			return -1;
+		ddc = ddf = de = 0;
+		run = 1;
+		k = r->buf[pos++];
+		if ( k & REC_RUN )
+			run = (k & 0x7f) + 1;
+		else if ( k & REC_SMALL )
+		{
+			ddc = ((k >> 3) & 7) - 3;
+			ddf = (k & 7) - 3;
+		}
+		else
+		{
+			flags = k & (RECF_ENABLE | RECF_AMP | RECF_QEI);
+			if ( ((k & RECF_ERR) && !get_varint(r, &pos, &de)) ||
+				 ((k & RECF_FB) && !get_varint(r, &pos, &ddf)) ||
+				 ((k & RECF_CMD) && !get_varint(r, &pos, &ddc)) )
+				return -1;
+		}
+		if ( flags < 0 )
+			return -1;
+		for ( ; run > 0 && n < r->cycles; run-- )
+		{
+			dc += ddc;
+			df += ddf;
+			cmd += dc;
+			fb += df;
+			errs += de;
+			ddc = ddf = de = 0;
+
+			cmd_posn = cmd;
+			POSCNT = fb;
+			cmd_err = errs;
+			PORTEbits.RE8 = (flags & RECF_AMP) != 0;
+			qei_cnterr = (flags & RECF_QEI) != 0;
+			pid.enable = (flags & RECF_ENABLE) != 0;
+			for ( k = 0; k < pwm_timing.ticks; k++ )
+				sim_isr(_PWMInterrupt);
+
+			duty = PDC1 ? (short)PDC1 : -(short)PDC3;
+			rec_fold(sum, duty, pid.output);
+			if ( trace )
+				fprintf(trace, "%u %ld %ld %.1f %.3f %d\n", n, pid.command, pid.feedback,
+					pid.error, pid.output, duty);
+			n++;
+		}
+	}
+	return n;
+}
+
+// replays r, 0 if it gave the card's outputs
+static int report(const struct RECORD *r, FILE *trace)
+{
+	unsigned short sum[2];
+	int n = replay(r, trace, sum);
+	unsigned long s = (unsigned long)sum[1] << 16 | sum[0];
+
+	if ( n < 0 )
+	{
+		printf("record does not decode\n");
+		return 1;
+	}
+	if ( r->us > 0.0 && (pwm_timing.periodfp * 1.0e6 > r->us + 0.1 || pwm_timing.periodfp * 1.0e6 < r->us - 0.1) )
+		printf("servo period %.1fus here, %.1fus on the card\n", pwm_timing.periodfp * 1.0e6, r->us);
+	printf("%d cycles%s, sum %08lX, card %08lX: %s\n", n, r->fault ? " up to a fault" : "", s, r->sum,
+		s == r->sum ? "same outputs" : "DIFFERENT outputs");
+	return s != r->sum;
+}
+
+/*********************************************************************
+  Self check: the records are made in a forked simulation, so the pwm
+  isr here has only ever run for the replays
+********************************************************************/
+#define BOOT_SECS	1.0
+
+static void line(const char *cmd)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "%s\r", cmd);
+	sim_send(buf);
+	sim_run(sim_time() + 0.1);
+}
+
+// the console log of a scenario in the simulation
+static int record(int jam, struct RECORD *r)
+{
+	FILE *log = tmpfile();
+	int st;
+
+	if ( log == 0 )
+		return 0;
+	fflush(NULL);
+	if ( fork() == 0 )
+	{
+		sim_start();
+		sim_run(BOOT_SECS);
+		line("");
+		line("p25");
+		line("d0.04");
+		line("f1000");
+		if ( jam )
+		{
+			// runs into a jam, until the following error trips
+			sim_cmd_move(1000, 0.1);
+			sim_run(sim_time() + 0.2);
+			sim_motor.tload = 0.05;
+			sim_motor.tf = 10.0;
+			sim_cmd_move(3000, 0.1);
+			// close to the trip, the buffer only holds ~100 cycles of this
+			sim_run(sim_time() + 0.015);
+			line("R1");
+		}
+		else
+		{
+			line("R2");
+			sim_cmd_move(2000, 0.2);
+		}
+		sim_run(sim_time() + 0.3);
+		sim_clear();
+		line("R");
+		fputs(sim_output(), log);
+		fflush(log);
+		_exit(0);
+	}
+	wait(&st);
+	rewind(log);
+	read_log(log, r);
+	fclose(log);
+	return r->done;
+}
+
+static int check(void)
+{
+	static struct RECORD r;
+	int bad = 0, k;
+
+	for ( k = 0; k < 2; k++ )
+	{
+		printf("%s: ", k ? "jam" : "move");
+		if ( !record(k, &r) )
+		{
+			printf("FAIL no record\n");
+			bad++;
+			continue;
+		}
+		if ( r.fault != k )
+			printf("FAIL %s ", k ? "not stopped by the fault" : "stopped by a fault");
+		if ( report(&r, 0) || r.fault != k || r.cycles < 50 )
+			bad++;
+		printf("again: ");
+		if ( report(&r, 0) )
+		{
+			printf("FAIL the second replay differs\n");
+			bad++;
+		}
+	}
+
+	// a feedback step off by one in the middle of the jam
+	for ( k = r.len / 2; k < r.len && (r.buf[k] & 0xc0) != REC_SMALL; k++ )
+		;
+	if ( k < r.len )
+	{
+		r.buf[k] ^= 1;
+		printf("corrupted: ");
+		if ( !report(&r, 0) )
+		{
+			printf("FAIL a corrupted record gave the same outputs\n");
+			bad++;
+		}
+	}
+	printf("%d failures\n", bad);
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	static struct RECORD r;
+	FILE *in = stdin;
+	int c, quiet = 0;
+
+	while ( (c = getopt(argc, argv, "cq")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'c': return check();
+		case 'q': quiet = 1; break;
+		default:
+			goto usage;
+		}
+	}
+	if ( argc - optind > 1 )
+		goto usage;
+	if ( optind < argc && (in = fopen(argv[optind], "r")) == 0 )
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	if ( read_log(in, &r) == 0 )
+	{
+		fprintf(stderr, "no complete record in the log\n");
+		return 1;
+	}
+	return report(&r, quiet ? 0 : stdout);
+
+usage:
+	fprintf(stderr, "usage: replay [-q] [log]\n"
+		"       replay -c\n");
+	return 2;
+}
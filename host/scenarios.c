@@ -0,0 +1,346 @@
+//---------------------------------------------------------------------
+//	File:		scenarios.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Regression suite of the servo loop: canonical moves run on
+//          the firmware in the simulation (as servosim) and their traces
+//          compared with the golden ones in golden/, so a change to pid.c
+//          or pwm.c shows what it did to the loop before it goes near a
+//          machine. make regress runs it.
+//
+//          scenarios [-d dir] [-t factor] [name ...]
+//              runs the scenarios (all without a name) and compares each
+//              with dir/<name>.trace. Prints the largest difference of
+//              each field and how fast the scenario ran against the time
+//              in its golden file. A field further off than its tolerance
+//              fails, so does running more than factor times slower than
+//              the golden run if -t is given. Exit status 1 on a failure.
+//          scenarios -u [-d dir] [name ...]
+//              runs them and writes the golden files
+//          scenarios -p name
+//              prints the trace of one scenario:
+//                 time command feedback error volts amps
+//
+//          Every scenario starts from the same point: booted, tuned
+//          p25 d0.04 f1000 and at rest, forked from one simulation.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../dspicservo.h"
+#include "sim.h"
+
+#define BOOT_SECS	1.0
+#define TRACE_SECS	0.001
+#define NFIELDS		6			// in a trace line
+#define MAX_LINES	5000
+
+// the firmware's
+extern struct PID pid;
+extern short sw_enable;
+
+struct SCENARIO{
+	const char *name;
+	const char *what;
+	void (*run)(void);
+};
+
+static FILE *trace_out;
+static double t0;				// sim time the scenario started
+
+// how far each field may be off the golden trace, a build with other
+// float rounding or a pwm edge a cycle earlier
+static const char *const field[NFIELDS] = { "time", "command", "feedback", "error", "volts", "amps" };
+static const double tolerance[NFIELDS] = { 1.0e-6, 0.0, 2.0, 2.0, 0.5, 0.05 };
+
+static void line(const char *cmd)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "%s\r", cmd);
+	sim_send(buf);
+}
+
+// runs to t after the start, a trace line per TRACE_SECS
+static void run_to(double t)
+{
+	while ( sim_time() - t0 < t - TRACE_SECS / 2 &&
+			sim_run(sim_time() + TRACE_SECS) == SIM_RUN )
+		fprintf(trace_out, "%.3f %ld %ld %.1f %.2f %.3f\n", sim_time() - t0, pid.command,
+			pid.feedback, pid.error, sim_volts, sim_motor.i);
+}
+
+/*
+ * the scenarios, each from rest
+ */
+static void step(void)
+{
+	sim_cmd_move(500, 0.005);
+	run_to(0.3);
+}
+
+static void ramp(void)
+{
+	sim_cmd_move(4000, 0.4);
+	run_to(0.6);
+}
+
+static void reversal(void)
+{
+	sim_cmd_move(3000, 0.2);
+	sim_cmd_move(-3000, 0.2);
+	run_to(0.6);
+}
+
+// faster than the motor can follow, the output limits until it catches up
+static void saturation(void)
+{
+	line("f10000");
+	sim_cmd_move(8000, 0.04);
+	run_to(0.4);
+}
+
+// the modbus enable coil goes on in the middle of a move
+static void enable_moving(void)
+{
+	sw_enable = 0;
+	run_to(0.05);
+	sim_cmd_move(4000, 0.4);
+	run_to(0.2);
+	sw_enable = 1;
+	run_to(0.6);
+}
+
+static void staircase(void)
+{
+	int k;
+
+	for ( k = 0; k < 5; k++ )
+	{
+		sim_cmd_move(200, 0.002);
+		sim_cmd_move(0, 0.06);
+	}
+	run_to(0.4);
+}
+
+static const struct SCENARIO scenarios[] = {
+	{ "step", "500 edges in 5ms", step },
+	{ "ramp", "4000 edges over 0.4s", ramp },
+	{ "reversal", "3000 edges out and back, no stop", reversal },
+	{ "saturation", "8000 edges in 40ms, output limited", saturation },
+	{ "enable", "enabled in the middle of a ramp", enable_moving },
+	{ "staircase", "5 steps of 200 edges, 60ms apart", staircase },
+};
+#define NSCENARIOS	(int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+/*********************************************************************
+  Function:        double run(const struct SCENARIO *s, FILE *f)
+
+  Overview:        runs a scenario in a child of the booted simulation,
+                   its trace into f
+
+  Output:          host seconds it took, < 0 if it did not finish
+********************************************************************/
+static double run(const struct SCENARIO *s, FILE *f)
+{
+	struct timespec a, b;
+	int st;
+
+	fflush(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	if ( fork() == 0 )
+	{
+		trace_out = f;
+		t0 = sim_time();
+		s->run();
+		fflush(f);
+		_exit(0);
+	}
+	wait(&st);
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	if ( !WIFEXITED(st) || WEXITSTATUS(st) != 0 )
+		return -1.0;
+	return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) * 1.0e-9;
+}
+
+// reads a trace, the host time from its header if there is one
+static int read_trace(FILE *f, double (*v)[NFIELDS], double *host)
+{
+	char line[128];
+	int n = 0;
+
+	while ( fgets(line, sizeof(line), f) )
+	{
+		if ( line[0] == '#' )
+		{
+			if ( host )
+				sscanf(line, "# %*s %*fs simulated in %lfs", host);
+			continue;
+		}
+		if ( n < MAX_LINES && sscanf(line, "%lf %lf %lf %lf %lf %lf", &v[n][0], &v[n][1],
+								   &v[n][2], &v[n][3], &v[n][4], &v[n][5]) == NFIELDS )
+			n++;
+	}
+	return n;
+}
+
+static void boot(void)
+{
+	sim_start();
+	sim_run(BOOT_SECS);
+	line("");
+	line("p25");
+	line("d0.04");
+	line("f1000");
+	sim_run(sim_time() + 0.5);
+	sim_clear();
+}
+
+static const struct SCENARIO *find(const char *name)
+{
+	int k;
+
+	for ( k = 0; k < NSCENARIOS; k++ )
+		if ( strcmp(scenarios[k].name, name) == 0 )
+			return &scenarios[k];
+	fprintf(stderr, "no scenario %s, there are:", name);
+	for ( k = 0; k < NSCENARIOS; k++ )
+		fprintf(stderr, " %s", scenarios[k].name);
+	fprintf(stderr, "\n");
+	return 0;
+}
+
+// runs s and compares or writes its golden file, 0 if it passed
+static int one(const struct SCENARIO *s, const char *dir, int update, double slow)
+{
+	static double now[MAX_LINES][NFIELDS], gold[MAX_LINES][NFIELDS];
+	double host, ghost = 0.0, d, drift[NFIELDS] = { 0.0 };
+	char path[256];
+	FILE *f = tmpfile(), *g;
+	int n, ng, k, j, bad = 0;
+
+	snprintf(path, sizeof(path), "%s/%s.trace", dir, s->name);
+	if ( f == 0 || (host = run(s, f)) < 0.0 )
+	{
+		printf("%-11s FAIL did not run\n", s->name);
+		return 1;
+	}
+	rewind(f);
+	n = read_trace(f, now, 0);
+	if ( update )
+	{
+		rewind(f);
+		if ( (g = fopen(path, "w")) == 0 )
+		{
+			perror(path);
+			return 1;
+		}
+		fprintf(g, "# %s: %.3fs simulated in %.4fs\n", s->name, n * TRACE_SECS, host);
+		fprintf(g, "# %s\n# time command feedback error volts amps\n", s->what);
+		while ( (k = fgetc(f)) != EOF )
+			fputc(k, g);
+		fclose(g);
+		fclose(f);
+		printf("%-11s %d lines written to %s\n", s->name, n, path);
+		return 0;
+	}
+	fclose(f);
+	if ( (g = fopen(path, "r")) == 0 )
+	{
+		perror(path);
+		return 1;
+	}
+	ng = read_trace(g, gold, &ghost);
+	fclose(g);
+
+	for ( k = 0; k < n && k < ng; k++ )
+		for ( j = 0; j < NFIELDS; j++ )
+			if ( (d = fabs(now[k][j] - gold[k][j])) > drift[j] )
+				drift[j] = d;
+	printf("%-11s ", s->name);
+	if ( n != ng )
+	{
+		printf("FAIL %d lines, golden has %d ", n, ng);
+		bad++;
+	}
+	for ( j = 0; j < NFIELDS; j++ )
+		if ( drift[j] > tolerance[j] + 1.0e-9 )
+		{
+			printf("FAIL %s off by %g ", field[j], drift[j]);
+			bad++;
+		}
+	if ( !bad )
+		printf("ok   ");
+	printf("drift fb %.0f err %.1f V %.2f A %.3f, %.0fx real time", drift[2], drift[3],
+		drift[4], drift[5], n * TRACE_SECS / host);
+	if ( ghost > 0.0 )
+	{
+		printf(" (%.2f of golden)", host / ghost);
+		if ( slow > 0.0 && host > slow * ghost )
+		{
+			printf(" FAIL slower than %gx", slow);
+			bad++;
+		}
+	}
+	printf("\n");
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	const struct SCENARIO *s;
+	const char *dir = "golden", *print = 0;
+	double slow = 0.0;
+	int c, k, update = 0, bad = 0;
+
+	while ( (c = getopt(argc, argv, "d:p:t:u")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'd': dir = optarg; break;
+		case 'p': print = optarg; break;
+		case 't': slow = atof(optarg); break;
+		case 'u': update = 1; break;
+		default:
+			goto usage;
+		}
+	}
+	if ( print )
+	{
+		if ( (s = find(print)) == 0 )
+			return 2;
+		boot();
+		return run(s, stdout) < 0.0;
+	}
+	for ( k = optind; k < argc; k++ )
+		if ( find(argv[k]) == 0 )
+			return 2;
+
+	boot();
+	if ( optind == argc )
+		for ( k = 0; k < NSCENARIOS; k++ )
+			bad += one(&scenarios[k], dir, update, slow);
+	else
+		for ( k = optind; k < argc; k++ )
+			bad += one(find(argv[k]), dir, update, slow);
+	if ( !update )
+		printf("%d scenarios, %d failures\n", optind == argc ? NSCENARIOS : argc - optind, bad);
+	return bad != 0;
+
+usage:
+	fprintf(stderr, "usage: scenarios [-d dir] [-t factor] [name ...]\n"
+		"       scenarios -u [-d dir] [name ...]\n"
+		"       scenarios -p name\n");
+	return 2;
+}
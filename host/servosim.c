@@ -0,0 +1,272 @@
+//---------------------------------------------------------------------
+//	File:		servosim.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Runs the servo firmware on the PC, closed loop with a
+//          simulated dc motor and encoder (sim/sim.c, sim/motor.c), much
+//          faster than real time.
+//
+//          servosim [-e eeprom] [-M motor] [-t secs] [-m edges] [-r secs] [-l Nm] [cmd ...]
+//              powers up (with the eeprom image from -e if it exists),
+//              sends each cmd as a console line, then moves the pc
+//              command input by edges over -r secs and runs until -t
+//              secs. A trace line per ms goes to stdout:
+//                 time command feedback error volts amps
+//              the console output to stderr. The eeprom is written back
+//              to the -e file at the end. -l puts a load on the motor,
+//              -M sets it up as gainsearch -M does.
+//          servosim -c
+//              self check: boot without a saved setup, tuning over the
+//              console, moves, a load, a jam tripping the following
+//              error fault, a qei count wrap and the sample to output
+//              delay the z command shows against the pwmtiming.c model,
+//              at the pwm intr and with a sample lead
+//
+//          The firmware runs from power up in every run, so each run
+//          starts from the eeprom image it is given.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- sample to output delay checked
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "../dspicservo.h"
+#include "sim.h"
+
+#define BOOT_SECS	1.0			// past the 500ms startup delay and the powerup messages
+#define LINE_SECS	0.1			// for a console line to be done
+#define TRACE_SECS	0.001
+
+// the firmware's
+extern struct PID pid;
+extern struct PID pidEE;
+extern struct COF cof;
+extern struct PWMTIMING pwm_timing;
+extern short calc_cksum(short sizew, short *adr);
+
+static void trace(FILE *f)
+{
+	fprintf(f, "%.4f %ld %ld %.1f %.2f %.3f\n", sim_time(), pid.command, pid.feedback,
+		pid.error, sim_volts, sim_motor.i);
+}
+
+// sends a console line and lets the firmware answer it
+static short line(const char *cmd)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "%s\r", cmd);
+	sim_send(buf);
+	return sim_run(sim_time() + LINE_SECS);
+}
+
+// a check failed, shows where the run is
+static int fail(const char *what)
+{
+	printf("FAIL %s at %.3fs: command %ld feedback %ld error %.1f fault 0x%x\n", what,
+		sim_time(), pid.command, pid.feedback, pid.error, cof.fault);
+	return 1;
+}
+
+// runs until t, the largest |error| on the way
+static float run_max(double t)
+{
+	float e, max = 0.0;
+
+	while ( sim_time() < t - TRACE_SECS / 2 && sim_run(sim_time() + TRACE_SECS) == SIM_RUN )
+	{
+		e = pid.error < 0 ? -pid.error : pid.error;
+		if ( e > max )
+			max = e;
+	}
+	return max;
+}
+
+// the z command's sample to output delay after a fresh window against
+// the model: in the sim the calc takes no time and the adc isr comes 12
+// TAD after the trigger
+static int check_s2o(unsigned short lead_us)
+{
+	char buf[16];
+	const char *z;
+	unsigned long lead_cy = 2UL * (pwm_timing.ptper + 1), want;
+	double min, mean, max;
+	unsigned late;
+
+	snprintf(buf, sizeof(buf), "g%u", lead_us);
+	line(buf);
+	line("z0");
+	sim_clear();
+	sim_run(sim_time() + 0.1);
+	line("z");
+	if ( lead_us )
+	{
+		calc_sample_lead(FCY, &pwm_timing, lead_us, &lead_cy);
+		lead_cy -= 12UL * ((ADCON3 & 0x3f) + 1) / 2;
+	}
+	want = calc_s2o(&pwm_timing, lead_cy, 0) * 10000UL / (FCY / 1000L);	// us * 10, as print_us()
+	if ( (z = strstr(sim_output(), "sample to output(us):")) == 0 ||
+		 sscanf(z + 21, "%lf %lf %lf late %u", &min, &mean, &max, &late) != 4 )
+		return fail("no sample to output delay from z");
+	if ( fabs(min * 10 - want) > 0.01 || fabs(max * 10 - want) > 0.01 || late )
+	{
+		printf("g%u: sample to output %.1f-%.1fus late %u, the model has %.1fus\n", lead_us, min,
+			max, late, want / 10.0);
+		return fail("sample to output delay");
+	}
+	return 0;
+}
+
+static int check(void)
+{
+	static const char *const tune[] = { "p25", "d0.04", "f1000" };
+	const short cksum_words = offsetof(struct PID, cksum) / sizeof(short);
+	clock_t start = clock();
+	double tf;
+	long long counts;
+	float max;
+	int bad = 0, k;
+
+	sim_start();
+	tf = sim_motor.tf;
+	sim_run(BOOT_SECS);
+	if ( !strstr(sim_output(), "Powerup") || !strstr(sim_output(), "EEPROM ERORR") )
+		bad += fail("no powerup message or eeprom error with an empty eeprom");
+	if ( strstr(sim_output(), "servo loop interval") )
+		bad += fail("did not wait for the console with an empty eeprom");
+
+	// any line gets it going, then tune it
+	line("");
+	for ( k = 0; k < (int)(sizeof(tune) / sizeof(tune[0])); k++ )
+	{
+		sim_clear();
+		line(tune[k]);
+		if ( !strstr(sim_output(), "Current Settings") )
+			bad += fail("no settings printed after a parameter");
+	}
+	if ( !pid.enable )
+		bad += fail("servo not enabled");
+	if ( pidEE.pgain != 25.0f || pidEE.dgain != 0.04f || pidEE.maxerror != 1000.0f ||
+		 -calc_cksum(cksum_words, (short *)&pidEE) != pidEE.cksum )
+		bad += fail("tuning not saved in eeprom");
+
+	// a move and back
+	sim_cmd_move(2000, 0.2);
+	max = run_max(sim_time() + 0.4);
+	if ( max > 50 || pid.command != 2000 || labs(pid.feedback - pid.command) > 8 )
+		bad += fail("2000 edge move");
+	sim_cmd_move(-2000, 0.2);
+	run_max(sim_time() + 0.4);
+	if ( pid.command != 0 || labs(pid.feedback) > 8 )
+		bad += fail("move back");
+
+	// holds against a load
+	sim_motor.tload = 0.05;
+	max = run_max(sim_time() + 0.3);
+	if ( max > 100 || labs(pid.feedback) > 50 || cof.fault )
+		bad += fail("0.05Nm load");
+
+	// jammed: the following error trips and the drive is off
+	sim_motor.tload = 0.0;
+	sim_motor.tf = 10.0;
+	sim_cmd_move(3000, 0.1);
+	run_max(sim_time() + 0.3);
+	if ( !(cof.fault & FLT_FOLLOW) || sim_volts != 0.0 )
+		bad += fail("no following error fault when jammed");
+	sim_motor.tf = tf;
+	line("r");
+	run_max(sim_time() + 0.2);
+	if ( cof.fault || labs(pid.feedback - pid.command) > 8 )
+		bad += fail("fault not cleared by r");
+
+	// past the 16 bit qei count
+	counts = motor_counts(&sim_motor) - pid.feedback;
+	sim_cmd_move(70000, 1.0);
+	max = run_max(sim_time() + 1.2);
+	if ( cof.fault || max > 500 || labs(pid.feedback - pid.command) > 8 ||
+		 llabs(motor_counts(&sim_motor) - counts - pid.feedback) > 4 )
+		bad += fail("70000 edge move");
+
+	bad += check_s2o(0);
+	bad += check_s2o(20);
+	bad += check_s2o(140);
+	bad += check_s2o(0);
+	sim_cmd_move(-2000, 0.2);
+	max = run_max(sim_time() + 0.4);
+	if ( cof.fault || max > 50 || labs(pid.feedback - pid.command) > 8 )
+		bad += fail("move after the sample lead changes");
+
+	printf("%.1fs simulated in %.2fs, %d failures\n", sim_time(),
+		(double)(clock() - start) / CLOCKS_PER_SEC, bad);
+	return bad != 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *ee = 0, *motor = 0;
+	double secs = 1.0, rise = 0.5, load = 0.0, t;
+	long edges = 0;
+	int c;
+
+	while ( (c = getopt(argc, argv, "ce:l:m:r:t:M:")) != -1 )
+	{
+		switch ( c )
+		{
+		case 'c': return check();
+		case 'e': ee = optarg; break;
+		case 'l': load = atof(optarg); break;
+		case 'm': edges = atol(optarg); break;
+		case 'r': rise = atof(optarg); break;
+		case 't': secs = atof(optarg); break;
+		case 'M': motor = optarg; break;
+		default:
+			goto usage;
+		}
+	}
+	if ( secs <= 0.0 || rise <= 0.0 )
+		goto usage;
+	if ( ee && sim_ee_load(ee) )
+		fprintf(stderr, "%s: no eeprom image, starting with an empty one\n", ee);
+
+	sim_start();
+	if ( motor && motor_arg(&sim_motor, motor) )
+		return 1;
+	if ( load != 0.0 )
+		sim_motor.tload = load;
+	if ( sim_run(BOOT_SECS) != SIM_RUN )
+		return 1;
+	for ( ; optind < argc; optind++ )
+		line(argv[optind]);
+	fputs(sim_output(), stderr);
+	sim_clear();
+
+	if ( edges )
+		sim_cmd_move(edges, rise);
+	t = sim_time();
+	while ( sim_time() < t + secs - TRACE_SECS / 2 && sim_run(sim_time() + TRACE_SECS) == SIM_RUN )
+	{
+		trace(stdout);
+		fputs(sim_output(), stderr);
+		sim_clear();
+	}
+	if ( ee && sim_ee_save(ee) )
+	{
+		perror(ee);
+		return 1;
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: servosim [-e eeprom] [-M motor] [-t secs] [-m edges] [-r secs] [-l Nm] [cmd ...]\n"
+		"       servosim -c\n");
+	return 2;
+}
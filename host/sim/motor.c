@@ -0,0 +1,172 @@
+//---------------------------------------------------------------------
+//	File:		motor.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Discrete time model of a brushed dc motor:
+//
+//             L di/dt = v - R i - Kt w
+//             J dw/dt = Kt i - B w - Tf sign(w) - Tload
+//
+//          integrated with semi implicit euler steps short against the
+//          electrical time constant L/R. Coulomb friction holds the
+//          shaft while the torque on it stays below Tf.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "motor.h"
+
+#define STEPS_PER_TAU	8		// integration steps per L/R
+
+/*********************************************************************
+  Function:        void motor_init(struct MOTOR *m)
+
+  Overview:        a small 24V servo motor with a 500 line encoder,
+                   at rest
+********************************************************************/
+void motor_init(struct MOTOR *m)
+{
+	m->vbus = 24.0;
+	m->r = 1.2;
+	m->l = 1.5e-3;
+	m->kt = 0.05;
+	m->j = 3.0e-5;
+	m->b = 2.0e-5;
+	m->tf = 4.0e-3;
+	m->tload = 0.0;
+	m->cpr = 2000.0;
+	m->i = 0.0;
+	m->w = 0.0;
+	m->theta = 0.0;
+}
+
+/*********************************************************************
+  Function:        void motor_step(struct MOTOR *m, double v, double dt)
+
+  Overview:        advances the motor dt seconds with v volts across it
+********************************************************************/
+void motor_step(struct MOTOR *m, double v, double dt)
+{
+	int n = (int)ceil(dt * STEPS_PER_TAU * m->r / m->l);
+	double h, t, w;
+
+	if ( n < 1 )
+		n = 1;
+	h = dt / n;
+	while ( n-- > 0 )
+	{
+		m->i += h * (v - m->r * m->i - m->kt * m->w) / m->l;
+		t = m->kt * m->i - m->b * m->w - m->tload;
+		if ( m->w == 0.0 && fabs(t) <= m->tf )
+			continue;				// stuck
+		w = m->w + h * (t - copysign(m->tf, m->w != 0.0 ? m->w : t)) / m->j;
+		if ( m->w * w < 0.0 )
+			w = 0.0;				// friction stops it, not reverses it
+		m->w = w;
+		m->theta += h * w;
+	}
+}
+
+// shaft position as the encoder counts it
+long long motor_counts(const struct MOTOR *m)
+{
+	return (long long)floor(m->theta * m->cpr / (2.0 * M_PI));
+}
+
+/*********************************************************************
+  Function:        int motor_parse(struct MOTOR *m, const char *s)
+
+  Input:           s - name=value pairs separated by commas, names as in
+                       struct MOTOR (load for tload), e.g. "r=0.8,j=1e-4"
+
+  Output:          0, or -1 with the parameters up to the bad one set
+********************************************************************/
+int motor_parse(struct MOTOR *m, const char *s)
+{
+	static const struct { const char *name; size_t ofs; } names[] = {
+		{ "vbus", offsetof(struct MOTOR, vbus) }, { "r", offsetof(struct MOTOR, r) },
+		{ "l", offsetof(struct MOTOR, l) }, { "kt", offsetof(struct MOTOR, kt) },
+		{ "j", offsetof(struct MOTOR, j) }, { "b", offsetof(struct MOTOR, b) },
+		{ "tf", offsetof(struct MOTOR, tf) }, { "load", offsetof(struct MOTOR, tload) },
+		{ "cpr", offsetof(struct MOTOR, cpr) },
+	};
+	const char *eq;
+	char *end;
+	double v;
+	size_t k, n;
+
+	while ( *s )
+	{
+		eq = strchr(s, '=');
+		if ( eq == 0 )
+			return -1;
+		n = eq - s;
+		for ( k = 0; k < sizeof(names) / sizeof(names[0]); k++ )
+			if ( strlen(names[k].name) == n && strncmp(s, names[k].name, n) == 0 )
+				break;
+		v = strtod(eq + 1, &end);
+		if ( k == sizeof(names) / sizeof(names[0]) || end == eq + 1 || (*end && *end != ',') )
+			return -1;
+		*(double *)((char *)m + names[k].ofs) = v;
+		s = *end ? end + 1 : end;
+	}
+	if ( m->r <= 0.0 || m->l <= 0.0 || m->j <= 0.0 || m->cpr <= 0.0 )
+		return -1;
+	return 0;
+}
+
+/*********************************************************************
+  Function:        int motor_arg(struct MOTOR *m, const char *arg)
+
+  Overview:        the -M argument of the tools: name=value pairs as
+                   motor_parse() takes them, or @file with one pair per
+                   line (what host/plantfit writes), # starts a comment
+
+  Output:          0, or -1 with a message on stderr
+********************************************************************/
+int motor_arg(struct MOTOR *m, const char *arg)
+{
+	char line[128], *p;
+	FILE *f;
+	int res = 0, n = 0;
+
+	if ( arg[0] != '@' )
+	{
+		if ( motor_parse(m, arg) == 0 )
+			return 0;
+		fprintf(stderr, "bad motor parameters: %s\n", arg);
+		return -1;
+	}
+	if ( (f = fopen(arg + 1, "r")) == 0 )
+	{
+		perror(arg + 1);
+		return -1;
+	}
+	while ( res == 0 && fgets(line, sizeof(line), f) )
+	{
+		n++;
+		if ( (p = strchr(line, '#')) != 0 )
+			*p = 0;
+		for ( p = line + strlen(line); p > line && (p[-1] == '\n' || p[-1] == '\r' ||
+			  p[-1] == ' ' || p[-1] == '\t'); )
+			*--p = 0;
+		for ( p = line; *p == ' ' || *p == '\t'; p++ )
+			;
+		if ( *p && motor_parse(m, p) )
+		{
+			fprintf(stderr, "%s:%d: bad motor parameter %s\n", arg + 1, n, p);
+			res = -1;
+		}
+	}
+	fclose(f);
+	return res;
+}
@@ -0,0 +1,41 @@
+//---------------------------------------------------------------------
+//	File:		motor.h
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Brushed dc motor with an incremental encoder, the plant of
+//          the host simulation. SI units, angles in radians.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#ifndef MOTOR_H
+#define MOTOR_H
+
+struct MOTOR{
+	// parameters
+	double vbus;		// V across the motor at 100% duty
+	double r;			// winding resistance, ohm
+	double l;			// winding inductance, H
+	double kt;			// torque constant Nm/A, also the back emf V/(rad/s)
+	double j;			// inertia of motor and load, kg m^2
+	double b;			// viscous friction, Nm/(rad/s)
+	double tf;			// coulomb friction, Nm
+	double tload;		// external load torque, Nm
+	double cpr;			// encoder counts per rev (lines * 4)
+	// state
+	double i;			// winding current, A
+	double w;			// speed, rad/s
+	double theta;		// shaft angle, rad
+};
+
+void motor_init(struct MOTOR *m);
+void motor_step(struct MOTOR *m, double v, double dt);
+long long motor_counts(const struct MOTOR *m);
+int motor_parse(struct MOTOR *m, const char *s);
+int motor_arg(struct MOTOR *m, const char *arg);
+
+#endif
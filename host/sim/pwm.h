@@ -0,0 +1,64 @@
+//---------------------------------------------------------------------
+//	File:		pwm.h
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: The motor control pwm configuration masks of the XC16
+//          peripheral library that pwm.c uses, for the host simulation.
+//          Each one is and'ed into the register value.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#ifndef SIM_PWM_H
+#define SIM_PWM_H
+
+// PTCON
+#define PWM_EN				0xffff
+#define PWM_IDLE_CON		0xdfff
+#define PWM_OP_SCALE1		0xff0f
+#define PWM_IPCLK_SCALE1	0xfff3
+#define PWM_MOD_UPDN		0xfffe
+
+// interrupt config
+#define PWM_INT_EN			0xffff
+#define PWM_FLTA_DIS_INT	0xff7f
+#define PWM_INT_PR1			0xfff9
+#define PWM_FLTA_INT_PR0	0xff8f
+
+// PWMCON1
+#define PWM_MOD1_IND		0xffff
+#define PWM_MOD2_IND		0xffff
+#define PWM_MOD3_IND		0xffff
+#define PWM_PEN1L			0xffff
+#define PWM_PDIS1H			0xffef
+#define PWM_PDIS2L			0xfffd
+#define PWM_PDIS2H			0xffdf
+#define PWM_PEN3L			0xffff
+#define PWM_PDIS3H			0xffbf
+
+// DTCON1
+#define PWM_DTAPS1			0xff3f
+#define PWM_DTA10			0xffca
+
+// FLTACON
+#define PWM_FLTA_MODE_CYCLE	0xffff
+#define PWM_FLTA1_DIS		0xfffe
+#define PWM_FLTA2_DIS		0xfffd
+#define PWM_FLTA3_DIS		0xfffb
+#define PWM_OVA1L_INACTIVE	0xfeff
+#define PWM_OVA1H_INACTIVE	0xfdff
+#define PWM_OVA2L_INACTIVE	0xfbff
+#define PWM_OVA2H_INACTIVE	0xf7ff
+#define PWM_OVA3L_INACTIVE	0xefff
+#define PWM_OVA3H_INACTIVE	0xdfff
+
+// PWMCON2
+#define PWM_SEVOPS1			0xf0ff
+#define PWM_OSYNC_PWM		0xffff
+#define PWM_UEN				0xfffe
+
+#endif
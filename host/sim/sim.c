@@ -0,0 +1,935 @@
+//---------------------------------------------------------------------
+//	File:		sim.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Runs the firmware on a PC against a register level model of
+//          the 30f4012 and a dc motor (motor.c), closed loop and much
+//          faster than real time.
+//
+//          The firmware, main() included, is compiled unchanged with
+//          xc.h of this directory in place of the XC16 one. main() is
+//          renamed fw_main and runs on a stack of its own; sim_run()
+//          switches to it until the simulated time is up, so a tool can
+//          stop it, look at it or send it commands and let it go on.
+//
+//          Time is in instruction cycles (sim_cy) and only passes where
+//          the background code could see it:
+//             - every timer read costs READ_CY
+//             - the first Nop() after a timer read, the idle loop in
+//               cpu_idle(), skips ahead to the next event
+//             - a data eeprom erase or write costs EE_WRITE_CY
+//          Interrupt handlers take no time. Events are the end of each
+//          pwm period (the motor is stepped with the duty of the period
+//          that ended and the encoder counts go into POSCNT), timer
+//          period matches, a byte arriving on the uart and an edge of
+//          the pc command input. Whenever time moves the pending
+//          interrupts with a priority above SRbits.IPL are run, highest
+//          first, the same when the firmware lowers its IPL.
+//
+//          Modelled: pwm1L/pwm3L duty, OVDCON overrides and UDIS, the
+//          postscaled pwm interrupt, QEI x4 counts with the CNTERR
+//          interrupt on a wrap, IC1/IC2 edges from the pc quadrature
+//          input on RD0/RD1, timers 1-3, uart rx with its 4 byte fifo
+//          and OERR, data eeprom in the sim_eedata section, PTMR and
+//          PTDIR from the time in the period, the adc interrupt 12 TAD
+//          after the special event trigger (no conversion).
+//          sim_pwm_late holds the longest a pwm interrupt had to wait
+//          for the firmware's IPL to come down, sim_pwm_lost counts the
+//          ones that came while the one before was still pending.
+//          Not modelled: uart tx timing (a byte is out as soon as it is
+//          written), isr execution time, dead time, adc values.
+//
+//          The host has 32 bit int and 64 bit long where XC16 has 16
+//          and 32. The firmware keeps its eeprom words in shorts so
+//          the parameter block and the flight record are the same.
+//          sim_tb_warp() moves the timebase on without the time passing
+//          so the 32 bit wrap, 3.2 hours in on the card, can be tested.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- PTMR, special event trigger and adc interrupt
+// Oct 19 2026 -- timebase warp
+// Oct 19 2026 -- pc command spikes and qei count errors on demand
+// Oct 19 2026 -- sim_send_bytes() for modbus frames
+// Oct 19 2026 -- character time from the parity and stop bits of U1MODE
+//----------------------------------------------------------------------
+#include <stdarg.h>
+#include <ucontext.h>
+#include "xc.h"
+#include "../../dspicservo.h"
+#include "../../DataEEPROM.h"
+#include "sim.h"
+
+#define NEVER			(~0ULL)
+#define READ_CY			4				// a timer read in the background
+#define IDLE_TICK_CY	1500			// motor step while the pwm is off
+#define EE_WRITE_CY		(FCY / 500)		// data eeprom row erase or write, 2ms
+#define RX_FIFO			4
+#define MOVES			16
+#define FW_STACK		(1024 * 1024)
+
+// the firmware
+int fw_main(void);
+void _IC1Interrupt(void);
+void _IC2Interrupt(void);
+void _T1Interrupt(void);
+void _T3Interrupt(void);
+void _U1RXInterrupt(void);
+void _PWMInterrupt(void);
+void _ADCInterrupt(void);
+void _QEIInterrupt(void);
+
+// registers, at their reset values
+volatile SRBITS SRbits;
+volatile unsigned short IFS0, IFS2, IEC0, IEC2;
+volatile unsigned short IPC0 = 0x4444, IPC1 = 0x4444, IPC2 = 0x4444, IPC9 = 0x4444, IPC10 = 0x4444;
+volatile unsigned short PTCON, PTPER, SEVTCMP, PWMCON1, PWMCON2, DTCON1, FLTACON,
+	OVDCON = 0x3f00, PDC1, PDC2, PDC3;
+volatile unsigned short POSCNT, MAXCNT = 0xffff, QEICON, DFLTCON;
+volatile unsigned short ADPCFG, TRISB = 0xffff, TRISC = 0xffff, TRISD = 0xffff, TRISE = 0xffff,
+	TRISF = 0xffff, PORTD, PORTE = 0x0100, LATB, LATE;
+volatile unsigned short T1CON, T2CON, T3CON, PR1 = 0xffff, PR2 = 0xffff, PR3 = 0xffff;
+volatile unsigned short sim_TMR1, sim_TMR2, sim_TMR3;
+volatile unsigned short IC1CON, IC2CON, IC1BUF, IC2BUF;
+volatile unsigned short U1MODE, U1BRG;
+volatile unsigned short ADCON1, ADCON2, ADCON3, ADCHS, ADCBUF0;
+static volatile unsigned short u1sta, u1tx;
+
+struct MOTOR sim_motor;
+unsigned long long sim_cy;
+double sim_volts;
+short sim_echo;
+void (*sim_pwm_hook)(void);
+void (*sim_rx_hook)(unsigned char ch);
+void (*sim_tx_hook)(unsigned char ch);
+unsigned long sim_pwm_late;
+unsigned long sim_pwm_lost;
+
+static ucontext_t tool_ctx, fw_ctx;
+static short fw_state;
+static unsigned long long stop_cy;
+static short in_isr;
+static short idle_armed;			// a timer was read since the last idle skip
+static unsigned long nop_debt;		// Nop() cycles not spent yet
+
+// interrupt sources, in natural order: the first one wins a tie
+struct VECTOR{
+	void (*isr)(void);
+	volatile unsigned short *ifs, *iec, *ipc;
+	unsigned short bit;
+	short shift;				// of the priority in *ipc
+};
+
+static const struct VECTOR vectors[] = {
+	{ _IC1Interrupt,  &IFS0, &IEC0, &IPC0,  1 << 1, 4 },
+	{ _T1Interrupt,   &IFS0, &IEC0, &IPC0,  1 << 3, 12 },
+	{ _IC2Interrupt,  &IFS0, &IEC0, &IPC1,  1 << 4, 0 },
+	{ _T3Interrupt,   &IFS0, &IEC0, &IPC1,  1 << 7, 12 },
+	{ _U1RXInterrupt, &IFS0, &IEC0, &IPC2,  1 << 9, 4 },
+	{ _ADCInterrupt,  &IFS0, &IEC0, &IPC2,  1 << 11, 12 },
+	{ _PWMInterrupt,  &IFS2, &IEC2, &IPC9,  1 << 7, 4 },
+	{ _QEIInterrupt,  &IFS2, &IEC2, &IPC10, 1 << 8, 0 },
+};
+#define NVECTORS	(sizeof(vectors) / sizeof(vectors[0]))
+
+struct TIMER{
+	volatile unsigned short *con, *tmr, *pr;
+	unsigned short ifbit;			// in IFS0
+	unsigned long acc;				// Tcy counted towards the next tick
+};
+
+static struct TIMER timers[] = {
+	{ &T1CON, &sim_TMR1, &PR1, 1 << 3 },
+	{ &T2CON, &sim_TMR2, &PR2, 1 << 6 },
+	{ &T3CON, &sim_TMR3, &PR3, 1 << 7 },
+};
+static const unsigned short prescale[4] = { 1, 8, 64, 256 };
+
+static unsigned long long next_pwm;		// end of the pwm period
+static unsigned long long pwm_if_at;	// PWMIF was set
+static unsigned long long pwm_start;	// start of it
+static unsigned short pwm_post;			// periods since the last interrupt
+static unsigned short sevt_post;		// special event triggers since the last one used
+static unsigned long long next_adc = NEVER;	// adc interrupt
+static long long enc_last;				// motor_counts() at the last period
+
+struct MOVE{
+	long edges;					// signed
+	unsigned long long cy;		// to spread them over
+};
+static struct MOVE moves[MOVES];
+static short mv_head, mv_n;
+static long mv_done;					// edges of moves[mv_head] sent
+static unsigned long long mv_start;
+static unsigned long long next_edge;
+static long cmd_pos;
+static short cmd_q;						// quadrature state
+static const unsigned char gray[4] = { 0, 1, 3, 2 };	// RD1:RD0, counting up
+
+static unsigned char *rxq;				// bytes still to arrive
+static size_t rxq_len, rxq_pos, rxq_size;
+static unsigned long long next_rx;
+static unsigned char rx_fifo[RX_FIFO];
+static short rx_n;
+static short rx_oerr;
+static short tx_pending;				// u1tx written, not sent yet
+
+static char *out;						// console output
+static size_t out_len, out_size;
+
+static void spend(unsigned long long cy);
+
+/*
+ * interrupts
+ */
+static void dispatch(void)
+{
+	short v, best, pri, top, ipl;
+	long n = 0;
+
+	if ( in_isr )
+		return;
+	for ( ;; )
+	{
+		best = -1;
+		top = SRbits.IPL;
+		for ( v = 0; v < (short)NVECTORS; v++ )
+		{
+			if ( !(*vectors[v].ifs & vectors[v].bit) || !(*vectors[v].iec & vectors[v].bit) )
+				continue;
+			pri = (*vectors[v].ipc >> vectors[v].shift) & 7;
+			if ( pri > top )
+			{
+				best = v;
+				top = pri;
+			}
+		}
+		if ( best < 0 )
+			return;
+		if ( ++n > 1000 )
+		{
+			fprintf(stderr, "sim: interrupt %d stays pending, its handler does not clear it\n", best);
+			exit(2);
+		}
+		if ( vectors[best].isr == _PWMInterrupt && sim_cy - pwm_if_at > sim_pwm_late )
+			sim_pwm_late = (unsigned long)(sim_cy - pwm_if_at);
+		ipl = SRbits.IPL;
+		SRbits.IPL = top;
+		in_isr = 1;
+		vectors[best].isr();
+		in_isr = 0;
+		SRbits.IPL = ipl;
+	}
+}
+
+void sim_ipl(short ipl)
+{
+	SRbits.IPL = ipl;
+	dispatch();
+}
+
+// runs an isr from the tool as if it had been taken
+void sim_isr(void (*isr)(void))
+{
+	in_isr = 1;
+	isr();
+	in_isr = 0;
+}
+
+/*
+ * timers
+ */
+
+// Tcy from now to the next period match
+static unsigned long long timer_next(const struct TIMER *t)
+{
+	unsigned long ticks;
+
+	if ( !(*t->con & 0x8000) )
+		return NEVER;
+	ticks = (unsigned short)(*t->pr - *t->tmr) + 1UL;
+	return (unsigned long long)ticks * prescale[(*t->con >> 4) & 3] - t->acc;
+}
+
+static void timer_run(struct TIMER *t, unsigned long long cy)
+{
+	unsigned short ps = prescale[(*t->con >> 4) & 3];
+	unsigned long long n;
+	unsigned long left;
+
+	if ( !(*t->con & 0x8000) )
+		return;
+	t->acc += cy;
+	n = t->acc / ps;
+	t->acc %= ps;
+	while ( n > 0 )
+	{
+		left = (unsigned short)(*t->pr - *t->tmr) + 1UL;
+		if ( n < left )
+		{
+			*t->tmr += (unsigned short)n;
+			break;
+		}
+		n -= left;
+		*t->tmr = 0;
+		IFS0 |= t->ifbit;
+	}
+}
+
+/*
+ * pwm, motor and encoder
+ */
+static double pin_duty(unsigned short pdc, unsigned short povd, unsigned short pout,
+					   unsigned long period)
+{
+	if ( !(OVDCON & povd) )
+		return (OVDCON & pout) ? 1.0 : 0.0;
+	return pdc >= period ? 1.0 : (double)pdc / period;
+}
+
+static void encoder_update(void)
+{
+	long long c = motor_counts(&sim_motor);
+	long d = (long)(c - enc_last);
+	long p;
+
+	enc_last = c;
+	if ( QEICONbits.QEIM == 0 || d == 0 )
+		return;
+	p = (long)POSCNT + d;
+	if ( p < 0 || p > 0xffff )
+	{
+		QEICONbits.CNTERR = 1;
+		IFS2bits.QEIIF = 1;
+	}
+	POSCNT = (unsigned short)p;
+}
+
+static void pwm_period(void)
+{
+	unsigned long period;
+
+	// the period that ended ran with sim_volts
+	motor_step(&sim_motor, sim_volts, (double)(sim_cy - pwm_start) / FCY);
+	encoder_update();
+	pwm_start = sim_cy;
+
+	if ( PTCONbits.PTEN )
+	{
+		period = 2UL * (PTPER + 1);
+		if ( !PWMCON2bits.UDIS )
+			sim_volts = sim_motor.vbus * (pin_duty(PDC1, 0x0100, 0x0001, period) -
+										  pin_duty(PDC3, 0x1000, 0x0010, period));
+		if ( ++pwm_post > PTCONbits.PTOPS )
+		{
+			pwm_post = 0;
+			if ( IFS2bits.PWMIF && IEC2bits.PWMIE )
+				sim_pwm_lost++;			// the last one was not taken yet
+			IFS2bits.PWMIF = 1;
+			pwm_if_at = sim_cy;
+		}
+		// the special event trigger in this period starts a conversion
+		if ( ADCON1bits.ADON && ADCON1bits.SSRC == 3 && ++sevt_post > PWMCON2bits.SEVOPS )
+		{
+			sevt_post = 0;
+			next_adc = sim_cy + ((SEVTCMP & 0x8000) ? period - 1 - (SEVTCMP & 0x7fff)
+													 : (SEVTCMP & 0x7fffUL))
+					   + 12UL * ((ADCON3 & 0x3f) + 1) / 2;
+		}
+	}
+	else
+	{
+		period = IDLE_TICK_CY;
+		sim_volts = 0.0;
+	}
+	next_pwm = sim_cy + period;
+	if ( sim_pwm_hook )
+		sim_pwm_hook();
+}
+
+// the conversion the special event trigger started is done
+static void adc_done(void)
+{
+	next_adc = NEVER;
+	if ( ADCON1bits.ADON )
+		IFS0bits.ADIF = 1;
+}
+
+// PTMR with PTDIR in bit 15: up from 0 to PTPER, then back down
+unsigned short sim_ptmr(void)
+{
+	unsigned long long c = sim_cy - pwm_start;
+
+	if ( !PTCONbits.PTEN )
+		return 0;
+	if ( c <= PTPER )
+		return (unsigned short)c;
+	return 0x8000 | (unsigned short)(2UL * (PTPER + 1) - 1 - c);
+}
+
+/*
+ * pc command input
+ */
+static unsigned long long edge_time(void)
+{
+	const struct MOVE *m = &moves[mv_head];
+
+	if ( m->edges == 0 )
+		return mv_start + m->cy;
+	return mv_start + (unsigned long long)(mv_done + 1) * m->cy / labs(m->edges);
+}
+
+static void cmd_edge(void)
+{
+	const struct MOVE *m = &moves[mv_head];
+	unsigned char was, now;
+
+	if ( m->edges )
+	{
+		was = gray[cmd_q];
+		cmd_q = (cmd_q + (m->edges > 0 ? 1 : 3)) & 3;
+		now = gray[cmd_q];
+		PORTD = (PORTD & ~3) | now;
+		if ( ((was ^ now) & 1) && (IC1CON & 7) )
+			IFS0bits.IC1IF = 1;
+		if ( ((was ^ now) & 2) && (IC2CON & 7) )
+			IFS0bits.IC2IF = 1;
+		cmd_pos += m->edges > 0 ? 1 : -1;
+		mv_done++;
+	}
+	if ( mv_done < labs(m->edges) )
+	{
+		next_edge = edge_time();
+		return;
+	}
+	// on to the next move, it starts where this one ends
+	mv_start += m->cy;
+	mv_head = (mv_head + 1) % MOVES;
+	mv_done = 0;
+	next_edge = --mv_n ? edge_time() : NEVER;
+}
+
+/*********************************************************************
+  Function:        void sim_cmd_move(long edges, double secs)
+
+  Overview:        queues a move of the pc command input, edges evenly
+                   spread over secs after the moves queued before it.
+                   Each edge is one count of cmd_posn (times the x
+                   multiplier). A move of 0 edges is a pause.
+********************************************************************/
+void sim_cmd_move(long edges, double secs)
+{
+	struct MOVE *m;
+
+	if ( mv_n == MOVES )
+	{
+		fprintf(stderr, "sim: more than %d moves queued\n", MOVES);
+		exit(2);
+	}
+	m = &moves[(mv_head + mv_n) % MOVES];
+	m->edges = edges;
+	m->cy = (unsigned long long)(secs * FCY + 0.5);
+	if ( mv_n++ == 0 )
+	{
+		mv_start = sim_cy;
+		mv_done = 0;
+		next_edge = edge_time();
+	}
+}
+
+// edges sent so far, up counts positive
+long sim_cmd_pos(void)
+{
+	return cmd_pos;
+}
+
+short sim_cmd_busy(void)
+{
+	return mv_n != 0;
+}
+
+/*
+ * uart
+ */
+// start, data, parity and stop bits of 16 clocks each
+static unsigned long char_cy(void)
+{
+	unsigned long bits = 10;
+
+	if ( U1MODEbits.PDSEL != 0 )
+		bits++;						// 8 bits and parity, or 9 bits
+	bits += U1MODEbits.STSEL;
+	return 16UL * bits * (U1BRG + 1);
+}
+
+// take in what the firmware wrote to the read only / clear only bits
+static void u1sta_read(void)
+{
+	volatile U1STABITS *b = (volatile U1STABITS *)&u1sta;
+
+	if ( rx_oerr && !b->OERR )
+	{
+		rx_oerr = 0;				// clearing OERR empties the fifo
+		rx_n = 0;
+	}
+}
+
+static void u1sta_write(void)
+{
+	volatile U1STABITS *b = (volatile U1STABITS *)&u1sta;
+
+	b->OERR = rx_oerr;
+	b->URXDA = rx_n > 0;
+	b->FERR = 0;
+	b->PERR = 0;
+	b->RIDLE = next_rx == NEVER;
+	b->TRMT = 1;
+	b->UTXBF = 0;
+}
+
+static void out_byte(unsigned char ch)
+{
+	if ( out_len + 2 > out_size )
+	{
+		out_size = out_size ? 2 * out_size : 4096;
+		out = realloc(out, out_size);
+		if ( out == 0 )
+			exit(2);
+	}
+	out[out_len++] = ch;
+	out[out_len] = 0;
+	if ( sim_echo )
+		putchar(ch);
+	if ( sim_tx_hook )
+		sim_tx_hook(ch);
+}
+
+static void tx_flush(void)
+{
+	if ( !tx_pending )
+		return;
+	tx_pending = 0;
+	if ( U1MODEbits.UARTEN && ((volatile U1STABITS *)&u1sta)->UTXEN )
+		out_byte((unsigned char)u1tx);
+}
+
+volatile unsigned short *sim_u1sta(void)
+{
+	tx_flush();
+	u1sta_read();
+	u1sta_write();
+	return &u1sta;
+}
+
+volatile unsigned short *sim_u1txreg(void)
+{
+	tx_flush();
+	tx_pending = 1;
+	return &u1tx;
+}
+
+unsigned short sim_u1rxreg(void)
+{
+	unsigned short ch;
+
+	u1sta_read();
+	ch = rx_fifo[0];
+	if ( rx_n )
+	{
+		memmove(rx_fifo, rx_fifo + 1, --rx_n);
+		u1sta_write();
+	}
+	return ch;
+}
+
+static void rx_byte(void)
+{
+	unsigned char ch = rxq[rxq_pos++];
+
+	u1sta_read();
+	if ( U1MODEbits.UARTEN )
+	{
+		if ( rx_oerr )
+			;						// receiver stopped until OERR is cleared
+		else if ( rx_n < RX_FIFO )
+		{
+			rx_fifo[rx_n++] = ch;
+			if ( sim_rx_hook )
+				sim_rx_hook(ch);
+		}
+		else
+			rx_oerr = 1;
+		IFS0bits.U1RXIF = 1;
+	}
+	if ( rxq_pos < rxq_len )
+		next_rx = sim_cy + char_cy();
+	else
+	{
+		rxq_len = rxq_pos = 0;
+		next_rx = NEVER;
+	}
+	u1sta_write();
+}
+
+// a byte straight into the uart rx fifo, for a tool that takes the rx
+// interrupt itself (sim_isr). 0 if the fifo is full.
+int sim_rx_put(unsigned char ch)
+{
+	if ( rx_n >= RX_FIFO )
+		return 0;
+	rx_fifo[rx_n++] = ch;
+	IFS0bits.U1RXIF = 1;
+	u1sta_write();
+	return 1;
+}
+
+// queue bytes for the console, they arrive back to back at the baud rate
+void sim_send(const char *s)
+{
+	sim_send_bytes((const unsigned char *)s, strlen(s));
+}
+
+// the same for binary data (modbus frames)
+void sim_send_bytes(const unsigned char *s, size_t n)
+{
+	if ( rxq_len + n > rxq_size )
+	{
+		rxq_size = rxq_len + n + 256;
+		rxq = realloc(rxq, rxq_size);
+		if ( rxq == 0 )
+			exit(2);
+	}
+	memcpy(rxq + rxq_len, s, n);
+	rxq_len += n;
+	if ( next_rx == NEVER && n )
+		next_rx = sim_cy + char_cy();
+}
+
+// everything the firmware sent since the last sim_clear()
+const char *sim_output(void)
+{
+	tx_flush();
+	return out ? out : "";
+}
+
+void sim_clear(void)
+{
+	tx_flush();
+	out_len = 0;
+	if ( out )
+		out[0] = 0;
+}
+
+/*
+ * firmware console output, what printf() and putchar() do with XC16
+ */
+int sim_printf(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if ( n > (int)sizeof(buf) - 1 )
+		n = sizeof(buf) - 1;
+	if ( n > 0 )
+		sim_fw_write(1, buf, n);
+	return n;
+}
+
+int sim_putchar(int ch)
+{
+	unsigned char c = ch;
+
+	sim_fw_write(1, &c, 1);
+	return ch;
+}
+
+int sim_fputs(const char *s, FILE *f)
+{
+	(void)f;
+	return sim_fw_write(1, (void *)s, strlen(s));
+}
+
+/*
+ * data eeprom, the _EEDATA variables themselves
+ */
+extern char __start_sim_eedata[], __stop_sim_eedata[];
+
+unsigned short sim_ee_offset(const volatile void *p)
+{
+	return (unsigned short)((const volatile char *)p - __start_sim_eedata);
+}
+
+static char *ee_addr(int offset, int words)
+{
+	if ( offset < 0 || __start_sim_eedata + offset + words * 2 > __stop_sim_eedata )
+	{
+		fprintf(stderr, "sim: eeprom access at %d outside the eeprom data\n", offset);
+		exit(2);
+	}
+	return __start_sim_eedata + offset;
+}
+
+int ReadEE(int Page, int Offset, short *DataOut, int Size)
+{
+	(void)Page;
+	if ( Size != WORD && Size != ROW )
+		return ERROREE;
+	memcpy(DataOut, ee_addr(Offset, Size), Size * 2);
+	return 0;
+}
+
+int EraseEE(int Page, int Offset, int Size)
+{
+	(void)Page;
+	if ( Size == ALL_EEPROM )
+		memset(__start_sim_eedata, 0xff, __stop_sim_eedata - __start_sim_eedata);
+	else if ( Size == WORD || Size == ROW )
+		memset(ee_addr(Offset, Size), 0xff, Size * 2);
+	else
+		return ERROREE;
+	if ( !in_isr )
+		spend(EE_WRITE_CY);
+	return 0;
+}
+
+int WriteEE(short *DataIn, int Page, int Offset, int Size)
+{
+	(void)Page;
+	if ( Size != WORD && Size != ROW )
+		return ERROREE;
+	memcpy(ee_addr(Offset, Size), DataIn, Size * 2);
+	if ( !in_isr )
+		spend(EE_WRITE_CY);
+	return 0;
+}
+
+int sim_ee_load(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	size_t n = __stop_sim_eedata - __start_sim_eedata;
+
+	if ( f == 0 )
+		return -1;
+	n = fread(__start_sim_eedata, 1, n, f) == n ? 0 : -1;
+	fclose(f);
+	return (int)n;
+}
+
+int sim_ee_save(const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	size_t n = __stop_sim_eedata - __start_sim_eedata;
+	int res;
+
+	if ( f == 0 )
+		return -1;
+	res = fwrite(__start_sim_eedata, 1, n, f) == n ? 0 : -1;
+	if ( fclose(f) )
+		res = -1;
+	return res;
+}
+
+/*
+ * time
+ */
+static unsigned long long next_event(void)
+{
+	unsigned long long t = next_pwm, n;
+	short i;
+
+	if ( next_edge < t )
+		t = next_edge;
+	if ( next_rx < t )
+		t = next_rx;
+	if ( next_adc < t )
+		t = next_adc;
+	for ( i = 0; i < 3; i++ )
+	{
+		n = timer_next(&timers[i]);
+		if ( n != NEVER && sim_cy + n < t )
+			t = sim_cy + n;
+	}
+	return t;
+}
+
+static void advance(unsigned long long to)
+{
+	unsigned long long t;
+	short i;
+
+	while ( sim_cy < to )
+	{
+		t = next_event();
+		if ( t > to )
+			t = to;
+		for ( i = 0; i < 3; i++ )
+			timer_run(&timers[i], t - sim_cy);
+		sim_cy = t;
+		if ( t == next_pwm )
+			pwm_period();
+		if ( t == next_edge )
+			cmd_edge();
+		if ( t == next_rx )
+			rx_byte();
+		if ( t == next_adc )
+			adc_done();
+		dispatch();
+	}
+}
+
+// back to the tool, sim_run() carries on from here
+static void yield(void)
+{
+	tx_flush();
+	swapcontext(&fw_ctx, &tool_ctx);
+}
+
+// the background uses cy Tcy, stopping for the tool on the way
+static void spend(unsigned long long cy)
+{
+	unsigned long long to = sim_cy + cy;
+
+	for ( ;; )
+	{
+		advance(to < stop_cy ? to : stop_cy);
+		if ( sim_cy >= to )
+			break;
+		yield();
+	}
+	if ( sim_cy >= stop_cy )
+		yield();
+}
+
+volatile unsigned short *sim_tmr(volatile unsigned short *reg)
+{
+	if ( !in_isr )
+	{
+		spend(READ_CY + nop_debt);
+		nop_debt = 0;
+		idle_armed = 1;
+	}
+	return reg;
+}
+
+void sim_nop(void)
+{
+	if ( in_isr )
+		return;
+	if ( !idle_armed )
+	{
+		nop_debt++;
+		return;
+	}
+	idle_armed = 0;
+	nop_debt = 0;
+	spend(next_event() - sim_cy);
+}
+
+// the U1 command, the firmware can not be restarted in the same process
+void sim_reset(void)
+{
+	fw_state = SIM_RESET;
+	for ( ;; )
+		yield();
+}
+
+static void fw_entry(void)
+{
+	fw_main();
+	fprintf(stderr, "sim: main() returned\n");
+	fw_state = SIM_RESET;
+}
+
+/*********************************************************************
+  Function:        void sim_start(void)
+
+  Overview:        powers up the card with the motor at rest (sim_motor
+                   may be changed before the first sim_run()). Load an
+                   eeprom image before this if there is one.
+********************************************************************/
+void sim_start(void)
+{
+	motor_init(&sim_motor);
+	next_pwm = IDLE_TICK_CY;
+	next_edge = NEVER;
+	next_rx = NEVER;
+	next_adc = NEVER;
+	getcontext(&fw_ctx);
+	fw_ctx.uc_stack.ss_sp = malloc(FW_STACK);
+	fw_ctx.uc_stack.ss_size = FW_STACK;
+	fw_ctx.uc_link = &tool_ctx;
+	if ( fw_ctx.uc_stack.ss_sp == 0 )
+		exit(2);
+	makecontext(&fw_ctx, fw_entry, 0);
+	fw_state = SIM_RUN;
+}
+
+/*********************************************************************
+  Function:        short sim_run(double t)
+
+  Overview:        runs the firmware until t seconds after power up
+
+  Output:          SIM_RUN, or SIM_RESET once the firmware has reset
+********************************************************************/
+short sim_run(double t)
+{
+	if ( fw_state != SIM_RUN )
+		return fw_state;
+	stop_cy = (unsigned long long)(t * FCY + 0.5);
+	swapcontext(&tool_ctx, &fw_ctx);
+	return fw_state;
+}
+
+double sim_time(void)
+{
+	return (double)sim_cy / FCY;
+}
+
+void sim_amp_fault(short on)
+{
+	PORTEbits.RE8 = !on;
+}
+
+// a spike on the pc command input: an IC1 edge with the pins unchanged
+void sim_cmd_spike(void)
+{
+	if ( IC1CON & 7 )
+		IFS0bits.IC1IF = 1;
+}
+
+// a qei count error: CNTERR without the count wrapping
+void sim_qei_error(void)
+{
+	if ( QEICONbits.QEIM == 0 )
+		return;
+	QEICONbits.CNTERR = 1;
+	IFS2bits.QEIIF = 1;
+}
+
+/*********************************************************************
+  Function:        void sim_tb_warp(unsigned long ticks)
+
+  Overview:        moves the firmware's timebase (timer 1 and the count
+                   of its wraps) on by ticks TB_HZ counts, as if the card
+                   had been idle that long. Let the firmware run between
+                   warps of more than a task period, a deadline further
+                   back than 2^31 counts looks like one in the future.
+********************************************************************/
+void sim_tb_warp(unsigned long ticks)
+{
+	unsigned long lo = sim_TMR1 + (ticks & 0xffff);
+
+	for ( ticks >>= 16; ticks > 0; ticks-- )
+		sim_isr(_T1Interrupt);
+	sim_TMR1 = (unsigned short)lo;
+	if ( lo > 0xffff )
+		sim_isr(_T1Interrupt);
+}
@@ -0,0 +1,62 @@
+//---------------------------------------------------------------------
+//	File:		sim.h
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Host simulation of the servo card: the firmware, built
+//          against the register model in xc.h, runs closed loop with
+//          the motor model of motor.c. See sim.c.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#ifndef SIM_H
+#define SIM_H
+
+#include <stddef.h>
+#include "motor.h"
+
+// sim_run() results
+#define SIM_RUN			0		// got to the requested time
+#define SIM_RESET		1		// the firmware reset itself (U1), it can not go on
+
+extern struct MOTOR sim_motor;			// the plant, params may be changed any time
+extern unsigned long long sim_cy;		// Tcy since power up
+extern double sim_volts;				// drive in the last pwm period
+extern short sim_echo;					// copy console output to stdout
+extern void (*sim_pwm_hook)(void);		// called after every pwm period
+extern void (*sim_rx_hook)(unsigned char ch);	// a byte went into the uart rx fifo
+extern void (*sim_tx_hook)(unsigned char ch);	// the uart sent a byte
+extern unsigned long sim_pwm_late;		// most Tcy a pwm interrupt waited, tools may clear it
+extern unsigned long sim_pwm_lost;		// pwm interrupts that came with the last one pending
+
+void sim_start(void);
+short sim_run(double t);
+double sim_time(void);
+
+// console
+void sim_send(const char *s);
+void sim_send_bytes(const unsigned char *s, size_t n);
+int sim_rx_put(unsigned char ch);
+const char *sim_output(void);
+void sim_clear(void);
+
+// pc quadrature command input
+void sim_cmd_move(long edges, double secs);
+long sim_cmd_pos(void);
+short sim_cmd_busy(void);
+
+void sim_amp_fault(short on);
+void sim_cmd_spike(void);
+void sim_qei_error(void);
+void sim_isr(void (*isr)(void));
+void sim_tb_warp(unsigned long ticks);
+
+// data eeprom image
+int sim_ee_load(const char *path);
+int sim_ee_save(const char *path);
+
+#endif
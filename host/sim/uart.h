@@ -0,0 +1,32 @@
+//---------------------------------------------------------------------
+//	File:		uart.h
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: The uart configuration masks of the XC16 peripheral library
+//          that serial.c uses, for the host simulation.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#ifndef SIM_UART_H
+#define SIM_UART_H
+
+// U1MODE
+#define UART_EN				0xffff
+#define UART_IDLE_CON		0xdfff
+#define UART_DIS_WAKE		0xff7f
+#define UART_DIS_LOOPBACK	0xffbf
+#define UART_DIS_ABAUD		0xffdf
+#define UART_NO_PAR_8BIT	0xfff9
+#define UART_1STOPBIT		0xfffe
+#define UART_ALTRX_ALTTX	0xffff
+
+// U1STA
+#define UART_TX_ENABLE		0xffff
+#define UART_TX_PIN_NORMAL	0xf7ff
+
+#endif
@@ -0,0 +1,198 @@
+//---------------------------------------------------------------------
+//	File:		xc.h
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Host stand in for the XC16 <xc.h> of the 30f4012, used when
+//          the firmware is built for the simulation (see sim.c). Only
+//          the registers and bits the firmware uses are here, with the
+//          same layout as the part.
+//
+//          It is force included ahead of every firmware file, which are
+//          compiled with SIM_FIRMWARE defined. Besides the registers it
+//             - routes printf, putchar and fputs to serial.c's write()
+//               (renamed sim_fw_write so it does not replace the libc one)
+//             - turns the interrupt/psv/persistent attributes into
+//               unused and places _EEDATA variables in the sim_eedata
+//               section, which is the simulated data eeprom
+//             - makes the cpu priority macros and Nop() calls into sim.c
+//
+//          Registers with side effects are accessed through functions:
+//          reading a timer is where simulated time passes, U1STA gets
+//          its read only bits from the uart model, U1RXREG pops the rx
+//          fifo and U1TXREG sends. The rest are plain variables.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- PTMR read from the sim, adc for the special event trigger
+//----------------------------------------------------------------------
+#ifndef SIM_XC_H
+#define SIM_XC_H
+
+// everything the firmware includes, before the macros below
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+
+#ifdef SIM_FIRMWARE
+#define __interrupt__	__unused__
+#define auto_psv		__unused__
+#define no_auto_psv		__unused__
+#define shadow			__unused__
+#define persistent		__unused__
+#define address(a)		__unused__
+#define _EEDATA(n)		__attribute__((aligned(n), section("sim_eedata")))
+#define _FOSC(x)
+#define _FWDT(x)
+#define _FBORPOR(x)
+#define asm(x)
+
+// console output goes through the firmware's write()
+#define printf		sim_printf
+#define putchar		sim_putchar
+#define fputs		sim_fputs
+#define write		sim_fw_write
+#endif
+
+#define __builtin_tblpage(p)	0
+#define __builtin_tbloffset(p)	sim_ee_offset(p)
+unsigned short sim_ee_offset(const volatile void *p);
+int sim_printf(const char *fmt, ...) __attribute__((format(__printf__, 1, 2)));
+int sim_putchar(int ch);
+int sim_fputs(const char *s, FILE *f);
+int sim_fw_write(int handle, void *buffer, unsigned int len);
+
+// cpu
+typedef struct { unsigned short C:1, Z:1, OV:1, N:1, RA:1, IPL:3, :8; } SRBITS;
+extern volatile SRBITS SRbits;
+void sim_ipl(short ipl);
+void sim_nop(void);
+void sim_reset(void);
+#define SET_CPU_IPL(x)				sim_ipl(x)
+#define SET_AND_SAVE_CPU_IPL(s, x)	do { (s) = SRbits.IPL; sim_ipl(x); } while (0)
+#define RESTORE_CPU_IPL(s)			sim_ipl(s)
+#define Nop()						sim_nop()
+#define SOFT_RESET()				sim_reset()
+
+#define SIM_BITS(t, r)	(*(volatile t *)&(r))
+#define SIM_BIT(r, n)	(((volatile SIM_BITS16 *)&(r))->b##n)
+typedef struct { unsigned short b0:1, b1:1, b2:1, b3:1, b4:1, b5:1, b6:1, b7:1,
+				 b8:1, b9:1, b10:1, b11:1, b12:1, b13:1, b14:1, b15:1; } SIM_BITS16;
+
+// interrupt controller
+extern volatile unsigned short IFS0, IFS2, IEC0, IEC2, IPC0, IPC1, IPC2, IPC9, IPC10;
+typedef struct { unsigned short INT0IF:1, IC1IF:1, OC1IF:1, T1IF:1, IC2IF:1, OC2IF:1, T2IF:1,
+				 T3IF:1, SPI1IF:1, U1RXIF:1, U1TXIF:1, ADIF:1, NVMIF:1, SI2CIF:1, MI2CIF:1, CNIF:1; } IFS0BITS;
+typedef struct { unsigned short INT0IE:1, IC1IE:1, OC1IE:1, T1IE:1, IC2IE:1, OC2IE:1, T2IE:1,
+				 T3IE:1, SPI1IE:1, U1RXIE:1, U1TXIE:1, ADIE:1, NVMIE:1, SI2CIE:1, MI2CIE:1, CNIE:1; } IEC0BITS;
+typedef struct { unsigned short :7, PWMIF:1, QEIIF:1, :2, FLTAIF:1, :4; } IFS2BITS;
+typedef struct { unsigned short :7, PWMIE:1, QEIIE:1, :2, FLTAIE:1, :4; } IEC2BITS;
+typedef struct { unsigned short INT0IP:3, :1, IC1IP:3, :1, OC1IP:3, :1, T1IP:3, :1; } IPC0BITS;
+typedef struct { unsigned short IC2IP:3, :1, OC2IP:3, :1, T2IP:3, :1, T3IP:3, :1; } IPC1BITS;
+typedef struct { unsigned short SPI1IP:3, :1, U1RXIP:3, :1, U1TXIP:3, :1, ADIP:3, :1; } IPC2BITS;
+typedef struct { unsigned short :4, PWMIP:3, :9; } IPC9BITS;
+typedef struct { unsigned short QEIIP:3, :5, FLTAIP:3, :5; } IPC10BITS;
+#define IFS0bits	SIM_BITS(IFS0BITS, IFS0)
+#define IEC0bits	SIM_BITS(IEC0BITS, IEC0)
+#define IFS2bits	SIM_BITS(IFS2BITS, IFS2)
+#define IEC2bits	SIM_BITS(IEC2BITS, IEC2)
+#define IPC0bits	SIM_BITS(IPC0BITS, IPC0)
+#define IPC1bits	SIM_BITS(IPC1BITS, IPC1)
+#define IPC2bits	SIM_BITS(IPC2BITS, IPC2)
+#define IPC9bits	SIM_BITS(IPC9BITS, IPC9)
+#define IPC10bits	SIM_BITS(IPC10BITS, IPC10)
+
+// motor control pwm
+extern volatile unsigned short PTCON, PTPER, SEVTCMP, PWMCON1, PWMCON2, DTCON1,
+	FLTACON, OVDCON, PDC1, PDC2, PDC3;
+unsigned short sim_ptmr(void);
+typedef struct { unsigned short PTMOD:2, PTCKPS:2, PTOPS:4, :5, PTSIDL:1, :1, PTEN:1; } PTCONBITS;
+typedef struct { unsigned short UDIS:1, OSYNC:1, :6, SEVOPS:4, :4; } PWMCON2BITS;
+#define PTCONbits	SIM_BITS(PTCONBITS, PTCON)
+#define PWMCON2bits	SIM_BITS(PWMCON2BITS, PWMCON2)
+#define PTMR		(sim_ptmr())
+
+// adc, only its interrupt after a special event triggered conversion
+extern volatile unsigned short ADCON1, ADCON2, ADCON3, ADCHS, ADCBUF0;
+typedef struct { unsigned short DONE:1, SAMP:1, ASAM:1, SIMSAM:1, :1, SSRC:3, FORM:2, :3,
+				 ADSIDL:1, :1, ADON:1; } ADCON1BITS;
+#define ADCON1bits	SIM_BITS(ADCON1BITS, ADCON1)
+
+// quadrature encoder
+extern volatile unsigned short POSCNT, MAXCNT, QEICON, DFLTCON;
+typedef struct { unsigned short UPDN_SRC:1, TQCS:1, POSRES:1, TQCKPS:2, TQGATE:1, PCDOUT:1,
+				 SWPAB:1, QEIM:3, UPDN:1, INDX:1, :1, QEISIDL:1, CNTERR:1; } QEICONBITS;
+typedef struct { unsigned short :4, QECK:3, QEOUT:1, CEID:1, IMV:2, :5; } DFLTCONBITS;
+#define QEICONbits	SIM_BITS(QEICONBITS, QEICON)
+#define DFLTCONbits	SIM_BITS(DFLTCONBITS, DFLTCON)
+
+// ports
+extern volatile unsigned short ADPCFG, TRISB, TRISC, TRISD, TRISE, TRISF, PORTD, PORTE, LATB, LATE;
+typedef struct { unsigned short PCFG0:1, :15; } ADPCFGBITS;
+typedef struct { unsigned short RE0:1, RE1:1, RE2:1, RE3:1, RE4:1, RE5:1, :2, RE8:1, :7; } PORTEBITS;
+#define ADPCFGbits	SIM_BITS(ADPCFGBITS, ADPCFG)
+#define PORTEbits	SIM_BITS(PORTEBITS, PORTE)
+#define _TRISB0		SIM_BIT(TRISB, 0)
+#define _TRISB1		SIM_BIT(TRISB, 1)
+#define _TRISB2		SIM_BIT(TRISB, 2)
+#define _TRISB3		SIM_BIT(TRISB, 3)
+#define _TRISB4		SIM_BIT(TRISB, 4)
+#define _TRISB5		SIM_BIT(TRISB, 5)
+#define _TRISC13	SIM_BIT(TRISC, 13)
+#define _TRISC14	SIM_BIT(TRISC, 14)
+#define _TRISC15	SIM_BIT(TRISC, 15)
+#define _TRISD0		SIM_BIT(TRISD, 0)
+#define _TRISD1		SIM_BIT(TRISD, 1)
+#define _TRISE0		SIM_BIT(TRISE, 0)
+#define _TRISE1		SIM_BIT(TRISE, 1)
+#define _TRISE2		SIM_BIT(TRISE, 2)
+#define _TRISE3		SIM_BIT(TRISE, 3)
+#define _TRISE4		SIM_BIT(TRISE, 4)
+#define _TRISE5		SIM_BIT(TRISE, 5)
+#define _TRISE8		SIM_BIT(TRISE, 8)
+#define _TRISF2		SIM_BIT(TRISF, 2)
+#define _TRISF3		SIM_BIT(TRISF, 3)
+#define _LATB1		SIM_BIT(LATB, 1)
+#define _LATB2		SIM_BIT(LATB, 2)
+#define _LATB3		SIM_BIT(LATB, 3)
+#define _LATE1		SIM_BIT(LATE, 1)
+
+// timers, TMRx reads and writes let simulated time pass
+extern volatile unsigned short T1CON, T2CON, T3CON, PR1, PR2, PR3;
+extern volatile unsigned short sim_TMR1, sim_TMR2, sim_TMR3;
+volatile unsigned short *sim_tmr(volatile unsigned short *reg);
+typedef struct { unsigned short :1, TCS:1, TSYNC:1, T32:1, TCKPS:2, TGATE:1, :6, TSIDL:1, :1, TON:1; } TCONBITS;
+#define T1CONbits	SIM_BITS(TCONBITS, T1CON)
+#define T2CONbits	SIM_BITS(TCONBITS, T2CON)
+#define T3CONbits	SIM_BITS(TCONBITS, T3CON)
+#define TMR1		(*sim_tmr(&sim_TMR1))
+#define TMR2		(*sim_tmr(&sim_TMR2))
+#define TMR3		(*sim_tmr(&sim_TMR3))
+
+// input capture
+extern volatile unsigned short IC1CON, IC2CON, IC1BUF, IC2BUF;
+typedef struct { unsigned short ICM:3, ICBNE:1, ICOV:1, ICI:2, ICTMR:1, :5, ICSIDL:1, :2; } ICCONBITS;
+#define IC1CONbits	SIM_BITS(ICCONBITS, IC1CON)
+#define IC2CONbits	SIM_BITS(ICCONBITS, IC2CON)
+
+// uart 1
+extern volatile unsigned short U1MODE, U1BRG;
+volatile unsigned short *sim_u1sta(void);
+volatile unsigned short *sim_u1txreg(void);
+unsigned short sim_u1rxreg(void);
+typedef struct { unsigned short STSEL:1, PDSEL:2, :2, ABAUD:1, LPBACK:1, WAKE:1, :2, ALTIO:1,
+				 :2, USIDL:1, :1, UARTEN:1; } U1MODEBITS;
+typedef struct { unsigned short URXDA:1, OERR:1, FERR:1, PERR:1, RIDLE:1, ADDEN:1, URXISEL:2,
+				 TRMT:1, UTXBF:1, UTXEN:1, UTXBRK:1, :3, UTXISEL:1; } U1STABITS;
+#define U1MODEbits	SIM_BITS(U1MODEBITS, U1MODE)
+#define U1STA		(*sim_u1sta())
+#define U1STAbits	(*(volatile U1STABITS *)sim_u1sta())
+#define U1TXREG		(*sim_u1txreg())
+#define U1RXREG		(sim_u1rxreg())
+
+#endif
@@ -0,0 +1,184 @@
+//---------------------------------------------------------------------
+//	File:		ident.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Excitation for plant identification (host/plantfit). While
+//          it runs the pwm isr adds a pseudo random binary sequence of
+//          +-amp to the pid output, and every few servo cycles hands a
+//          sample to the background, which streams it on the console:
+//
+//             # ident <amp>% every <n> cycles of <us>us, pdcmax <count>
+//             CCCCFFFFDDDD          one line per sample, hex
+//             ...
+//             # ident end, <n> samples lost
+//
+//          CCCC and FFFF are the low 16 bits of pid.command and
+//          pid.feedback at the end of the sample, DDDD the drive duty
+//          averaged over it (+PDC1 or -PDC3, pdcmax is 100%). The prbs
+//          bit is held for a whole sample. A line is 14 chars, at
+//          115200 baud keep the sample rate under 800/s.
+//
+//          The servo loop keeps running, with its gains set to 0 the
+//          axis is open loop; it then wanders off, so turn the following
+//          error check off for the run (a14). A fault or disabling the
+//          servo ends it.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- ring of 8 samples, the ram is short
+//----------------------------------------------------------------------
+#include <xc.h>
+#include "dspicservo.h"
+#include <stdio.h>
+
+#define ID_RING		8			// samples between the isr and ident_task(), 10ms at 800/s
+#define ID_LFSR		0x6000		// x^15 + x^14 + 1, period 32767
+
+struct IDSAMPLE{
+	unsigned short command;
+	unsigned short feedback;
+	short duty;
+};
+
+extern struct PID pid;
+extern struct COF cof;
+extern struct PWMTIMING pwm_timing;
+
+static struct IDSAMPLE id_ring[ID_RING];
+static volatile unsigned short id_head, id_tail;
+static volatile short id_on;		// isr is exciting and sampling
+static volatile short id_end;		// isr stopped, ident_task() prints the end
+static unsigned short id_lfsr = 1;
+static float id_out;				// +- this is added to pid.output
+static short id_every, id_n;
+static long id_sum;					// duty over the sample so far
+static unsigned short id_lost;		// ring was full
+
+/*********************************************************************
+  Function:        float ident_excite(void)
+
+  PreCondition:    called from the pwm isr once per servo cycle after
+                   calc_pid()
+
+  Output:          what to add to pid.output this cycle
+********************************************************************/
+float ident_excite(void)
+{
+	if ( !id_on )
+		return 0.0;
+	if ( cof.fault || !pid.enable )
+	{
+		id_on = 0;
+		id_end = 1;
+		return 0.0;
+	}
+	return (id_lfsr & 1) ? id_out : -id_out;
+}
+
+/*********************************************************************
+  Function:        void ident_record(short duty)
+
+  PreCondition:    called from the pwm isr once per servo cycle after
+                   the duty was set
+
+  Input:           duty - drive applied this cycle, +PDC1 or -PDC3
+********************************************************************/
+void ident_record(short duty)
+{
+	struct IDSAMPLE *s;
+	unsigned short next;
+
+	if ( !id_on )
+		return;
+	id_sum += duty;
+	if ( ++id_n < id_every )
+		return;
+	next = (id_head + 1) % ID_RING;
+	if ( next == id_tail )
+		id_lost++;
+	else
+	{
+		s = &id_ring[id_head];
+		s->command = (unsigned short)pid.command;
+		s->feedback = (unsigned short)pid.feedback;
+		s->duty = (short)(id_sum / id_every);
+		id_head = next;
+	}
+	id_n = 0;
+	id_sum = 0;
+	// next bit of the prbs, held for the coming sample
+	id_lfsr = (id_lfsr >> 1) ^ ((id_lfsr & 1) ? ID_LFSR : 0);
+}
+
+/*********************************************************************
+  Function:        void ident_start(float amp, short every)
+
+  Input:           amp   - prbs level in % of full duty, 0 stops
+                   every - servo cycles per sample
+********************************************************************/
+void ident_start(float amp, short every)
+{
+	if ( amp < 0.0 )
+		amp = -amp;
+	if ( amp > 100.0 )
+		amp = 100.0;
+	if ( every < 1 )
+		every = 1;
+	if ( amp == 0.0 )
+	{
+		if ( id_on )
+		{
+			id_on = 0;
+			id_end = 1;
+		}
+		return;
+	}
+	id_on = 0;						// the isr leaves everything alone now
+	id_out = amp * pid.maxerror / 100.0;
+	id_every = every;
+	id_n = 0;
+	id_sum = 0;
+	id_lost = 0;
+	id_head = id_tail = 0;
+	id_end = 0;
+	printf("\r\n# ident ");
+	fx_print(amp, 1);
+	printf("%% every %d cycles of ", every);
+	fx_print(pwm_timing.periodfp * 1.0e6, 1);
+	printf("us, pdcmax %u\r\n", pwm_timing.pdcmax);
+	id_on = 1;
+}
+
+/*********************************************************************
+  Function:        short ident_task(void)
+
+  Overview:        background task, prints the samples the isr queued
+********************************************************************/
+short ident_task(void)
+{
+	struct IDSAMPLE s;
+	short n = 0;
+
+	while ( id_tail != id_head )
+	{
+		s = id_ring[id_tail];
+		id_tail = (id_tail + 1) % ID_RING;
+		bus_open(tb_now());
+		printf("%04X%04X%04X\r\n", s.command, s.feedback, (unsigned short)s.duty);
+		bus_close();
+		n++;
+	}
+	if ( id_end && !id_on )
+	{
+		id_end = 0;
+		bus_open(tb_now());
+		printf("# ident end, %u samples lost\r\n", id_lost);
+		bus_close();
+		n++;
+	}
+	return n != 0;
+}
@@ -0,0 +1,188 @@
+//---------------------------------------------------------------------
+//	File:		load.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: CPU load monitor. Whenever the background loop has nothing
+//          to do it calls cpu_idle(), which burns a fixed block of
+//          cycles and counts it. At powerup the same block is run with
+//          interrupts masked to find how many blocks fit in a second;
+//          the count actually reached each second gives the idle time.
+//          Time spent in isr's is measured by the profiler (profile.c)
+//          and whatever is left was used by main loop work.
+//
+//          All loads are kept in 0.1% units.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- telemetry lines from their own timer, synced again by
+//                every broadcast so the bus slots follow the master
+// Oct 19 2026 -- no telemetry line in modbus mode
+//----------------------------------------------------------------------
+#include <xc.h>
+#include "dspicservo.h"
+#include <stdio.h>
+
+#define IDLE_SPIN		64		// nops per idle block (~10us at 24 MIPS)
+#define LOAD_CAL_DIV	50		// calibrate for 1/50 sec
+#define LOAD_HIST		10		// seconds of history for the peak load
+
+#ifdef ISR_PROFILE
+extern volatile unsigned long prof_isr_cy;
+#endif
+extern short mb_on;
+
+static unsigned long idle_count;	// idle blocks run this second
+static unsigned long idle_base;		// idle blocks per second on an idle cpu
+static struct SWTIMER load_timer;	// closes the window once a second
+static struct SWTIMER telem_timer;	// telemetry line, in our bus slot
+static short load_hist[LOAD_HIST];	// total load for the last few seconds
+static short load_pos;
+
+short load_total;			// cpu used (isr + main loop)
+short load_isr;				// cpu used by isr's
+short load_main;			// cpu used by the main loop
+short load_peak;			// highest total over the last LOAD_HIST secs
+short load_telemetry;		// print a load line every second
+
+void print_load(void);
+static void load_update(void);
+static void load_telem(void);
+
+/*********************************************************************
+  Function:        void cpu_idle(void)
+
+  Overview:        call from every place the background loop waits
+********************************************************************/
+void cpu_idle(void)
+{
+	short i;
+
+	for ( i = IDLE_SPIN; i; i-- )
+		Nop();
+	idle_count++;
+}
+
+/*********************************************************************
+  Function:        void calibrate_load(void)
+
+  PreCondition:    timer 2 running (setup_profile), servo not running
+
+  Overview:        runs idle blocks for 20ms with all interrupts masked
+                   to find the idle blocks/sec of an unloaded cpu
+********************************************************************/
+void calibrate_load(void)
+{
+	unsigned long cy = 0;
+	unsigned long n = 0;
+	unsigned short t, last;
+	int ipl;
+
+	SET_AND_SAVE_CPU_IPL(ipl, 7);
+	last = TMR2;
+	while ( cy < FCY / LOAD_CAL_DIV )
+	{
+		cpu_idle();
+		t = TMR2;
+		cy += (unsigned short)(t - last);
+		last = t;
+		n++;
+	}
+	RESTORE_CPU_IPL(ipl);
+
+	idle_base = n * (FCY / 1000) / (cy / 1000);
+	idle_count = 0;
+	swt_start(&load_timer, TB_HZ, TB_HZ, load_update);
+}
+
+/*********************************************************************
+  Function:        static void load_update(void)
+
+  Overview:        software timer callback, closes the measurement
+                   window once a second
+********************************************************************/
+static void load_update(void)
+{
+	unsigned long idle;
+	unsigned long isr_cy = 0;
+	short idle10, i;
+
+	idle = idle_count;
+	idle_count = 0;
+#ifdef ISR_PROFILE
+	{
+		int ipl;
+		SET_AND_SAVE_CPU_IPL(ipl, 7);
+		isr_cy = prof_isr_cy;
+		prof_isr_cy = 0;
+		RESTORE_CPU_IPL(ipl);
+	}
+#endif
+
+	idle10 = 1000;
+	if ( idle_base >= 1000 && idle < idle_base )
+		idle10 = (short)(idle / (idle_base / 1000));
+	load_total = 1000 - idle10;
+	load_isr = (short)(isr_cy / (FCY / 1000));
+	if ( load_isr > load_total )
+		load_isr = load_total;
+	load_main = load_total - load_isr;
+
+	load_hist[load_pos] = load_total;
+	if ( ++load_pos >= LOAD_HIST )
+		load_pos = 0;
+	load_peak = 0;
+	for ( i = 0; i < LOAD_HIST; i++ )
+		if ( load_hist[i] > load_peak )
+			load_peak = load_hist[i];
+}
+
+// software timer callback, the telemetry line of the last window
+static void load_telem(void)
+{
+	if ( mb_on )
+		return;				// the line is for rtu frames now
+	bus_open(tb_now());		// we are in our slot, see load_sync()
+	print_load();
+	bus_close();
+}
+
+/*********************************************************************
+  Function:        void load_sync(unsigned long delay)
+
+  Overview:        the next telemetry line comes out one second plus
+                   delay from now, then one a second; none if telemetry
+                   is off. Cards on a bus use their slot as delay and
+                   are synced by every broadcast, not only the one that
+                   starts telemetry: their crystals are 100ppm or more
+                   apart, so slots timed from one sync would drift into
+                   each other within a minute. The master sends a
+                   broadcast ("@* c") once a period to keep them apart.
+********************************************************************/
+void load_sync(unsigned long delay)
+{
+	if ( load_telemetry )
+		swt_start(&telem_timer, TB_HZ + delay, TB_HZ, load_telem);
+	else
+		swt_stop(&telem_timer);
+}
+
+/*********************************************************************
+  Function:        void print_load(void)
+
+  Overview:        c command and telemetry line
+********************************************************************/
+void print_load(void)
+{
+#ifdef ISR_PROFILE
+	printf("\rload %d.%d%% isr %d.%d%% main %d.%d%% peak %d.%d%%\r\n",
+		load_total / 10, load_total % 10, load_isr / 10, load_isr % 10,
+		load_main / 10, load_main % 10, load_peak / 10, load_peak % 10);
+#else
+	printf("\rload %d.%d%% peak %d.%d%%\r\n",
+		load_total / 10, load_total % 10, load_peak / 10, load_peak % 10);
+#endif
+}
@@ -10,13 +10,32 @@
 //
 //		main.c		    -- Main source code file
 //		capture.c		-- interface to pc quadrature cmd inputs using IC1 and IC2
-//      timer1.c        -- timer 1 setup for 100us intervals
-//      serial.c        -- interface to pc serial port for tuning - 9600n81
+//      timer1.c        -- timer 1 free running timebase and software timers
+//      serial.c        -- interface to pc serial port for tuning - 115200n81, rx line queue
 //      encoder.c       -- interface to quadature encoder
 //		pwm.c			-- pwn ch for motor current control
+//		pwmtiming.c		-- pwm period/servo rate calculations
+//		profile.c		-- isr execution time profiler (uses timer 2)
+//		load.c			-- cpu load monitor
+//		sched.c			-- cooperative scheduler for the background tasks
+//		busframe.c		-- node addressing for several cards on one rs-485 line
+//		mbrtu.c			-- modbus rtu slave protocol
+//		modbus.c		-- modbus register map and frame timing (uses timer 3)
+//		fault.c			-- fault supervisor run in the pwm isr
+//		flight.c		-- fault flight recorder saved to eeprom
+//		ident.c			-- prbs excitation and sample stream for plant identification
+//		fra.c			-- stepped sine frequency response analyzer
+//		rec.c			-- servo input recorder for a replay on the pc (INPUT_RECORDER)
+//		params.c		-- table of console/eeprom parameters
+//		fixnum.c		-- number parsing/printing without float stdio
 //		pid.c			-- actual code for pid loop
 //		save-res.c		-- routines to read/write configuration
-//		p30f4012.gld	-- Linker script file
+//		p30f4012.gld	-- Linker script file, program memory must end at 0x3a00
+//		                   (APP_END) to leave room for the bootloader, commands.c
+//		                   reserves the rest so the link fails if it does not.
+//		                   Link with --stack=448 (host/Makefile: make fit)
+//		boot/			-- serial bootloader, a project of its own (see boot/boot.c)
+//		host/sim/		-- register model to run these files on a pc (host/servosim)
 //		DataEEPROM.s	-- assembler file for read/write eeprom
 //---------------------------------------------------------------------
 //
@@ -47,6 +66,7 @@
 // needs a 30mhz part
 _FOSC( XT_PLL16 );  // 6mhz * PLL16  / 4 = 24mips
 //_FOSC( EC_PLL8 );  // 14.318mhz osc * PLL8  / 4 = 28.636mips
+//_FOSC( XT_PLL16 );  // 7.3728mhz xtal * PLL16 / 4 = 29.49mips
 _FWDT(WDT_OFF);                   // wdt off
 /* enablebrownout @4.2v, 64ms powerup delay, MCLR pin active */
 /* pwm pins in use, both active low to give 64ms delay on powerup */
@@ -57,20 +77,28 @@ _FBORPOR(PBOR_ON & BORV45 & MCLR_DIS & PWRT_64 );
 //----------------------------------------------------------------------
 
 extern void setup_TMR1(void);
+extern void setup_profile(void);
+extern void calibrate_load(void);
+extern void cpu_idle(void);
+extern void load_sync(unsigned long delay);
 extern void setup_encoder(void);
 extern void setup_uart(void);
+extern long uart_autobaud(void);
+extern long uart_baud;
 
-extern volatile unsigned short int timer_test;
 extern volatile unsigned short int cmd_posn;			// current posn cmd from PC
-extern volatile short int rxrdy;
+extern short rx_assemble(void);
+extern char *rx_getline(void);
+extern void rx_release(void);
 extern volatile float jerk;					// global used for loop tuning
 
 extern void setup_pwm(void);
+extern int set_pwm_timing(unsigned short fpwm, short post, short ticks);
 //extern void set_pwm(float amps);
 extern void setup_adc10(void);
 extern void setup_capture(void);
 extern int restore_setup( void );
-extern int calc_cksum(int sizew, int *adr);
+extern short calc_cksum(short sizew, short *adr);
 extern void print_tuning( void );
 
 extern void test_pc_interface( void );
@@ -80,14 +108,26 @@ extern struct PID _EEDATA(32) pidEE;
 extern struct PID pid;
 extern struct COF cof;
 extern void init_pid(void);
-extern void	process_serial_buffer();
+extern void init_fault(void);
+extern short fault_task(void);
+extern short modbus_task(void);
+extern void modbus_mode(short on);
+extern void fault_outputs_off(void);
+extern void fr_trap(void);
+extern short fr_task(void);
+extern short ident_task(void);
+extern short fra_task(void);
+extern void	process_serial_buffer(char *line);
+extern short eeprom_task( void );
+extern void sched_init(const struct TASK *tab, struct TASKSTAT *stat, short n);
+extern void sched_run(void);
 
 
 
 void __attribute__((__interrupt__,auto_psv)) _StackError (void)
 {
-	PDC1 = 0;	// cutoff output
-        PDC3 = 0;	// cutoff output
+	fault_outputs_off();	// cutoff output
+	fr_trap();				// save the last servo cycles to eeprom
 	printf("STACK ERROR\r\n");	
 while (1)
 	{	
@@ -96,8 +136,8 @@ while (1)
 
 void __attribute__((__interrupt__,auto_psv)) _AddressError (void)
 {
-	PDC1 = 0;	// cutoff output
-	PDC3 = 0;	// cutoff output
+	fault_outputs_off();	// cutoff output
+	fr_trap();				// save the last servo cycles to eeprom
 	printf("ADDRESS ERROR\r\n");	
 while (1)
 	{
@@ -106,8 +146,8 @@ while (1)
 
 void __attribute__((__interrupt__,auto_psv)) _MathError (void)
 {
-	PDC1 = 0;	// cutoff output
-	PDC3 = 0;	// cutoff output
+	fault_outputs_off();	// cutoff output
+	fr_trap();				// save the last servo cycles to eeprom
 	printf("MATH ERROR\r\n");		
 	while (1)
 	{
@@ -136,7 +176,7 @@ void setup_io(void)
 							// 0=output, 1=input
 	_TRISB0 = 1;			// used as AN0 above
 	_TRISB1 = 0;			// used to indicate when PID calc is active
-	_TRISB2 = 0;			// spare
+	_TRISB2 = 0;			// rs-485 driver enable (BUS_DE)
 	_TRISB3 = 0;			// spare
 	_TRISB4 = 1;			// used by quad encoder input ch A
 	_TRISB5 = 1;			// used by quad encoder input ch B
@@ -164,6 +204,117 @@ void setup_io(void)
 	_TRISF3 = 1;			// PGD used by icsp
 }
 
+/*********************************************************************
+  Background tasks run by sched_run(). Each one does a small piece of
+  work and returns non zero if there was anything to do.
+********************************************************************/
+
+// check for serial cmds
+short sw_enable = 1;		// modbus enable coil, and'ed with SVO_ENABLE
+
+static short serial_task(void)
+{
+	short busy = rx_assemble();
+	char *line = rx_getline();
+	char *cmd;
+	short kind;
+
+	if ( line == 0 )
+		return busy;
+	// on a multi-drop bus only lines addressed to us are taken
+	cmd = bus_parse(line, pid.nodeid, &kind);
+	if ( cmd )
+	{
+		if ( kind == BUS_REPLY )
+			bus_open(tb_now() + TB_US(BUS_TURN_US));
+		else
+			load_sync(TB_US(bus_slot_us(pid.nodeid)));	// telemetry slots follow the master
+		// any command stops the j tuning oscillation (j restarts it)
+		jerk = 0.0;
+		process_serial_buffer(cmd);
+		bus_close();
+	}
+	rx_release();
+	return 1;
+}
+
+// check to see if external forces are causing use to change servo status
+static short enable_task(void)
+{
+	static unsigned long settle;		// no enable again before this time
+	static short settling;				// settle has not been reached yet
+
+	// only look at settle while it is ahead: once it is 2^31 counts
+	// (1.6 hours) behind it reads as a time in the future again
+	if ( settling && TB_REACHED(tb_now(), settle) )
+		settling = 0;
+	if (SVO_ENABLE && sw_enable)
+	{
+		if ( pid.enable == 0 && !settling )	// last loop, servo was off
+		{
+			pid.enable = 1;
+			printf("\r\n>");
+			// give the servo loop some time to get established
+			settle = tb_now() + TB_MS(250);
+			settling = 1;
+			return 1;
+		}
+	}
+	else
+	{
+		// a disable is never held off
+		if ( pid.enable == 1 )	// last loop servo was active
+		{
+			pid.enable = 0;
+			printf(" \r\n>");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// j x.x servo tuning: step the command back and forth every 1/2 second
+// until a serial command arrives or the servo gets disabled
+static short jerk_task(void)
+{
+	static long applied = 0;		// offset currently added to the command
+	long step;
+	int ipl;
+
+	if ( jerk > 0.0 && SVO_ENABLE )
+		step = applied ? -applied : (long)jerk;
+	else if ( applied )
+	{
+		step = -applied;
+		jerk = 0.0;
+	}
+	else
+		return 0;
+
+	// the pwm isr also updates pid.command
+	SET_AND_SAVE_CPU_IPL(ipl, IPL_SERVO);
+	pid.command += step;
+	RESTORE_CPU_IPL(ipl);
+	applied += step;
+	return 1;
+}
+
+static const struct TASK tasks[] = {
+	// name     func           period         budget
+	{ "serial", serial_task,   0,             TB_MS(100) },
+	{ "modbus", modbus_task,   0,             TB_MS(10) },
+	{ "enable", enable_task,   TB_MS(10),     TB_MS(1) },
+	{ "fault",  fault_task,    TB_MS(10),     TB_MS(50) },
+	{ "eeprom", eeprom_task,   0,             TB_MS(10) },
+	{ "flight", fr_task,       0,             TB_MS(10) },
+	{ "ident",  ident_task,    0,             TB_MS(25) },
+	{ "fra",    fra_task,      0,             TB_MS(25) },
+	{ "timers", swt_poll,      0,             TB_MS(5) },
+	{ "jerk",   jerk_task,     TB_MS(500),    TB_MS(1) },
+};
+#define NTASKS		(sizeof(tasks) / sizeof(tasks[0]))
+static struct TASKSTAT task_stat[NTASKS];
+
 /*********************************************************************
   Function:        int main(void)
 
@@ -182,27 +333,31 @@ void setup_io(void)
 ********************************************************************/
 int main(void) 
 {
-	int cs;
+	short cs;
+	const struct PARAM *bad;
 	// vars used for detection of incremental motion
 	jerk = 0.0;
 	setup_io();             // make all i/o pins go the right dir
+	setup_profile();        // free running isr timing clock
 	setup_uart();		// setup the serial interface to the PC
-        setup_TMR1();           // set up 1ms timer
-	IEC0bits.T1IE = 1;      // Enable interrupts for timer 1
+        setup_TMR1();           // set up free running timebase
+	IEC0bits.T1IE = 1;      // Enable interrupts for timer 1 wrap
+	calibrate_load();       // idle cpu speed for the load monitor
+	uart_autobaud();        // if enabled in serial.c, before IC1 is taken
    	// needed for delays in following routines
 	// 1/2 seconds startup delay 
 	
  
-    timer_test = 5000;		
-	while ( timer_test );
-    printf("\r\nPowerup..i/o...uart...timer...");
+	tb_delay(TB_MS(500));
+    printf("\r\nPowerup..i/o...uart(%ld)...timer...", uart_baud);
     
 	init_pid();
 	pid.enable = 0;		// turn servo loop off for a while
-	setup_pwm();		// start analog output
-	//set_pwm(0.0); 
     setup_encoder();    // 16 bit quadrature encoder module setup
     setup_capture();    // 2 pins with quadrature cmd from PC
+	init_fault();		// before the pwm isr starts supervising
+	setup_pwm();		// start analog output
+	//set_pwm(0.0); 
 	
 	// some junk for the serial channel
 	printf("%s%s\n\r",CPWRT,VERSION);
@@ -211,7 +366,13 @@ int main(void)
 	// Read array named "setupEE" from DataEEPROM and place 
 	// the result into array in RAM named, "setup" 
 	restore_setup();
-	cs = -calc_cksum(((long int)&pid.cksum - (long int)&pid)/sizeof(int),(int*)&pid);
+	cs = -calc_cksum(((long int)&pid.cksum - (long int)&pid)/sizeof(short),(short*)&pid);
+	if ( cs == pid.cksum && (bad = param_validate()) != 0 )
+	{
+		// good cksum but written by a build with other limits
+		printf(" param %c out of range in eeprom\r\n", bad->code);
+		cs = ~pid.cksum;
+	}
 	if ( cs != pid.cksum )
 	{
 		// opps, no valid setup detected
@@ -222,79 +383,38 @@ int main(void)
 		{
 			// a very fast flash to indicate no config... serial activity
 			// (hopefully the user setting params gets us out of the loop)
-		 	timer_test = 1000; 
-			while ( timer_test )
-				{				}
-			if ( rxrdy ) break;
+			tb_delay(TB_MS(100));
+			rx_assemble();
+			if ( rx_getline() ) break;
 		}
 	}
 	else
 	{
-		printf("Using setup from eeprom.. ? for help\r\n");
-		print_tuning();
-	}
-
-    printf("using %fms servo loop interval\r\n",pid.ticksperservo * 0.250);
-	while (1)
-	{
-		// check for serial cmds
-		if ( rxrdy )
-			process_serial_buffer();
-
-		if ( jerk > 0.0 )
-		{
-			while ( 1 )
-			{
-				// loop forever until serial active or servo gets disabled
-				if ( rxrdy || !SVO_ENABLE )
-				{
-					jerk = 0.0;
-					break;
-				}
-				pid.command += jerk;
-			    timer_test = 5000; while ( timer_test );
-				pid.command -= jerk;
-			    timer_test = 5000; while ( timer_test );
-			}
-		}
-/*    
-  // check for a drive fault ( posn error > allowed )
-      if (( pid.maxerror > 0.0 ) && ( fabs(pid.error) > pid.maxerror ) && SVO_ENABLE )
-      {
-      pid.enable = 0;    // shut down servo updates
-        while (1)          // trap here until svo disabled or pwr cycle
-        {
-//          set_pwm( 0.0 );
-          printf("  %f\r\n",(double)pid.error);
-           timer_test = 2500*4; while ( timer_test );
-
-        if (!SVO_ENABLE) 
-          break;
-      }
-            while ( !SVO_ENABLE );  // wait for us to be enabled
-    }
-
-*/
-		// check to see if external forces are causing use to change servo status
-		if (SVO_ENABLE)
+		// hand the restored pwm rate to the pwm isr, drop it if out of range
+		if ( set_pwm_timing(pid.fpwm, pid.pwmpost, pid.ticksperservo) )
 		{
-			if ( pid.enable == 0 )	// last loop, servo was off
-			{
-				pid.enable = 1;
-				printf("\r\n>");
-				// give the servo loop some time to get established
-				timer_test = 2500; while ( timer_test );
-			}
+			printf("bad pwm timing in eeprom, using defaults\r\n");
+			pid.fpwm = FPWM;
+			pid.pwmpost = PWM_POST;
+			pid.ticksperservo = TICKS_MIN;
+			set_pwm_timing(pid.fpwm, pid.pwmpost, pid.ticksperservo);
 		}
-		else
+		printf("Using setup from eeprom.. ? for help\r\n");
+		print_tuning();
+		if ( pid.protocol )
 		{
-			if ( pid.enable == 1 )	// last loop servo was active
-			{
-				pid.enable = 0;
-				printf(" \r\n>");
-			}
+			printf("serial port is modbus rtu from now on\r\n");
+			modbus_mode(1);
 		}
 	}
+
+    printf("using ");
+	fx_print(pid.ticksperservo * pid.pwmpost * 1000.0 / pid.fpwm, FX_DIGITS);
+	printf("ms servo loop interval\r\n");
+	// from here on everything in the background runs as tasks
+	sched_init(tasks, task_stat, NTASKS);
+	while (1)
+		sched_run();
 	// to keep compiler happy....
 	return 0;
 }
\ No newline at end of file
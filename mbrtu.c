@@ -0,0 +1,159 @@
+//---------------------------------------------------------------------
+//	File:		mbrtu.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Modbus RTU slave: checks a received frame and turns it into
+//          the reply in the same buffer. Function codes
+//              01 read coils             05 write single coil
+//              03 read holding registers 06 write single register
+//              04 read input registers   16 write multiple registers
+//          Frames to address 0 are broadcasts, acted on without reply.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#include "mbrtu.h"
+
+#define GET16(p)	(((unsigned short)(p)[0] << 8) | (p)[1])
+#define PUT16(p, v)	((p)[0] = (unsigned char)((v) >> 8), (p)[1] = (unsigned char)(v))
+
+// crc16 with poly 0xa001, sent low byte first
+unsigned short mb_crc(const unsigned char *p, short len)
+{
+	unsigned short crc = 0xffff;
+	short i;
+
+	while ( len-- > 0 )
+	{
+		crc ^= *p++;
+		for ( i = 0; i < 8; i++ )
+			crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+	}
+	return crc;
+}
+
+static short mb_finish(unsigned char *f, short len)
+{
+	unsigned short crc = mb_crc(f, len);
+
+	f[len] = (unsigned char)crc;
+	f[len + 1] = (unsigned char)(crc >> 8);
+	return len + 2;
+}
+
+static short mb_exception(unsigned char *f, short code)
+{
+	f[1] |= 0x80;
+	f[2] = (unsigned char)code;
+	return mb_finish(f, 3);
+}
+
+/*********************************************************************
+  Function:        short mb_process(unsigned char *f, short len,
+                                    unsigned char addr)
+
+  Input:           f    - frame as received, at least MB_BUF bytes
+                   len  - bytes received incl. the crc
+                   addr - our slave address
+
+  Output:          length of the reply now in f, 0 for no reply (not
+                   for us, bad crc or a broadcast)
+********************************************************************/
+short mb_process(unsigned char *f, short len, unsigned char addr)
+{
+	unsigned short start, n, v[MB_MAX_READ];
+	short ex = MB_OK, i, on;
+
+	if ( len < 4 || len > MB_BUF )
+		return 0;
+	if ( f[0] != addr && f[0] != 0 )
+		return 0;
+	if ( mb_crc(f, len - 2) != (f[len - 2] | ((unsigned short)f[len - 1] << 8)) )
+		return 0;
+	if ( len < 8 && f[1] != 0x10 )
+		ex = MB_EX_VALUE;		// every function we know has start and count
+	start = GET16(&f[2]);
+	n = GET16(&f[4]);
+
+	if ( ex == MB_OK )
+	switch ( f[1] )
+	{
+	case 0x01:					// read coils
+		if ( n < 1 || n > 8 * MB_MAX_READ )
+		{
+			ex = MB_EX_VALUE;
+			break;
+		}
+		for ( i = 0; i < (short)(n + 7) / 8; i++ )
+			f[3 + i] = 0;
+		for ( i = 0; i < (short)n && !ex; i++ )
+		{
+			ex = mb_read_coil(start + i, &on);
+			if ( on )
+				f[3 + i / 8] |= 1 << (i % 8);
+		}
+		if ( ex )
+			break;
+		f[2] = (n + 7) / 8;
+		len = mb_finish(f, 3 + f[2]);
+		break;
+
+	case 0x03:					// read holding registers
+	case 0x04:					// read input registers
+		if ( n < 1 || n > MB_MAX_READ )
+		{
+			ex = MB_EX_VALUE;
+			break;
+		}
+		ex = f[1] == 0x03 ? mb_read_holding(start, n, v) : mb_read_input(start, n, v);
+		if ( ex )
+			break;
+		f[2] = n * 2;
+		for ( i = 0; i < (short)n; i++ )
+			PUT16(&f[3 + i * 2], v[i]);
+		len = mb_finish(f, 3 + n * 2);
+		break;
+
+	case 0x05:					// write single coil, value 0xff00 or 0
+		if ( n != 0xff00 && n != 0 )
+		{
+			ex = MB_EX_VALUE;
+			break;
+		}
+		ex = mb_write_coil(start, n != 0);
+		len = 8;				// echo of the request
+		break;
+
+	case 0x06:					// write single register
+		v[0] = n;
+		ex = mb_write_holding(start, 1, v);
+		len = 8;
+		break;
+
+	case 0x10:					// write multiple registers
+		if ( len < 9 || n < 1 || n > MB_MAX_WRITE || f[6] != n * 2 || len != 9 + n * 2 )
+		{
+			ex = MB_EX_VALUE;
+			break;
+		}
+		for ( i = 0; i < (short)n; i++ )
+			v[i] = GET16(&f[7 + i * 2]);
+		ex = mb_write_holding(start, n, v);
+		len = mb_finish(f, 6);
+		break;
+
+	default:
+		ex = MB_EX_FUNCTION;
+		break;
+	}
+
+	if ( f[0] == 0 )
+		return 0;				// broadcasts are never answered
+	if ( ex )
+		return mb_exception(f, ex);
+	return len;
+}
@@ -0,0 +1,40 @@
+//---------------------------------------------------------------------
+//	File:		mbrtu.h
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Modbus RTU slave protocol engine. Like pwmtiming.h this does
+//          not include <xc.h>: the card (modbus.c) and host/mbslave both
+//          supply the register access functions below.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+//----------------------------------------------------------------------
+#ifndef MBRTU_H
+#define MBRTU_H
+
+#define MB_BUF			64		// longest frame we take, limits the counts below
+#define MB_MAX_READ		((MB_BUF - 5) / 2)	// registers per read
+#define MB_MAX_WRITE	((MB_BUF - 9) / 2)	// registers per write
+
+// exception codes
+#define MB_OK			0
+#define MB_EX_FUNCTION	1
+#define MB_EX_ADDRESS	2
+#define MB_EX_VALUE		3
+#define MB_EX_FAILURE	4
+
+unsigned short mb_crc(const unsigned char *p, short len);
+short mb_process(unsigned char *f, short len, unsigned char addr);
+
+// supplied by the user of the engine, each returns MB_OK or MB_EX_xxx
+short mb_read_holding(unsigned short start, short n, unsigned short *v);
+short mb_write_holding(unsigned short start, short n, const unsigned short *v);
+short mb_read_input(unsigned short start, short n, unsigned short *v);
+short mb_read_coil(unsigned short coil, short *on);
+short mb_write_coil(unsigned short coil, short on);
+
+#endif
@@ -0,0 +1,388 @@
+//---------------------------------------------------------------------
+//	File:		modbus.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Modbus RTU slave on the serial port, selected with the y
+//          parameter (0 = console, 1 = modbus). The slave address is
+//          the node id (n), 1 if that is 0.
+//
+//          The rx isr hands each byte to mb_rx_byte(). Timer 3 is
+//          restarted on every byte and runs out 3.5 characters after
+//          the last one, which ends the frame. A gap of more than 1.5
+//          characters inside a frame spoils it. Above 19200 baud the
+//          fixed 750us/1750us times of the modbus spec are used. The
+//          port runs 8E1, the rtu default, so a character is 11 bits.
+//
+//          Register map (see mbrtu.c for the function codes):
+//          holding 2i,2i+1   parameter i of params[] as a 32 bit float,
+//                            high word first, written in pairs
+//          holding 100+i     parameter i as a 16 bit integer
+//          input   0-1       command (32 bit)    2-3  feedback (32 bit)
+//                  4-5       error (float)       6-7  output (float)
+//                  8         latched fault bits  9    first fault bits
+//                  10        fault trips         11   pc cmd errors
+//                  12        servo enabled       13   cpu load (0.1%)
+//                  14        encoder count
+//          coil    0         enable (and'ed with the enable input)
+//                  1         write 1: reset posn and clear a fault
+//                  2         write 1: save parameters to eeprom
+//                  3         fault latched (read only)
+//
+//          Writes through modbus are not saved until coil 2 is set, so
+//          a plc writing gains often does not wear out the eeprom.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- frame end isr at IPL_TICK, the snapshot masks only the servo isr
+// Oct 19 2026 -- holding writes check every value before storing any
+// Oct 19 2026 -- t1.5 counts the next character too, 8E1, telemetry off
+//----------------------------------------------------------------------
+#include <xc.h>
+#include "dspicservo.h"
+#include "mbrtu.h"
+
+#define MB_INT_VIEW		100		// first register of the 16 bit view
+#define MB_INPUTS		15
+
+extern struct PID pid;
+extern struct COF cof;
+extern volatile unsigned short int cmd_err;
+extern short load_total;
+extern long uart_baud;
+extern short sw_enable;
+extern int save_setup( void );
+extern void servo_reset( void );
+extern int set_pwm_timing(unsigned short fpwm, short post, short ticks);
+extern short load_telemetry;
+extern void load_sync(unsigned long delay);
+
+static unsigned char mb_buf[MB_BUF];
+static volatile short mb_len;		// bytes received, MB_BUF+1 = too long
+static volatile short mb_bad;		// gap inside the frame
+static volatile short mb_ready;		// frame complete, owned by modbus_task()
+static unsigned short mb_t15;		// timer 3 counts for 1.5 chars and the next one
+short mb_on;						// modbus owns the serial port
+
+// frame statistics
+unsigned short mb_frames, mb_errors;
+
+/*********************************************************************
+  Function:        void mb_rx_byte(unsigned char ch)
+
+  PreCondition:    called from the uart rx isr in modbus mode
+********************************************************************/
+void mb_rx_byte(unsigned char ch)
+{
+	if ( mb_ready )
+		return;					// last frame not handled yet, drop it
+	if ( mb_len && TMR3 > mb_t15 )
+		mb_bad = 1;
+	if ( mb_len < MB_BUF )
+		mb_buf[mb_len] = ch;
+	if ( mb_len <= MB_BUF )
+		mb_len++;
+	TMR3 = 0;
+	T3CONbits.TON = 1;
+}
+
+/*********************************************************************
+  Function:        void _T3Interrupt(void)
+
+  Overview:        3.5 characters of silence: the frame is complete
+********************************************************************/
+void __attribute__((__interrupt__,no_auto_psv)) _T3Interrupt (void)
+{
+	PROF_ENTER(PROF_T3);
+	IFS0bits.T3IF = 0;
+	T3CONbits.TON = 0;
+	if ( mb_len )
+		mb_ready = 1;
+	PROF_EXIT(PROF_T3);
+}
+
+/*********************************************************************
+  Function:        void modbus_mode(short on)
+
+  Overview:        gives the serial port to modbus or back to the
+                   console. Timer 3 runs at Tcy/8. The telemetry lines
+                   of the c command stop, they would land in the frames
+                   of every slave on the line.
+********************************************************************/
+void modbus_mode(short on)
+{
+	unsigned long t35, t15;
+
+	IEC0bits.T3IE = 0;
+	T3CON = 0x0010;				// off, Tcy/8
+	mb_len = 0;
+	mb_bad = 0;
+	mb_ready = 0;
+	if ( on )
+	{
+		if ( uart_baud > 19200 )
+		{
+			t35 = (FCY / 8) / 1000000L * 1750;
+			t15 = (FCY / 8) / 1000000L * 750;
+		}
+		else
+		{
+			// 11 bit characters
+			t35 = (FCY / 8) * 11 * 7 / 2 / uart_baud;
+			t15 = (FCY / 8) * 11 * 3 / 2 / uart_baud;
+		}
+		// TMR3 restarts when a byte is in, so at the next one it also
+		// holds that character's own 11 bits, not only the silence
+		t15 += (FCY / 8) * 11 / uart_baud;
+		PR3 = (unsigned short)t35;
+		mb_t15 = (unsigned short)t15;
+		TMR3 = 0;
+		IFS0bits.T3IF = 0;
+		IPC1bits.T3IP = IPL_TICK;
+		IEC0bits.T3IE = 1;
+		load_telemetry = 0;
+		load_sync(0);
+	}
+	U1MODEbits.PDSEL = on ? 1 : 0;	// 8E1 for modbus, 8N1 for the console
+	mb_on = on;
+}
+
+// send a reply, the line is quiet since the frame ended 3.5 chars ago
+static void mb_send(const unsigned char *p, short len)
+{
+	BUS_DE = 1;
+	while ( len-- > 0 )
+	{
+		while ( U1STAbits.UTXBF )
+			;
+		U1TXREG = *p++;
+	}
+	while ( !U1STAbits.TRMT )
+		;
+	BUS_DE = 0;
+}
+
+/*********************************************************************
+  Function:        short modbus_task(void)
+
+  Overview:        background task, answers a complete frame
+********************************************************************/
+short modbus_task(void)
+{
+	short len;
+
+	if ( !mb_ready )
+		return 0;
+	if ( mb_bad || mb_len > MB_BUF )
+		mb_errors++;
+	else
+	{
+		mb_frames++;
+		len = mb_process(mb_buf, mb_len, pid.nodeid ? pid.nodeid : 1);
+		if ( len )
+			mb_send(mb_buf, len);
+	}
+	mb_len = 0;
+	mb_bad = 0;
+	mb_ready = 0;				// the isr may fill the buffer again
+	return 1;
+}
+
+/*
+ * register access for mbrtu.c
+ */
+static unsigned long float_bits(float f)
+{
+	union { float f; unsigned long l; } u;
+
+	u.f = f;
+	return u.l;
+}
+
+short mb_read_holding(unsigned short start, short n, unsigned short *v)
+{
+	unsigned short reg;
+	unsigned long l;
+	float f;
+
+	for ( ; n > 0; n--, start++ )
+	{
+		if ( start >= MB_INT_VIEW && start < MB_INT_VIEW + param_count )
+		{
+			reg = start - MB_INT_VIEW;
+			f = param_get(&params[reg]);
+			*v++ = params[reg].type == PT_USHORT ? (unsigned short)f : (unsigned short)(short)f;
+		}
+		else if ( start < 2 * param_count )
+		{
+			l = float_bits(param_get(&params[start / 2]));
+			*v++ = (start & 1) ? (unsigned short)l : (unsigned short)(l >> 16);
+		}
+		else
+			return MB_EX_ADDRESS;
+	}
+	return MB_OK;
+}
+
+// parameter behind holding register reg and the value written to it,
+// from two registers for a float
+static const struct PARAM *mb_param(unsigned short reg, const unsigned short *v, float *f)
+{
+	union { float f; unsigned long l; } u;
+	const struct PARAM *p;
+
+	if ( reg >= MB_INT_VIEW )
+	{
+		p = &params[reg - MB_INT_VIEW];
+		*f = p->type == PT_USHORT ? (float)*v : (float)(short)*v;
+	}
+	else
+	{
+		p = &params[reg / 2];
+		u.l = ((unsigned long)v[0] << 16) | v[1];
+		*f = u.f;
+	}
+	return p;
+}
+
+/*********************************************************************
+  Function:        short mb_write_holding(unsigned short start, short n,
+                                          const unsigned short *v)
+
+  Overview:        all the values are checked before any is stored, a
+                   refused one leaves every parameter as it was. The pwm
+                   rate, postscale and ticks are checked as the set they
+                   make together and applied once at the end, so writing
+                   them in one frame does not depend on their order.
+********************************************************************/
+short mb_write_holding(unsigned short start, short n, const unsigned short *v)
+{
+	const struct PARAM *p;
+	struct PWMTIMING t;
+	unsigned short fpwm = pid.fpwm;
+	short post = pid.pwmpost, ticks = pid.ticksperservo;
+	short pass, k, words, pwm = 0;
+	float f;
+
+	// check the addresses before anything is changed
+	if ( start >= MB_INT_VIEW )
+	{
+		if ( start + n > MB_INT_VIEW + param_count )
+			return MB_EX_ADDRESS;
+	}
+	else if ( (start & 1) || (n & 1) || start + n > 2 * param_count )
+		return MB_EX_ADDRESS;	// floats only as whole pairs
+	words = start >= MB_INT_VIEW ? 1 : 2;
+
+	for ( pass = 0; pass < 2; pass++ )
+	{
+		for ( k = 0; k < n; k += words )
+		{
+			p = mb_param(start + k, v + k, &f);
+			if ( param_check(p, f) != PARAM_OK )
+				return MB_EX_VALUE;		// in the first pass, nothing stored yet
+			if ( p->type != PT_FLOAT )
+				f = (float)(long)f;
+			if ( pass == 0 )
+			{
+				if ( p->code == 'w' )
+					fpwm = (unsigned short)f;
+				else if ( p->code == 'u' )
+					post = (short)f;
+				else if ( p->code == 't' )
+					ticks = (short)f;
+				else
+					continue;
+				pwm = 1;
+			}
+			else if ( p->code == 'w' || p->code == 'u' || p->code == 't' )
+				param_store(p, f);
+			else if ( param_put(p, f) != PARAM_OK )
+				return MB_EX_FAILURE;	// the other hooks take any value in range
+		}
+		if ( pass == 0 && pwm && calc_pwm_timing(FCY, fpwm, post, ticks, &t) != PWMT_OK )
+			return MB_EX_VALUE;
+	}
+	if ( pwm )
+		set_pwm_timing(fpwm, post, ticks);
+	return MB_OK;
+}
+
+short mb_read_input(unsigned short start, short n, unsigned short *v)
+{
+	unsigned short in[MB_INPUTS];
+	unsigned long l;
+	int ipl;
+
+	if ( start + n > MB_INPUTS )
+		return MB_EX_ADDRESS;
+
+	// one consistent snapshot of what the pwm isr updates
+	SET_AND_SAVE_CPU_IPL(ipl, IPL_SERVO);
+	in[0] = (unsigned short)(pid.command >> 16);
+	in[1] = (unsigned short)pid.command;
+	in[2] = (unsigned short)(pid.feedback >> 16);
+	in[3] = (unsigned short)pid.feedback;
+	l = float_bits(pid.error);
+	in[4] = (unsigned short)(l >> 16);
+	in[5] = (unsigned short)l;
+	l = float_bits(pid.output);
+	in[6] = (unsigned short)(l >> 16);
+	in[7] = (unsigned short)l;
+	in[8] = cof.fault;
+	in[9] = cof.first;
+	in[10] = cof.trips;
+	in[11] = cmd_err;
+	in[12] = pid.enable;
+	in[14] = POSCNT;
+	RESTORE_CPU_IPL(ipl);
+	in[13] = load_total;
+
+	while ( n-- > 0 )
+		*v++ = in[start++];
+	return MB_OK;
+}
+
+short mb_read_coil(unsigned short coil, short *on)
+{
+	switch ( coil )
+	{
+	case 0:
+		*on = sw_enable;
+		break;
+	case 1:
+	case 2:
+		*on = 0;				// actions, always read back 0
+		break;
+	case 3:
+		*on = cof.fault != 0;
+		break;
+	default:
+		return MB_EX_ADDRESS;
+	}
+	return MB_OK;
+}
+
+short mb_write_coil(unsigned short coil, short on)
+{
+	switch ( coil )
+	{
+	case 0:
+		sw_enable = on;
+		break;
+	case 1:
+		if ( on )
+			servo_reset();
+		break;
+	case 2:
+		if ( on )
+			save_setup();
+		break;
+	default:
+		return MB_EX_ADDRESS;
+	}
+	return MB_OK;
+}
@@ -0,0 +1,300 @@
+//---------------------------------------------------------------------
+//	File:		params.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Table of the servo parameters that can be set from the
+//          console. Each entry gives the command letter, where the value
+//          lives in struct PID, its type and limits, whether it is kept
+//          in eeprom and an optional apply hook. Setting, checking,
+//          printing and the help text all come from this one table so a
+//          new parameter is one line here plus its field in struct PID.
+//
+//          The table is const so it stays in program memory and is read
+//          through psv.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version, replaces the per parameter cases in
+//                process_serial_buffer() and print_tuning()
+// Oct 19 2026 -- range checked before the cast, inf and nan turned away
+// Oct 19 2026 -- g, sample lead before the pwm edge
+// Oct 19 2026 -- param_find() searches the table, no index to keep in step
+// Oct 19 2026 -- param_check() and param_store() for a set of values
+//                written together (modbus)
+// Oct 19 2026 -- f at least 1 count, the pwm isr divides by it
+// Oct 19 2026 -- param_find() back on a const index in flash, fwtest
+//                checks it against the table
+//----------------------------------------------------------------------
+#include <xc.h>
+#include "dspicservo.h"
+#include <stdio.h>
+#include <stddef.h>
+
+extern struct PID pid;
+extern int save_setup( void );
+extern int set_pwm_timing(unsigned short fpwm, short post, short ticks);
+extern int set_sample_lead(unsigned short lead_us);
+extern void modbus_mode(short on);
+
+static int apply_igain(float v);
+static int apply_ticks(float v);
+static int apply_fpwm(float v);
+static int apply_post(float v);
+static int apply_protocol(float v);
+static int apply_lead(float v);
+
+#define PID_OFS(f)	offsetof(struct PID, f)
+
+const struct PARAM params[] = {
+	// code label                 unit    help                                        offset                type       flags               min        max        apply
+	{ 'p', "(p)",                 "",     "set proportional gain",                    PID_OFS(pgain),       PT_FLOAT,  PF_SAVE,            0.0,       1.0e6,     0 },
+	{ 'i', "(i)",                 "",     "set integral gain",                        PID_OFS(igain),       PT_FLOAT,  PF_SAVE,            0.0,       1.0e6,     apply_igain },
+	{ 'd', "(d)",                 "",     "set differential gain",                    PID_OFS(dgain),       PT_FLOAT,  PF_SAVE,            0.0,       1.0e6,     0 },
+	{ '0', "FF(0)",               "",     "set FF0 gain",                             PID_OFS(ff0gain),     PT_FLOAT,  PF_SAVE,            -1.0e6,    1.0e6,     0 },
+	{ '1', "FF(1)",               "",     "set FF1 gain",                             PID_OFS(ff1gain),     PT_FLOAT,  PF_SAVE,            -1.0e6,    1.0e6,     0 },
+	{ 'b', "dead(b)and",          "",     "set deadband",                             PID_OFS(deadband),    PT_FLOAT,  PF_SAVE,            0.0,       32767.0,   0 },
+	{ 'm', "(m)ax Output",        "amps", "set max output current(amps)",             PID_OFS(maxoutput),   PT_FLOAT,  PF_SAVE,            0.0,       1.0e6,     0 },
+	{ 'f', "(f)ault error",       "",     "set max error before drive faults(counts)", PID_OFS(maxerror),   PT_FLOAT,  PF_SAVE,            1.0,       1.0e6,     0 },
+	{ 'x', "(x)pc cmd multiplier", "",    "set pc command multiplier",                PID_OFS(multiplier),  PT_SHORT,  PF_SAVE,            1,         22,        0 },
+	{ 'w', "p(w)m frequency",     "Hz",   "set pwm frequency in Hz",                  PID_OFS(fpwm),        PT_USHORT, PF_SAVE,            FPWM_MIN,  FPWM_MAX,  apply_fpwm },
+	{ 'u', "pwm intr postscale(u)", "",   "set # of pwm periods/per pwm intr",        PID_OFS(pwmpost),     PT_SHORT,  PF_SAVE,            PWM_POST_MIN, PWM_POST_MAX, apply_post },
+	{ 't', "(t)icks per servo cycle", "", "set # of pwm intr ticks/per servo calc",   PID_OFS(ticksperservo), PT_SHORT, PF_SAVE,           TICKS_MIN, TICKS_MAX, apply_ticks },
+	{ 'o', "pc cmd (o)verspeed fault", " errs/window", "set max bogus pc cmd edges per window, 0=off", PID_OFS(maxcmderr), PT_SHORT, PF_SAVE, 0, 32767, 0 },
+	{ 'a', "f(a)ult checks enabled", "",  "enable fault checks 1=follow 2=encoder 4=pc cmd 8=amp", PID_OFS(faultmask), PT_USHORT, PF_SAVE | PF_HEX, 0, FLT_ALL, 0 },
+	{ 'n', "(n)ode id",           "",     "set rs-485 node id, 0=own serial port",    PID_OFS(nodeid),      PT_SHORT,  PF_SAVE,            0,         BUS_NODE_MAX, 0 },
+	{ 'y', "protocol(y)",         "",     "serial port protocol 0=console 1=modbus rtu", PID_OFS(protocol),  PT_SHORT,  PF_SAVE,            0,         1,         apply_protocol },
+	{ 'g', "sample lead(g)",      "us",   "sample feedback this long before a pwm edge, 0=at the pwm intr", PID_OFS(samplelead), PT_USHORT, PF_SAVE, 0,   LEAD_MAX_US, apply_lead },
+};
+
+const short param_count = sizeof(params) / sizeof(params[0]);
+
+// command letter -> table index + 1, 0 if the letter is not a parameter.
+// Keep in step with the table above; fwtest params finds every entry
+// through it.
+static const unsigned char param_index['z' - '0' + 1] = {
+	['p' - '0'] = 1,  ['i' - '0'] = 2,  ['d' - '0'] = 3,  ['0' - '0'] = 4,
+	['1' - '0'] = 5,  ['b' - '0'] = 6,  ['m' - '0'] = 7,  ['f' - '0'] = 8,
+	['x' - '0'] = 9,  ['w' - '0'] = 10, ['u' - '0'] = 11, ['t' - '0'] = 12,
+	['o' - '0'] = 13, ['a' - '0'] = 14, ['n' - '0'] = 15,
+	['y' - '0'] = 16, ['g' - '0'] = 17,
+};
+
+/*********************************************************************
+  Function:        const struct PARAM *param_find(char code)
+
+  Overview:        one lookup in a 75 byte const index instead of a
+                   walk over the table, the same cost for every letter
+
+  Output:          table entry for a command letter, 0 if there is none
+********************************************************************/
+const struct PARAM *param_find(char code)
+{
+	unsigned char i;
+
+	if ( code < '0' || code > 'z' )
+		return 0;
+	i = param_index[code - '0'];
+	return i ? &params[i - 1] : 0;
+}
+
+// value of a parameter as a float whatever its type
+float param_get(const struct PARAM *p)
+{
+	char *v = (char *)&pid + p->offset;
+
+	switch ( p->type )
+	{
+	case PT_SHORT:
+		return *(short *)v;
+	case PT_USHORT:
+		return *(unsigned short *)v;
+	default:
+		return *(float *)v;
+	}
+}
+
+// stores a value param_check() took, without the apply hook
+void param_store(const struct PARAM *p, float value)
+{
+	char *v = (char *)&pid + p->offset;
+
+	switch ( p->type )
+	{
+	case PT_SHORT:
+		*(short *)v = (short)value;
+		break;
+	case PT_USHORT:
+		*(unsigned short *)v = (unsigned short)value;
+		break;
+	default:
+		*(float *)v = value;
+		break;
+	}
+}
+
+/*********************************************************************
+  Function:        int param_put(const struct PARAM *p, float value)
+
+  Overview:        checks the limits, runs the apply hook and stores the
+                   value. Integer parameters take the value truncated,
+                   as the old atof() and cast did.
+
+  Output:          PARAM_OK, PARAM_RANGE or the hook's error
+********************************************************************/
+int param_put(const struct PARAM *p, float value)
+{
+	int res;
+
+	if ( param_check(p, value) != PARAM_OK )
+		return PARAM_RANGE;
+	if ( p->type != PT_FLOAT )
+		value = (float)(long)value;
+	if ( p->apply && (res = p->apply(value)) != PARAM_OK )
+		return res;
+	param_store(p, value);
+	return PARAM_OK;
+}
+
+// the limits of param_put(), !(in range) also turns NaN away, and inf
+// before a cast
+int param_check(const struct PARAM *p, float value)
+{
+	return value >= p->min && value <= p->max ? PARAM_OK : PARAM_RANGE;
+}
+
+// param_put() and an eeprom save for PF_SAVE entries (console)
+int param_set(const struct PARAM *p, float value)
+{
+	int res = param_put(p, value);
+
+	if ( res == PARAM_OK && (p->flags & PF_SAVE) )
+		save_setup();
+	return res;
+}
+
+/*********************************************************************
+  Function:        const struct PARAM *param_validate(void)
+
+  Overview:        checks every parameter against its limits, used on
+                   the values restored from eeprom
+
+  Output:          first entry out of range, 0 if all are good
+********************************************************************/
+const struct PARAM *param_validate(void)
+{
+	const struct PARAM *p;
+	float v;
+
+	for ( p = params; p < &params[param_count]; p++ )
+	{
+		v = param_get(p);
+		if ( v != v || v < p->min || v > p->max )	// v != v catches NaN
+			return p;
+	}
+	return 0;
+}
+
+// report why param_set() refused a value
+void param_error(const struct PARAM *p, int res)
+{
+	switch ( res )
+	{
+	case PARAM_RANGE:
+		if ( p->type == PT_FLOAT )
+		{
+			printf("%c must be ", p->code);
+			fx_print(p->min, FX_DIGITS);
+			printf(" to ");
+			fx_print(p->max, FX_DIGITS);
+			printf("\r\n");
+		}
+		else
+			printf("%c must be %ld to %ld\r\n", p->code, (long)p->min, (long)p->max);
+		break;
+	case PWMT_BAD_FPWM:
+		printf("pwm freq must be %u-%uHz\r\n", FPWM_MIN, FPWM_MAX);
+		break;
+	case PWMT_BAD_POST:
+		printf("pwm intr postscale must be %d-%d\r\n", PWM_POST_MIN, PWM_POST_MAX);
+		break;
+	case PWMT_BAD_TICKS:
+		printf("ticks per servo cycle must be %d-%d\r\n", TICKS_MIN, TICKS_MAX);
+		break;
+	case PWMT_TOO_FAST:
+		printf("pwm intr would be faster than %dus\r\n", PWM_MIN_TICK_US);
+		break;
+	}
+}
+
+void param_print(const struct PARAM *p)
+{
+	printf("%s = ", p->label);
+	switch ( p->type )
+	{
+	case PT_SHORT:
+		printf("%hd", *(short *)((char *)&pid + p->offset));
+		break;
+	case PT_USHORT:
+		if ( p->flags & PF_HEX )
+			printf("0x%02X", *(unsigned short *)((char *)&pid + p->offset));
+		else
+			printf("%u", *(unsigned short *)((char *)&pid + p->offset));
+		break;
+	default:
+		fx_print(param_get(p), FX_DIGITS);
+		break;
+	}
+	printf("%s\r\n", p->unit);
+}
+
+// help lines for the parameter commands
+void param_help(void)
+{
+	const struct PARAM *p;
+
+	for ( p = params; p < &params[param_count]; p++ )
+	{
+		if ( p->type == PT_FLOAT )
+			printf("%c x.x %s\r\n", p->code, p->help);
+		else
+			printf("%c n   %s(%ld-%ld)\r\n", p->code, p->help, (long)p->min, (long)p->max);
+	}
+}
+
+/*
+ * apply hooks, called with the new value before it is stored
+ */
+static int apply_igain(float v)
+{
+	pid.error_i = 0.0;		// reset integrator
+	return PARAM_OK;
+}
+
+static int apply_ticks(float v)
+{
+	return set_pwm_timing(pid.fpwm, pid.pwmpost, (short)v);
+}
+
+static int apply_fpwm(float v)
+{
+	return set_pwm_timing((unsigned short)v, pid.pwmpost, pid.ticksperservo);
+}
+
+static int apply_post(float v)
+{
+	return set_pwm_timing(pid.fpwm, (short)v, pid.ticksperservo);
+}
+
+static int apply_protocol(float v)
+{
+	modbus_mode((short)v);
+	return PARAM_OK;
+}
+
+static int apply_lead(float v)
+{
+	return set_sample_lead((unsigned short)v);
+}
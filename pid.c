@@ -94,6 +94,7 @@
 /* our servo loop data variable */
 struct PID pid;
 struct COF cof;
+extern struct PWMTIMING pwm_timing;
 /***********************************************************************
 *                  LOCAL FUNCTION DECLARATIONS                         *
 ************************************************************************/
@@ -127,8 +128,14 @@ void init_pid(void)
     pid.ff1gain = 0.0;
     pid.maxoutput = 2000.0;		// emergency limit
 	pid.multiplier = 1;
-    pid.ticksperservo = 1;		// 500us/servo calc
-//	unsigned char emergncy=0; //TESTTEST
+    pid.ticksperservo = 1;		// 1 pwm intr (250us)/servo calc
+    pid.fpwm = FPWM;
+    pid.pwmpost = PWM_POST;
+    pid.maxcmderr = 0;			// pc cmd overspeed check off
+    pid.faultmask = FLT_ALL;
+    pid.nodeid = 0;				// not on a bus
+    pid.protocol = 0;			// console on the serial port
+    pid.samplelead = 0;			// sampled at the pwm intr
 }
 
 
@@ -142,11 +149,10 @@ void calc_pid( void )
 {
     float tmp1;
     float periodfp, periodrecip;
-    long period = pid.ticksperservo * 250000;	/* thread period in ns */
 
-    /* precalculate some timing constants */
-    periodfp = period * 0.000000001;		// usually .001 sec
-    periodrecip = 1.0 / periodfp;			// usually 1000.0
+    /* timing constants are derived by the pwm module when its rate changes */
+    periodfp = pwm_timing.periodfp;			// usually .00025 sec
+    periodrecip = pwm_timing.periodrecip;	// usually 4000.0
 
     /* calculate the error */
     tmp1 = (float)(pid.command - pid.feedback);
@@ -182,10 +188,5 @@ void calc_pid( void )
 
 
 	pid.output = tmp1;
-
-if (fabs(pid.error) > pid.maxoutput)
-	{
-		cof.emergncy=1;  //TESTTEST
- 	}
-
+	// fault_check() in the pwm isr acts on the error from here
 }
@@ -0,0 +1,272 @@
+//---------------------------------------------------------------------
+//	File:		profile.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Measures execution time and entry jitter of the isr's.
+//          Timer 2 free runs at Tcy (16 bits, wraps every 2.7ms at
+//          24 MIPS) and each isr reads it on entry and exit using
+//          PROF_ENTER()/PROF_EXIT() from dspicservo.h. The time between
+//          entries is taken from the timebase once it is too long for
+//          timer 2 (timer 1, the t3 timeouts, slow pwm rates).
+//
+//          The z command prints min/mean/max, a histogram of run
+//          times and the number of servo cycle overruns, and the delay
+//          from the servo's feedback read to the pwm edge its duty goes
+//          out on (pwm.c measures it).
+//
+//          The per isr stats are only built with ISR_PROFILE, the 30f4012
+//          has no ram for them next to the flight recorder. The delay
+//          and the overruns are always there.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- sample to output delay
+// Oct 19 2026 -- periods over 16 bits of Tcy from the timebase
+// Oct 19 2026 -- per isr stats under ISR_PROFILE
+//----------------------------------------------------------------------
+#include <xc.h>
+#include "dspicservo.h"
+#include <stdio.h>
+
+#ifdef ISR_PROFILE
+struct ISRPROF{
+	unsigned short count;		// samples in sum (halved with sum on overflow)
+	unsigned long sum;			// total Tcy of the samples in count
+	unsigned short min;			// shortest run time (Tcy)
+	unsigned short max;			// longest run time (Tcy)
+	unsigned short last;		// TMR2 at entry of the previous call
+	unsigned long last_tb;		// tb_now() at entry of the previous call
+	unsigned long per_min;		// shortest time between entries (Tcy)
+	unsigned long per_max;		// longest time between entries (Tcy)
+	unsigned short hist[PROF_BINS];
+};
+#endif
+
+struct S2OPROF{
+	unsigned short count;		// samples in sum (halved with sum on overflow)
+	unsigned long sum;			// Tcy
+	unsigned short min;
+	unsigned short max;
+	unsigned short late;		// duty missed the pwm edge after the sample
+};
+
+#ifdef ISR_PROFILE
+static struct ISRPROF prof[PROF_NUM];
+volatile short prof_nest;				// number of profiled isr's active
+volatile unsigned long prof_isr_cy;		// Tcy spent in isr's, used by load.c
+
+static const char * const prof_names[PROF_NUM] = {
+	"pwm ", "ic1 ", "ic2 ", "qei ", "u1rx", "t1  ", "t3  "
+};
+#endif
+static struct S2OPROF s2o;
+volatile unsigned short prof_overruns;	// pwm intr still pending when isr exits
+
+#ifdef ISR_PROFILE
+/*********************************************************************
+  Function:        void prof_record(short id, unsigned short t0)
+
+  PreCondition:    called at the end of an isr, t0 is TMR2 at entry
+
+  Overview:        adds one run time sample to the stats of isr id.
+                   Each isr only touches its own entry so no locking is
+                   needed between isr's of different priority.
+                   Timer 2 wraps every 65536 Tcy so the time since the
+                   last entry comes from it only when the timebase says
+                   it is well under that, else from the timebase to 64
+                   Tcy.
+********************************************************************/
+void prof_record(short id, unsigned short t0)
+{
+	struct ISRPROF *p = &prof[id];
+	unsigned short dt = TMR2 - t0;
+	unsigned long tb = tb_now() - (dt >> 6);	// at entry, TB_HZ is Tcy/64
+	unsigned long ticks, per;
+	short bin;
+
+	// the outermost isr's time already includes any nested ones
+	if ( --prof_nest == 0 )
+		prof_isr_cy += dt;
+
+	if ( p->count == 0 )
+	{
+		// first sample since a clear
+		p->sum = 0;
+		p->min = 0xffff;
+		p->max = 0;
+		p->per_min = 0xffffffffUL;
+		p->per_max = 0;
+	}
+	else
+	{
+		ticks = TB_ELAPSED(tb, p->last_tb);
+		if ( ticks < 1000 )			// 64000 Tcy, one count of error is safe
+			per = (unsigned short)(t0 - p->last);
+		else
+			per = ticks << 6;
+		if ( per < p->per_min ) p->per_min = per;
+		if ( per > p->per_max ) p->per_max = per;
+	}
+	p->last = t0;
+	p->last_tb = tb;
+
+	if ( dt < p->min ) p->min = dt;
+	if ( dt > p->max ) p->max = dt;
+	if ( p->count == 0x8000 )
+	{
+		// keep the mean going without overflowing the sum
+		p->count >>= 1;
+		p->sum >>= 1;
+	}
+	p->count++;
+	p->sum += dt;
+
+	for ( bin = 0; bin < PROF_BINS - 1 && dt >= (128U << bin); bin++ )
+		;
+	if ( p->hist[bin] != 0xffff )
+		p->hist[bin]++;
+}
+#endif
+
+/*********************************************************************
+  Function:        void prof_s2o(unsigned short cy, short late)
+
+  PreCondition:    called by the servo isr only
+
+  Overview:        adds one sample to output delay, in Tcy
+********************************************************************/
+void prof_s2o(unsigned short cy, short late)
+{
+	if ( s2o.count == 0 )
+	{
+		s2o.sum = 0;
+		s2o.min = 0xffff;
+		s2o.max = 0;
+		s2o.late = 0;
+	}
+	if ( cy < s2o.min ) s2o.min = cy;
+	if ( cy > s2o.max ) s2o.max = cy;
+	if ( late && s2o.late != 0xffff )
+		s2o.late++;
+	if ( s2o.count == 0x8000 )
+	{
+		s2o.count >>= 1;
+		s2o.sum >>= 1;
+	}
+	s2o.count++;
+	s2o.sum += cy;
+}
+
+// print a Tcy count as us with 1 decimal without using float printf
+static void print_us(unsigned long cy)
+{
+	// in 100us and the rest so the products fit in 32 bits
+	unsigned long us10 = cy / (FCY / 10000L) * 1000UL +
+		cy % (FCY / 10000L) * 1000UL / (FCY / 10000L);
+
+	printf("%5lu.%lu", us10 / 10, us10 % 10);
+}
+
+/*********************************************************************
+  Function:        void print_profile(short clear)
+
+  Overview:        z command, prints the stats of all isr's and
+                   optionally starts a new measurement window
+********************************************************************/
+void print_profile(short clear)
+{
+#ifdef ISR_PROFILE
+	struct ISRPROF p;
+	short i, b;
+#endif
+	struct S2OPROF d;
+	unsigned short ovr;
+	int ipl;
+
+#ifdef ISR_PROFILE
+	printf("\risr     count    min(us)  mean(us)  max(us)  min/max period(us)\r\n");
+	for ( i = 0; i < PROF_NUM; i++ )
+	{
+		// take a consistent copy, the isr's keep running while we print
+		SET_AND_SAVE_CPU_IPL(ipl, 7);
+		p = prof[i];
+		RESTORE_CPU_IPL(ipl);
+
+		printf("%s %6u ", prof_names[i], p.count);
+		if ( p.count == 0 )
+		{
+			printf("\r\n");
+			continue;
+		}
+		print_us(p.min);
+		printf("  ");
+		print_us((unsigned short)(p.sum / p.count));
+		printf("  ");
+		print_us(p.max);
+		printf("  ");
+		if ( p.count > 1 )
+		{
+			print_us(p.per_min);
+			printf("/");
+			print_us(p.per_max);
+		}
+		printf("\r\n     hist:");
+		for ( b = 0; b < PROF_BINS; b++ )
+			printf(" %u", p.hist[b]);
+		printf("\r\n");
+	}
+	printf("hist bins: <128 <256 <512 <1k <2k <4k <8k >=8k Tcy\r\n");
+#else
+	printf("\rno isr profile in this build\r\n");
+#endif
+	ovr = prof_overruns;
+	printf("servo overruns: %u\r\n", ovr);
+
+	SET_AND_SAVE_CPU_IPL(ipl, 7);
+	d = s2o;
+	RESTORE_CPU_IPL(ipl);
+	if ( d.count )
+	{
+		printf("sample to output(us):");
+		print_us(d.min);
+		printf("  ");
+		print_us((unsigned short)(d.sum / d.count));
+		printf("  ");
+		print_us(d.max);
+		printf("  late %u\r\n", d.late);
+	}
+
+	if ( clear )
+	{
+		SET_AND_SAVE_CPU_IPL(ipl, 7);
+#ifdef ISR_PROFILE
+		for ( i = 0; i < PROF_NUM; i++ )
+		{
+			prof[i].count = 0;
+			for ( b = 0; b < PROF_BINS; b++ )
+				prof[i].hist[b] = 0;
+		}
+#endif
+		prof_overruns = 0;
+		s2o.count = 0;
+		RESTORE_CPU_IPL(ipl);
+	}
+}
+
+/*********************************************************************
+  Function:        void setup_profile(void)
+
+  Overview:        timer 2 free runs at Tcy with no interrupt
+********************************************************************/
+void setup_profile(void)
+{
+	T2CON = 0;				// internal Tcy clock, 1:1, 16 bit
+	TMR2 = 0;
+	PR2 = 0xffff;			// free run over the full 16 bits
+	T2CONbits.TON = 1;
+	prof_overruns = 0;
+}
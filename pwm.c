@@ -14,6 +14,14 @@
 // Mar 18 2006 --    stripped to single output for servo card
 // Sept 26 2006      put pid calcs inside pwm isr
 // Nov 18 2006 --    added lpf on motor output
+// Oct 19 2026 --    pwm rate, intr postscale and servo decimation set at runtime
+// Oct 19 2026 --    prbs excitation for plant identification added to the pid output
+// Oct 19 2026 --    sine injection and demodulation for the frequency response analyzer
+// Oct 19 2026 --    inputs read before the enable check and recorded for replay
+// Oct 19 2026 --    isr at IPL_SERVO instead of 1, above the console and timers
+// Oct 19 2026 --    servo on the adc isr at a sample lead before the pwm edge,
+//                   duty committed under UDIS, sample to output delay measured
+// Oct 19 2026 --    no duty from set_pwm_error() without a fault error distance
 //---------------------------------------------------------------------- 
 #include <xc.h>
 #include "dspicservo.h"
@@ -25,47 +33,192 @@
 extern struct PID pid;
 extern struct COF cof;
 extern void calc_pid( void );
+extern unsigned short fault_check( void );
+extern void fault_clear( void );
 extern volatile unsigned short int cmd_posn;      // current posn cmd from PC
+extern volatile unsigned short prof_overruns;
+extern void prof_s2o(unsigned short cy, short late);
+
+// last servo cycle's 16 bit inputs and enable state, outside the isr so
+// the input recorder (rec.c) can snapshot them
+unsigned short pwm_last_cmd, pwm_last_fb;
+short pwm_last_state;
+
+struct PWMTIMING pwm_timing;            // timing currently loaded into the pwm module
+static struct PWMTIMING pwm_pending;    // next timing, loaded by the isr
+static volatile short pwm_pending_rdy = 0;
+
+static unsigned short pwm_lead;         // sample lead loaded, us, 0 = at the pwm intr
+static unsigned short lead_pending;     // next sample lead, loaded by the isr
+static volatile short lead_pending_rdy = 0;
+static unsigned long lead_cy;           // trigger to the pwm edge, Tcy
+static short gear = 0;                  // pwm intrs since the last servo calc
 
 //void set_pwm(float amps);
 void set_pwm_error(float posn_error);
 
 /*********************************************************************
-  Function:        void __attribute__((__interrupt__)) _PWMInterrupt(void)
+  Function:        static void load_pwm_timing(void)
 
-  PreCondition:    None.
- 
-  Input:           None
+  PreCondition:    called from the pwm isr between servo cycles
 
-  Output:          None.
+  Overview:        moves the pending timing into the pwm module.
+                   UDIS holds off the buffered PTPER/PDCx transfer until
+                   all of them are written so the module never runs a
+                   period with a mix of old and new values. The duty
+                   cycles are rescaled so the output level is unchanged.
+********************************************************************/
+static void load_pwm_timing(void)
+{
+  unsigned long pdc;
 
-  Side Effects:    None.
+  PWMCON2bits.UDIS = 1;
+  pdc = PDC1;
+  PDC1 = (unsigned short)(pdc * pwm_pending.pdcmax / pwm_timing.pdcmax);
+  pdc = PDC3;
+  PDC3 = (unsigned short)(pdc * pwm_pending.pdcmax / pwm_timing.pdcmax);
+  PTPER = pwm_pending.ptper;
+  PTCONbits.PTOPS = pwm_pending.post - 1;
+  pwm_timing = pwm_pending;
+  pwm_pending_rdy = 0;
+  PWMCON2bits.UDIS = 0;
+}
 
-  Overview:        handles pwm interrupts 
-           we get a pwm intr every 4 pwm cycles (250us)
-                   - setup by PTCON
-                   - try and keep code < 250us or we need to deal with reentrancy
+/*********************************************************************
+  Function:        int set_pwm_timing(fpwm, post, ticks)
 
-  Note:            None.
+  Input:           fpwm  - pwm frequency in Hz
+                   post  - pwm periods per pwm interrupt
+                   ticks - pwm interrupts per servo calc
+
+  Output:          PWMT_OK or a PWMT_xxx error code (nothing changes)
+
+  Overview:        validates a new pwm timing and queues it for the isr
+                   which applies it at the next servo cycle boundary.
 ********************************************************************/
-void __attribute__((__interrupt__,auto_psv)) _PWMInterrupt(void)
+int set_pwm_timing(unsigned short fpwm, short post, short ticks)
 {
-  static short gear = 0;
-  static unsigned short new_cmd,last_cmd, new_fb,last_fb = 0;
-  static short last_state = 0;  // last servo cycle enable/disable state
+  struct PWMTIMING t;
+  int res;
 
-//  PWM_INTR = 1;    // use output pin to show how long we are in here
-  IFS2bits.PWMIF =0;  // clr the interrrupt
-  if (++gear >= pid.ticksperservo)
+  res = calc_pwm_timing(FCY, fpwm, post, ticks, &t);
+  if ( res != PWMT_OK )
+    return res;
+  // the isr only looks at pwm_pending while pwm_pending_rdy is set
+  pwm_pending_rdy = 0;
+  pwm_pending = t;
+  pwm_pending_rdy = 1;
+  return PWMT_OK;
+}
+
+/*********************************************************************
+  Function:        int set_sample_lead(unsigned short lead_us)
+
+  Input:           lead_us - 0 or up to LEAD_MAX_US
+
+  Output:          PWMT_OK
+
+  Overview:        queues a new sample lead for the isr, like
+                   set_pwm_timing()
+********************************************************************/
+int set_sample_lead(unsigned short lead_us)
+{
+  lead_pending_rdy = 0;
+  lead_pending = lead_us;
+  lead_pending_rdy = 1;
+  return PWMT_OK;
+}
+
+/*********************************************************************
+  Function:        static void load_sample_lead(void)
+
+  PreCondition:    pwm_timing loaded, called from the servo isr between
+                   servo cycles or from setup_pwm()
+
+  Overview:        with a lead the special event trigger starts an adc
+                   conversion lead us before a pwm edge, every post pwm
+                   periods, and the adc isr runs the servo in place of
+                   the pwm isr. The conversion itself is not used, it
+                   is only there for its interrupt: 12 TAD of 4 Tcy
+                   after the trigger. Without a lead the pwm isr runs
+                   the servo at the start of a pwm period as it always
+                   did.
+********************************************************************/
+static void load_sample_lead(void)
+{
+  pwm_lead = lead_pending;
+  lead_pending_rdy = 0;
+  if ( pwm_lead == 0 )
+  {
+    IEC0bits.ADIE = 0;
+    ADCON1bits.ADON = 0;
+    IFS0bits.ADIF = 0;
+    lead_cy = 2UL * (pwm_timing.ptper + 1);   // a full period from the pwm intr
+    IFS2bits.PWMIF = 0;
+    IEC2bits.PWMIE = 1;
+    return;
+  }
+  SEVTCMP = calc_sample_lead(FCY, &pwm_timing, pwm_lead, &lead_cy);
+  PWMCON2bits.SEVOPS = pwm_timing.post - 1;
+  if ( !ADCON1bits.ADON )
+  {
+    ADCHS = 0;                  // AN0, the value is not used
+    ADCON2 = 0;                 // AVdd/AVss, intr after each conversion
+    ADCON3 = 7;                 // TAD = 4 Tcy, 166ns at 24 MIPS
+    ADCON1bits.SSRC = 3;        // pwm special event ends sampling
+    ADCON1bits.ASAM = 1;        // and sampling starts again after it
+    ADCON1bits.ADON = 1;
+  }
+  IEC2bits.PWMIE = 0;
+  IFS0bits.ADIF = 0;
+  IEC0bits.ADIE = 1;
+}
+
+// Tcy to the next pwm edge, where the buffered duty cycles load. PTMR
+// counts up from 0 to PTPER and back down, bit 15 (PTDIR) going down.
+static unsigned short pwm_to_edge(void)
+{
+  unsigned short t = PTMR;
+
+  if ( t & 0x8000 )
+    return (t & 0x7fff) + 1;
+  return 2 * (pwm_timing.ptper + 1) - t;
+}
+
+/*********************************************************************
+  Function:        static void servo_tick(void)
+
+  PreCondition:    called by the servo isr, the pwm or the adc one
+
+  Overview:        one servo isr tick, the servo calcs every
+                   pwm_timing.ticks of them. The feedback is read first
+                   thing. The duty cycles are written with UDIS set so
+                   both load at the same pwm edge, the first after UDIS
+                   is cleared, and the time from the read to that edge
+                   goes to the profiler. It is late when the calc missed
+                   the edge after the sample.
+                   - the IPL_EDGE isr's can come in anywhere in here,
+                     cmd_posn is read in one go
+********************************************************************/
+static void servo_tick(void)
+{
+  unsigned short new_cmd, new_fb, t0, s2o;
+  short duty;
+
+  if (++gear >= pwm_timing.ticks)
   {
     gear = 0;
     // time to do servo calcs
-    if ( pid.enable && (last_state == 0) )
+    t0 = TMR2;
+    new_fb = POSCNT;        // grab current posn from encoder
+    new_cmd = cmd_posn;     // grab current cmd from pc
+    rec_input(new_cmd, new_fb);	// 0 unless recording for a replay
+    if ( pid.enable && (pwm_last_state == 0) )
     {
       // we just got enabled.. try to prevent jumps
       // setup servo loop internals so our current posn is the target posn
-      new_cmd = last_cmd = new_fb = last_fb = 0;
-      cmd_posn = POSCNT;    // make 16bit incr registers match
+      pwm_last_cmd = pwm_last_fb = 0;
+      cmd_posn = new_cmd = new_fb;    // make 16bit incr registers match
       pid.command = 0L;    // make 32 bit counter match
       pid.feedback = 0L;
       pid.error_i = 0.0;    // reset internal error accumulators
@@ -73,26 +226,103 @@ void __attribute__((__interrupt__,auto_psv)) _PWMInterrupt(void)
       pid.error = 0.0;
       pid.cmd_d = 0.0;
       pid.prev_cmd = 0L;
+      fault_clear();       // disable/reenable clears a latched fault
     }
     // the servo calcs are run even if we are not enabled
     // this helps debugging because the s serial command can be used
     // to look at servo calc results without the motor going bezerk  
-    new_cmd = cmd_posn;     // grab current cmd from pc
-    new_fb = POSCNT;        // grab current posn from encoder
-    pid.command  += (long int)((short)(new_cmd - last_cmd));
-    pid.feedback += (long int)((short)(new_fb  - last_fb ));
-      last_cmd = new_cmd;
-    last_fb = new_fb;
+    pid.command  += (long int)((short)(new_cmd - pwm_last_cmd));
+    pid.feedback += (long int)((short)(new_fb  - pwm_last_fb ));
+    pwm_last_cmd = new_cmd;
+    pwm_last_fb = new_fb;
+    pid.command += fra_command();	// 0 unless measuring the closed loop
     calc_pid();
+    pid.output += ident_excite();	// 0 unless identifying the plant
+    pid.output += fra_output();		// 0 unless measuring the open loop
 
-    //set_pwm(pid.output);
+    // the supervisor turns the outputs off itself when it trips
+    PWMCON2bits.UDIS = 1;
+    if ( fault_check() == 0 )
 	  set_pwm_error(pid.output);  
+    PWMCON2bits.UDIS = 0;
+    s2o = (unsigned short)(TMR2 - t0) + pwm_to_edge();
+    prof_s2o(s2o, s2o > lead_cy);
+    duty = PDC1 ? (short)PDC1 : -(short)PDC3;
+    fr_record(duty);	// freezes when a fault latched
+    ident_record(duty);
+    fra_record();
+    rec_output(duty);
+    //set_pwm(pid.output);
 	// set_pwm(0.0);
     // update loop position analog output
     
-    last_state = pid.enable;
+    pwm_last_state = pid.enable;
+
+    // new pwm timing is only loaded between servo cycles so calc_pid()
+    // always runs with a period that matches the one it was given
+    if ( pwm_pending_rdy )
+    {
+      load_pwm_timing();
+      lead_pending_rdy = 1;     // the trigger moves with the period
+    }
+    if ( lead_pending_rdy )
+      load_sample_lead();
   }
-//  PWM_INTR = 0;
+}
+
+/*********************************************************************
+  Function:        void __attribute__((__interrupt__)) _PWMInterrupt(void)
+
+  PreCondition:    None.
+ 
+  Input:           None
+
+  Output:          None.
+
+  Side Effects:    None.
+
+  Overview:        handles pwm interrupts 
+           we get a pwm intr every pwm_timing.post pwm cycles
+                   (16khz/4 = 250us by default) - setup by PTCON
+                   - try and keep code < 1 intr period or we need to
+                     deal with reentrancy
+                   - only enabled while there is no sample lead
+
+  Note:            None.
+********************************************************************/
+void __attribute__((__interrupt__,auto_psv)) _PWMInterrupt(void)
+{
+  PROF_ENTER(PROF_PWM);
+
+  PWM_INTR = 1;    // use output pin to show how long we are in here
+  IFS2bits.PWMIF =0;  // clr the interrrupt
+  servo_tick();
+  // if the next pwm intr is already pending we have used up the period
+  if ( IFS2bits.PWMIF )
+    prof_overruns++;
+  PWM_INTR = 0;
+  PROF_EXIT(PROF_PWM);
+}
+
+/*********************************************************************
+  Function:        void __attribute__((__interrupt__)) _ADCInterrupt(void)
+
+  Overview:        the servo isr while there is a sample lead, at the
+                   end of the conversion the special event trigger
+                   started, every pwm_timing.post pwm periods. Profiled
+                   as the pwm isr.
+********************************************************************/
+void __attribute__((__interrupt__,auto_psv)) _ADCInterrupt(void)
+{
+  PROF_ENTER(PROF_PWM);
+
+  PWM_INTR = 1;
+  IFS0bits.ADIF = 0;
+  servo_tick();
+  if ( IFS0bits.ADIF )
+    prof_overruns++;
+  PWM_INTR = 0;
+  PROF_EXIT(PROF_PWM);
 }
 /*********************************************************************
   Function:        void setupPWM(void)
@@ -114,13 +344,21 @@ void setup_pwm(void)
 {
     /* Holds the PWM interrupt configuration value*/
     unsigned int config;
+
+    // derive PTPER/PDC scaling from the (default) pwm params
+    if ( calc_pwm_timing(FCY, pid.fpwm, pid.pwmpost, pid.ticksperservo,
+                         &pwm_timing) != PWMT_OK )
+      calc_pwm_timing(FCY, FPWM, PWM_POST, TICKS_MIN, &pwm_timing);
+    pwm_pending_rdy = 0;
+
     /* Configure pwm interrupt enable/disable and set interrupt priorties */
-    config = (PWM_INT_EN & PWM_FLTA_DIS_INT & PWM_INT_PR1 & PWM_FLTA_INT_PR0);
+    config = (PWM_INT_EN & PWM_FLTA_DIS_INT & PWM_FLTA_INT_PR0);
     /* clear the Interrupt flags */
     IFS2bits.PWMIF = 0;  
     IFS2bits.FLTAIF = 0;  
     /* Set priority for the period match */
-    IPC9bits.PWMIP      = (0x0007 & config);
+    IPC9bits.PWMIP      = IPL_SERVO;	// only the edge isr's above, see dspicservo.h
+    IPC2bits.ADIP       = IPL_SERVO;	// the servo isr with a sample lead
     /* Set priority for the Fault A */
     IPC10bits.FLTAIP    = (0x0070 & config)>> 4;
     /* enable /disable of interrupt Period match */
@@ -129,9 +367,9 @@ void setup_pwm(void)
     IEC2bits.FLTAIE     = (0x0080 & config) >> 7;
     /* Configure PWM to generate 0 current*/
     PWMCON2bits.UDIS = 0;
-    PDC1 = (FCY/FPWM - 1);
-    PDC3 = (FCY/FPWM - 1);
-    PTPER = (FCY/FPWM/2 - 1);      // set the pwm period register(/2 for cnt up/dwn)
+    PDC1 = pwm_timing.pdcmax;
+    PDC3 = pwm_timing.pdcmax;
+    PTPER = pwm_timing.ptper;      // set the pwm period register(/2 for cnt up/dwn)
     SEVTCMP = 0x00;
     /* 1L output is independant and enabled */
     /* 3L output is independant and enabled */
@@ -155,8 +393,12 @@ void setup_pwm(void)
               PWM_OVA3H_INACTIVE ;
     /* set special event post scaler, output override sync select and pwm update enable */
     PWMCON2 = (PWM_SEVOPS1 & PWM_OSYNC_PWM & PWM_UEN);
-    // we get a pwm intr every 4 pwm cycles (250us)
-    PTCON   = (PWM_EN & PWM_IDLE_CON & PWM_OP_SCALE4 & PWM_IPCLK_SCALE1 & PWM_MOD_UPDN);
+    // we get a pwm intr every pwm_timing.post pwm cycles
+    PTCON   = (PWM_EN & PWM_IDLE_CON & PWM_OP_SCALE1 & PWM_IPCLK_SCALE1 & PWM_MOD_UPDN)
+              | ((pwm_timing.post - 1) << 4);
+    // the pwm or the adc isr runs the servo
+    lead_pending = pid.samplelead;
+    load_sample_lead();
 }
 /*********************************************************************
   Function:        void set_pwm_error(float position_error)
@@ -177,28 +419,24 @@ void setup_pwm(void)
 ********************************************************************/
 void set_pwm_error(float posn_error)
 {
-    const long pwm_max = (FCY/FPWM) - 1;      // 100% pwm count ( gives 5v output )
+    const long pwm_max = pwm_timing.pdcmax;   // 100% pwm count ( gives 5v output )
     long temp;
     long temp2;
+
+    // the table keeps f at 1 or more; an eeprom image from before that
+    // may still hold 0, which would be inf or nan cast to long below
+    if ( !(pid.maxerror > 0.0) ){
+    PDC1 = 0;
+    PDC3 = 0;
+    return;
+    }
     temp = (long)(((float)pwm_max * posn_error)/pid.maxerror);
     temp2= (long)(((float)pwm_max * posn_error)/pid.maxerror);
     temp2=fabs(temp2);
 
-   if(temp2>1499){
-       temp2=1499;
+   if(temp2>pwm_max){
+       temp2=pwm_max;
     }
-//	if(cof.emergncy>0) //TESTTEST
-//		{
-//			PDC1 = 0;
-//			PDC3 = 0;
-//			temp2=0;
-//			temp=0;
-//				while(1)
-//				{
-//				}
-
-//		}
-
 /////////////////////////////
     if (temp>0){
     PDC3 = 0;
@@ -0,0 +1,117 @@
+//---------------------------------------------------------------------
+//	File:		pwmtiming.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Derive the PTPER/PDC scaling and the servo period constants
+//          used by calc_pid() from the runtime pwm settings.
+//
+//          In count up/down mode one pwm period is 2*(PTPER+1) Tcy
+//          and the duty registers compare at Tcy/2 resolution, so a
+//          100% duty is PDC = 2*(PTPER+1) - 1.
+//
+//          The buffered duty registers load at the pwm edge where PTMR
+//          turns to count up from 0. A new duty cycle goes out at the
+//          first such edge after it is written, the sample to output
+//          delay is the time from reading the feedback to that edge.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- special event trigger for the sample lead, s2o delay model
+//----------------------------------------------------------------------
+#include "pwmtiming.h"
+
+/*********************************************************************
+  Function:        int calc_pwm_timing(...)
+
+  Input:           fcy   - instruction clock in Hz
+                   fpwm  - requested pwm frequency in Hz
+                   post  - pwm periods per pwm interrupt (1-16)
+                   ticks - pwm interrupts per servo calculation
+
+  Output:          *t is filled in only if the settings are valid.
+
+  Overview:        returns PWMT_OK or one of the PWMT_xxx error codes
+********************************************************************/
+int calc_pwm_timing(long fcy, unsigned short fpwm, short post, short ticks,
+					struct PWMTIMING *t)
+{
+	unsigned long period_cy;
+	unsigned long tick_cy;
+
+	if ( fpwm < FPWM_MIN || fpwm > FPWM_MAX )
+		return PWMT_BAD_FPWM;
+	if ( post < PWM_POST_MIN || post > PWM_POST_MAX )
+		return PWMT_BAD_POST;
+	if ( ticks < TICKS_MIN || ticks > TICKS_MAX )
+		return PWMT_BAD_TICKS;
+
+	// round to the nearest achievable period
+	period_cy = ((unsigned long)fcy + fpwm) / (2UL * fpwm) * 2UL;
+	tick_cy = period_cy * post;
+	if ( tick_cy < (unsigned long)(fcy / (1000000L / PWM_MIN_TICK_US)) )
+		return PWMT_TOO_FAST;
+
+	t->fpwm = fpwm;
+	t->post = post;
+	t->ticks = ticks;
+	t->ptper = (unsigned short)(period_cy / 2 - 1);
+	t->pdcmax = (unsigned short)(period_cy - 1);
+	t->tick_cy = tick_cy;
+	t->servo_cy = tick_cy * ticks;
+	t->periodfp = (float)t->servo_cy / (float)fcy;
+	t->periodrecip = (float)fcy / (float)t->servo_cy;
+	return PWMT_OK;
+}
+
+/*********************************************************************
+  Function:        unsigned short calc_sample_lead(...)
+
+  Input:           t       - timing from calc_pwm_timing()
+                   lead_us - the special event trigger comes this long
+                             before a pwm edge, 0 = at the edge
+
+  Output:          SEVTCMP value, SEVTDIR in bit 15. *lead_cy is the
+                   Tcy from the trigger to the next pwm edge.
+
+  Overview:        a trigger w Tcy before the edge is in the down count
+                   at PTMR = w-1 for w up to half a period, else in the
+                   up count at PTMR = period-w. A lead of more than a
+                   period is taken mod the period.
+********************************************************************/
+unsigned short calc_sample_lead(long fcy, const struct PWMTIMING *t, unsigned short lead_us,
+								unsigned long *lead_cy)
+{
+	unsigned long period = 2UL * (t->ptper + 1);
+	unsigned long w;
+
+	w = ((unsigned long)lead_us * (unsigned long)(fcy / 1000L) + 500UL) / 1000UL % period;
+	if ( w == 0 )
+		w = period;
+	*lead_cy = w;
+	if ( w <= t->ptper + 1UL )
+		return 0x8000 | (unsigned short)(w - 1);
+	return (unsigned short)(period - w);
+}
+
+/*********************************************************************
+  Function:        unsigned long calc_s2o(...)
+
+  Input:           lead_cy - Tcy from the sample to the next pwm edge
+                   busy_cy - Tcy from the sample to the duty write
+
+  Output:          sample to output delay in Tcy: the duty goes out at
+                   the first edge after the write, one that comes with
+                   the write is missed
+********************************************************************/
+unsigned long calc_s2o(const struct PWMTIMING *t, unsigned long lead_cy, unsigned long busy_cy)
+{
+	unsigned long period = 2UL * (t->ptper + 1);
+
+	if ( busy_cy < lead_cy )
+		return lead_cy;
+	return lead_cy + ((busy_cy - lead_cy) / period + 1) * period;
+}
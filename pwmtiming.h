@@ -0,0 +1,57 @@
+//---------------------------------------------------------------------
+//	File:		pwmtiming.h
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: PWM period / interrupt / servo rate calculations.
+//          This header does not include <xc.h> so the same math can
+//          be compiled on a PC by the tools in host/.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version, pwm rate is now a runtime parameter
+// Oct 19 2026 -- sample lead and sample to output delay
+//----------------------------------------------------------------------
+#ifndef PWMTIMING_H
+#define PWMTIMING_H
+
+// supported range of the runtime pwm settings
+#define FPWM_MIN		8000	// Hz
+#define FPWM_MAX		40000	// Hz
+#define PWM_POST_MIN	1		// pwm periods per interrupt (PTOPS+1)
+#define PWM_POST_MAX	16
+#define TICKS_MIN		1		// interrupts per servo calc
+#define TICKS_MAX		100
+// the servo isr must not be asked to run faster than this
+#define PWM_MIN_TICK_US	100
+// feedback sampled this long before a pwm edge at most, see calc_sample_lead()
+#define LEAD_MAX_US		1000
+
+// error codes from calc_pwm_timing()
+#define PWMT_OK			0
+#define PWMT_BAD_FPWM	1
+#define PWMT_BAD_POST	2
+#define PWMT_BAD_TICKS	3
+#define PWMT_TOO_FAST	4
+
+struct PWMTIMING{
+	unsigned short fpwm;		// requested pwm frequency (Hz)
+	unsigned short post;		// pwm periods per interrupt
+	unsigned short ticks;		// interrupts per servo calc
+	unsigned short ptper;		// PTPER value (count up/down mode)
+	unsigned short pdcmax;		// PDCx count for 100% duty
+	unsigned long tick_cy;		// instruction cycles per interrupt
+	unsigned long servo_cy;		// instruction cycles per servo calc
+	float periodfp;				// servo period in seconds
+	float periodrecip;			// 1.0 / periodfp
+};
+
+int calc_pwm_timing(long fcy, unsigned short fpwm, short post, short ticks,
+					struct PWMTIMING *t);
+unsigned short calc_sample_lead(long fcy, const struct PWMTIMING *t, unsigned short lead_us,
+								unsigned long *lead_cy);
+unsigned long calc_s2o(const struct PWMTIMING *t, unsigned long lead_cy, unsigned long busy_cy);
+
+#endif
@@ -0,0 +1,326 @@
+//---------------------------------------------------------------------
+//	File:		rec.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Input recorder for a deterministic replay (host/replay).
+//          At the start of a servo cycle the servo state the pwm isr
+//          works from is copied into the buffer (rec_fields[]); after
+//          that each servo cycle only adds what came in from outside:
+//          the pc command and encoder counts, the enable state, the
+//          bogus pc command edge count, the amp fault input and the qei
+//          count error. Fed the same inputs from the same state the isr
+//          has to come out with the same outputs, a sum of the duty and
+//          pid.output of every cycle is kept to check that it did.
+//
+//          The counts are coded as their second difference, so standing
+//          still and moving at a steady speed cost nothing, one byte per
+//          cycle:
+//             1ccc cccc   128 or fewer cycles, c + 1, with nothing new
+//             01cc cfff   c - 3 and f - 3, command and feedback second
+//                         differences of -3..3, nothing else new
+//             00ef xqae   e, f, x set: zigzag varints follow for the
+//                         cmd_err step, feedback and command second
+//                         differences, q qei error, a RE8, e enable
+//
+//          R1 records from now, R2 from the first pc command edge, until
+//          the buffer is full, a fault latches or R0. R prints the
+//          record as hex lines:
+//             # rec <n> cycles of <us>us, <bytes> bytes, sum <hex>[, fault]
+//             <32 hex digits>
+//             ...
+//             # rec end
+//
+//          Console commands that change the servo state (a parameter,
+//          r) are not inputs of the isr, the replay stops matching
+//          from where one was given. Nor should ident or fra run.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- built in only with INPUT_RECORDER, 256 byte buffer
+//----------------------------------------------------------------------
+#include <xc.h>
+#include "dspicservo.h"
+#include <stdio.h>
+
+#ifdef INPUT_RECORDER
+
+#define REC_BYTES		256			// snapshot (128 bytes) and the cycles
+#define REC_MAXTOKEN	10			// a full token: flags and three varints
+
+// rec_state
+#define REC_OFF			0
+#define REC_ARMED		1			// starts at the first pc command edge
+#define REC_START		2			// starts at the next servo cycle
+#define REC_ON			3
+#define REC_DONE		4			// buffer full or a fault
+
+extern struct PID pid;
+extern struct COF cof;
+extern struct PWMTIMING pwm_timing;
+extern unsigned short pwm_last_cmd, pwm_last_fb;
+extern short pwm_last_state;
+
+// the servo state the pwm isr starts a cycle from, in the order it is in
+// the record
+const struct RECFIELD rec_fields[] = {
+	{ &pid.pgain, RF_FLOAT },		{ &pid.igain, RF_FLOAT },
+	{ &pid.dgain, RF_FLOAT },		{ &pid.ff0gain, RF_FLOAT },
+	{ &pid.ff1gain, RF_FLOAT },		{ &pid.maxoutput, RF_FLOAT },
+	{ &pid.deadband, RF_FLOAT },	{ &pid.maxerror, RF_FLOAT },
+	{ &pid.maxerror_i, RF_FLOAT },	{ &pid.maxerror_d, RF_FLOAT },
+	{ &pid.maxcmd_d, RF_FLOAT },	{ &pid.multiplier, RF_SHORT },
+	{ &pid.ticksperservo, RF_SHORT }, { &pid.fpwm, RF_SHORT },
+	{ &pid.pwmpost, RF_SHORT },		{ &pid.maxcmderr, RF_SHORT },
+	{ &pid.faultmask, RF_SHORT },	{ &pid.command, RF_LONG },
+	{ &pid.feedback, RF_LONG },		{ &pid.prev_cmd, RF_LONG },
+	{ &pid.error, RF_FLOAT },		{ &pid.maxposerror, RF_FLOAT },
+	{ &pid.error_i, RF_FLOAT },		{ &pid.prev_error, RF_FLOAT },
+	{ &pid.error_d, RF_FLOAT },		{ &pid.cmd_d, RF_FLOAT },
+	{ &pid.output, RF_FLOAT },		{ &pid.enable, RF_SHORT },
+	{ &pid.limit_state, RF_SHORT },	{ &cof.fault, RF_SHORT },
+	{ &cof.first, RF_SHORT },		{ &cof.trips, RF_SHORT },
+	{ &cof.trip_error, RF_FLOAT },	{ &cof.last_cmd_err, RF_SHORT },
+	{ &cof.cmderr_win, RF_SHORT },	{ &cof.win_cycles, RF_SHORT },
+	{ &cof.amp_low, RF_SHORT },		{ &pwm_last_cmd, RF_SHORT },
+	{ &pwm_last_fb, RF_SHORT },		{ &pwm_last_state, RF_SHORT },
+	{ &PDC1, RF_SHORT },			{ &PDC3, RF_SHORT },
+};
+const short rec_nfields = sizeof(rec_fields) / sizeof(rec_fields[0]);
+
+static unsigned char rec_buf[REC_BYTES];
+static volatile short rec_state;
+static short rec_len;				// bytes in rec_buf
+static short rec_run;				// index of the open run byte, -1 none
+static unsigned short rec_cycles;
+static unsigned short rec_sum[2];
+static short rec_fault;				// stopped by a fault
+// this cycle's inputs and what the last one had
+static unsigned short rec_cmd, rec_fb, rec_errs;
+static short rec_amp, rec_qei;
+static unsigned short rec_last_cmd, rec_last_fb, rec_last_errs;
+static short rec_dcmd, rec_dfb;		// last first differences
+static unsigned char rec_flags;		// flag bits of the last token
+
+static void put_word(unsigned short w)
+{
+	rec_buf[rec_len++] = (unsigned char)w;
+	rec_buf[rec_len++] = (unsigned char)(w >> 8);
+}
+
+static void put_varint(short v)
+{
+	unsigned short z = (unsigned short)(v << 1) ^ (unsigned short)(v >> 15);
+
+	while ( z >= 0x80 )
+	{
+		rec_buf[rec_len++] = (unsigned char)(z | 0x80);
+		z >>= 7;
+	}
+	rec_buf[rec_len++] = (unsigned char)z;
+}
+
+// the state the coming cycle starts from
+static void rec_snapshot(void)
+{
+	union { float f; long l; unsigned short w[2]; } u;
+	short i;
+
+	rec_len = 0;
+	for ( i = 0; i < rec_nfields; i++ )
+	{
+		switch ( rec_fields[i].type )
+		{
+		case RF_SHORT:
+			put_word(*(volatile unsigned short *)rec_fields[i].p);
+			break;
+		case RF_LONG:
+			u.l = *(long *)rec_fields[i].p;
+			put_word((unsigned short)u.l);
+			put_word((unsigned short)(u.l >> 16));
+			break;
+		default:
+			u.f = *(float *)rec_fields[i].p;
+			put_word(u.w[0]);
+			put_word(u.w[1]);
+			break;
+		}
+	}
+	rec_run = -1;
+	rec_cycles = 0;
+	rec_sum[0] = rec_sum[1] = 0;
+	rec_fault = 0;
+	rec_last_cmd = pwm_last_cmd;
+	rec_last_fb = pwm_last_fb;
+	rec_last_errs = cof.last_cmd_err;
+	rec_dcmd = rec_dfb = 0;
+	rec_flags = 0xff;					// the first token has them all
+}
+
+/*********************************************************************
+  Function:        void rec_input(unsigned short cmd, unsigned short fb)
+
+  PreCondition:    called from the pwm isr at the start of a servo
+                   cycle, before anything of it was done
+
+  Input:           cmd, fb - cmd_posn and POSCNT as the isr read them
+********************************************************************/
+void rec_input(unsigned short cmd, unsigned short fb)
+{
+	if ( rec_state == REC_ARMED && cmd != pwm_last_cmd )
+		rec_state = REC_START;
+	if ( rec_state == REC_START )
+	{
+		rec_snapshot();
+		rec_state = REC_ON;
+	}
+	rec_cmd = cmd;
+	rec_fb = fb;
+}
+
+/*********************************************************************
+  Function:        void rec_faults(unsigned short errs, short amp,
+                                   short qei)
+
+  PreCondition:    called from fault_check() with what it read
+********************************************************************/
+void rec_faults(unsigned short errs, short amp, short qei)
+{
+	rec_errs = errs;
+	rec_amp = amp;
+	rec_qei = qei;
+}
+
+/*********************************************************************
+  Function:        void rec_fold(unsigned short *sum, short duty,
+                                 float output)
+
+  Overview:        adds a cycle's outputs to a fletcher style sum, the
+                   replay keeps the same one
+********************************************************************/
+void rec_fold(unsigned short *sum, short duty, float output)
+{
+	union { float f; unsigned short w[2]; } u;
+
+	u.f = output;
+	sum[0] += (unsigned short)duty;
+	sum[1] += sum[0];
+	sum[0] += u.w[0];
+	sum[1] += sum[0];
+	sum[0] += u.w[1];
+	sum[1] += sum[0];
+}
+
+/*********************************************************************
+  Function:        void rec_output(short duty)
+
+  PreCondition:    called from the pwm isr at the end of a servo cycle
+
+  Overview:        codes the cycle's inputs and sums its outputs
+********************************************************************/
+void rec_output(short duty)
+{
+	unsigned char flags;
+	short dc, df, ddc, ddf, de;
+
+	if ( rec_state != REC_ON )
+		return;
+	dc = (short)(rec_cmd - rec_last_cmd);
+	df = (short)(rec_fb - rec_last_fb);
+	ddc = dc - rec_dcmd;
+	ddf = df - rec_dfb;
+	de = (short)(rec_errs - rec_last_errs);
+	flags = (pid.enable ? RECF_ENABLE : 0) | (rec_amp ? RECF_AMP : 0) | (rec_qei ? RECF_QEI : 0);
+	if ( flags == rec_flags && de == 0 && ddc == 0 && ddf == 0 )
+	{
+		if ( rec_run >= 0 && rec_buf[rec_run] < REC_RUN + 127 )
+			rec_buf[rec_run]++;
+		else
+		{
+			rec_run = rec_len;
+			rec_buf[rec_len++] = REC_RUN;
+		}
+	}
+	else if ( flags == rec_flags && de == 0 && ddc >= -3 && ddc <= 3 && ddf >= -3 && ddf <= 3 )
+	{
+		rec_run = -1;
+		rec_buf[rec_len++] = REC_SMALL | ((ddc + 3) << 3) | (ddf + 3);
+	}
+	else
+	{
+		rec_run = -1;
+		rec_buf[rec_len++] = flags | (ddc ? RECF_CMD : 0) | (ddf ? RECF_FB : 0) | (de ? RECF_ERR : 0);
+		if ( de )
+			put_varint(de);
+		if ( ddf )
+			put_varint(ddf);
+		if ( ddc )
+			put_varint(ddc);
+	}
+	rec_flags = flags;
+	rec_last_cmd = rec_cmd;
+	rec_last_fb = rec_fb;
+	rec_last_errs = rec_errs;
+	rec_dcmd = dc;
+	rec_dfb = df;
+	rec_fold(rec_sum, duty, pid.output);
+	rec_cycles++;
+	if ( cof.fault )
+		rec_fault = 1;
+	if ( rec_fault || rec_len > REC_BYTES - REC_MAXTOKEN || rec_cycles == 0xffff )
+		rec_state = REC_DONE;
+}
+
+/*********************************************************************
+  Function:        void rec_command(short how)
+
+  Overview:        the R command: 1 records from now, 2 from the first
+                   pc command edge, 0 stops, -1 (R alone) prints
+********************************************************************/
+void rec_command(short how)
+{
+	short i;
+
+	switch ( how )
+	{
+	case 0:
+		if ( rec_state != REC_OFF && rec_state != REC_DONE )
+			rec_state = rec_state == REC_ON ? REC_DONE : REC_OFF;
+		break;
+	case 1:
+	case 2:
+		rec_state = REC_OFF;			// the isr leaves it alone now
+		rec_len = 0;
+		rec_state = how == 1 ? REC_START : REC_ARMED;
+		printf("\rrecording %s\r\n", how == 1 ? "now" : "from the first pc command edge");
+		return;
+	}
+	if ( rec_state == REC_ARMED || rec_state == REC_START )
+	{
+		printf("\rrecorder armed, nothing recorded yet\r\n");
+		return;
+	}
+	if ( rec_state == REC_OFF && rec_len == 0 )
+	{
+		printf("\rnothing recorded, R1 or R2 starts\r\n");
+		return;
+	}
+	if ( rec_state == REC_ON )
+		printf("\r# still recording, R0 stops\r\n");
+	printf("\r# rec %u cycles of ", rec_cycles);
+	fx_print(pwm_timing.periodfp * 1.0e6, 1);
+	printf("us, %d bytes, sum %04X%04X%s\r\n", rec_len, rec_sum[1], rec_sum[0],
+		rec_fault ? ", fault" : "");
+	for ( i = 0; i < rec_len; i++ )
+	{
+		printf("%02X", rec_buf[i]);
+		if ( (i & 15) == 15 || i == rec_len - 1 )
+			printf("\r\n");
+	}
+	printf("# rec end\r\n");
+}
+
+#endif	// INPUT_RECORDER
@@ -28,10 +28,19 @@
 #include <string.h>
 #include <math.h>		// for PI etc
 #include "dspicservo.h"
+#include <stddef.h>
 #include "DataEEPROM.h"		// for eeprom read and write routines
 
 extern struct PID pid;
 
+// only the params up to and including the cksum are kept in eeprom,
+// rounded up to whole 16 word rows
+#define EE_PARAM_BYTES	(offsetof(struct PID, cksum) + sizeof(pid.cksum))
+#define EE_ROWS			((EE_PARAM_BYTES + ROW*2 - 1) / (ROW*2))
+
+static short ee_shadow[EE_ROWS * ROW];	// snapshot being written to eeprom
+static short ee_row = -1;				// next row to write, -1 = idle
+
 // we need to pull some tricks to get it all done
 // structure with all setup constants that is stored in eeprom
 // aligned on 32 byte boundary
@@ -42,10 +51,10 @@ struct PID _EEDATA(32) pidEE={0.0};
 // Routine to calculate a checksum on a section of memory
 // call with array size in 16 bit words and ptr to start.
 //=============================================================================
-int calc_cksum(int sizew, int *adr)
+short calc_cksum(short sizew, short *adr)
 {
-	int i;
-	int cksum = 0;
+	short i;
+	short cksum = 0;
 	for (i=0; i < sizew; i++)
 		cksum += *adr++;
 
@@ -56,47 +65,62 @@ int calc_cksum(int sizew, int *adr)
 
 //=============================================================================
 // Routine to save setup structure into eeprom
-// 
+// The params are copied and the copy is written behind by eeprom_task()
+// one row per call, so a save never holds up the background loop for
+// more than one row erase+write (~4ms). A save while one is still being
+// written simply starts over with the newer copy.
 //=============================================================================
 int save_setup( void )
 {
-	int size = sizeof(pid);
-	int *sptr = (int *)&pid;
-	int res;
-	int offset = 0;
-
 	// compute correct checksum for upper part of array
 	// and place it in the checsum variable
 //	pid.cksum = -calc_cksum((sizeof(pid)-sizeof(int))/sizeof(int),
 //							 (int*)&pid);
-	pid.cksum = -calc_cksum(((long int)&pid.cksum - (long int)&pid)/sizeof(int),
-                            (int*)&pid);
+	pid.cksum = -calc_cksum(((long int)&pid.cksum - (long int)&pid)/sizeof(short),
+                            (short*)&pid);
 
+	memcpy(ee_shadow, &pid, EE_PARAM_BYTES);
+	ee_row = 0;
+	return 0;
+}
 
-	// this routine attempts to write the entire ram setup structure
-	// into the eeprom on board.
-	// write 16 words of structure at a time
-	
-	while (size > 0)
-	{
-		// Erase 16 words (1 row in dsPIC30F DataEEPROM) in Data EEPROM 
-		// from calEE structure
-		res = EraseEE(__builtin_tblpage(&pidEE), 
-                      __builtin_tbloffset(&pidEE)+offset, ROW);
-		if (res)
-			printf("clr of eeprom failed at %d\r\n",offset);
+//=============================================================================
+// Background task: writes the next row of a pending save into eeprom.
+// Returns non zero if it did any work.
+//=============================================================================
+short eeprom_task( void )
+{
+	int offset;
+	int res;
 
-		res = WriteEE(sptr, __builtin_tblpage(&pidEE),
-							__builtin_tbloffset(&pidEE)+offset, ROW);
-		if (res)
-			printf("write to eeprom failed at offset %d\r\n",offset);
+	if ( ee_row < 0 )
+		return 0;
 
-		offset += ROW*2;		// bump offset to destination 32 bytes up 
-		sptr   += ROW;			// bump source ptr up 16 words
-		size   -= ROW*2;	    // 16 words or 32 bytes/write
-	}
-//	printf("saved setup in EEPROM 0x%04X\r\n",pid.cksum);	
-	return res;
+	offset = ee_row * ROW*2;
+	// Erase 16 words (1 row in dsPIC30F DataEEPROM) in Data EEPROM 
+	// from calEE structure
+	res = EraseEE(__builtin_tblpage(&pidEE), 
+                  __builtin_tbloffset(&pidEE)+offset, ROW);
+	if (res)
+		printf("clr of eeprom failed at %d\r\n",offset);
+
+	res = WriteEE(&ee_shadow[ee_row * ROW], __builtin_tblpage(&pidEE),
+						__builtin_tbloffset(&pidEE)+offset, ROW);
+	if (res)
+		printf("write to eeprom failed at offset %d\r\n",offset);
+
+	if ( ++ee_row >= EE_ROWS )
+		ee_row = -1;
+	return 1;
+}
+
+//=============================================================================
+// finish any pending save now (used before a reset)
+//=============================================================================
+void flush_setup( void )
+{
+	while ( eeprom_task() )
+		;
 }
 
 //=============================================================================
@@ -105,15 +129,15 @@ int save_setup( void )
 //=============================================================================
 int restore_setup( void )
 {
-	int size = sizeof(pid);
-	int *dptr = (int *)&pid;
+	short *dptr = ee_shadow;
 	int res = 0;
 	int offset = 0;
+	int row;
 
-	// this routine attempts to read the entire calibration structure
-	// into the ram on board.
+	// this routine reads the param rows into the shadow copy and
+	// moves just the params into the ram setup structure.
 	// read 16 words of structure at a time
-	while (size > 0)
+	for ( row = 0; row < EE_ROWS; row++ )
 	{
 		res = ReadEE(__builtin_tblpage(&pidEE),
 					 __builtin_tbloffset(&pidEE)+offset,
@@ -124,7 +148,7 @@ int restore_setup( void )
 
 		offset += ROW*2;		// bump offset to destination 32 bytes up 
 		dptr   += ROW;			// bump source ptr up 16 words
-		size   -= ROW*2;	    // 16 words or 32 bytes/write
 	}
+	memcpy(&pid, ee_shadow, EE_PARAM_BYTES);
 	return res;
 }
\ No newline at end of file
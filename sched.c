@@ -0,0 +1,135 @@
+//---------------------------------------------------------------------
+//	File:		sched.c
+//
+//	Written By:	Alkhaldi Automation
+//
+// Purpose: Cooperative scheduler for the background loop. Each task in
+//          the table is a function that does a small piece of work and
+//          returns. A task with period 0 is called on every pass, the
+//          others when their deadline on the timebase comes up. Tasks
+//          are tried in table order so put the most urgent first.
+//
+//          The run time of every call is measured; the worst case and
+//          the number of calls that went over the task's budget are
+//          printed by the c command.
+//
+//---------------------------------------------------------------------
+//
+// Revision History
+//
+// Oct 19 2026 -- first version
+// Oct 19 2026 -- task table const, the run time state in its own array
+//----------------------------------------------------------------------
+#include <xc.h>
+#include "dspicservo.h"
+#include <stdio.h>
+
+extern void cpu_idle(void);
+
+static const struct TASK *sched_tab;
+static struct TASKSTAT *sched_stat;
+static short sched_n;
+
+/*********************************************************************
+  Function:        void sched_init(const struct TASK *tab,
+                                   struct TASKSTAT *stat, short n)
+
+  Overview:        takes over a task table and the n entries of stat
+                   that go with it, first periodic calls are one period
+                   from now
+********************************************************************/
+void sched_init(const struct TASK *tab, struct TASKSTAT *stat, short n)
+{
+	unsigned long now = tb_now();
+	short i;
+
+	sched_tab = tab;
+	sched_stat = stat;
+	sched_n = n;
+	for ( i = 0; i < n; i++ )
+	{
+		stat[i].deadline = now + tab[i].period;
+		stat[i].worst = 0;
+		stat[i].overruns = 0;
+		stat[i].runs = 0;
+	}
+}
+
+/*********************************************************************
+  Function:        short sched_due(const struct TASK *t,
+                                   struct TASKSTAT *s, unsigned long now)
+
+  Overview:        true if the task should run now. Advances the deadline
+                   by one period, or restarts it from now if more than a
+                   period was missed so a stalled task does not run in a
+                   burst afterwards.
+********************************************************************/
+short sched_due(const struct TASK *t, struct TASKSTAT *s, unsigned long now)
+{
+	if ( t->period == 0 )
+		return 1;
+	if ( !TB_REACHED(now, s->deadline) )
+		return 0;
+	s->deadline += t->period;
+	if ( TB_REACHED(now, s->deadline) )
+		s->deadline = now + t->period;
+	return 1;
+}
+
+/*********************************************************************
+  Function:        void sched_run(void)
+
+  Overview:        one pass over the task table, called forever from
+                   main(). A pass where no task reported work is counted
+                   as idle time by the load monitor.
+********************************************************************/
+void sched_run(void)
+{
+	const struct TASK *t;
+	struct TASKSTAT *s;
+	unsigned long start, dt;
+	short i, busy = 0;
+
+	for ( i = 0; i < sched_n; i++ )
+	{
+		t = &sched_tab[i];
+		s = &sched_stat[i];
+		start = tb_now();
+		if ( !sched_due(t, s, start) )
+			continue;
+		if ( t->func() )
+		{
+			busy = 1;
+			dt = TB_ELAPSED(tb_now(), start);
+			if ( dt > s->worst )
+				s->worst = dt;
+			if ( dt > t->budget )
+				s->overruns++;
+			s->runs++;
+		}
+	}
+	if ( !busy )
+		cpu_idle();
+}
+
+/*********************************************************************
+  Function:        void print_tasks(void)
+
+  Overview:        part of the c command
+********************************************************************/
+void print_tasks(void)
+{
+	const struct TASK *t;
+	struct TASKSTAT *s;
+	short i;
+
+	printf("task      runs    worst(us)  budget(us)  overruns\r\n");
+	for ( i = 0; i < sched_n; i++ )
+	{
+		t = &sched_tab[i];
+		s = &sched_stat[i];
+		printf("%-8s %6lu %10lu %10lu %8u\r\n", t->name, s->runs,
+			s->worst * 1000 / (TB_HZ / 1000), t->budget * 1000 / (TB_HZ / 1000),
+			s->overruns);
+	}
+}
@@ -6,14 +6,56 @@
 //#include "libpic30.h"
 
 // Select the desired UART baud rate here
-#define THE_BAUD_RATE 9600
+//#define THE_BAUD_RATE 9600
 //#define THE_BAUD_RATE 19200
 //#define THE_BAUD_RATE 57600
-//#define THE_BAUD_RATE 115200 
+#define THE_BAUD_RATE 115200L
+//#define THE_BAUD_RATE 230400L		// needs the 7.3728mhz xtal
+//#define THE_BAUD_RATE 460800L		// needs the 7.3728mhz xtal
 
-char rxbuff[30];			// global rx buffer for serial data
-char *rxbuffptr;		// local input ptr for storing data
-short int rxrdy;			// flag to indicate a line of data is available in buffer
+#if UART_ERR_PM(FCY, THE_BAUD_RATE) > UART_ERR_MAX_PM || UART_ERR_PM(FCY, THE_BAUD_RATE) < -UART_ERR_MAX_PM
+#error "THE_BAUD_RATE can not be made from FCY, see host/baudcalc"
+#elif UART_ERR_PM(FCY, THE_BAUD_RATE) > UART_ERR_WARN_PM || UART_ERR_PM(FCY, THE_BAUD_RATE) < -UART_ERR_WARN_PM
+#warning "THE_BAUD_RATE is more than 1% off with this FCY, see host/baudcalc"
+#endif
+
+// Set to 1 to measure the pc's baud rate at powerup: send U characters
+// within AUTOBAUD_MS. Without them the link falls back to BAUD_FALLBACK.
+#define AUTOBAUD	0
+#define AUTOBAUD_MS	2000
+#define AB_EDGES	8			// edges to see, a 'U' gives 9 one bit gaps
+
+long uart_baud = THE_BAUD_RATE;	// rate in use
+
+extern struct PID pid;
+extern short mb_on;
+extern void mb_rx_byte(unsigned char ch);
+static short bus_talk;			// a bus card may drive the line
+static unsigned long bus_at;	// but not before this time
+
+// receive path: the rx isr only moves bytes from the uart fifo into
+// rx_ring. rx_assemble() runs in the background, echoes them and builds
+// lines in rx_lines[]; a complete line (CR) is queued until the command
+// processor is done with it. Commands can be sent back to back without
+// waiting for the prompt.
+#define RX_RING		64			// bytes, power of 2
+#define RX_LINES	4			// queued lines incl. the one being built
+#define RX_LINE		30			// max line length incl. the nul
+
+static volatile char rx_ring[RX_RING];
+static volatile unsigned short rx_head;	// written by the isr only
+static volatile unsigned short rx_tail;	// written by rx_assemble() only
+
+static char rx_lines[RX_LINES][RX_LINE];
+static short rx_rd;				// oldest complete line
+static short rx_wr;				// line being built
+static short rx_len;			// chars in the line being built
+
+// error counters, printed by the c command
+volatile unsigned short rx_oerr;		// uart fifo overruns
+volatile unsigned short rx_ferr;		// framing errors (byte dropped)
+volatile unsigned short rx_full;		// bytes lost because rx_ring was full
+unsigned short rx_long;					// chars cut off lines too long
 
 #if 0
 //**************************************************************************
@@ -48,36 +90,162 @@ printf(" This is a test %d times \r\n",i);
 
 ********************************************************************/
 
-void __attribute__((__interrupt__,auto_psv)) _U1RXInterrupt (void)
+void __attribute__((__interrupt__,no_auto_psv)) _U1RXInterrupt (void)
 {
+	unsigned short next;
 	char ch;
+	PROF_ENTER(PROF_U1RX);
 
     IFS0bits.U1RXIF = 0;
 
 	while (U1STAbits.URXDA)
 	{
+		// FERR belongs to the byte at the top of the fifo
+		if ( U1STAbits.FERR )
+		{
+			ch = U1RXREG;
+			rx_ferr++;
+			continue;
+		}
 		ch = U1RXREG & 0xFF;
-		// save the character if there is room in the input buffer
-		if ( ch == 0x0a )
-			continue;			// strip LF
+		if ( mb_on )
+		{
+			mb_rx_byte(ch);		// modbus frames bypass the line queue
+			continue;
+		}
+		next = (rx_head + 1) & (RX_RING - 1);
+		if ( next == rx_tail )
+			rx_full++;
+		else
+		{
+			rx_ring[rx_head] = ch;
+			rx_head = next;
+		}
+	}
+	// the uart stops receiving until OERR is cleared, the fifo is empty now
+	if ( U1STAbits.OERR )
+	{
+		U1STAbits.OERR = 0;
+		rx_oerr++;
+	}
+	PROF_EXIT(PROF_U1RX);
+}
 
+/*********************************************************************
+  Function:        short rx_assemble(void)
+
+  Overview:        background part of the receive path. Takes bytes out
+                   of rx_ring, echoes them and adds them to the line
+                   being built. A CR queues the line; while the queue is
+                   full the bytes are left in rx_ring.
+
+  Output:          non zero if any bytes were handled
+********************************************************************/
+short rx_assemble(void)
+{
+	short n = 0;
+	char ch;
+
+	while ( rx_tail != rx_head )
+	{
+		ch = rx_ring[rx_tail];
 		if ( ch == 0x0d )
 		{
-			// end of input stream.. 
-			// let user know if we have something to process
-			rxrdy = 1;
-			break;
+			// end of input stream.. queue it if there is room
+			if ( ((rx_wr + 1) % RX_LINES) == rx_rd )
+				break;
+			rx_lines[rx_wr][rx_len] = 0;
+			rx_wr = (rx_wr + 1) % RX_LINES;
+			rx_len = 0;
 		}
-
-		// if we have room in the buffer, store the ch for later processing
-		if (rxbuffptr < (&rxbuff[0] + sizeof(rxbuff) - 1 ))
+		else if ( ch != 0x0a )		// strip LF
 		{
-			// still working on filling buffer
-			*rxbuffptr++ = ch;
-			*rxbuffptr = 0;			// null terminate buffer
-			putchar(ch);	
+			if ( rx_len < RX_LINE - 1 )
+			{
+				rx_lines[rx_wr][rx_len++] = ch;
+				putchar(ch);
+			}
+			else
+				rx_long++;
 		}
+		rx_tail = (rx_tail + 1) & (RX_RING - 1);
+		n++;
+	}
+	return n;
+}
+
+// oldest complete line, 0 if there is none
+char *rx_getline(void)
+{
+	if ( rx_rd == rx_wr )
+		return 0;
+	return rx_lines[rx_rd];
+}
+
+// done with the line from rx_getline()
+void rx_release(void)
+{
+	if ( rx_rd != rx_wr )
+		rx_rd = (rx_rd + 1) % RX_LINES;
+}
+
+/*********************************************************************
+  Function:        int write(int handle, void *buffer, unsigned int len)
+
+  Overview:        replaces the library's stdout path so every printf
+                   and putchar goes through here. With a node id the
+                   output is dropped unless the bus is open for us, and
+                   the rs-485 driver is only enabled while sending. In
+                   modbus mode nothing gets out, the line only carries
+                   rtu frames (mb_send()).
+********************************************************************/
+int write(int handle, void *buffer, unsigned int len)
+{
+	unsigned char *p = buffer;
+	unsigned int i;
+
+	if ( mb_on )
+		return len;
+	if ( pid.nodeid )
+	{
+		if ( !bus_talk )
+			return len;			// not our turn
+		while ( !TB_REACHED(tb_now(), bus_at) )
+			;
+		BUS_DE = 1;
 	}
+	for ( i = 0; i < len; i++ )
+	{
+		while ( U1STAbits.UTXBF )
+			;
+		U1TXREG = *p++;
+	}
+	if ( pid.nodeid )
+	{
+		while ( !U1STAbits.TRMT )	// last stop bit out
+			;
+		BUS_DE = 0;
+	}
+	return len;
+}
+
+// let a bus card talk, first byte not before tb_now() == at
+void bus_open(unsigned long at)
+{
+	bus_at = at;
+	bus_talk = 1;
+}
+
+void bus_close(void)
+{
+	bus_talk = 0;
+}
+
+// part of the c command
+void print_serial(void)
+{
+	printf("serial rx: overruns %u  framing errs %u  ring full %u  long lines %u\r\n",
+		rx_oerr, rx_ferr, rx_full, rx_long);
 }
 
 
@@ -94,16 +262,84 @@ void setup_uart( void )
                UART_ALTRX_ALTTX;	// use alternate i/o pins
 
 
-    U1BRG  = (((FCY/THE_BAUD_RATE) /16) - 1);     /* baud rate */
+    U1BRG  = UART_BRG(FCY, THE_BAUD_RATE);     /* baud rate */
     U1MODE = uartmode;  /* operation settings */
     U1STA = UART_TX_ENABLE & UART_TX_PIN_NORMAL;   /* TX & RX interrupt modes */
 	U1STAbits.URXISEL = 0;						/* rx intr every ch */
 
-	rxbuffptr = &rxbuff[0];
-	rxbuff[0] = 0;
-	rxrdy = 0;
+	rx_head = rx_tail = 0;
+	rx_rd = rx_wr = rx_len = 0;
+	rx_oerr = rx_ferr = rx_full = rx_long = 0;
 
 
 	IFS0bits.U1RXIF = 0;
+	IPC2bits.U1RXIP = IPL_U1RX;	// below the servo isr, see dspicservo.h
 	IEC0bits.U1RXIE = 1;		// go live with serial rx intr
 } 
+
+
+/*********************************************************************
+  Function:        long uart_autobaud(void)
+
+  PreCondition:    uart, timebase and the timer 2 profiler clock running,
+                   IC1 not set up yet (setup_capture() comes later)
+
+  Overview:        with ABAUD set the uart rx pin drives IC1. The
+                   shortest time between edges on timer 2 (Tcy) is one
+                   bit. The measured rate is snapped to the nearest
+                   standard rate that U1BRG can make; if there were no
+                   edges or nothing is close the link is set to
+                   BAUD_FALLBACK.
+
+  Output:          the baud rate now in use
+********************************************************************/
+long uart_autobaud(void)
+{
+#if AUTOBAUD
+	static const long rates[] = BAUD_RATES;
+	unsigned long deadline = tb_now() + TB_MS(AUTOBAUD_MS);
+	unsigned short t, last = 0, bit = 0xffff;
+	short edges = 0, i;
+	long baud = BAUD_FALLBACK, meas;
+
+	IEC0bits.U1RXIE = 0;
+	IC1CON = 0;
+	IC1CONbits.ICTMR = 1;		// timer 2
+	U1MODEbits.ABAUD = 1;
+	IC1CONbits.ICM = 1;			// capture every edge
+	while ( edges < AB_EDGES && !TB_REACHED(tb_now(), deadline) )
+	{
+		if ( !IC1CONbits.ICBNE )
+			continue;
+		t = IC1BUF;
+		if ( edges && (unsigned short)(t - last) < bit )
+			bit = t - last;
+		last = t;
+		edges++;
+	}
+	IC1CON = 0;
+	U1MODEbits.ABAUD = 0;
+
+	if ( edges >= AB_EDGES )
+	{
+		meas = FCY / bit;
+		for ( i = 0; i < (short)(sizeof(rates) / sizeof(rates[0])); i++ )
+		{
+			if ( meas > rates[i] - rates[i] / 20 && meas < rates[i] + rates[i] / 20 &&
+				 UART_ERR_PM(FCY, rates[i]) <= UART_ERR_MAX_PM &&
+				 UART_ERR_PM(FCY, rates[i]) >= -UART_ERR_MAX_PM )
+				baud = rates[i];
+		}
+	}
+	// let the rest of the autobaud characters pass, then start clean
+	tb_delay(TB_MS(20));
+	U1BRG = UART_BRG(FCY, baud);
+	uart_baud = baud;
+	while ( U1STAbits.URXDA )
+		t = U1RXREG;
+	U1STAbits.OERR = 0;
+	IFS0bits.U1RXIF = 0;
+	IEC0bits.U1RXIE = 1;
+#endif
+	return uart_baud;
+}
@@ -11,13 +11,22 @@
 // Revision History
 //
 // Nov 5 2005 -- first version 
+// Oct 19 2026 -- timer 1 free runs as a 32 bit timebase (low word in TMR1,
+//               high word counted by the wrap interrupt) instead of
+//               interrupting at 10khz. Delays and software timers
+//               compare deadlines against tb_now().
+// Oct 19 2026 -- wrap isr at IPL_TICK, no psv
 //---------------------------------------------------------------------- 
 #include <xc.h>
 #include "dspicservo.h"
 
-volatile unsigned short int timer_test;
-
 extern struct PID pid;
+extern void cpu_idle(void);
+
+static volatile unsigned short tb_hi;	// upper 16 bits of the timebase
+
+#define SWT_MAX 6
+static struct SWTIMER *swt_list[SWT_MAX];	// running software timers
 
 /*********************************************************************
   Function:        void __attribute__((__interrupt__)) _T1Interrupt (void)
@@ -28,19 +37,133 @@ extern struct PID pid;
 
   Side Effects:    None.
 
-  Overview:        This isr is used to periodically do certain tasks
-          		   Basic rate is set to 10000intr/sec in the init function
+  Overview:        Timer 1 wraps from 0xffff to 0 every 65536 counts
+                   (175ms at 24 MIPS), this extends it to 32 bits.
 
 ********************************************************************/
 
-void __attribute__((__interrupt__,auto_psv)) _T1Interrupt (void)
+void __attribute__((__interrupt__,no_auto_psv)) _T1Interrupt (void)
 {
+	PROF_ENTER(PROF_T1);
 	IFS0bits.T1IF = 0;
+	tb_hi++;
+	PROF_EXIT(PROF_T1);
+	return;
+}
 
-	// this block of timers is used in the software for delays
-    if ( timer_test > 0 ) --timer_test;
+/*********************************************************************
+  Function:        unsigned long tb_now(void)
 
-	return;
+  Overview:        returns the 32 bit timebase in TB_HZ counts.
+                   Safe to call from any isr or with interrupts masked:
+                   a wrap that has not been serviced yet shows up as
+                   T1IF set with a small TMR1 value.
+********************************************************************/
+unsigned long tb_now(void)
+{
+	unsigned short hi, lo;
+
+	do
+	{
+		hi = tb_hi;
+		lo = TMR1;
+		if ( IFS0bits.T1IF && lo < 0x8000 )
+			hi++;
+	} while ( hi != tb_hi && !IFS0bits.T1IF );
+	return ((unsigned long)hi << 16) | lo;
+}
+
+/*********************************************************************
+  Function:        void tb_delay(unsigned long ticks)
+
+  Overview:        background delay, the idle time is counted by the
+                   load monitor
+********************************************************************/
+void tb_delay(unsigned long ticks)
+{
+	unsigned long deadline = tb_now() + ticks;
+
+	while ( !TB_REACHED(tb_now(), deadline) )
+		cpu_idle();
+}
+
+/*********************************************************************
+  Function:        void swt_start(t, delay, period, func)
+
+  Input:           t      - timer owned by the caller
+                   delay  - TB_HZ counts until the first call of func
+                   period - TB_HZ counts between calls, 0 for one shot
+                   func   - called from swt_poll() in the background
+
+  Overview:        (re)starts a software timer. The deadline advances by
+                   period on each call so periodic timers do not drift.
+********************************************************************/
+void swt_start(struct SWTIMER *t, unsigned long delay, unsigned long period,
+			   void (*func)(void))
+{
+	short i, slot = -1;
+
+	t->deadline = tb_now() + delay;
+	t->period = period;
+	t->func = func;
+	t->active = 1;
+	for ( i = 0; i < SWT_MAX; i++ )
+	{
+		if ( swt_list[i] == t )
+			return;
+		if ( swt_list[i] == 0 && slot < 0 )
+			slot = i;
+	}
+	if ( slot >= 0 )
+		swt_list[slot] = t;
+	else
+		t->active = 0;			// table full
+}
+
+void swt_stop(struct SWTIMER *t)
+{
+	short i;
+
+	t->active = 0;
+	for ( i = 0; i < SWT_MAX; i++ )
+		if ( swt_list[i] == t )
+			swt_list[i] = 0;
+}
+
+/*********************************************************************
+  Function:        short swt_poll(void)
+
+  Overview:        runs the callbacks of all expired software timers,
+                   called from the background loop. Returns the number
+                   of callbacks run.
+********************************************************************/
+short swt_poll(void)
+{
+	struct SWTIMER *t;
+	unsigned long now;
+	short i, n = 0;
+
+	for ( i = 0; i < SWT_MAX; i++ )
+	{
+		t = swt_list[i];
+		if ( t == 0 )
+			continue;
+		now = tb_now();
+		if ( !TB_REACHED(now, t->deadline) )
+			continue;
+		if ( t->period )
+		{
+			t->deadline += t->period;
+			// if we fell more than a period behind, skip the missed calls
+			if ( TB_REACHED(now, t->deadline) )
+				t->deadline = now + t->period;
+		}
+		else
+			swt_stop(t);
+		t->func();
+		n++;
+	}
+	return n;
 }
 
 
@@ -55,8 +178,8 @@ void __attribute__((__interrupt__,auto_psv)) _T1Interrupt (void)
 
   Side Effects:    None.
 
-  Overview:        Initialization of timer 1 as a periodic interrupt 
-                   each 0.1 ms (10khz)
+  Overview:        Initialization of timer 1 as a free running counter
+                   at Tcy/64 with an interrupt only when it wraps
 
   Note:            None.
 ********************************************************************/
@@ -65,8 +188,10 @@ void setup_TMR1(void)
 {
 	T1CON = 0x0020;			// internal Tcy/64 clock
 	TMR1 = 0;
-    #define PR1PRESET  (FCY/64/10000)
-	PR1 = PR1PRESET;		// 0.1 ms interrupts (100us)
+	PR1 = 0xffff;			// count over the full 16 bits
+	tb_hi = 0;
+	IFS0bits.T1IF = 0;
+	IPC0bits.T1IP = IPL_TICK;	// tb_now() copes with a wrap not taken yet
 	T1CONbits.TON = 1;		// turn on timer 1 
 	return;
 }